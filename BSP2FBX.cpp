@@ -1,39 +1,190 @@
 #include "BSP2FBX.h"
+#ifndef BSP2FBX_NO_FBXSDK
 #include "fbxsdk/fileio/fbxiosettings.h"
 #include "fbxsdk/fileio/fbxexporter.h"
 #include "fbxsdk/scene/geometry/fbxmesh.h"
 #include "fbxsdk/scene/geometry/fbxlayer.h"
+#include "fbxsdk/scene/geometry/fbxlodgroup.h"
+#endif
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <stdarg.h>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <filesystem>
+#include <atomic>
+#include <chrono>
+#include "BatchConverter.h"
+#include "ConversionCache.h"
+#include "ConversionServer.h"
+#include "Benchmark.h"
+#include "BSPTextures.h"
+#include "BSPMeshOptimizer.h"
+#include "BSPVertexKernel.h"
+#include "WADLoader.h"
+#include "FBXNativeExporter.h"
+#include "GLTFExporter.h"
+#include "ThreadPool.h"
+
+// Faces whose center is closer to a node's plane than this lie on it
+#define CHUNK_PLANE_EPSILON 0.01
+
+// Distance per map unit of error at which a simplified level is used : the
+// error covers a pixel of a 1080 lines screen with a 60 degrees field of view
+#define LOD_DISTANCE_PER_UNIT 935.3f
 
 //---------------------------------------------------------------------
-BSP2FBX::BSP2FBX()
+BSP2FBX::BSP2FBX(const BSP2FBXOptions& options, WADTextureCache* wadCache)
 {
+	m_options = options;
 	m_bspLoader = nullptr;
+	m_threadPool = nullptr;
+	m_stats = options.stats ? new BSPStats() : nullptr;
+	m_ownsWadCache = (wadCache == nullptr);
+	m_wadCache = m_ownsWadCache ? new WADTextureCache() : wadCache;
+
+#ifndef BSP2FBX_NO_FBXSDK
 	m_fbxManager = FbxManager::Create();
 	m_fbxScene = nullptr;
+
+	// IO settings are shared by every export done with this manager
+	FbxIOSettings* ios = FbxIOSettings::Create(m_fbxManager, IOSROOT);
+	m_fbxManager->SetIOSettings(ios);
+#endif
 }
 
 //---------------------------------------------------------------------
 BSP2FBX::~BSP2FBX()
 {
 	UnloadBSPFile();
+#ifndef BSP2FBX_NO_FBXSDK
+	m_fbxManager->Destroy();
+#endif
+
+	if (m_threadPool)
+		delete m_threadPool;
+
+	if (m_stats)
+		delete m_stats;
+
+	if (m_ownsWadCache)
+		delete m_wadCache;
+}
+
+//---------------------------------------------------------------------
+ThreadPool* BSP2FBX::GetThreadPool()
+{
+	// Share the pool we're running on in batch mode instead of oversubscribing cores
+	ThreadPool* currentPool = ThreadPool::GetCurrentPool();
+	if (currentPool)
+		return currentPool;
+
+	if (!m_threadPool)
+		m_threadPool = new ThreadPool(m_options.nThreads);
+	return m_threadPool;
 }
 
 //---------------------------------------------------------------------
-void BSP2FBX::LoadBSPFile(const char * bspFile)
+string BSP2FBX::GetOutputFileName(const char* extension) const
 {
+	return m_bspFileName.substr(0, m_bspFileName.size() - 4) + string(extension);
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::Log(const char* format, ...) const
+{
+	if (!m_options.verbose)
+		return;
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+//---------------------------------------------------------------------
+bool BSP2FBX::LoadBSPFile(const char * bspFile)
+{
+	// A context can be reused for several maps
+	UnloadBSPFile();
+
 	m_bspFileName = bspFile;
-	m_bspLoader = new BSPLoader(m_bspFileName.c_str());
-	m_bspLoader->ReadVertices();
-	m_bspLoader->ReadPlanes();
-	m_bspLoader->ReadEdges();
-	m_bspLoader->ReadSurfEdges();
-	m_bspLoader->ReadTexInfo();
-	m_bspLoader->ReadTextures();
-	m_bspLoader->ReadFaces();
-	m_bspLoader->ReadModels();
-	m_bspLoader->ReadEntities();
-	//m_bspLoader->ReadLeaves();
+	if (m_stats)
+		m_stats->Clear();
+	{
+		BSPScopedTimer timer(m_stats, "open");
+		m_bspLoader = new BSPLoader(m_bspFileName.c_str(), m_options.memoryMapped, m_options.verbose);
+	}
+	if (!m_bspLoader->IsValid()) {
+		UnloadBSPFile();
+		return false;
+	}
+
+	// Every lump read is a stage of its own in the stats
+	auto readLump = [this](const char* stage, int lumpId, void (BSPLoader::*read)()) {
+		BSPScopedTimer timer(m_stats, stage, (uint64_t)m_bspLoader->m_Header.lump[lumpId].nLength);
+		(m_bspLoader->*read)();
+	};
+	readLump("vertices", LUMP_VERTICES, &BSPLoader::ReadVertices);
+	readLump("planes", LUMP_PLANES, &BSPLoader::ReadPlanes);
+	readLump("edges", LUMP_EDGES, &BSPLoader::ReadEdges);
+	readLump("surfedges", LUMP_SURFEDGES, &BSPLoader::ReadSurfEdges);
+	readLump("texinfo", LUMP_TEXINFO, &BSPLoader::ReadTexInfo);
+	readLump("textures", LUMP_TEXTURES, &BSPLoader::ReadTextures);
+	if (m_options.exportTextures)
+		readLump("texture_data", LUMP_TEXTURES, &BSPLoader::ReadTextureData);
+	readLump("faces", LUMP_FACES, &BSPLoader::ReadFaces);
+	if (m_options.lightmaps)
+		readLump("lighting", LUMP_LIGHTING, &BSPLoader::ReadLighting);
+	readLump("models", LUMP_MODELS, &BSPLoader::ReadModels);
+	readLump("entities", LUMP_ENTITIES, &BSPLoader::ReadEntities);
+	// Collision of hull 0 and chunks walk the same tree as the visibility, the other hulls have trees of their own
+	bool readTree = m_options.pvs || m_options.cullHidden;
+	if (readTree || (m_options.collisionHulls & 1) || m_options.chunkFaces) {
+		readLump("nodes", LUMP_NODES, &BSPLoader::ReadNodes);
+		readLump("leaves", LUMP_LEAVES, &BSPLoader::ReadLeaves);
+	}
+	if (readTree)
+		readLump("marksurfaces", LUMP_MARKSURFACES, &BSPLoader::ReadMarkSurfaces);
+	if (m_options.collisionHulls & ~1u)
+		readLump("clipnodes", LUMP_CLIPNODES, &BSPLoader::ReadClipNodes);
+	if (m_options.pvs)
+		readLump("visibility", LUMP_VISIBILITY, &BSPLoader::ReadVisibility);
+
+	// Every map has at least the worldspawn model
+	if (m_bspLoader->m_nModels == 0) {
+		printf("[ERROR] %s has no models\n", bspFile);
+		UnloadBSPFile();
+		return false;
+	}
+
+	// Lightmap coordinates are needed to build meshes
+	if (m_options.lightmaps) {
+		BSPScopedTimer timer(m_stats, "lightmap_atlas");
+		m_lightmapAtlas.Build(*m_bspLoader);
+	}
+	if (m_options.pvs) {
+		BSPScopedTimer timer(m_stats, "pvs_decode");
+		m_visibility.Build(*m_bspLoader);
+	}
+	if (m_options.cullHidden) {
+		BSPScopedTimer timer(m_stats, "cull_hidden");
+		FindHiddenFaces();
+	}
+	if (m_options.collisionHulls) {
+		BSPScopedTimer timer(m_stats, "collision");
+		const BSPLoader& loader = *m_bspLoader;
+		vector<unsigned> models(1, 0);
+		for (auto& funcwall : loader.m_funcwalls)
+			models.push_back((unsigned)(funcwall.model - loader.m_Models));
+		for (auto& funcbreakable : loader.m_funcbreakables)
+			models.push_back((unsigned)(funcbreakable.model - loader.m_Models));
+		m_collision.Build(loader, m_options.collisionHulls, models, GetThreadPool());
+		Log("Built %zu collision brushes\n", m_collision.GetBrushCount());
+	}
+	return true;
 }
 
 // Converts a Right Handed Coordinate system to Left Handed and vice-versa
@@ -46,114 +197,354 @@ VECTOR3D SwitchHandedness(VECTOR3D v) {
 }
 
 //---------------------------------------------------------------------
-FbxMesh* BSP2FBX::CreateFbxMesh(BSPMODEL* model) {
-		
-	unsigned nPolygons = model->nFaces;					// FbxMesh initialization data structures
-	vector<unsigned> nPolygonCPs;						// Every polygon is composed of an array of control points indices
-	vector<VECTOR3D> cpPositions;						// Control point positions
-	vector<VECTOR3D> cpNormals;							// Control point normals
-	vector<VECTOR3D> cpTangents;						// Control point tangents
-
-	// Go through all the faces of BSPMODEL
-	for (unsigned faceId = model->iFirstFace; faceId < (model->iFirstFace + model->nFaces); faceId++) {
-
-		//printf("----- face : %u -----\n", faceId);
-
-		// A face is a n-sided-polygon defined by a series of "SurfEdges"
-		// It's basically a closed loop of edges like this:
-		// f : (e0, e1, e2, ..., eN-1) for N edges
-		// f : (v0 -> v1, v1 -> v2, v2 -> v3, ... , vN-1 -> v0) for N vertices
-		// so number of vertices aka Control Points is same as number of surfedges 
-		BSPFACE* face = &(m_bspLoader->m_Faces[faceId]);
-
-		// Get face's material
-		BSPTEXTUREINFO texInfo = m_bspLoader->m_TextureInfos[face->iTextureInfo];
-		BSPMIPTEX tex = m_bspLoader->m_Textures[texInfo.iMiptex];
-
-		//	skyboxes are not to be added to our visible mesh
-		if (!strcmp(tex.szName, "sky")) {
-			// We're a polygon less now
-			nPolygons--;
+bool BSP2FBX::IsSkyFace(const BSPFACE* face) const
+{
+	const BSPTEXTUREINFO& texInfo = m_bspLoader->m_TextureInfos[face->iTextureInfo];
+	return !strcmp(m_bspLoader->m_Textures[texInfo.iMiptex].szName, "sky");
+}
+
+//---------------------------------------------------------------------
+bool BSP2FBX::IsHiddenFace(unsigned faceId) const
+{
+	return !m_hiddenFaces.empty() && m_hiddenFaces[faceId];
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::FindHiddenFaces()
+{
+	const BSPLoader& loader = *m_bspLoader;
+	const BSPMODEL& world = loader.m_Models[0];
+	m_hiddenFaces.clear();
+
+	// Brush entities have their own trees, only worldspawn's leaves mark faces
+	vector<bool> marked(loader.m_nFaces, false);
+	vector<bool> visited(loader.m_nNodes, false);
+	vector<int> children(1, world.iHeadnodes[0]);
+	unsigned nOpenLeaves = 0;
+	while (!children.empty()) {
+		int child = children.back();
+		children.pop_back();
+
+		// Visited nodes are skipped so corrupt trees with cycles still end
+		if (child >= 0) {
+			if ((unsigned)child >= loader.m_nNodes || visited[child])
+				continue;
+			visited[child] = true;
+			children.push_back(loader.m_Nodes[child].iChildren[0]);
+			children.push_back(loader.m_Nodes[child].iChildren[1]);
+			continue;
+		}
+
+		unsigned leafId = ~child;
+		if (leafId >= loader.m_nLeaves || loader.m_Leaves[leafId].nContents == CONTENTS_SOLID)
 			continue;
+		const BSPLEAF& leaf = loader.m_Leaves[leafId];
+		unsigned end = min((unsigned)leaf.iFirstMarkSurface + leaf.nMarkSurfaces, loader.m_nMarkSurfaces);
+		for (unsigned markSurfaceId = leaf.iFirstMarkSurface; markSurfaceId < end; markSurfaceId++) {
+			if (loader.m_MarkSurfaces[markSurfaceId] < loader.m_nFaces)
+				marked[loader.m_MarkSurfaces[markSurfaceId]] = true;
 		}
+		nOpenLeaves++;
+	}
+
+	// A map without leaves would lose all its geometry
+	unsigned firstFace = (unsigned)world.iFirstFace;
+	unsigned endFace = min(firstFace + (unsigned)world.nFaces, loader.m_nFaces);
+	if (find(marked.begin() + firstFace, marked.begin() + endFace, true) == marked.begin() + endFace) {
+		printf("[WARNING] No leaf of %s marks any face, hidden faces are kept\n", m_bspFileName.c_str());
+		return;
+	}
+
+	m_hiddenFaces.assign(loader.m_nFaces, false);
+	unsigned nHiddenFaces = 0;
+	size_t nHiddenVertices = 0;
+	for (unsigned faceId = firstFace; faceId < endFace; faceId++) {
+		const BSPFACE* face = &loader.m_Faces[faceId];
+		if (marked[faceId] || IsSkyFace(face))
+			continue;
+		m_hiddenFaces[faceId] = true;
+		nHiddenFaces++;
+		nHiddenVertices += face->nEdges;
+	}
+	Log("Culled %u hidden faces with %zu vertices, %u non-solid leaves\n", nHiddenFaces, nHiddenVertices, nOpenLeaves);
+}
+
+// Key used to share identical normals and tangents between polygons
+struct VectorKey {
+	float		values[3];
+
+	bool operator==(const VectorKey& o) const {
+		return values[0] == o.values[0] && values[1] == o.values[1] && values[2] == o.values[2];
+	}
+};
+
+struct VectorKeyHash {
+	size_t operator()(const VectorKey& key) const {
+		return FoldHash(HashFloats(key.values, sizeof(key.values) / sizeof(key.values[0])));
+	}
+};
+
+typedef unordered_map<VectorKey, unsigned, VectorKeyHash> VectorTable;
+
+//---------------------------------------------------------------------
+// Index of v in a table of distinct vectors, appended to values if it's new
+static unsigned AddToTable(VectorTable& table, vector<float>& values, const VECTOR3D& v)
+{
+	VectorKey key = { { v.x, v.y, v.z } };
+	auto inserted = table.emplace(key, (unsigned)table.size());
+	if (inserted.second)
+		values.insert(values.end(), { v.x, v.y, v.z });
+	return inserted.first->second;
+}
+
+//---------------------------------------------------------------------
+// Give the last polygon of meshData the normal of a face's plane, and a tangent
+// along the S axis of its texture projected on the plane : the direction U grows
+static void AddCompactNormal(const BSPLoader& loader, const BSPFACE* face, BSPMeshData& meshData,
+	VectorTable& normals, VectorTable& tangents)
+{
+	VECTOR3D normal = loader.m_Planes[face->iPlane].vNormal;
+	if (face->nPlaneSide) {
+		normal.x = -normal.x;
+		normal.y = -normal.y;
+		normal.z = -normal.z;
+	}
+
+	const VECTOR3D& s = loader.m_TextureInfos[face->iTextureInfo].vS;
+	float d = s.x * normal.x + s.y * normal.y + s.z * normal.z;
+	VECTOR3D tangent(s.x - normal.x * d, s.y - normal.y * d, s.z - normal.z * d);
+	float length = sqrt(tangent.x * tangent.x + tangent.y * tangent.y + tangent.z * tangent.z);
+	if (length > 0.0f) {
+		tangent.x /= length;
+		tangent.y /= length;
+		tangent.z /= length;
+	}
+
+	meshData.polygonNormals.push_back(AddToTable(normals, meshData.normalTable, SwitchHandedness(normal)));
+	meshData.polygonTangents.push_back(AddToTable(tangents, meshData.tangentTable, SwitchHandedness(tangent)));
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::BuildMeshData(const BSPMODEL* model, BSPMeshData& meshData, const vector<unsigned>* faces) const {
+		
+	meshData.Clear();
+
+	vector<unsigned> modelFaces;
+	if (!faces || faces->empty()) {
+		modelFaces.resize(model->nFaces);
+		for (unsigned i = 0; i < modelFaces.size(); i++)
+			modelFaces[i] = model->iFirstFace + i;
+		faces = &modelFaces;
+	}
+
+	// Visible faces are bucketed by texture so the polygons of a material are contiguous
+	// Sorting (texture, face) keys keeps faces of the same texture in BSP order
+	vector<uint64_t> sortedFaces;
+	sortedFaces.reserve(faces->size());
+	size_t nPolygonVertices = 0;
+	for (unsigned faceId : *faces) {
+		const BSPFACE* face = &(m_bspLoader->m_Faces[faceId]);
+
+		//	skyboxes are not to be added to our visible mesh, nor faces nothing can see
+		if (IsSkyFace(face) || IsHiddenFace(faceId))
+			continue;
+
+		uint32_t miptex = m_bspLoader->m_TextureInfos[face->iTextureInfo].iMiptex;
+		sortedFaces.push_back(((uint64_t)miptex << 32) | faceId);
+		nPolygonVertices += face->nEdges;
+	}
+	sort(sortedFaces.begin(), sortedFaces.end());
+
+	// Size every stream up front so they're allocated only once
+	bool lightmapped = !m_lightmapAtlas.IsEmpty();
+	meshData.Resize((unsigned)sortedFaces.size(), nPolygonVertices, lightmapped);
+
+	// Faces are gathered then the attributes of all their vertices computed in
+	// one batch, the batch of every worker is kept for its next mesh
+	static thread_local BSPVertexKernel kernel;
+	kernel.Clear();
+	kernel.Reserve(sortedFaces.size(), nPolygonVertices);
+
+	// Polygons of the mesh with the same normal or tangent share its entry in the compact tables
+	VectorTable normals, tangents;
+	if (m_options.compactNormals) {
+		meshData.polygonNormals.reserve(sortedFaces.size());
+		meshData.polygonTangents.reserve(sortedFaces.size());
+	}
+	for (uint64_t sortedFace : sortedFaces) {
+		unsigned faceId = (unsigned)(sortedFace & 0xFFFFFFFF);
+		const BSPFACE* face = &(m_bspLoader->m_Faces[faceId]);
 
 		// Number of control points is equal to the number of edges for a closed planar surface
-		nPolygonCPs.push_back(face->nEdges);
-
-		// Store each face's normal
-		BSPPLANE* plane = &(m_bspLoader->m_Planes[face->iPlane]);
-		VECTOR3D normal = plane->vNormal;
-		// Reverse normal if specified
-		if (face->nPlaneSide) {
-			normal.x *= -1.0f;
-			normal.y *= -1.0f;
-			normal.z *= -1.0f;
-		}
-		//polygonNormals.push_back(normal);
-		/*printf("Poly: %u Vertices: %u LightingStyle: %u,%u,%u,%u Texture: %s\n", 
-			faceId, 
-			face->nEdges, 
-			face->nStyles[0], face->nStyles[1], face->nStyles[2], face->nStyles[3],
-			tex.szName);*/
-
-		// For each surfedge
-		for (unsigned surfedgeId = face->iFirstEdge; surfedgeId < (face->iFirstEdge + face->nEdges); surfedgeId++) {
-
-			// Get corresponding edgeId
-			int edgeId = m_bspLoader->m_SurfEdges[surfedgeId];
-			unsigned edgeId_abs = abs(edgeId);
-
-			// Get vertex IDs of edge
-			unsigned v0Id = m_bspLoader->m_Edges[edgeId_abs].iVertex[0];
-			unsigned v1Id = m_bspLoader->m_Edges[edgeId_abs].iVertex[1];
-
-			// Swap v0Id and v1Id if we have a negative edgeId
-			if (edgeId < 0)
-				swap(v0Id, v1Id);
-
-			// Get vertices
-			VECTOR3D v0 = m_bspLoader->m_Vertices[v0Id];
-			VECTOR3D v1 = m_bspLoader->m_Vertices[v1Id];
-
-			/*printf("SurfEdge: %u Edge: %d Edge_abs: %u, v0:%f,%f,%f v1:%f,%f,%f \n", surfedgeId, edgeId, edgeId_abs,
-				v0.x, v0.y, v0.z, v1.x, v1.y, v1.z);*/
-
-			// Every edge naturally defines a tangent as well
-			VECTOR3D tangent;
-			tangent.x = v0.x - v1.x;
-			tangent.y = v0.y - v1.y;
-			tangent.z = v0.z - v1.z;
-
-			float tangent_length = sqrt(tangent.x * tangent.x + tangent.y * tangent.y + tangent.z * tangent.z);
-			tangent.x = tangent.x / tangent_length;
-			tangent.y = tangent.y / tangent_length;
-			tangent.z = tangent.z / tangent_length;
-
-			/*printf("SurfEdge: %u Edge: %d Edge_abs: %u, v0:%f,%f,%f v1:%f,%f,%f Tangent: %f,%f,%f Normal: %f,%f,%f\n", 
-				surfedgeId, edgeId, edgeId_abs,
-				v0.x, v0.y, v0.z, 
-				v1.x, v1.y, v1.z,
-				tangent.x, tangent.y, tangent.z,
-				normal.x, normal.y, normal.z);*/
-
-			// Compute texture coordinates for this vertex
-			// http://www.flipcode.com/archives/Quake_2_BSP_File_Format.shtml
-			float u = (texInfo.vS.x * v0.x + texInfo.vS.y * v0.y + texInfo.vS.z * v0.z) + texInfo.fSShift;
-			float v = (texInfo.vT.x * v0.x + texInfo.vT.y * v0.y + texInfo.vT.z * v0.z) + texInfo.fTShift;
-
-			/*printf("Vertex: %f,%f,%f S:%f,%f,%f T: %f,%f,%f Offset: %f,%f UV: %f,%f\n", 
-				v0.x, v0.y, v0.z, 
-				texInfo.vS.x, texInfo.vS.y, texInfo.vS.z,
-				texInfo.vT.x, texInfo.vT.y, texInfo.vT.z,
-				texInfo.fSShift, texInfo.fTShift,
-				u, v);*/
-
-			// Add v0 to the list of control points
-			cpPositions.push_back(SwitchHandedness(v0));
-			cpNormals.push_back(SwitchHandedness(normal));
-			cpTangents.push_back(SwitchHandedness(tangent));
+		// Scene materials are the BSP textures
+		meshData.AddPolygon(face->nEdges, m_bspLoader->m_TextureInfos[face->iTextureInfo].iMiptex);
+		kernel.AddFace(*m_bspLoader, faceId);
+		if (m_options.compactNormals)
+			AddCompactNormal(*m_bspLoader, face, meshData, normals, tangents);
+	}
+
+	// Lightmap coordinates need the texture coordinates in texels, which are
+	// written in their place first
+	float* st = lightmapped ? meshData.lightmapUVs.data() : nullptr;
+	kernel.Compute(meshData.positions.data(), meshData.normals.data(), meshData.uvs.data(), meshData.tangents.data(), st);
+	if (lightmapped) {
+		size_t vertex = 0;
+		for (uint64_t sortedFace : sortedFaces) {
+			unsigned faceId = (unsigned)(sortedFace & 0xFFFFFFFF);
+			unsigned nEdges = m_bspLoader->m_Faces[faceId].nEdges;
+			for (unsigned i = 0; i < nEdges; i++, vertex++) {
+				VECTOR2D uv = m_lightmapAtlas.GetUV(faceId, st[vertex * 2], st[vertex * 2 + 1]);
+				st[vertex * 2] = uv.x;
+				st[vertex * 2 + 1] = uv.y;
+			}
 		}
 	}
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::BuildCollisionMeshData(const BSPCollisionBrush& brush, BSPMeshData& meshData) const
+{
+	meshData.Clear();
+	meshData.Resize((unsigned)brush.nFaceVertices.size(), brush.vertices.size());
+
+	// Brushes aren't textured, they all use the collision material after the textures
+	VectorTable normals, tangents;
+	unsigned material = m_bspLoader->m_nTextures;
+	size_t vertex = 0;
+	for (unsigned faceId = 0; faceId < brush.nFaceVertices.size(); faceId++) {
+		unsigned nVertices = brush.nFaceVertices[faceId];
+		meshData.AddPolygon(nVertices, material);
+
+		// Every vertex of a face gets its normal and the tangent along its first edge
+		VECTOR3D normal = SwitchHandedness(brush.normals[faceId]);
+		const VECTOR3D& v0 = brush.vertices[vertex];
+		const VECTOR3D& v1 = brush.vertices[vertex + 1];
+		VECTOR3D tangent(v1.x - v0.x, v1.y - v0.y, v1.z - v0.z);
+		float length = sqrt(tangent.x * tangent.x + tangent.y * tangent.y + tangent.z * tangent.z);
+		if (length > 0.0f) {
+			tangent.x /= length;
+			tangent.y /= length;
+			tangent.z /= length;
+		}
+		tangent = SwitchHandedness(tangent);
+		if (m_options.compactNormals) {
+			meshData.polygonNormals.push_back(AddToTable(normals, meshData.normalTable, normal));
+			meshData.polygonTangents.push_back(AddToTable(tangents, meshData.tangentTable, tangent));
+		}
+
+		for (unsigned i = 0; i < nVertices; i++, vertex++) {
+			VECTOR3D position = SwitchHandedness(brush.vertices[vertex]);
+			memcpy(&meshData.positions[vertex * 3], &position, 3 * sizeof(float));
+			memcpy(&meshData.normals[vertex * 3], &normal, 3 * sizeof(float));
+			memcpy(&meshData.tangents[vertex * 3], &tangent, 3 * sizeof(float));
+		}
+	}
+}
+
+// Key used to find control points with identical attributes
+// position x y z, normal x y z, u v, lightmap u v
+struct WeldKey {
+	float		values[10];
+
+	bool operator==(const WeldKey& o) const {
+		for (unsigned i = 0; i < 10; i++) {
+			if (values[i] != o.values[i])
+				return false;
+		}
+		return true;
+	}
+};
+
+struct WeldKeyHash {
+	size_t operator()(const WeldKey& key) const {
+		return FoldHash(HashFloats(key.values, sizeof(key.values) / sizeof(key.values[0])));
+	}
+};
+
+//---------------------------------------------------------------------
+void BSP2FBX::WeldMeshData(BSPMeshData& meshData) {
+
+	// Already welded
+	if (meshData.IsWelded())
+		return;
+
+	size_t nPolygonVertices = meshData.GetPolygonVertexCount();
+	bool lightmapped = meshData.HasLightmapUVs();
+	meshData.polygonCPs.resize(nPolygonVertices);
+
+	unordered_map<WeldKey, unsigned, WeldKeyHash> cpIndex;
+	cpIndex.reserve(nPolygonVertices);
+
+	// Control points are compacted in place : a new control point is never
+	// written past the polygon vertex being read, so no second copy of the
+	// streams is needed and their buffers are kept for the next mesh
+	unsigned nControlPoints = 0;
+	for (size_t i = 0; i < nPolygonVertices; i++) {
+		WeldKey key;
+		memcpy(&key.values[0], meshData.GetPosition(i), 3 * sizeof(float));
+		memcpy(&key.values[3], meshData.GetNormal(i), 3 * sizeof(float));
+		memcpy(&key.values[6], meshData.GetUV(i), 2 * sizeof(float));
+		key.values[8] = lightmapped ? meshData.GetLightmapUV(i)[0] : 0.0f;
+		key.values[9] = lightmapped ? meshData.GetLightmapUV(i)[1] : 0.0f;
+		auto inserted = cpIndex.emplace(key, nControlPoints);
+		if (inserted.second) {
+			memcpy(&meshData.positions[nControlPoints * 3], &key.values[0], 3 * sizeof(float));
+			memcpy(&meshData.normals[nControlPoints * 3], &key.values[3], 3 * sizeof(float));
+			memcpy(&meshData.uvs[nControlPoints * 2], &key.values[6], 2 * sizeof(float));
+			if (lightmapped)
+				memcpy(&meshData.lightmapUVs[nControlPoints * 2], &key.values[8], 2 * sizeof(float));
+			nControlPoints++;
+		}
+		meshData.polygonCPs[i] = inserted.first->second;
+	}
+
+	// Tangents stay as they are, one per polygon vertex
+	meshData.positions.resize(nControlPoints * 3);
+	meshData.normals.resize(nControlPoints * 3);
+	meshData.uvs.resize(nControlPoints * 2);
+	if (lightmapped)
+		meshData.lightmapUVs.resize(nControlPoints * 2);
+}
+
+#ifndef BSP2FBX_NO_FBXSDK
+//---------------------------------------------------------------------
+// Convert a stream of the mesh straight into the storage of a layer element's
+// direct array, which is sized once, rather than through an element at a time SetAt
+static void FillDirectArray(FbxLayerElementArrayTemplate<FbxVector4>& array, const float* values, int count)
+{
+	array.Resize(count);
+	FbxVector4* data = array.GetLocked(FbxLayerElementArray::eWriteLock);
+	for (int i = 0; i < count; i++, values += 3)
+		data[i] = FbxVector4(values[0], values[1], values[2]);
+	array.Release(&data);
+}
+
+static void FillDirectArray(FbxLayerElementArrayTemplate<FbxVector2>& array, const float* values, int count)
+{
+	array.Resize(count);
+	FbxVector2* data = array.GetLocked(FbxLayerElementArray::eWriteLock);
+	for (int i = 0; i < count; i++, values += 2)
+		data[i] = FbxVector2(values[0], values[1]);
+	array.Release(&data);
+}
+
+static void FillIndexArray(FbxLayerElementArrayTemplate<int>& array, const vector<unsigned>& indices)
+{
+	array.Resize((int)indices.size());
+	int* data = array.GetLocked(FbxLayerElementArray::eWriteLock);
+	for (size_t i = 0; i < indices.size(); i++)
+		data[i] = (int)indices[i];
+	array.Release(&data);
+}
+
+//---------------------------------------------------------------------
+FbxMesh* BSP2FBX::CreateFbxMesh(const BSPMeshData& meshData) {
+
+	unsigned nPolygons = meshData.nPolygons;
+	const vector<unsigned>& nPolygonCPs = meshData.nPolygonCPs;
+	int nControlPoints = (int)meshData.GetControlPointCount();
+	int nTangents = (int)meshData.GetPolygonVertexCount();
+	bool welded = meshData.IsWelded();
 
 	//printf("Creating FbxMesh\n");
 
@@ -162,25 +553,29 @@ FbxMesh* BSP2FBX::CreateFbxMesh(BSPMODEL* model) {
 
 	// Create an array of global control points 
 	// A polygon would just index into this array
-	mesh->InitControlPoints(cpPositions.size());
+	mesh->InitControlPoints(nControlPoints);
 	FbxVector4* cps = mesh->GetControlPoints();
-	for (unsigned i = 0; i < cpPositions.size(); i++) {
-		cps[i] = FbxVector4(cpPositions[i].x, cpPositions[i].y, cpPositions[i].z);
+	for (int i = 0; i < nControlPoints; i++) {
+		const float* p = meshData.GetPosition(i);
+		cps[i] = FbxVector4(p[0], p[1], p[2]);
 	}
 
-	//printf("control points: %u\n", cpPositions.size());
+	//printf("control points: %u\n", nControlPoints);
 	//printf("polygons: %u\n", nPolygons);
 
 	mesh->ReservePolygonCount(nPolygons);
-	// Global control point index
-	unsigned cpId = 0;
+	mesh->ReservePolygonVertexCount(nTangents);
+	// Global polygon vertex index
+	unsigned pvId = 0;
 
 	// Add a polygon to the mesh
 	for (unsigned pId = 0; pId < nPolygons; pId++) {
 		unsigned nCPs = nPolygonCPs[pId];
 		mesh->BeginPolygon();
 		for (unsigned i = 0; i < nCPs; i++) {
-			mesh->AddPolygon(cpId++);
+			// Unwelded polygon vertices each have their own control point
+			mesh->AddPolygon(meshData.GetPolygonCP(pvId));
+			pvId++;
 		}
 		mesh->EndPolygon();
 	}
@@ -203,139 +598,1221 @@ FbxMesh* BSP2FBX::CreateFbxMesh(BSPMODEL* model) {
 	FbxLayerElementNormal* leNormal = FbxLayerElementNormal::Create(mesh, "normalLayer");
 	FbxLayerElementTangent* leTangent = FbxLayerElementTangent::Create(mesh, "tangentLayer");
 
-	// Set its mapping mode to map each normal vector to each polygon
-	leNormal->SetMappingMode(FbxLayerElement::eByControlPoint);
-	leTangent->SetMappingMode(FbxLayerElement::eByControlPoint);
-
-	// Set the reference mode of so that the n'th element of the normal array maps to the n'th
-	// element of the polygon array.
-	leNormal->SetReferenceMode(FbxLayerElement::eDirect);
-	leTangent->SetReferenceMode(FbxLayerElement::eDirect);
+	if (meshData.HasCompactNormals()) {
+		// Every polygon indexes the tables of distinct normals and tangents of the mesh
+		leNormal->SetMappingMode(FbxLayerElement::eByPolygon);
+		leNormal->SetReferenceMode(FbxLayerElement::eIndexToDirect);
+		FillDirectArray(leNormal->GetDirectArray(), meshData.normalTable.data(), (int)meshData.normalTable.size() / 3);
+		FillIndexArray(leNormal->GetIndexArray(), meshData.polygonNormals);
 
-	// Add per control point normal
-	for (auto cpn : cpNormals) {
-		// Reverse all normals
-		FbxVector4 n(cpn.x, cpn.y, cpn.z);
-		leNormal->GetDirectArray().Add(n);
+		leTangent->SetMappingMode(FbxLayerElement::eByPolygon);
+		leTangent->SetReferenceMode(FbxLayerElement::eIndexToDirect);
+		FillDirectArray(leTangent->GetDirectArray(), meshData.tangentTable.data(), (int)meshData.tangentTable.size() / 3);
+		FillIndexArray(leTangent->GetIndexArray(), meshData.polygonTangents);
 	}
+	else {
+		// Set its mapping mode to map each normal vector to each polygon
+		// Welded control points are shared by faces with different edges so
+		// tangents have to be given per polygon vertex
+		leNormal->SetMappingMode(FbxLayerElement::eByControlPoint);
+		leTangent->SetMappingMode(welded ? FbxLayerElement::eByPolygonVertex : FbxLayerElement::eByControlPoint);
 
-	// Add per control point tangent
-	for (auto cpt : cpTangents) {
-		// Reverse all normals
-		FbxVector4 t(cpt.x, cpt.y, cpt.z);
-		leTangent->GetDirectArray().Add(t);
+		// Set the reference mode of so that the n'th element of the normal array maps to the n'th
+		// element of the polygon array.
+		leNormal->SetReferenceMode(FbxLayerElement::eDirect);
+		leTangent->SetReferenceMode(FbxLayerElement::eDirect);
+
+		// Add per control point normal, direct arrays are sized once and filled in place
+		FillDirectArray(leNormal->GetDirectArray(), meshData.normals.data(), nControlPoints);
+
+		// Add per control point tangent
+		FillDirectArray(leTangent->GetDirectArray(), meshData.tangents.data(), nTangents);
 	}
 
+	// Texture coordinates are per control point as well, welding only merged
+	// control points with the same UV
+	FbxLayerElementUV* leUV = FbxLayerElementUV::Create(mesh, "uvLayer");
+	leUV->SetMappingMode(FbxLayerElement::eByControlPoint);
+	leUV->SetReferenceMode(FbxLayerElement::eDirect);
+	FillDirectArray(leUV->GetDirectArray(), meshData.uvs.data(), nControlPoints);
+
+	// One material per polygon, polygons of a material are contiguous
+	FbxLayerElementMaterial* leMaterial = FbxLayerElementMaterial::Create(mesh, "materialLayer");
+	leMaterial->SetMappingMode(FbxLayerElement::eByPolygon);
+	leMaterial->SetReferenceMode(FbxLayerElement::eIndexToDirect);
+	FillIndexArray(leMaterial->GetIndexArray(), meshData.polygonMaterials);
+
 	// Assign normals to layer
 	nLayer->SetNormals(leNormal);
+	nLayer->SetMaterials(leMaterial);
+	nLayer->SetUVs(leUV, FbxLayerElement::eTextureDiffuse);
 	tLayer->SetTangents(leTangent);
 
+	// Lightmap atlas coordinates are the second UV set
+	if (meshData.HasLightmapUVs()) {
+		FbxLayerElementUV* leLightmapUV = FbxLayerElementUV::Create(mesh, "lightmapUV");
+		leLightmapUV->SetMappingMode(FbxLayerElement::eByControlPoint);
+		leLightmapUV->SetReferenceMode(FbxLayerElement::eDirect);
+		FillDirectArray(leLightmapUV->GetDirectArray(), meshData.lightmapUVs.data(), nControlPoints);
+		tLayer->SetUVs(leLightmapUV, FbxLayerElement::eTextureDiffuse);
+	}
+
 	return mesh;
 }
 
 //---------------------------------------------------------------------
-void BSP2FBX::GenerateFBX()
+FbxSurfaceMaterial* BSP2FBX::CreateFbxMaterial(const BSPSceneMaterial& material, const string& outputDirectory) {
+
+	FbxSurfacePhong* phong = FbxSurfacePhong::Create(m_fbxScene, material.name.c_str());
+	phong->ShadingModel.Set("Phong");
+	phong->Diffuse.Set(FbxDouble3(1.0, 1.0, 1.0));
+	phong->DiffuseFactor.Set(1.0);
+
+	// Textures are only referenced when they were exported
+	if (!material.textureFile.empty()) {
+		FbxFileTexture* texture = FbxFileTexture::Create(m_fbxScene, material.name.c_str());
+		texture->SetFileName((std::filesystem::path(outputDirectory) / material.textureFile).string().c_str());
+		texture->SetRelativeFileName(material.textureFile.c_str());
+		texture->SetTextureUse(FbxTexture::eStandard);
+		texture->SetMappingType(FbxTexture::eUV);
+		texture->SetMaterialUse(FbxFileTexture::eModelMaterial);
+		texture->UVSet.Set("uvLayer");
+		phong->Diffuse.ConnectSrcObject(texture);
+
+		// See-through texels have a zero alpha in the exported image
+		if (material.transparent)
+			phong->TransparentColor.ConnectSrcObject(texture);
+	}
+	return phong;
+}
+
+//---------------------------------------------------------------------
+bool BSP2FBX::ExportWithFbxSdk(const vector<BSPSceneNode>& nodes, const vector<BSPSceneMaterial>& materials, const char* fileName)
 {
 	// Create scene object
 	m_fbxScene = FbxScene::Create(m_fbxManager, m_bspFileName.c_str());
 	FbxNode* root = m_fbxScene->GetRootNode();
 
-	// Create a visible geometry node containing all visible geometry in BSP
-	FbxNode* node_visible_geometry = FbxNode::Create(m_fbxScene, "visible_geometry");
-	printf("Creating FBX Node: visible_geometry\n");
-	// Applying a mirror transform in X direction for all the nodes down this hierarchy
-	node_visible_geometry->LclScaling.Set(FbxDouble3(-1, 1, 1));
-	root->AddChild(node_visible_geometry);
-
-	// ----- Visible Geometries in BSP  -----
+	// Nodes are created up front, meshes get attached as they're built
+	vector<FbxNode*> fbxNodes(nodes.size());
+	for (unsigned i = 0; i < nodes.size(); i++) {
+		const BSPSceneNode& node = nodes[i];
+		fbxNodes[i] = FbxNode::Create(m_fbxScene, node.name.c_str());
+		fbxNodes[i]->LclScaling.Set(FbxDouble3(node.scaling.x, node.scaling.y, node.scaling.z));
 
-	// --- worldspawn ---
-	BSPMODEL* worldspawn_model = &(m_bspLoader->m_Models[0]);
-	printf("Creating FBX Node: worldspawn\n");
-	FbxMesh* worldspawn_mesh = CreateFbxMesh(worldspawn_model);
-	FbxNode* node_worldspawn = FbxNode::Create(m_fbxScene, "worldspawn");
-	node_worldspawn->SetNodeAttribute(worldspawn_mesh);
-	node_visible_geometry->AddChild(node_worldspawn);
+		// Custom data goes to user properties
+		for (auto& property : node.properties) {
+			FbxProperty fbxProperty;
+			switch (property.type) {
+			case PROPERTY_INT:
+				fbxProperty = FbxProperty::Create(fbxNodes[i], FbxIntDT, property.name.c_str());
+				fbxProperty.Set(property.intValue);
+				break;
+			case PROPERTY_VECTOR:
+				fbxProperty = FbxProperty::Create(fbxNodes[i], FbxDouble3DT, property.name.c_str());
+				fbxProperty.Set(FbxDouble3(property.vectorValue.x, property.vectorValue.y, property.vectorValue.z));
+				break;
+			case PROPERTY_STRING:
+				fbxProperty = FbxProperty::Create(fbxNodes[i], FbxStringDT, property.name.c_str());
+				fbxProperty.Set(FbxString(property.stringValue.c_str()));
+				break;
+			}
+			fbxProperty.ModifyFlag(FbxPropertyFlags::eUserDefined, true);
+		}
 
-	// --- func_walls ---
-	FbxNode* node_func_walls = FbxNode::Create(m_fbxScene, "func_walls");
-	printf("Creating FBX Node: func_walls\n");
-	node_visible_geometry->AddChild(node_func_walls);
-	int index = 0;
-	for (auto i : m_bspLoader->m_funcwalls) {
-		// Create a sub-node per func_wall and add it to func_walls node
-		string node_name = string("func_wall") + to_string(index++);
-		FbxNode* node_func_wall = FbxNode::Create(m_fbxScene, node_name.c_str());
-		printf("Creating FBX Node: %s\n", node_name.c_str());
-		FbxMesh* mesh = CreateFbxMesh(i.model);
-		node_func_wall->AddNodeAttribute(mesh);
-		node_func_walls->AddChild(node_func_wall);
+		// LOD groups switch to their next child at every threshold
+		if (!node.lodDistances.empty()) {
+			FbxLODGroup* lodGroup = FbxLODGroup::Create(m_fbxScene, node.name.c_str());
+			lodGroup->MinMaxDistance.Set(false);
+			lodGroup->WorldSpace.Set(false);
+			for (float distance : node.lodDistances)
+				lodGroup->AddThreshold(FbxDistance(distance, "cm"));
+			fbxNodes[i]->SetNodeAttribute(lodGroup);
+		}
+		FbxNode* parent = node.parent < 0 ? root : fbxNodes[node.parent];
+		parent->AddChild(fbxNodes[i]);
 	}
 
-	// --- func_breakables ---
-	FbxNode* node_func_breakables = FbxNode::Create(m_fbxScene, "func_breakables");
-	printf("Creating FBX Node: func_breakables\n");
-	node_visible_geometry->AddChild(node_func_breakables);
-	index = 0;
-	for (auto i : m_bspLoader->m_funcbreakables) {
-		// Create a sub-node per func_wall and add it to func_walls node
-		string node_name = string("func_breakable") + to_string(index++);
-		FbxNode* node_func_breakable = FbxNode::Create(m_fbxScene, node_name.c_str());
-		printf("Creating FBX Node: %s\n", node_name.c_str());
-		FbxMesh* mesh = CreateFbxMesh(i.model);
-		node_func_breakable->AddNodeAttribute(mesh);
-		node_func_breakables->AddChild(node_func_breakable);
-	}
+	// ----- Textures -----
+	// Fill some color into our black and white world!
+	// A material is shared by every node using its texture, it's created on first use
+	vector<FbxSurfaceMaterial*> fbxMaterials(materials.size(), nullptr);
+	std::error_code ec;
+	string outputDirectory = std::filesystem::absolute(fileName, ec).parent_path().string();
+
+	// FBX objects can only be created from a single thread
+	ForEachMesh(nodes, [&](unsigned nodeId, const BSPMeshData& meshData) {
+		FbxNode* fbxNode = fbxNodes[nodeId];
+		fbxNode->SetNodeAttribute(CreateFbxMesh(meshData));
+
+		// The material layer indexes the node's materials, which are added in mesh material order
+		for (unsigned materialId : meshData.materials) {
+			if (!fbxMaterials[materialId])
+				fbxMaterials[materialId] = CreateFbxMaterial(materials[materialId], outputDirectory);
+			fbxNode->AddMaterial(fbxMaterials[materialId]);
+		}
+	});
 
 	// ----- Lights -----
 	// Get lights to lighten up the world!
 
-	// ----- Textures -----
-	// Fill some color into our black and white world!
-
 	// ----- Collision -----
 	// Need to define collision geometry before we load our player
 
 	// ----- Export to a FBX file -----
-	FbxIOSettings* ios = FbxIOSettings::Create(m_fbxManager, IOSROOT);
-	m_fbxManager->SetIOSettings(ios);
 	FbxExporter* lExporter = FbxExporter::Create(m_fbxManager, "");
-	string fbxFileName = m_bspFileName.substr(0, m_bspFileName.size() - 4) + string(".fbx");
 	// Get the appropriate file format. Binary : FBX binary (*.fbx), ASCII : FBX ascii (*.fbx)
 	int lFormat = m_fbxManager->GetIOPluginRegistry()->FindWriterIDByDescription("FBX binary (*.fbx)");
-	bool lResult = lExporter->Initialize(fbxFileName.c_str(), lFormat, m_fbxManager->GetIOSettings());
+	bool lResult = lExporter->Initialize(fileName, lFormat, m_fbxManager->GetIOSettings());
 	if (!lResult) {
 		printf("Call to FbxExporter::Initialize() failed.\n");
 		printf("Error returned: %s\n\n", lExporter->GetStatus().GetErrorString());
 	}
-	lResult = lExporter->Export(m_fbxScene);
-	if (!lResult) {
-		printf("Call to FbxExporter::Export() failed.\n");
+	else {
+		lResult = lExporter->Export(m_fbxScene);
+		if (!lResult) {
+			printf("Call to FbxExporter::Export() failed.\n");
+		}
 	}
 	lExporter->Destroy();
-	printf("*** Exporting to : %s ***\n", fbxFileName.c_str());
+	Log("*** Exporting to : %s ***\n", fileName);
+
+	// The scene isn't needed anymore once it's on disk
+	m_fbxScene->Destroy();
+	m_fbxScene = nullptr;
+	return lResult;
+}
+#endif
+
+//---------------------------------------------------------------------
+void BSP2FBX::BuildSceneNodes(vector<BSPSceneNode>& nodes) const
+{
+	// A visible geometry node contains all visible geometry in BSP
+	// Applying a mirror transform in X direction for all the nodes down this hierarchy
+	nodes.push_back(BSPSceneNode("visible_geometry", -1));
+	nodes.back().scaling = VECTOR3D(-1.0f, 1.0f, 1.0f);
+
+	// --- worldspawn ---
+	// Split in a sub-node per leaf when exporting visibility, or per spatial chunk
+	int worldspawn = (int)nodes.size();
+	nodes.push_back(BSPSceneNode("worldspawn", 0, &(m_bspLoader->m_Models[0])));
+	if (!m_visibility.IsEmpty()) {
+		nodes.back().model = nullptr;
+		BuildLeafNodes(nodes, worldspawn);
+	}
+	else if (m_options.chunkFaces) {
+		nodes.back().model = nullptr;
+		BuildChunkNodes(nodes, worldspawn);
+	}
+
+	// --- func_walls ---
+	// A sub-node per func_wall under a func_walls node
+	int funcWalls = (int)nodes.size();
+	nodes.push_back(BSPSceneNode("func_walls", 0));
+	for (unsigned index = 0; index < m_bspLoader->m_funcwalls.size(); index++)
+		nodes.push_back(BSPSceneNode(string("func_wall") + to_string(index), funcWalls, m_bspLoader->m_funcwalls[index].model));
+
+	// --- func_breakables ---
+	int funcBreakables = (int)nodes.size();
+	nodes.push_back(BSPSceneNode("func_breakables", 0));
+	for (unsigned index = 0; index < m_bspLoader->m_funcbreakables.size(); index++)
+		nodes.push_back(BSPSceneNode(string("func_breakable") + to_string(index), funcBreakables, m_bspLoader->m_funcbreakables[index].model));
+
+	// --- levels of detail ---
+	if (!m_options.lodErrors.empty())
+		BuildLODNodes(nodes);
+
+	// --- collision ---
+	if (!m_collision.IsEmpty())
+		BuildCollisionNodes(nodes);
+
+	for (auto& node : nodes)
+		Log("Creating FBX Node: %s\n", node.name.c_str());
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::BuildCollisionNodes(vector<BSPSceneNode>& nodes) const
+{
+	const BSPLoader& loader = *m_bspLoader;
+
+	// Brushes are named after the node of their model, UCX_ for hull 0 so that
+	// Unreal imports them as the collision of that mesh, HULLn_ for the others
+	// which only matter to movement code
+	vector<pair<string, const BSPMODEL*>> models;
+	models.push_back(make_pair(string("worldspawn"), &loader.m_Models[0]));
+	for (unsigned index = 0; index < loader.m_funcwalls.size(); index++)
+		models.push_back(make_pair(string("func_wall") + to_string(index), loader.m_funcwalls[index].model));
+	for (unsigned index = 0; index < loader.m_funcbreakables.size(); index++)
+		models.push_back(make_pair(string("func_breakable") + to_string(index), loader.m_funcbreakables[index].model));
+
+	int collision = (int)nodes.size();
+	nodes.push_back(BSPSceneNode("collision", -1));
+	nodes.back().scaling = VECTOR3D(-1.0f, 1.0f, 1.0f);
+	for (unsigned hull = 0; hull < MAX_MAP_HULLS; hull++) {
+		if (!(m_options.collisionHulls & (1 << hull)))
+			continue;
+		int hullNode = (int)nodes.size();
+		nodes.push_back(BSPSceneNode(string("collision_hull") + to_string(hull), collision));
+		nodes.back().properties.push_back(BSPSceneProperty("bsp_hull", (int)hull));
+		string prefix = hull == 0 ? string("UCX_") : string("HULL") + to_string(hull) + "_";
+
+		for (auto& model : models) {
+			unsigned modelId = (unsigned)(model.second - loader.m_Models);
+			const vector<BSPCollisionBrush>& brushes = m_collision.GetBrushes(modelId, hull);
+			for (unsigned brush = 0; brush < brushes.size(); brush++) {
+				char suffix[16];
+				snprintf(suffix, sizeof(suffix), "_%02u", brush);
+				nodes.push_back(BSPSceneNode(prefix + model.first + suffix, hullNode, model.second));
+				nodes.back().hull = (int)hull;
+				nodes.back().brush = brush;
+				nodes.back().properties.push_back(BSPSceneProperty("bsp_model", (int)modelId));
+			}
+		}
+	}
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::BuildChunkNodes(vector<BSPSceneNode>& nodes, int worldspawn) const
+{
+	const BSPLoader& loader = *m_bspLoader;
+	const BSPMODEL* world = &loader.m_Models[0];
+
+	// Center and bounds of every visible face
+	struct ChunkFace {
+		unsigned	faceId;
+		double		center[3];
+		VECTOR3D	mins, maxs;
+	};
+	vector<ChunkFace> faces;
+	for (unsigned faceId = world->iFirstFace; faceId < (unsigned)(world->iFirstFace + world->nFaces); faceId++) {
+		const BSPFACE* face = &loader.m_Faces[faceId];
+		if (IsSkyFace(face) || IsHiddenFace(faceId) || face->nEdges == 0)
+			continue;
+		ChunkFace chunkFace;
+		chunkFace.faceId = faceId;
+		chunkFace.center[0] = chunkFace.center[1] = chunkFace.center[2] = 0.0;
+		chunkFace.mins = VECTOR3D(FLT_MAX, FLT_MAX, FLT_MAX);
+		chunkFace.maxs = VECTOR3D(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (unsigned surfedgeId = face->iFirstEdge; surfedgeId < face->iFirstEdge + face->nEdges; surfedgeId++) {
+			int edgeId = loader.m_SurfEdges[surfedgeId];
+			const BSPEDGE& edge = loader.m_Edges[abs(edgeId)];
+			const VECTOR3D& v = loader.m_Vertices[edgeId < 0 ? edge.iVertex[1] : edge.iVertex[0]];
+			chunkFace.center[0] += v.x;
+			chunkFace.center[1] += v.y;
+			chunkFace.center[2] += v.z;
+			chunkFace.mins = VECTOR3D(min(chunkFace.mins.x, v.x), min(chunkFace.mins.y, v.y), min(chunkFace.mins.z, v.z));
+			chunkFace.maxs = VECTOR3D(max(chunkFace.maxs.x, v.x), max(chunkFace.maxs.y, v.y), max(chunkFace.maxs.z, v.z));
+		}
+		for (unsigned axis = 0; axis < 3; axis++)
+			chunkFace.center[axis] /= face->nEdges;
+		faces.push_back(chunkFace);
+	}
+
+	// Faces go down the tree on the side of every node plane their center is on,
+	// faces lying on a plane on the side they face. BSP faces are split by the
+	// planes above them so whole subtrees end up in a chunk once they fit
+	vector<bool> visited(loader.m_nNodes, false);
+	vector<pair<int, vector<unsigned>>> children;
+	children.push_back(make_pair(world->iHeadnodes[0], vector<unsigned>(faces.size())));
+	for (unsigned i = 0; i < faces.size(); i++)
+		children.back().second[i] = i;
+	vector<vector<unsigned>> chunks;
+	while (!children.empty()) {
+		int child = children.back().first;
+		vector<unsigned> chunkFaces;
+		chunkFaces.swap(children.back().second);
+		children.pop_back();
+		if (chunkFaces.empty())
+			continue;
+
+		if (chunkFaces.size() <= m_options.chunkFaces) {
+			chunks.push_back(vector<unsigned>());
+			chunks.back().swap(chunkFaces);
+			continue;
+		}
+
+		// Leaves too big for a chunk, and nodes of corrupt trees with cycles, are
+		// halved at the median of their face centers along their longest axis
+		if (child < 0 || (unsigned)child >= loader.m_nNodes || visited[child] || loader.m_Nodes[child].iPlane >= loader.m_nPlanes) {
+			double mins[3] = { DBL_MAX, DBL_MAX, DBL_MAX }, maxs[3] = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+			for (unsigned i : chunkFaces) {
+				for (unsigned axis = 0; axis < 3; axis++) {
+					mins[axis] = min(mins[axis], faces[i].center[axis]);
+					maxs[axis] = max(maxs[axis], faces[i].center[axis]);
+				}
+			}
+			unsigned longest = 0;
+			for (unsigned axis = 1; axis < 3; axis++) {
+				if (maxs[axis] - mins[axis] > maxs[longest] - mins[longest])
+					longest = axis;
+			}
+			auto median = chunkFaces.begin() + chunkFaces.size() / 2;
+			nth_element(chunkFaces.begin(), median, chunkFaces.end(), [&](unsigned a, unsigned b) {
+				return faces[a].center[longest] < faces[b].center[longest];
+			});
+			children.push_back(make_pair(-1, vector<unsigned>(median, chunkFaces.end())));
+			children.push_back(make_pair(-1, vector<unsigned>(chunkFaces.begin(), median)));
+			continue;
+		}
+		visited[child] = true;
+
+		const BSPNODE& node = loader.m_Nodes[child];
+		const BSPPLANE& plane = loader.m_Planes[node.iPlane];
+		vector<unsigned> sides[2];
+		for (unsigned i : chunkFaces) {
+			const ChunkFace& chunkFace = faces[i];
+			double distance = plane.vNormal.x * chunkFace.center[0] + plane.vNormal.y * chunkFace.center[1] +
+				plane.vNormal.z * chunkFace.center[2] - plane.fDist;
+			if (fabs(distance) < CHUNK_PLANE_EPSILON) {
+				const BSPFACE* face = &loader.m_Faces[chunkFace.faceId];
+				const VECTOR3D& faceNormal = loader.m_Planes[face->iPlane].vNormal;
+				double facing = plane.vNormal.x * faceNormal.x + plane.vNormal.y * faceNormal.y + plane.vNormal.z * faceNormal.z;
+				distance = face->nPlaneSide ? -facing : facing;
+			}
+			sides[distance >= 0.0 ? 0 : 1].push_back(i);
+		}
+		children.push_back(make_pair((int)node.iChildren[1], vector<unsigned>()));
+		children.back().second.swap(sides[1]);
+		children.push_back(make_pair((int)node.iChildren[0], vector<unsigned>()));
+		children.back().second.swap(sides[0]);
+	}
+
+	// Bounds are in the space of the mesh so a runtime can cull and stream chunks
+	unsigned nChunks = (unsigned)chunks.size();
+	size_t nMaxFaces = 0;
+	nodes[worldspawn].properties.push_back(BSPSceneProperty("bsp_chunks", (int)nChunks));
+	for (unsigned chunk = 0; chunk < nChunks; chunk++) {
+		VECTOR3D mins(FLT_MAX, FLT_MAX, FLT_MAX), maxs(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		vector<unsigned> faceIds;
+		for (unsigned i : chunks[chunk]) {
+			const ChunkFace& chunkFace = faces[i];
+			faceIds.push_back(chunkFace.faceId);
+			mins = VECTOR3D(min(mins.x, chunkFace.mins.x), min(mins.y, chunkFace.mins.y), min(mins.z, chunkFace.mins.z));
+			maxs = VECTOR3D(max(maxs.x, chunkFace.maxs.x), max(maxs.y, chunkFace.maxs.y), max(maxs.z, chunkFace.maxs.z));
+		}
+		nMaxFaces = max(nMaxFaces, faceIds.size());
+
+		nodes.push_back(BSPSceneNode(string("chunk") + to_string(chunk), worldspawn, world));
+		BSPSceneNode& node = nodes.back();
+		node.faces.swap(faceIds);
+		node.properties.push_back(BSPSceneProperty("bsp_chunk", (int)chunk));
+		node.properties.push_back(BSPSceneProperty("bsp_mins", SwitchHandedness(mins)));
+		node.properties.push_back(BSPSceneProperty("bsp_maxs", SwitchHandedness(maxs)));
+	}
+
+	Log("Split worldspawn in %u chunks of up to %zu faces, for a budget of %u\n", nChunks, nMaxFaces, m_options.chunkFaces);
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::BuildLODNodes(vector<BSPSceneNode>& nodes) const
+{
+	// A mesh node keeps its name and custom data as the group, its levels are
+	// children built from the same faces and simplified more and more
+	unsigned nNodes = (unsigned)nodes.size();
+	for (unsigned i = 0; i < nNodes; i++) {
+		if (!nodes[i].model || nodes[i].hull >= 0)
+			continue;
+		const BSPMODEL* model = nodes[i].model;
+		string name = nodes[i].name;
+		vector<unsigned> faces;
+		faces.swap(nodes[i].faces);
+		nodes[i].model = nullptr;
+		for (float error : m_options.lodErrors)
+			nodes[i].lodDistances.push_back(error * LOD_DISTANCE_PER_UNIT);
+
+		for (unsigned lod = 0; lod <= m_options.lodErrors.size(); lod++) {
+			nodes.push_back(BSPSceneNode(name + "_LOD" + to_string(lod), (int)i, model));
+			nodes.back().faces = faces;
+			nodes.back().lod = lod;
+			nodes.back().lodError = lod ? m_options.lodErrors[lod - 1] : 0.0f;
+		}
+	}
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::BuildLeafNodes(vector<BSPSceneNode>& nodes, int worldspawn) const
+{
+	const BSPLoader& loader = *m_bspLoader;
+	const BSPMODEL* world = &loader.m_Models[0];
+	unsigned nLeaves = m_visibility.GetLeafCount();
+
+	// Faces on a leaf boundary are marked by every leaf they touch, they go with the first one
+	vector<bool> assigned(world->nFaces, false);
+	vector<vector<unsigned>> leafFaces(nLeaves + 1);
+	for (unsigned leafId = 1; leafId <= nLeaves; leafId++) {
+		const BSPLEAF& leaf = loader.m_Leaves[leafId];
+		unsigned end = min((unsigned)leaf.iFirstMarkSurface + leaf.nMarkSurfaces, loader.m_nMarkSurfaces);
+		for (unsigned markSurfaceId = leaf.iFirstMarkSurface; markSurfaceId < end; markSurfaceId++) {
+			unsigned faceId = loader.m_MarkSurfaces[markSurfaceId];
+			unsigned index = faceId - world->iFirstFace;
+			if (index >= assigned.size() || assigned[index] || IsSkyFace(&loader.m_Faces[faceId]) || IsHiddenFace(faceId))
+				continue;
+			assigned[index] = true;
+			leafFaces[leafId].push_back(faceId);
+		}
+	}
+
+	// Leaves without visible faces don't get a node, the others are numbered in node order
+	vector<unsigned> clusterLeaves;
+	for (unsigned leafId = 1; leafId <= nLeaves; leafId++) {
+		if (!leafFaces[leafId].empty())
+			clusterLeaves.push_back(leafId);
+	}
+	unsigned nClusters = (unsigned)clusterLeaves.size();
+	nodes[worldspawn].properties.push_back(BSPSceneProperty("bsp_clusters", (int)nClusters));
+
+	// bsp_pvs is a bitset over the leaf nodes, bit i of byte i / 8 for node i,
+	// run-length compressed like the visibility lump (a zero byte is followed
+	// by the number of zero bytes it stands for) and written in hexadecimal
+	// A cluster always sees itself, even if vis was run on a leaf without faces
+	vector<uint8_t> row((nClusters + 7) / 8);
+	vector<uint8_t> compressed;
+	size_t pvsSize = 0;
+	static const char hexDigits[] = "0123456789abcdef";
+	for (unsigned cluster = 0; cluster < nClusters; cluster++) {
+		unsigned leafId = clusterLeaves[cluster];
+		fill(row.begin(), row.end(), 0);
+		for (unsigned other = 0; other < nClusters; other++) {
+			if (other == cluster || m_visibility.IsVisible(leafId, clusterLeaves[other]))
+				row[other >> 3] |= (uint8_t)(1 << (other & 7));
+		}
+		compressed.clear();
+		BSPVisibility::CompressRow(row.data(), row.size(), compressed);
+		pvsSize += compressed.size();
+
+		string pvs;
+		pvs.reserve(compressed.size() * 2);
+		for (uint8_t byte : compressed) {
+			pvs.push_back(hexDigits[byte >> 4]);
+			pvs.push_back(hexDigits[byte & 15]);
+		}
+
+		// Leaf bounds are in the space of the mesh so a runtime can find the camera's leaf
+		const BSPLEAF& leaf = loader.m_Leaves[leafId];
+		VECTOR3D mins = SwitchHandedness(VECTOR3D(leaf.nMins[0], leaf.nMins[1], leaf.nMins[2]));
+		VECTOR3D maxs = SwitchHandedness(VECTOR3D(leaf.nMaxs[0], leaf.nMaxs[1], leaf.nMaxs[2]));
+
+		nodes.push_back(BSPSceneNode(string("leaf") + to_string(leafId), worldspawn, world));
+		BSPSceneNode& node = nodes.back();
+		node.faces.swap(leafFaces[leafId]);
+		node.properties.push_back(BSPSceneProperty("bsp_leaf", (int)leafId));
+		node.properties.push_back(BSPSceneProperty("bsp_cluster", (int)cluster));
+		node.properties.push_back(BSPSceneProperty("bsp_mins", mins));
+		node.properties.push_back(BSPSceneProperty("bsp_maxs", maxs));
+		node.properties.push_back(BSPSceneProperty("bsp_pvs", pvs));
+	}
+
+	// Faces no leaf marks, which a correctly compiled map doesn't have, are always drawn
+	vector<unsigned> unmarkedFaces;
+	for (unsigned index = 0; index < assigned.size(); index++) {
+		unsigned faceId = world->iFirstFace + index;
+		if (!assigned[index] && !IsSkyFace(&loader.m_Faces[faceId]) && !IsHiddenFace(faceId))
+			unmarkedFaces.push_back(faceId);
+	}
+	if (!unmarkedFaces.empty()) {
+		nodes.push_back(BSPSceneNode("leaf_unmarked", worldspawn, world));
+		nodes.back().faces.swap(unmarkedFaces);
+	}
+
+	Log("Split worldspawn in %u leaf clusters out of %u leaves, %zu bytes of visibility\n", nClusters, nLeaves, pvsSize);
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::BuildSceneMaterials(vector<BSPSceneMaterial>& materials) const
+{
+	materials.resize(m_bspLoader->m_nTextures);
+	for (unsigned i = 0; i < materials.size(); i++) {
+		const char* textureName = m_bspLoader->m_Textures[i].szName;
+		materials[i].name = string(textureName, strnlen(textureName, MAXTEXTURENAME));
+		materials[i].transparent = IsTransparentTexture(textureName);
+		if (i < m_textureFiles.size())
+			materials[i].textureFile = m_textureFiles[i];
+	}
+
+	// Collision brushes use a material of their own
+	if (!m_collision.IsEmpty()) {
+		materials.push_back(BSPSceneMaterial());
+		materials.back().name = "collision";
+	}
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::ForEachMesh(const vector<BSPSceneNode>& nodes, const function<void(unsigned, const BSPMeshData&)>& callback)
+{
+	vector<unsigned> meshNodes;
+	for (unsigned i = 0; i < nodes.size(); i++) {
+		if (nodes[i].model)
+			meshNodes.push_back(i);
+	}
+
+	// Only a window of meshes is alive at once : big enough to keep every
+	// worker busy, small enough that memory doesn't grow with the map
+	ThreadPool* pool = GetThreadPool();
+	unsigned windowSize = 2 * pool->GetThreadCount();
+	if (windowSize == 0)
+		windowSize = 1;
+	// The window's buffers are kept by the context so converting map after map
+	// reuses them instead of allocating every stream again
+	vector<BSPMeshData>& meshData = m_meshWindow;
+	if (meshData.size() < windowSize)
+		meshData.resize(windowSize);
+
+	atomic<size_t> nPolygonVertices(0), nControlPoints(0);
+	atomic<size_t> nTriangles(0), nMissesBefore(0), nMissesAfter(0);
+	atomic<size_t> nLODTriangles[MAX_LOD_LEVELS] = {};
+	for (unsigned first = 0; first < meshNodes.size(); first += windowSize) {
+		unsigned count = min(windowSize, (unsigned)meshNodes.size() - first);
+
+		// BuildMeshData clears the meshes of the previous window and reuses their buffers
+		pool->ParallelFor(0, count, 1, [&](unsigned i) {
+			const BSPSceneNode& node = nodes[meshNodes[first + i]];
+			auto start = chrono::steady_clock::now();
+			// Only the full render geometry counts in the totals, collision brushes
+			// aren't drawn and simplified levels are reported on their own
+			bool counted = node.hull < 0 && node.lod == 0;
+			if (node.hull >= 0)
+				BuildCollisionMeshData(m_collision.GetBrushes((unsigned)(node.model - m_bspLoader->m_Models), node.hull)[node.brush], meshData[i]);
+			else
+				BuildMeshData(node.model, meshData[i], &node.faces);
+			if (m_options.weld) {
+				WeldMeshData(meshData[i]);
+				if (counted) {
+					nPolygonVertices += meshData[i].polygonCPs.size();
+					nControlPoints += meshData[i].GetControlPointCount();
+				}
+			}
+			// Simplified levels of detail are always triangles
+			if (m_options.triangulate || node.lod > 0) {
+				TriangulateMeshData(meshData[i]);
+				if (node.lod > 0)
+					SimplifyMeshData(meshData[i], node.lodError);
+				if (counted) {
+					nTriangles += meshData[i].nPolygons;
+					nMissesBefore += CountCacheMisses(meshData[i]);
+				}
+				OptimizeVertexCache(meshData[i]);
+				if (counted)
+					nMissesAfter += CountCacheMisses(meshData[i]);
+			}
+			if (!m_options.lodErrors.empty() && node.hull < 0) {
+				size_t nMeshTriangles = 0;
+				for (unsigned pId = 0; pId < meshData[i].nPolygons; pId++)
+					nMeshTriangles += max(meshData[i].nPolygonCPs[pId], 2u) - 2;
+				nLODTriangles[node.lod] += nMeshTriangles;
+			}
+			if (m_stats) {
+				BSPStatsModel model;
+				model.node = node.name;
+				if (node.hull >= 0)
+					model.faces = meshData[i].nPolygons;
+				else
+					model.faces = node.faces.empty() ? (unsigned)node.model->nFaces : (unsigned)node.faces.size();
+				model.polygons = meshData[i].nPolygons;
+				model.controlPoints = meshData[i].GetControlPointCount();
+				model.polygonVertices = meshData[i].GetPolygonVertexCount();
+				model.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+				m_stats->AddModel(model);
+				m_stats->AddStage("mesh_build", model.seconds);
+				if (counted) {
+					m_stats->AddCounter("polygons", model.polygons);
+					m_stats->AddCounter("control_points", model.controlPoints);
+					m_stats->AddCounter("polygon_vertices", model.polygonVertices);
+				}
+			}
+		});
+
+		for (unsigned i = 0; i < count; i++)
+			callback(meshNodes[first + i], meshData[i]);
+	}
+
+	if (m_options.weld)
+		Log("Welded %zu polygon vertices into %zu control points\n", nPolygonVertices.load(), nControlPoints.load());
+
+	// ACMR : vertices transformed per triangle, before and after reordering the triangles
+	if (m_options.triangulate && nTriangles > 0) {
+		Log("Triangulated into %zu triangles, ACMR %.3f before and %.3f after vertex cache optimization\n",
+			nTriangles.load(), (double)nMissesBefore / nTriangles, (double)nMissesAfter / nTriangles);
+	}
+
+	// Triangles of every level of detail, polygons of the full one counting as fans
+	if (!m_options.lodErrors.empty()) {
+		for (unsigned lod = 0; lod <= m_options.lodErrors.size(); lod++) {
+			size_t count = nLODTriangles[lod].load();
+			Log("LOD%u : %zu triangles, %.1f%% of LOD0\n", lod, count, nLODTriangles[0] ? 100.0 * count / nLODTriangles[0] : 0.0);
+			if (m_stats)
+				m_stats->AddCounter(("lod" + to_string(lod) + "_triangles").c_str(), count);
+		}
+	}
+}
+
+//---------------------------------------------------------------------
+bool BSP2FBX::ExportScene(BSPSceneExporter& exporter, const char* fileName)
+{
+	vector<BSPSceneNode> nodes;
+	BuildSceneNodes(nodes);
+	vector<BSPSceneMaterial> materials;
+	BuildSceneMaterials(materials);
+
+	if (!exporter.BeginScene(fileName, nodes, materials)) {
+		printf("[ERROR] Couldn't create %s\n", fileName);
+		return false;
+	}
+	ForEachMesh(nodes, [&](unsigned nodeId, const BSPMeshData& meshData) {
+		exporter.WriteMesh(nodeId, meshData);
+	});
+	bool result = exporter.EndScene();
+	if (!result)
+		printf("[ERROR] Couldn't write %s\n", fileName);
+	Log("*** Exporting to : %s ***\n", fileName);
+	return result;
+}
+
+//---------------------------------------------------------------------
+bool BSP2FBX::GenerateFBX()
+{
+	string fbxFileName = GetOutputFileName(".fbx");
+
+#ifndef BSP2FBX_NO_FBXSDK
+	if (!m_options.nativeFbx) {
+		vector<BSPSceneNode> nodes;
+		BuildSceneNodes(nodes);
+		vector<BSPSceneMaterial> materials;
+		BuildSceneMaterials(materials);
+		return ExportWithFbxSdk(nodes, materials, fbxFileName.c_str());
+	}
+#endif
+
+	FBXNativeExporter exporter(m_options.compressArrays);
+	return ExportScene(exporter, fbxFileName.c_str());
+}
+
+//---------------------------------------------------------------------
+bool BSP2FBX::GenerateGLTF(bool binary)
+{
+	string gltfFileName = GetOutputFileName(binary ? ".glb" : ".gltf");
+	GLTFExporter exporter(binary);
+	return ExportScene(exporter, gltfFileName.c_str());
+}
+
+// Texture names may contain characters that aren't allowed in file names like '*'
+static string GetTextureFileName(const string& textureName)
+{
+	string fileName = textureName;
+	for (auto& c : fileName) {
+		if ((unsigned char)c < 0x20 || strchr("<>:\"/\\|?*", c))
+			c = '_';
+	}
+	return fileName;
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::GetWADSearchDirectories(vector<string>& directories) const
+{
+	directories = m_options.wadDirectories;
+
+	// Maps usually live in <game>/<mod>/maps with the mod's WADs in <mod>
+	// and the ones of Half-Life in <game>/valve
+	std::filesystem::path mapDirectory = std::filesystem::path(m_bspFileName).parent_path();
+	if (mapDirectory.empty())
+		mapDirectory = ".";
+	directories.push_back(mapDirectory.string());
+	directories.push_back((mapDirectory / "..").string());
+	directories.push_back((mapDirectory / ".." / ".." / "valve").string());
+}
+
+//---------------------------------------------------------------------
+// Outputs restored by a ConversionCache are hard links to its files, writing through them would change the cache
+static void UnlinkCachedOutput(const string& fileName)
+{
+	std::error_code ec;
+	if (std::filesystem::hard_link_count(fileName, ec) > 1)
+		std::filesystem::remove(fileName, ec);
+}
+
+//---------------------------------------------------------------------
+unsigned BSP2FBX::ExportTextures()
+{
+	unsigned nTextures = m_bspLoader->m_nTextures;
+	m_textureFiles.assign(nTextures, string());
+
+	// Every map gets its own directory so batches don't write the same files concurrently
+	string directory = GetOutputFileName("_textures");
+	size_t slash = directory.find_last_of("/\\");
+	string relativeDirectory = (slash == string::npos) ? directory : directory.substr(slash + 1);
+	std::error_code ec;
+	std::filesystem::create_directories(directory, ec);
+	if (ec) {
+		printf("[ERROR] Couldn't create %s\n", directory.c_str());
+		return 0;
+	}
+
+	// WAD files are only looked for when some textures aren't embedded
+	vector<const WADLoader*> wads;
+	for (unsigned i = 0; i < nTextures; i++) {
+		size_t size;
+		if (!m_bspLoader->GetMiptexData(i, size)) {
+			vector<string> searchDirectories;
+			GetWADSearchDirectories(searchDirectories);
+			m_wadCache->FindWADs(m_bspLoader->m_worldspawn.wads, searchDirectories, wads);
+			break;
+		}
+	}
+
+	atomic<unsigned> nWritten(0), nFromWADs(0), nMissing(0);
+	GetThreadPool()->ParallelFor(0, nTextures, 1, [&](unsigned i) {
+		const char* textureName = m_bspLoader->m_Textures[i].szName;
+
+		BSPTextureImage embeddedImage;
+		shared_ptr<const BSPTextureImage> wadImage;
+		const BSPTextureImage* image = &embeddedImage;
+
+		size_t size;
+		const uint8_t* miptex = m_bspLoader->GetMiptexData(i, size);
+		if (miptex) {
+			if (!DecodeMiptex(miptex, size, embeddedImage)) {
+				printf("[WARNING] Texture %.16s is corrupt\n", textureName);
+				return;
+			}
+		}
+		else {
+			// Decoded once for every map of a batch using it
+			wadImage = m_wadCache->GetTexture(textureName, wads);
+			if (!wadImage) {
+				printf("[WARNING] Texture %.16s wasn't found in any WAD file\n", textureName);
+				nMissing++;
+				return;
+			}
+			image = wadImage.get();
+			nFromWADs++;
+		}
+
+		// Only the full size level is saved, image formats have no mip levels
+		string fileName = GetTextureFileName(ToLowerTextureName(textureName)) + GetImageExtension(m_options.textureFormat);
+		string path = directory + "/" + fileName;
+		UnlinkCachedOutput(path);
+		if (!WriteImage(path.c_str(), m_options.textureFormat, image->width, image->height, image->mips[0].data())) {
+			printf("[WARNING] Couldn't write %s\n", path.c_str());
+			return;
+		}
+		m_textureFiles[i] = relativeDirectory + "/" + fileName;
+		nWritten++;
+	});
+
+	Log("Exported %u textures to %s, %u from WAD files, %u missing\n", nWritten.load(), directory.c_str(),
+		nFromWADs.load(), nMissing.load());
+	return nWritten;
+}
+
+//---------------------------------------------------------------------
+unsigned BSP2FBX::ExportLightmaps()
+{
+	if (m_lightmapAtlas.IsEmpty())
+		return 0;
+
+	string directory = GetOutputFileName("_lightmaps");
+	std::error_code ec;
+	std::filesystem::create_directories(directory, ec);
+	if (ec) {
+		printf("[ERROR] Couldn't create %s\n", directory.c_str());
+		return 0;
+	}
+
+	// Pages are named like UDIM tiles : style<N>.<1001 + page>
+	const vector<uint8_t>& styles = m_lightmapAtlas.GetStyles();
+	unsigned nPages = m_lightmapAtlas.GetPageCount();
+	unsigned pageSize = m_lightmapAtlas.GetPageSize();
+	vector<string> pageFiles((unsigned)styles.size() * nPages);
+	GetThreadPool()->ParallelFor(0, (unsigned)pageFiles.size(), 1, [&](unsigned i) {
+		uint8_t style = styles[i / nPages];
+		unsigned page = i % nPages;
+
+		vector<uint32_t> rgba;
+		m_lightmapAtlas.RenderPage(*m_bspLoader, page, style, rgba);
+
+		string path = directory + "/style" + to_string(style) + "." + to_string(1001 + page) + GetImageExtension(m_options.textureFormat);
+		UnlinkCachedOutput(path);
+		if (!WriteImage(path.c_str(), m_options.textureFormat, pageSize, pageSize, rgba.data())) {
+			printf("[WARNING] Couldn't write %s\n", path.c_str());
+			return;
+		}
+		pageFiles[i] = path;
+	});
+
+	m_lightmapFiles.clear();
+	for (auto& pageFile : pageFiles) {
+		if (!pageFile.empty())
+			m_lightmapFiles.push_back(pageFile);
+	}
+	Log("Exported %u lightmap pages of %ux%u to %s, %zu light styles\n", (unsigned)m_lightmapFiles.size(), pageSize, pageSize,
+		directory.c_str(), styles.size());
+	return (unsigned)m_lightmapFiles.size();
+}
+
+//---------------------------------------------------------------------
+bool BSP2FBX::GenerateOutput()
+{
+	// Images are unlinked as they're written, the scene files up front
+	vector<string> outputFiles;
+	GetOutputFiles(outputFiles);
+	for (auto& outputFile : outputFiles)
+		UnlinkCachedOutput(outputFile);
+
+	if (m_options.exportTextures) {
+		BSPScopedTimer timer(m_stats, "export_textures");
+		unsigned nTextures = ExportTextures();
+		if (m_stats)
+			m_stats->AddCounter("textures_written", nTextures);
+	}
+	if (m_options.lightmaps) {
+		BSPScopedTimer timer(m_stats, "export_lightmaps");
+		unsigned nImages = ExportLightmaps();
+		if (m_stats)
+			m_stats->AddCounter("lightmap_images_written", nImages);
+	}
+
+	bool result;
+	{
+		BSPScopedTimer timer(m_stats, "export");
+		switch (m_options.format) {
+		case OUTPUT_GLTF:	result = GenerateGLTF(false); break;
+		case OUTPUT_GLB:	result = GenerateGLTF(true); break;
+		default:			result = GenerateFBX(); break;
+		}
+	}
+
+	if (m_stats) {
+		string statsFileName = GetOutputFileName(".stats.json");
+		if (!m_stats->WriteJSON(statsFileName.c_str(), m_bspFileName.c_str()))
+			printf("[WARNING] Couldn't write %s\n", statsFileName.c_str());
+		else
+			Log("*** Statistics written to : %s ***\n", statsFileName.c_str());
+	}
+	return result;
+}
+
+//---------------------------------------------------------------------
+void BSP2FBX::GetOutputFiles(vector<string>& files) const
+{
+	files.clear();
+	vector<string> candidates;
+	switch (m_options.format) {
+	case OUTPUT_GLTF:
+		candidates.push_back(GetOutputFileName(".gltf"));
+		candidates.push_back(GetOutputFileName(".bin"));
+		break;
+	case OUTPUT_GLB:
+		candidates.push_back(GetOutputFileName(".glb"));
+		break;
+	default:
+		candidates.push_back(GetOutputFileName(".fbx"));
+		break;
+	}
+
+	std::error_code ec;
+	for (auto& candidate : candidates) {
+		if (std::filesystem::is_regular_file(candidate, ec))
+			files.push_back(candidate);
+	}
+
+	// Only the images written for this map, the directories can hold stale ones of earlier runs
+	// Texture files are relative to the output's directory and textures can share one
+	string outputName = GetOutputFileName("");
+	size_t slash = outputName.find_last_of("/\\");
+	string outputDirectory = (slash == string::npos) ? string() : outputName.substr(0, slash + 1);
+	vector<string> textureFiles;
+	for (auto& textureFile : m_textureFiles) {
+		if (!textureFile.empty())
+			textureFiles.push_back(outputDirectory + textureFile);
+	}
+	sort(textureFiles.begin(), textureFiles.end());
+	textureFiles.erase(unique(textureFiles.begin(), textureFiles.end()), textureFiles.end());
+	files.insert(files.end(), textureFiles.begin(), textureFiles.end());
+	files.insert(files.end(), m_lightmapFiles.begin(), m_lightmapFiles.end());
 }
 
 //---------------------------------------------------------------------
 void BSP2FBX::UnloadBSPFile()
 {
 	if (m_bspLoader)
-		delete[] m_bspLoader;
+		delete m_bspLoader;
 	m_bspLoader = nullptr;
+	m_textureFiles.clear();
+	m_lightmapFiles.clear();
+	m_lightmapAtlas.Clear();
+	m_visibility.Clear();
+	m_collision.Clear();
+	m_hiddenFaces.clear();
+
+#ifndef BSP2FBX_NO_FBXSDK
+	if (m_fbxScene)
+		m_fbxScene->Destroy();
+	m_fbxScene = nullptr;
+#endif
+}
+
+//---------------------------------------------------------------------
+static void PrintUsage() {
+	printf("Usage: bsp2fbx [options] file.bsp\n");
+	printf("       bsp2fbx [options] <file.bsp | directory | @responsefile>...\n");
+	printf("Options:\n");
+	printf("  --mmap         Memory-map BSP files instead of reading them through a stream\n");
+	printf("  --threads N    Number of worker threads in batch mode (default: one per core)\n");
+	printf("  --weld         Share control points between faces with the same position, normal and UV\n");
+	printf("  --native-fbx   Stream the FBX file with the built-in writer instead of the FBX SDK\n");
+	printf("  --compress     Deflate geometry arrays of natively written FBX files\n");
+	printf("  --textures FMT Decode textures to a <map>_textures directory as png or tga\n");
+	printf("  --wad-dir DIR  Look for WAD files in DIR before the map's directories, can be repeated\n");
+	printf("  --lightmaps    Bake lightmap atlases to a <map>_lightmaps directory and add a second UV set\n");
+	printf("  --triangulate  Write triangles ordered for the GPU's vertex cache instead of polygons\n");
+	printf("  --compact-normals  Write FBX normals and tangents per polygon from tables of distinct ones\n");
+	printf("  --pvs          Split worldspawn in a node per BSP leaf carrying the leaves it can see\n");
+	printf("  --cull-hidden  Drop worldspawn faces which only border solid leaves\n");
+	printf("  --collision HULLS  Export the convex brushes of the given hulls, like 0 or 0,1,2,3, as collision nodes\n");
+	printf("  --chunks N     Split worldspawn along its BSP nodes in chunk nodes of up to N faces\n");
+	printf("  --lods E1[,E2[,E3]]  Add levels of detail simplified by up to E map units, under a LOD group per mesh\n");
+	printf("  --cache DIR    Reuse the outputs of maps already converted with the same options from DIR\n");
+	printf("  --cache-size MB  Evict the least recently used outputs beyond MB megabytes (default: 4096)\n");
+	printf("  --stats        Write the time, lump bytes and meshes of every stage to a <map>.stats.json file\n");
+	printf("  --gltf         Write a glTF 2.0 .gltf file and its .bin instead of a FBX file\n");
+	printf("  --glb          Write a single binary glTF 2.0 .glb file instead of a FBX file\n");
+	printf("  --verbose      Print per map loading messages in batch mode\n");
+	printf("  --server       Convert the maps requested on stdin with warm workers, answering on stdout\n");
+	printf("  --benchmark-entities N  Time N runs of the entity lump parsers on every input instead of converting\n");
+	printf("  --benchmark N  Time N conversions of generated maps stage by stage, no input needed\n");
+	printf("  --benchmark-map F,W,B,E  Map of F faces, W func_walls, B func_breakables and E point entities\n");
+	printf("                 to benchmark instead of the default ones, can be repeated\n");
+	printf("  --benchmark-json FILE  Write the benchmark results to FILE instead of stdout\n");
 }
 
 //---------------------------------------------------------------------
 int main(int argc, char** argv) {
-	if (argc < 2) {
+	BSP2FBXOptions options;
+	vector<const char*> inputs;
+	bool verbose = false;
+	bool server = false;
+	unsigned benchmarkEntities = 0;
+	unsigned benchmarkIterations = 0;
+	vector<BSPGeneratorSettings> benchmarkMaps;
+	const char* benchmarkJson = nullptr;
+
+	// Options start with "--", anything else is an input
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--mmap")) {
+			options.memoryMapped = true;
+		}
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			options.nThreads = (unsigned)atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--weld")) {
+			options.weld = true;
+		}
+		else if (!strcmp(argv[i], "--native-fbx")) {
+			options.nativeFbx = true;
+		}
+		else if (!strcmp(argv[i], "--compress")) {
+#ifndef BSP2FBX_WITH_ZLIB
+			printf("[WARNING] Built without zlib, --compress is ignored\n");
+#endif
+			options.compressArrays = true;
+		}
+		else if (!strcmp(argv[i], "--textures") && i + 1 < argc) {
+			const char* format = argv[++i];
+			if (strcmp(format, "png") && strcmp(format, "tga")) {
+				printf("ERROR: Unknown texture format %s\n", format);
+				PrintUsage();
+				exit(1);
+			}
+			options.exportTextures = true;
+			options.textureFormat = strcmp(format, "tga") ? IMAGE_PNG : IMAGE_TGA;
+		}
+		else if (!strcmp(argv[i], "--wad-dir") && i + 1 < argc) {
+			options.wadDirectories.push_back(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--lightmaps")) {
+			options.lightmaps = true;
+		}
+		else if (!strcmp(argv[i], "--triangulate")) {
+			options.triangulate = true;
+		}
+		else if (!strcmp(argv[i], "--compact-normals")) {
+			options.compactNormals = true;
+		}
+		else if (!strcmp(argv[i], "--pvs")) {
+			options.pvs = true;
+		}
+		else if (!strcmp(argv[i], "--cull-hidden")) {
+			options.cullHidden = true;
+		}
+		else if (!strcmp(argv[i], "--collision") && i + 1 < argc) {
+			// Comma separated hull numbers
+			const char* hulls = argv[++i];
+			options.collisionHulls = 0;
+			for (const char* c = hulls; *c; c++) {
+				if (*c >= '0' && *c < '0' + MAX_MAP_HULLS && (c[1] == ',' || !c[1])) {
+					options.collisionHulls |= 1 << (*c - '0');
+					if (c[1])
+						c++;
+					continue;
+				}
+				printf("ERROR: Invalid collision hulls %s\n", hulls);
+				PrintUsage();
+				exit(1);
+			}
+		}
+		else if (!strcmp(argv[i], "--chunks") && i + 1 < argc) {
+			options.chunkFaces = (unsigned)atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--lods") && i + 1 < argc) {
+			// Comma separated increasing errors, one per simplified level
+			const char* errors = argv[++i];
+			options.lodErrors.clear();
+			for (const char* c = errors; *c; ) {
+				char* end;
+				float error = strtof(c, &end);
+				if (end == c || (*end && *end != ',') || !(error > 0.0f) || options.lodErrors.size() + 1 >= MAX_LOD_LEVELS ||
+					(!options.lodErrors.empty() && error <= options.lodErrors.back())) {
+					printf("ERROR: Invalid LOD errors %s\n", errors);
+					PrintUsage();
+					exit(1);
+				}
+				options.lodErrors.push_back(error);
+				c = *end ? end + 1 : end;
+			}
+			if (options.lodErrors.empty()) {
+				printf("ERROR: Invalid LOD errors %s\n", errors);
+				PrintUsage();
+				exit(1);
+			}
+		}
+		else if (!strcmp(argv[i], "--cache") && i + 1 < argc) {
+			options.cacheDirectory = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--cache-size") && i + 1 < argc) {
+			options.cacheMaxBytes = strtoull(argv[++i], nullptr, 10) << 20;
+		}
+		else if (!strcmp(argv[i], "--stats")) {
+			options.stats = true;
+		}
+		else if (!strcmp(argv[i], "--gltf")) {
+			options.format = OUTPUT_GLTF;
+		}
+		else if (!strcmp(argv[i], "--glb")) {
+			options.format = OUTPUT_GLB;
+		}
+		else if (!strcmp(argv[i], "--verbose")) {
+			verbose = true;
+		}
+		else if (!strcmp(argv[i], "--server")) {
+			server = true;
+		}
+		else if (!strcmp(argv[i], "--benchmark-entities") && i + 1 < argc) {
+			benchmarkEntities = (unsigned)atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--benchmark") && i + 1 < argc) {
+			benchmarkIterations = (unsigned)atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--benchmark-map") && i + 1 < argc) {
+			BSPGeneratorSettings settings;
+			if (sscanf(argv[++i], "%u,%u,%u,%u", &settings.nFaces, &settings.nFuncWalls,
+				&settings.nFuncBreakables, &settings.nEntities) != 4) {
+				printf("ERROR: Invalid benchmark map %s\n", argv[i]);
+				PrintUsage();
+				exit(1);
+			}
+			benchmarkMaps.push_back(settings);
+		}
+		else if (!strcmp(argv[i], "--benchmark-json") && i + 1 < argc) {
+			benchmarkJson = argv[++i];
+		}
+		else if (!strncmp(argv[i], "--", 2)) {
+			printf("ERROR: Unknown option %s\n", argv[i]);
+			PrintUsage();
+			exit(1);
+		}
+		else {
+			inputs.push_back(argv[i]);
+		}
+	}
+
+	// Leaves are already chunks of worldspawn
+	if (options.pvs && options.chunkFaces) {
+		printf("[WARNING] --chunks is ignored with --pvs, which splits worldspawn by leaf\n");
+		options.chunkFaces = 0;
+	}
+
+	// Maps come from the requests
+	if (server) {
+		FILE* responses = ConversionServer::DetachStdout();
+		if (!responses) {
+			printf("ERROR: Couldn't redirect stdout\n");
+			exit(1);
+		}
+		ConversionServer conversionServer(options);
+		unsigned nFailed = conversionServer.Run(stdin, responses);
+		fclose(responses);
+		return nFailed ? 1 : 0;
+	}
+
+	// Generated maps don't need any input
+	if (benchmarkIterations) {
+		if (benchmarkMaps.empty()) {
+			BSPGeneratorSettings small, medium, large;
+			small.nFaces = 2000;
+			small.nFuncWalls = 20;
+			small.nFuncBreakables = 10;
+			small.nEntities = 200;
+			large.nFaces = 58000;
+			large.nFuncWalls = 400;
+			large.nFuncBreakables = 200;
+			large.nEntities = 20000;
+			benchmarkMaps = { small, medium, large };
+		}
+		return RunSyntheticBenchmark(benchmarkMaps, benchmarkIterations, options, benchmarkJson) ? 0 : 1;
+	}
+
+	if (inputs.empty()) {
 		printf("ERROR: No BSP file was provided as an argument.\n");
+		PrintUsage();
 		exit(1);
 	}
 
-	const char* bspFileName = argv[1];
+	if (benchmarkEntities) {
+		bool result = true;
+		for (auto input : inputs)
+			result = RunEntityParserBenchmark(input, benchmarkEntities) && result;
+		return result ? 0 : 1;
+	}
+
+	// Several maps, a directory or a response file are converted in batch
+	std::error_code ec;
+	bool batch = inputs.size() > 1 || inputs[0][0] == '@' || std::filesystem::is_directory(inputs[0], ec);
+	if (batch) {
+		options.verbose = verbose;
+		BatchConverter batchConverter(options);
+		for (auto input : inputs) {
+			if (!batchConverter.AddInput(input))
+				exit(1);
+		}
+		unsigned nFailed = batchConverter.Run();
+		return nFailed ? 1 : 0;
+	}
+
+	const char* bspFileName = inputs[0];
 	printf("Loading BSP file : %s\n", bspFileName);
 
-	BSP2FBX bsp2fbx;
-	bsp2fbx.LoadBSPFile(bspFileName);
-	bsp2fbx.GenerateFBX();
+	BSP2FBX bsp2fbx(options);
+	if (!options.cacheDirectory.empty()) {
+		ConversionCache cache(options.cacheDirectory, options.cacheMaxBytes, options);
+		bool cached;
+		if (!cache.Convert(bsp2fbx, bspFileName, cached))
+			exit(1);
+		if (cached)
+			printf("Outputs of %s were reused from the cache\n", bspFileName);
+		return 0;
+	}
+	if (!bsp2fbx.LoadBSPFile(bspFileName))
+		exit(1);
+	if (!bsp2fbx.GenerateOutput())
+		exit(1);
 	return 0;
 }
\ No newline at end of file
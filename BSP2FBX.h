@@ -4,41 +4,225 @@
 	The BSP2FBX class uses BSPLoader to read models from a BSP and 
 	generates a corresponding FBX file using the Autodesk's FBX SDK.
 	Each BSPMODEL (defined in BSPDefines.h) is converted to a FbxMesh object.
+	Scenes can also be streamed through a BSPSceneExporter such as the
+	native FBX writer, which is the only one left when building with
+	BSP2FBX_NO_FBXSDK.
 */
 
+#ifndef BSP2FBX_NO_FBXSDK
 #include "fbxsdk.h"
+#endif
 #include "BSPLoader.h"
+#include "BSPScene.h"
+#include "BSPLightmaps.h"
+#include "BSPVisibility.h"
+#include "BSPCollision.h"
+#include "BSPStats.h"
+#include "ImageWriter.h"
+#include <functional>
 #include <string>
 
 using namespace std;
 
+// Bumped whenever the outputs of a map change for the same options, which
+// makes cached conversions stale
+#define BSP2FBX_VERSION "1.1"
+
+// Levels of detail of a mesh, the full one included
+#define MAX_LOD_LEVELS 4
+
+// Output file formats
+enum BSPOutputFormat {
+	OUTPUT_FBX,
+	OUTPUT_GLTF,	// .gltf with its geometry in a .bin file
+	OUTPUT_GLB		// Single binary glTF file
+};
+
+// Conversion settings, mostly set from the command line
+struct BSP2FBXOptions {
+	bool		memoryMapped;	// Map the BSP file instead of reading lumps through a stream
+	bool		verbose;		// Print informational messages while converting
+	unsigned	nThreads;		// Worker threads for batch and mesh building, 0 for one per core
+	bool		weld;			// Merge control points sharing position, normal and UV
+	bool		nativeFbx;		// Stream the FBX file with FBXNativeExporter instead of the FBX SDK
+	bool		compressArrays;	// Deflate geometry arrays of natively written FBX files
+	BSPOutputFormat	format;		// Format written by GenerateOutput
+	bool		exportTextures;	// Decode textures and write them next to the output
+	BSPImageFormat	textureFormat;	// Image format of exported textures
+	vector<string>	wadDirectories;	// Searched for WAD files before the map's own directories
+	bool		lightmaps;		// Bake lightmap atlases and give meshes a second UV set into them
+	bool		triangulate;	// Fan triangulate faces and reorder triangles for the vertex cache
+	bool		compactNormals;	// Write FBX normals and tangents once per distinct polygon normal
+	bool		pvs;			// Split worldspawn by BSP leaf and attach the leaves' visibility
+	bool		cullHidden;		// Drop worldspawn faces no open leaf references
+	unsigned	collisionHulls;	// Bit mask of the hulls exported as collision brushes, 0 for none
+	unsigned	chunkFaces;		// Split worldspawn along its BSP nodes in chunks of up to this many faces, 0 not to
+	vector<float>	lodErrors;	// Errors of the simplified levels of detail, increasing in map units, none without LODs
+	bool		stats;			// Time every stage and write the statistics next to the output
+	string		cacheDirectory;	// Reuse the outputs of maps converted before, no cache when empty
+	uint64_t	cacheMaxBytes;	// Size of the cache's outputs before old ones are evicted
+
+	BSP2FBXOptions() {
+		exportTextures = false;
+		lightmaps = false;
+		triangulate = false;
+		compactNormals = false;
+		pvs = false;
+		cullHidden = false;
+		collisionHulls = 0;
+		chunkFaces = 0;
+		stats = false;
+		cacheMaxBytes = 4ull << 30;
+		textureFormat = IMAGE_PNG;
+		format = OUTPUT_FBX;
+		memoryMapped = false;
+		weld = false;
+		nativeFbx = false;
+		compressArrays = false;
+		verbose = true;
+		nThreads = 0;
+	}
+};
+
+class ThreadPool;
+class WADTextureCache;
+
 class BSP2FBX {
 public:
 	// Constructor
-	BSP2FBX();
+	// WAD textures are decoded into wadCache, a private cache is used if none is given
+	BSP2FBX(const BSP2FBXOptions& options = BSP2FBXOptions(), WADTextureCache* wadCache = nullptr);
 
 	// Destructor
 	~BSP2FBX();
 
 	// Read a BSP file contents using the BSPLoader
-	void LoadBSPFile(const char* bspFile);
+	// Returns false if the file couldn't be read
+	bool LoadBSPFile(const char* bspFile);
+
+	// Build a BSPMODEL's geometry into meshData, reusing its buffers
+	// Only the given faces of the model are built if faces isn't null or empty
+	// Only reads the loaded BSP so models can be built concurrently
+	void BuildMeshData(const BSPMODEL* model, BSPMeshData& meshData, const vector<unsigned>* faces = nullptr) const;
+
+	// Build a collision brush of the loaded map into meshData, a polygon per face
+	void BuildCollisionMeshData(const BSPCollisionBrush& brush, BSPMeshData& meshData) const;
 
-	// Create a FBxMesh using a BSPMODEL's geometry
-	FbxMesh* CreateFbxMesh(BSPMODEL* model);
+	// Deduplicate control points with the same position, normal and UV
+	static void WeldMeshData(BSPMeshData& meshData);
+
+	// Build the exported node hierarchy from the loaded entities
+	void BuildSceneNodes(vector<BSPSceneNode>& nodes) const;
+
+	// Build a material per BSP texture, referencing the images of ExportTextures if it was called
+	void BuildSceneMaterials(vector<BSPSceneMaterial>& materials) const;
+
+	// Build the geometry of every node with a model and hand it to callback in node order
+	// Meshes are built in parallel a few at a time and freed once the callback returns
+	void ForEachMesh(const vector<BSPSceneNode>& nodes, const function<void(unsigned, const BSPMeshData&)>& callback);
+
+	// Stream the scene to fileName through an exporter
+	// Returns false if the export failed
+	bool ExportScene(BSPSceneExporter& exporter, const char* fileName);
+
+#ifndef BSP2FBX_NO_FBXSDK
+	// Create a FBxMesh from a model's geometry
+	FbxMesh* CreateFbxMesh(const BSPMeshData& meshData);
+
+	// Create the material of a texture, with the exported image in its diffuse channel if any
+	FbxSurfaceMaterial* CreateFbxMaterial(const BSPSceneMaterial& material, const string& outputDirectory);
+#endif
 
 	// Dump the FBX (binary) file
-	void GenerateFBX();
+	// Returns false if the export failed
+	bool GenerateFBX();
+
+	// Dump a glTF 2.0 file, a single .glb if binary or a .gltf and a .bin otherwise
+	// Returns false if the export failed
+	bool GenerateGLTF(bool binary);
+
+	// Decode the textures of the map and write them to a <map>_textures directory
+	// Textures which aren't embedded in the BSP are read from the worldspawn's WAD files
+	// Returns the number of textures written
+	unsigned ExportTextures();
+
+	// Write the lightmap atlas pages of every light style to a <map>_lightmaps directory
+	// Returns the number of images written
+	unsigned ExportLightmaps();
+
+	// Dump the file in the format set in the options, with its textures and lightmaps if enabled
+	// Existing outputs hard-linked elsewhere are unlinked first rather than written through
+	bool GenerateOutput();
+
+	// Files GenerateOutput wrote for the loaded map, only the scene files before it runs
+	void GetOutputFiles(vector<string>& files) const;
 
 	// Unload a currently loaded BSP data if any
 	void UnloadBSPFile();
 
 private:
+	// printf only in verbose mode
+	void Log(const char* format, ...) const;
+
+	// Faces using the sky texture aren't part of the visible geometry
+	bool IsSkyFace(const BSPFACE* face) const;
+
+	// Faces found by FindHiddenFaces aren't either
+	bool IsHiddenFace(unsigned faceId) const;
+
+	// Walk worldspawn's BSP tree and flag its faces that no non-solid leaf marks
+	// These only border solid space, which is also where the compiler puts the
+	// outside of a sealed map, so they can never be seen
+	void FindHiddenFaces();
+
+	// Pool used to build meshes, the calling pool in batch mode or our own
+	ThreadPool* GetThreadPool();
+
+	// BSP file name with its extension replaced
+	string GetOutputFileName(const char* extension) const;
+
+	// Directories searched for the worldspawn's WAD files, in order
+	void GetWADSearchDirectories(vector<string>& directories) const;
+
+	// A node per BSP leaf under worldspawn with the faces first marked by that leaf
+	// and the PVS of the leaves, as a run-length compressed bitset over these nodes
+	void BuildLeafNodes(vector<BSPSceneNode>& nodes, int worldspawn) const;
+
+	// A node per spatial chunk under worldspawn, splitting its faces along the
+	// planes of its BSP nodes until chunks fit in the face budget
+	// Levels of detail are built per chunk, collision brushes stay per model
+	void BuildChunkNodes(vector<BSPSceneNode>& nodes, int worldspawn) const;
+
+	// A node per collision brush of every exported model under a collision node
+	void BuildCollisionNodes(vector<BSPSceneNode>& nodes) const;
+
+	// Turn every mesh node into a LOD group with a child per level of detail
+	void BuildLODNodes(vector<BSPSceneNode>& nodes) const;
+
+#ifndef BSP2FBX_NO_FBXSDK
+	// Build the scene with the FBX SDK and export it to fileName
+	bool ExportWithFbxSdk(const vector<BSPSceneNode>& nodes, const vector<BSPSceneMaterial>& materials, const char* fileName);
+#endif
 
-	string		m_bspFileName;
-	BSPLoader*	m_bspLoader;
+	BSP2FBXOptions	m_options;
+	string			m_bspFileName;
+	BSPLoader*		m_bspLoader;
+	ThreadPool*		m_threadPool;		// Created on first use when not running in a pool
+	vector<string>	m_textureFiles;		// Image of every texture relative to the output, empty if not exported
+	vector<string>	m_lightmapFiles;	// Lightmap pages written for the map
+	BSPLightmapAtlas	m_lightmapAtlas;	// Lightmap of every face, empty without lightmaps
+	BSPVisibility	m_visibility;		// PVS of every leaf, empty without pvs
+	BSPCollision	m_collision;		// Brushes of the collision hulls, empty without collisionHulls
+	vector<bool>	m_hiddenFaces;		// Faces nothing can see, empty without cullHidden
+	BSPStats*		m_stats;			// Statistics of the current map, null without stats
+	vector<BSPMeshData>	m_meshWindow;	// Meshes being built by ForEachMesh, buffers reused across maps
+	WADTextureCache*	m_wadCache;		// Decoded WAD textures, shared in batch mode
+	bool			m_ownsWadCache;
 
+#ifndef BSP2FBX_NO_FBXSDK
 	// ---- FBX stuff -----
 	FbxManager*			m_fbxManager;
 	FbxScene*			m_fbxScene;
 	vector<FbxMesh*>	m_fbxMeshes;
+#endif
 };
\ No newline at end of file
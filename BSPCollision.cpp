@@ -0,0 +1,311 @@
+#include "BSPCollision.h"
+#include "BSPLoader.h"
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+
+// Points closer than this to a plane are on it
+#define ON_EPSILON		0.01
+// Half size of the polygon a brush face is cut out of, larger than any map
+#define BASE_WINDING_SIZE	131072.0
+// Deeper trees are corrupt, real ones are a few dozen nodes deep
+#define MAX_TREE_DEPTH	1024
+
+// Polygons are clipped in double precision, the base one being much larger than the map
+struct WindingPoint {
+	double		x, y, z;
+};
+typedef vector<WindingPoint> Winding;
+
+//---------------------------------------------------------------------
+BSPCollision::BSPCollision()
+{
+	m_nBrushes = 0;
+}
+
+//---------------------------------------------------------------------
+void BSPCollision::Clear()
+{
+	m_Brushes.clear();
+	m_nBrushes = 0;
+}
+
+//---------------------------------------------------------------------
+const vector<BSPCollisionBrush>& BSPCollision::GetBrushes(unsigned modelId, unsigned hull) const
+{
+	static const vector<BSPCollisionBrush> none;
+	size_t index = (size_t)modelId * MAX_MAP_HULLS + hull;
+	return hull < MAX_MAP_HULLS && index < m_Brushes.size() ? m_Brushes[index] : none;
+}
+
+//---------------------------------------------------------------------
+VECTOR3D BSPCollision::GetHullExtents(unsigned hull)
+{
+	// Boxes of the engine's hulls, centered on the origin of what moves
+	switch (hull) {
+	case 1:	return VECTOR3D(16, 16, 36);	// Standing player
+	case 2:	return VECTOR3D(32, 32, 32);	// Large monsters
+	case 3:	return VECTOR3D(16, 16, 18);	// Crouching player
+	default: return VECTOR3D(0, 0, 0);		// Points
+	}
+}
+
+//---------------------------------------------------------------------
+void BSPCollision::Build(const BSPLoader& loader, unsigned hullMask, const vector<unsigned>& models, ThreadPool* pool)
+{
+	Clear();
+	m_Brushes.resize((size_t)loader.m_nModels * MAX_MAP_HULLS);
+
+	// Entities sharing a model would build it twice
+	vector<unsigned> uniqueModels;
+	for (unsigned modelId : models) {
+		if (modelId < loader.m_nModels)
+			uniqueModels.push_back(modelId);
+	}
+	sort(uniqueModels.begin(), uniqueModels.end());
+	uniqueModels.erase(unique(uniqueModels.begin(), uniqueModels.end()), uniqueModels.end());
+
+	atomic<size_t> nBrushes(0);
+	atomic<unsigned> nInvalid(0);
+	pool->ParallelFor(0, (unsigned)uniqueModels.size(), 1, [&](unsigned i) {
+		unsigned modelId = uniqueModels[i];
+		const BSPMODEL& model = loader.m_Models[modelId];
+		for (unsigned hull = 0; hull < MAX_MAP_HULLS; hull++) {
+			if (!(hullMask & (1 << hull)))
+				continue;
+
+			TreeWalk walk;
+			walk.loader = &loader;
+			walk.hull = hull;
+			walk.inPath.assign(hull == 0 ? loader.m_nNodes : loader.m_nClipNodes, false);
+			walk.brushes = &m_Brushes[(size_t)modelId * MAX_MAP_HULLS + hull];
+			walk.nInvalid = 0;
+
+			// Solid space reaching out of the model, like the outside of a sealed map,
+			// ends at its bounds : hulls are the bounds swept by the hull's box
+			VECTOR3D extents = GetHullExtents(hull);
+			double mins[3] = { model.nMins[0] - extents.x, model.nMins[1] - extents.y, model.nMins[2] - extents.z };
+			double maxs[3] = { model.nMaxs[0] + extents.x, model.nMaxs[1] + extents.y, model.nMaxs[2] + extents.z };
+			for (unsigned axis = 0; axis < 3; axis++) {
+				HalfSpace halfSpace = {};
+				halfSpace.normal[axis] = 1.0;
+				halfSpace.dist = maxs[axis];
+				walk.bounds.push_back(halfSpace);
+				halfSpace.normal[axis] = -1.0;
+				halfSpace.dist = -mins[axis];
+				walk.bounds.push_back(halfSpace);
+			}
+
+			WalkChild(walk, model.iHeadnodes[hull], 0);
+			nBrushes += walk.brushes->size();
+			nInvalid += walk.nInvalid;
+		}
+	});
+	m_nBrushes = nBrushes;
+
+	if (nInvalid)
+		printf("[WARNING] %u collision tree nodes are out of range or too deep, their brushes are missing\n", nInvalid.load());
+}
+
+//---------------------------------------------------------------------
+void BSPCollision::WalkChild(TreeWalk& walk, int child, unsigned depth)
+{
+	const BSPLoader& loader = *walk.loader;
+	if (depth > MAX_TREE_DEPTH) {
+		walk.nInvalid++;
+		return;
+	}
+
+	// Nodes of hull 0 have leaves below them, clipnodes end with the contents directly
+	if (child >= 0) {
+		uint32_t planeId;
+		int children[2];
+		if (walk.hull == 0) {
+			if ((unsigned)child >= loader.m_nNodes) {
+				walk.nInvalid++;
+				return;
+			}
+			planeId = loader.m_Nodes[child].iPlane;
+			children[0] = loader.m_Nodes[child].iChildren[0];
+			children[1] = loader.m_Nodes[child].iChildren[1];
+		}
+		else {
+			if ((unsigned)child >= loader.m_nClipNodes) {
+				walk.nInvalid++;
+				return;
+			}
+			planeId = (uint32_t)loader.m_ClipNodes[child].iPlane;
+			children[0] = loader.m_ClipNodes[child].iChildren[0];
+			children[1] = loader.m_ClipNodes[child].iChildren[1];
+		}
+		if (planeId >= loader.m_nPlanes || walk.inPath[child]) {
+			walk.nInvalid++;
+			return;
+		}
+
+		// The front child is where normal . x >= dist, the back child the rest
+		const BSPPLANE& plane = loader.m_Planes[planeId];
+		HalfSpace halfSpace;
+		halfSpace.normal[0] = -plane.vNormal.x;
+		halfSpace.normal[1] = -plane.vNormal.y;
+		halfSpace.normal[2] = -plane.vNormal.z;
+		halfSpace.dist = -plane.fDist;
+		walk.inPath[child] = true;
+		walk.path.push_back(halfSpace);
+		WalkChild(walk, children[0], depth + 1);
+		for (unsigned axis = 0; axis < 3; axis++)
+			walk.path.back().normal[axis] = -walk.path.back().normal[axis];
+		walk.path.back().dist = plane.fDist;
+		WalkChild(walk, children[1], depth + 1);
+		walk.path.pop_back();
+		walk.inPath[child] = false;
+		return;
+	}
+
+	int contents = child;
+	if (walk.hull == 0) {
+		unsigned leafId = ~child;
+		if (leafId >= loader.m_nLeaves) {
+			walk.nInvalid++;
+			return;
+		}
+		contents = loader.m_Leaves[leafId].nContents;
+	}
+
+	// Nothing goes through the sky either
+	if (contents != CONTENTS_SOLID && contents != CONTENTS_SKY)
+		return;
+
+	vector<HalfSpace> halfSpaces(walk.path);
+	halfSpaces.insert(halfSpaces.end(), walk.bounds.begin(), walk.bounds.end());
+	BSPCollisionBrush brush;
+	if (BuildBrush(halfSpaces, brush))
+		walk.brushes->push_back(move(brush));
+}
+
+//---------------------------------------------------------------------
+// Keep the part of a winding behind a plane, normal . x <= dist
+static void ClipWinding(Winding& winding, const double normal[3], double dist)
+{
+	size_t count = winding.size();
+	vector<double> dists(count);
+	bool anyFront = false;
+	for (size_t i = 0; i < count; i++) {
+		const WindingPoint& p = winding[i];
+		dists[i] = normal[0] * p.x + normal[1] * p.y + normal[2] * p.z - dist;
+		if (dists[i] > ON_EPSILON)
+			anyFront = true;
+	}
+	if (!anyFront)
+		return;
+
+	Winding clipped;
+	clipped.reserve(count + 1);
+	for (size_t i = 0; i < count; i++) {
+		const WindingPoint& p = winding[i];
+		const WindingPoint& next = winding[(i + 1) % count];
+		double d = dists[i];
+		double nextD = dists[(i + 1) % count];
+		if (d <= ON_EPSILON)
+			clipped.push_back(p);
+
+		// Edges crossing the plane are split where they cross it
+		if ((d < -ON_EPSILON && nextD > ON_EPSILON) || (d > ON_EPSILON && nextD < -ON_EPSILON)) {
+			double t = d / (d - nextD);
+			clipped.push_back({ p.x + (next.x - p.x) * t, p.y + (next.y - p.y) * t, p.z + (next.z - p.z) * t });
+		}
+	}
+	winding.swap(clipped);
+}
+
+//---------------------------------------------------------------------
+bool BSPCollision::BuildBrush(const vector<HalfSpace>& halfSpaces, BSPCollisionBrush& brush)
+{
+	// A plane met twice on the way down, or as one of the bounds, only keeps its tightest side
+	vector<HalfSpace> planes;
+	planes.reserve(halfSpaces.size());
+	for (const HalfSpace& halfSpace : halfSpaces) {
+		bool duplicate = false;
+		for (HalfSpace& plane : planes) {
+			if (fabs(plane.normal[0] - halfSpace.normal[0]) < 1e-6 && fabs(plane.normal[1] - halfSpace.normal[1]) < 1e-6 &&
+				fabs(plane.normal[2] - halfSpace.normal[2]) < 1e-6) {
+				plane.dist = min(plane.dist, halfSpace.dist);
+				duplicate = true;
+				break;
+			}
+		}
+		if (!duplicate)
+			planes.push_back(halfSpace);
+	}
+
+	Winding winding;
+	for (size_t i = 0; i < planes.size(); i++) {
+		const double* normal = planes[i].normal;
+
+		// A square on the plane, clockwise around its normal, larger than the map
+		unsigned axis = 0;
+		for (unsigned j = 1; j < 3; j++) {
+			if (fabs(normal[j]) > fabs(normal[axis]))
+				axis = j;
+		}
+		double up[3] = { 0.0, 0.0, 0.0 };
+		up[axis == 2 ? 0 : 2] = 1.0;
+		double d = up[0] * normal[0] + up[1] * normal[1] + up[2] * normal[2];
+		for (unsigned j = 0; j < 3; j++)
+			up[j] -= normal[j] * d;
+		double length = sqrt(up[0] * up[0] + up[1] * up[1] + up[2] * up[2]);
+		for (unsigned j = 0; j < 3; j++)
+			up[j] *= BASE_WINDING_SIZE / length;
+		double right[3] = {
+			up[1] * normal[2] - up[2] * normal[1],
+			up[2] * normal[0] - up[0] * normal[2],
+			up[0] * normal[1] - up[1] * normal[0]
+		};
+		double origin[3] = { normal[0] * planes[i].dist, normal[1] * planes[i].dist, normal[2] * planes[i].dist };
+		winding.clear();
+		static const double corners[4][2] = { { 1, 1 }, { 1, -1 }, { -1, -1 }, { -1, 1 } };
+		for (auto& corner : corners) {
+			winding.push_back({ origin[0] + right[0] * corner[0] + up[0] * corner[1],
+				origin[1] + right[1] * corner[0] + up[1] * corner[1],
+				origin[2] + right[2] * corner[0] + up[2] * corner[1] });
+		}
+
+		// What's left of it inside every other plane is the face
+		for (size_t j = 0; j < planes.size() && winding.size() >= 3; j++) {
+			if (j != i)
+				ClipWinding(winding, planes[j].normal, planes[j].dist);
+		}
+
+		// Compilers put vertices and axial planes on integers, which clipping barely misses
+		vector<VECTOR3D> face;
+		for (const WindingPoint& point : winding) {
+			double coordinates[3] = { point.x, point.y, point.z };
+			for (double& c : coordinates) {
+				double rounded = floor(c + 0.5);
+				if (fabs(c - rounded) < ON_EPSILON)
+					c = rounded;
+			}
+			VECTOR3D p((float)coordinates[0], (float)coordinates[1], (float)coordinates[2]);
+			if (!face.empty()) {
+				const VECTOR3D& last = face.back();
+				if (fabsf(p.x - last.x) < ON_EPSILON && fabsf(p.y - last.y) < ON_EPSILON && fabsf(p.z - last.z) < ON_EPSILON)
+					continue;
+			}
+			face.push_back(p);
+		}
+		while (face.size() > 1 && fabsf(face[0].x - face.back().x) < ON_EPSILON &&
+			fabsf(face[0].y - face.back().y) < ON_EPSILON && fabsf(face[0].z - face.back().z) < ON_EPSILON)
+			face.pop_back();
+		if (face.size() < 3)
+			continue;
+
+		brush.vertices.insert(brush.vertices.end(), face.begin(), face.end());
+		brush.nFaceVertices.push_back((unsigned)face.size());
+		brush.normals.push_back(VECTOR3D((float)normal[0], (float)normal[1], (float)normal[2]));
+	}
+
+	// A closed convex volume has at least 4 faces
+	return brush.nFaceVertices.size() >= 4;
+}
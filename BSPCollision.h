@@ -0,0 +1,90 @@
+/*
+	This file rebuilds convex collision brushes from the BSP trees a map is
+	clipped against.
+
+	Hull 0 is the tree of the nodes lump, used for points and bullets, and
+	hulls 1 to 3 are the clipnode trees of the standing player, of large
+	monsters and of the crouching player, whose brushes are grown by the size
+	of their box. Every solid or sky leaf of a tree is the convex region
+	bounded by the planes on the path from the root down to it, on the side
+	the path went : a brush face is cut out of each of these planes by
+	clipping a large polygon against all the others. Leaves reaching out of
+	the model are closed by its bounds, grown by the size of the hull.
+
+	Physics engines test a few hundred convex brushes much faster than the
+	triangles of the visible mesh, which is what these are exported for.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "BSPDefines.h"
+
+using namespace std;
+
+class BSPLoader;
+class ThreadPool;
+
+// A convex brush, in BSP space
+// Faces wind clockwise around their outward normal like the faces of the map
+struct BSPCollisionBrush {
+	vector<VECTOR3D>	vertices;		// Vertices of every face, in face order
+	vector<unsigned>	nFaceVertices;	// Number of vertices of every face
+	vector<VECTOR3D>	normals;		// Outward normal of every face
+};
+
+// ======================================================================
+// BSPCollision holds the collision brushes of the hulls of some models
+// ======================================================================
+class BSPCollision
+{
+public:
+	BSPCollision();
+
+	// Rebuild the brushes of the hulls in hullMask, bit h for hull h, of the given models
+	// Models are built concurrently on pool, one task each
+	// Planes, nodes, leaves, clipnodes and models have to be read
+	void Build(const BSPLoader& loader, unsigned hullMask, const vector<unsigned>& models, ThreadPool* pool);
+
+	// Forget the brushes
+	void Clear();
+
+	bool IsEmpty() const { return m_nBrushes == 0; }
+	size_t GetBrushCount() const { return m_nBrushes; }
+
+	// Brushes of a model's hull, empty if they weren't built
+	const vector<BSPCollisionBrush>& GetBrushes(unsigned modelId, unsigned hull) const;
+
+	// Half size of the box a hull moves through the map
+	static VECTOR3D GetHullExtents(unsigned hull);
+
+private:
+	// A half-space, normal . x <= dist
+	struct HalfSpace {
+		double		normal[3];
+		double		dist;
+	};
+
+	// Walks a model's tree, collecting the half-spaces on the way down to every solid leaf
+	struct TreeWalk {
+		const BSPLoader*			loader;
+		unsigned					hull;
+		vector<HalfSpace>			path;		// Half-spaces from the root to the current node
+		vector<bool>				inPath;		// Nodes on the path, so corrupt trees with cycles still end
+		vector<HalfSpace>			bounds;		// The model's box, grown by the hull
+		vector<BSPCollisionBrush>*	brushes;
+		unsigned					nInvalid;	// Nodes and planes out of range
+	};
+
+	// Visit a child of the tree, a node or a leaf
+	static void WalkChild(TreeWalk& walk, int child, unsigned depth);
+
+	// Make a brush out of the half-spaces bounding a solid leaf
+	// Returns false for leaves too thin to enclose anything
+	static bool BuildBrush(const vector<HalfSpace>& halfSpaces, BSPCollisionBrush& brush);
+
+	vector<vector<BSPCollisionBrush>>	m_Brushes;	// Brushes of every model's hull, model * MAX_MAP_HULLS + hull
+	size_t								m_nBrushes;
+};
@@ -7,6 +7,7 @@
 
 #pragma once
 #include <stdint.h>
+#include <stdio.h>
 
 // Header stuff
 #define LUMP_ENTITIES      0
@@ -71,6 +72,13 @@ struct BSPNODE
 	uint16_t	firstFace, nFaces;	// Index and count into Faces
 };
 
+// Clipnode, node of the collision trees of hulls 1 to 3
+struct BSPCLIPNODE
+{
+	int32_t		iPlane;				// Index into Planes lump
+	int16_t		iChildren[2];		// If >= 0, then indices into Clipnodes // otherwise contents of the space behind it
+};
+
 // Vector of 3 floats typical for position, normal etc.
 struct VECTOR3D
 {
@@ -83,6 +91,16 @@ struct VECTOR3D
 
 };
 
+// Vector of 2 floats typical for texture coordinates
+struct VECTOR2D
+{
+	float x, y;
+
+	VECTOR2D(float x0 = 0, float y0 = 0) {
+		x = x0; y = y0;
+	}
+};
+
 #define PLANE_X		0			// Plane is perpendicular to given axis
 #define PLANE_Y		1
 #define PLANE_Z		2
@@ -163,7 +181,7 @@ struct BSPMODEL {
 	int32_t nVisLeafs;                 // ???
 	int32_t iFirstFace, nFaces;        // Index and count into faces
 
-	void printInfo() {
+	void printInfo() const {
 		printf("** BSPMODEL **\n");
 		printf("Bounding box : (%f,%f,%f) -> (%f,%f,%f)\n",
 			nMins[0], nMins[1], nMins[2],
@@ -173,6 +191,14 @@ struct BSPMODEL {
 	}
 };
 
+// Leaf contents
+#define CONTENTS_EMPTY        -1
+#define CONTENTS_SOLID        -2
+#define CONTENTS_WATER        -3
+#define CONTENTS_SLIME        -4
+#define CONTENTS_LAVA         -5
+#define CONTENTS_SKY          -6
+
 struct BSPLEAF
 {
 	int32_t nContents;                         // Contents enumeration
@@ -35,7 +35,7 @@ enum eMaterial {
 struct entity_worldspawn {
 	vector<string>	wads;		// List of WAD files
 	string			skyname;	// Skybox string
-	BSPMODEL*		model;		// Model which stores the world's geometry
+	const BSPMODEL*	model;		// Model which stores the world's geometry
 
 	// Constructor
 	entity_worldspawn() {
@@ -57,7 +57,7 @@ struct entity_worldspawn {
 
 // https://developer.valvesoftware.com/wiki/Func_wall
 struct entity_funcwall {
-	BSPMODEL*		model;
+	const BSPMODEL*	model;
 	Color			rendercolor;
 	uint8_t			renderamt;
 
@@ -73,7 +73,7 @@ struct entity_funcwall {
 
 // https://developer.valvesoftware.com/wiki/Func_breakable
 struct entity_funcbreakable {
-	BSPMODEL*		model;
+	const BSPMODEL*	model;
 	string          gibmodel;
 	unsigned        explodemagnitude;
 	unsigned		health;
@@ -0,0 +1,115 @@
+#include "BSPEntityList.h"
+#include <stdio.h>
+
+// Tokens of the entity lump
+enum EntityToken {
+	TOKEN_END,
+	TOKEN_OPEN,			// {
+	TOKEN_CLOSE,		// }
+	TOKEN_STRING,		// Quoted string or bare word
+	TOKEN_ERROR			// Quoted string without its closing quote
+};
+
+// Reads the next token of text from position, moving it after the token
+static EntityToken NextToken(string_view text, size_t& position, string_view& token)
+{
+	size_t size = text.size();
+	for (;;) {
+		// Whitespace and control characters separate tokens
+		while (position < size && (unsigned char)text[position] <= ' ')
+			position++;
+		if (position >= size)
+			return TOKEN_END;
+
+		// Comments last until the end of the line
+		if (text[position] == '/' && position + 1 < size && text[position + 1] == '/') {
+			size_t newline = text.find('\n', position);
+			position = (newline == string_view::npos) ? size : newline + 1;
+			continue;
+		}
+		break;
+	}
+
+	char c = text[position];
+	if (c == '{' || c == '}') {
+		position++;
+		return c == '{' ? TOKEN_OPEN : TOKEN_CLOSE;
+	}
+
+	// Quoted strings run to the next quote, there's no escaping
+	if (c == '"') {
+		size_t end = text.find('"', position + 1);
+		if (end == string_view::npos)
+			return TOKEN_ERROR;
+		token = text.substr(position + 1, end - position - 1);
+		position = end + 1;
+		return TOKEN_STRING;
+	}
+
+	size_t start = position;
+	while (position < size && (unsigned char)text[position] > ' ' &&
+		text[position] != '{' && text[position] != '}' && text[position] != '"')
+		position++;
+	token = text.substr(start, position - start);
+	return TOKEN_STRING;
+}
+
+//---------------------------------------------------------------------
+void BSPEntityList::Clear()
+{
+	m_Pairs.clear();
+	m_Entities.clear();
+}
+
+//---------------------------------------------------------------------
+bool BSPEntityList::Parse(string_view lump)
+{
+	Clear();
+
+	// The lump ends at its first NUL, lumps are often padded with some
+	size_t nul = lump.find('\0');
+	if (nul != string_view::npos)
+		lump = lump.substr(0, nul);
+
+	// Entities take about 200 bytes and 6 pairs, overestimating saves reallocations
+	m_Entities.reserve(lump.size() / 128 + 1);
+	m_Pairs.reserve(lump.size() / 24 + 1);
+
+	size_t position = 0;
+	string_view key, value;
+	for (;;) {
+		EntityToken token = NextToken(lump, position, key);
+		if (token == TOKEN_END)
+			return true;
+		if (token != TOKEN_OPEN) {
+			printf("[WARNING] Expected '{' at offset %zu of the entity lump\n", position);
+			return false;
+		}
+
+		EntityRange entity = { m_Pairs.size(), 0 };
+		for (;;) {
+			token = NextToken(lump, position, key);
+			if (token == TOKEN_CLOSE)
+				break;
+			if (token != TOKEN_STRING || NextToken(lump, position, value) != TOKEN_STRING) {
+				printf("[WARNING] Entity %zu of the entity lump is malformed\n", m_Entities.size());
+				m_Pairs.resize(entity.firstPair);
+				return false;
+			}
+			m_Pairs.push_back({ key, value });
+		}
+		entity.nPairs = m_Pairs.size() - entity.firstPair;
+		m_Entities.push_back(entity);
+	}
+}
+
+//---------------------------------------------------------------------
+string_view BSPEntityList::GetValue(size_t entityId, string_view key) const
+{
+	const BSPEntityPair* pairs = GetPairs(entityId);
+	for (size_t i = GetPairCount(entityId); i-- > 0; ) {
+		if (pairs[i].key == key)
+			return pairs[i].value;
+	}
+	return string_view();
+}
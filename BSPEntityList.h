@@ -0,0 +1,64 @@
+/*
+	This file defines BSPEntityList which tokenizes the entity lump of a BSP
+	file in a single pass without copying it.
+
+	The lump is a list of entities, each a '{' '}' block of "key" "value"
+	pairs, ending at its first NUL:
+		{
+		"classname" "worldspawn"
+		"wad" "\half-life\valve\halflife.wad;decals.wad"
+		}
+	Tokens are quoted strings, which can hold spaces, braces and newlines but
+	no quote, or bare words ending at whitespace. "//" starts a comment until
+	the end of the line like in the engine's parser.
+
+	Keys and values are views into the lump, which has to outlive the list.
+	The pairs of every entity are stored one after the other in a single
+	array so parsing a map only allocates a couple of times.
+*/
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// A key and its value, views into the entity lump
+struct BSPEntityPair {
+	string_view	key;
+	string_view	value;
+};
+
+// ======================================================================
+// BSPEntityList holds the key/value pairs of every entity of a lump
+// ======================================================================
+class BSPEntityList
+{
+public:
+	// Tokenize a whole entity lump, stopping at its first NUL
+	// Returns false if the lump is malformed, the entities before the error are kept
+	bool Parse(string_view lump);
+
+	// Forget the parsed entities
+	void Clear();
+
+	size_t GetEntityCount() const { return m_Entities.size(); }
+
+	// Pairs of an entity in lump order
+	const BSPEntityPair*	GetPairs(size_t entityId) const		{ return m_Pairs.data() + m_Entities[entityId].firstPair; }
+	size_t					GetPairCount(size_t entityId) const	{ return m_Entities[entityId].nPairs; }
+
+	// Value of a key of an entity, the last one if the key is repeated like the engine does
+	// Returns an empty view if the entity doesn't have the key
+	string_view GetValue(size_t entityId, string_view key) const;
+
+private:
+	struct EntityRange {
+		size_t	firstPair;
+		size_t	nPairs;
+	};
+
+	vector<BSPEntityPair>	m_Pairs;		// Pairs of every entity one after the other
+	vector<EntityRange>		m_Entities;
+};
@@ -0,0 +1,462 @@
+#include "BSPGenerator.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "BSPDefines.h"
+#include "BSPCollision.h"
+
+using namespace std;
+
+#define GENERATOR_CELL_SIZE		64		// Size of the quads of worldspawn's panels
+#define GENERATOR_PANEL_CELLS	126		// Quads along a panel side
+#define GENERATOR_PANEL_SPACING	256		// Height between panels
+#define GENERATOR_TEXTURES		8
+#define GENERATOR_TEXTURE_SIZE	16
+
+// Deterministic on every platform unlike the standard distributions
+struct GeneratorRandom {
+	uint32_t	state;
+
+	GeneratorRandom(uint32_t seed) {
+		state = seed ? seed : 1;
+	}
+
+	// xorshift32
+	uint32_t Next() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	int Range(int min, int max) {
+		return min + (int)(Next() % (uint32_t)(max - min + 1));
+	}
+};
+
+// Lumps of the generated map, in the order of the header
+struct GeneratorLumps {
+	vector<BSPPLANE>		planes;
+	vector<VECTOR3D>		vertices;
+	vector<BSPNODE>			nodes;
+	vector<BSPCLIPNODE>		clipNodes;
+	vector<BSPTEXTUREINFO>	textureInfos;
+	vector<BSPFACE>			faces;
+	vector<BSPLEAF>			leaves;
+	vector<uint16_t>		markSurfaces;
+	vector<BSPEDGE>			edges;
+	vector<BSPSURFEDGE>		surfEdges;
+	vector<BSPMODEL>		models;
+	vector<uint8_t>			textures;
+	vector<uint8_t>			visibility;
+	string					entities;
+};
+
+//---------------------------------------------------------------------
+// Texture infos of a texture projected along X, Y and Z
+static void AddTextureInfos(GeneratorLumps& lumps, uint32_t miptex)
+{
+	const VECTOR3D axes[3][2] = {
+		{ VECTOR3D(0.0f, 1.0f, 0.0f), VECTOR3D(0.0f, 0.0f, -1.0f) },
+		{ VECTOR3D(1.0f, 0.0f, 0.0f), VECTOR3D(0.0f, 0.0f, -1.0f) },
+		{ VECTOR3D(1.0f, 0.0f, 0.0f), VECTOR3D(0.0f, -1.0f, 0.0f) }
+	};
+	for (unsigned axis = 0; axis < 3; axis++) {
+		BSPTEXTUREINFO texInfo;
+		texInfo.vS = axes[axis][0];
+		texInfo.fSShift = 0.0f;
+		texInfo.vT = axes[axis][1];
+		texInfo.fTShift = 0.0f;
+		texInfo.iMiptex = miptex;
+		texInfo.nFlags = 0;
+		lumps.textureInfos.push_back(texInfo);
+	}
+}
+
+//---------------------------------------------------------------------
+// Embedded textures with their 4 mip levels and palette
+static void AddTextures(GeneratorLumps& lumps)
+{
+	const unsigned size = GENERATOR_TEXTURE_SIZE;
+	const size_t pixelsSize = size * size + (size / 2) * (size / 2) + (size / 4) * (size / 4) + (size / 8) * (size / 8);
+	const size_t miptexSize = sizeof(BSPMIPTEX) + pixelsSize + 2 + 256 * 3 + 2;
+
+	BSPTEXTUREHEADER header;
+	header.nMipTextures = GENERATOR_TEXTURES;
+	size_t offset = sizeof(header) + GENERATOR_TEXTURES * sizeof(BSPMIPTEXOFFSET);
+	lumps.textures.resize(offset + GENERATOR_TEXTURES * miptexSize);
+	memcpy(lumps.textures.data(), &header, sizeof(header));
+
+	for (unsigned i = 0; i < GENERATOR_TEXTURES; i++) {
+		BSPMIPTEXOFFSET miptexOffset = (BSPMIPTEXOFFSET)(offset + i * miptexSize);
+		memcpy(&lumps.textures[sizeof(header) + i * sizeof(BSPMIPTEXOFFSET)], &miptexOffset, sizeof(miptexOffset));
+		uint8_t* miptex = &lumps.textures[miptexOffset];
+
+		BSPMIPTEX tex;
+		memset(&tex, 0, sizeof(tex));
+		snprintf(tex.szName, MAXTEXTURENAME, "bench%u", i);
+		tex.nWidth = tex.nHeight = size;
+		uint32_t mipOffset = sizeof(BSPMIPTEX);
+		for (unsigned mip = 0; mip < MIPLEVELS; mip++) {
+			tex.nOffsets[mip] = mipOffset;
+			mipOffset += (size >> mip) * (size >> mip);
+		}
+		memcpy(miptex, &tex, sizeof(tex));
+
+		// Stripes of the palette's first colors, a gradient palette tinted per texture
+		uint8_t* pixels = miptex + sizeof(BSPMIPTEX);
+		for (size_t p = 0; p < pixelsSize; p++)
+			pixels[p] = (uint8_t)((p / 4) % 16);
+		uint8_t* palette = pixels + pixelsSize;
+		palette[0] = 0;
+		palette[1] = 1;
+		palette += 2;
+		for (unsigned c = 0; c < 256; c++) {
+			palette[c * 3 + 0] = (uint8_t)(c * (i + 1) * 16);
+			palette[c * 3 + 1] = (uint8_t)(c * 16);
+			palette[c * 3 + 2] = (uint8_t)(255 - c * 16);
+		}
+	}
+}
+
+//---------------------------------------------------------------------
+static BSPFACE MakeFace(uint16_t plane, uint32_t firstEdge, uint16_t texInfo)
+{
+	BSPFACE face;
+	face.iPlane = plane;
+	face.nPlaneSide = 0;
+	face.iFirstEdge = firstEdge;
+	face.nEdges = 4;
+	face.iTextureInfo = texInfo;
+	memset(face.nStyles, 255, sizeof(face.nStyles));
+	face.nLightmapOffset = 0xFFFFFFFF;
+	return face;
+}
+
+//---------------------------------------------------------------------
+static BSPPLANE MakePlane(unsigned axis, float sign, float dist)
+{
+	BSPPLANE plane;
+	float normal[3] = { 0.0f, 0.0f, 0.0f };
+	normal[axis] = sign;
+	plane.vNormal = VECTOR3D(normal[0], normal[1], normal[2]);
+	plane.fDist = dist * sign;
+	plane.nType = PLANE_X + axis;
+	return plane;
+}
+
+//---------------------------------------------------------------------
+// Worldspawn's panels, row after row while faces are left and vertices fit
+static void AddPanels(GeneratorLumps& lumps, unsigned nFaces, unsigned maxVertices)
+{
+	const unsigned cells = GENERATOR_PANEL_CELLS;
+	const unsigned rowVertices = cells + 1;
+	unsigned nEmitted = 0;
+	for (unsigned panel = 0; nEmitted < nFaces; panel++) {
+		float z = (float)(panel * GENERATOR_PANEL_SPACING);
+		if (lumps.vertices.size() + 2 * rowVertices > maxVertices || lumps.planes.size() >= MAX_MAP_PLANES)
+			return;
+		uint16_t plane = (uint16_t)lumps.planes.size();
+		lumps.planes.push_back(MakePlane(2, 1.0f, z));
+
+		// First row of vertices and its edges
+		unsigned firstVertex = (unsigned)lumps.vertices.size();
+		for (unsigned x = 0; x <= cells; x++)
+			lumps.vertices.push_back(VECTOR3D((float)(x * GENERATOR_CELL_SIZE), 0.0f, z));
+		unsigned previousRowEdges = (unsigned)lumps.edges.size();
+		for (unsigned x = 0; x < cells; x++)
+			lumps.edges.push_back({ { (uint16_t)(firstVertex + x), (uint16_t)(firstVertex + x + 1) } });
+
+		for (unsigned y = 0; y < cells && nEmitted < nFaces; y++) {
+			if (lumps.vertices.size() + rowVertices > maxVertices)
+				return;
+
+			// Next row of vertices, the vertical edges up to it and its horizontal edges
+			unsigned rowStart = (unsigned)lumps.vertices.size();
+			for (unsigned x = 0; x <= cells; x++)
+				lumps.vertices.push_back(VECTOR3D((float)(x * GENERATOR_CELL_SIZE), (float)((y + 1) * GENERATOR_CELL_SIZE), z));
+			unsigned verticalEdges = (unsigned)lumps.edges.size();
+			for (unsigned x = 0; x <= cells; x++)
+				lumps.edges.push_back({ { (uint16_t)(rowStart - rowVertices + x), (uint16_t)(rowStart + x) } });
+			unsigned rowEdges = (unsigned)lumps.edges.size();
+			for (unsigned x = 0; x < cells; x++)
+				lumps.edges.push_back({ { (uint16_t)(rowStart + x), (uint16_t)(rowStart + x + 1) } });
+
+			for (unsigned x = 0; x < cells && nEmitted < nFaces; x++, nEmitted++) {
+				uint32_t firstEdge = (uint32_t)lumps.surfEdges.size();
+				lumps.surfEdges.push_back((BSPSURFEDGE)(previousRowEdges + x));
+				lumps.surfEdges.push_back((BSPSURFEDGE)(verticalEdges + x + 1));
+				lumps.surfEdges.push_back(-(BSPSURFEDGE)(rowEdges + x));
+				lumps.surfEdges.push_back(-(BSPSURFEDGE)(verticalEdges + x));
+				unsigned texture = ((x / 4) + (y / 4)) % GENERATOR_TEXTURES;
+				lumps.faces.push_back(MakeFace(plane, firstEdge, (uint16_t)(texture * 3 + 2)));
+			}
+			previousRowEdges = rowEdges;
+		}
+	}
+}
+
+//---------------------------------------------------------------------
+// An axis aligned box model for a brush entity
+static void AddBox(GeneratorLumps& lumps, GeneratorRandom& random, BSPMODEL& model)
+{
+	float mins[3], maxs[3];
+	for (unsigned axis = 0; axis < 3; axis++) {
+		mins[axis] = (float)(random.Range(-64, 64) * 16);
+		maxs[axis] = mins[axis] + (float)(random.Range(2, 8) * 16);
+	}
+
+	unsigned firstVertex = (unsigned)lumps.vertices.size();
+	for (unsigned corner = 0; corner < 8; corner++) {
+		lumps.vertices.push_back(VECTOR3D(
+			(corner & 1) ? maxs[0] : mins[0],
+			(corner & 2) ? maxs[1] : mins[1],
+			(corner & 4) ? maxs[2] : mins[2]));
+	}
+
+	// Corners of every side, counter-clockwise seen from outside
+	const unsigned sides[6][4] = {
+		{ 0, 4, 6, 2 }, { 1, 3, 7, 5 },		// -X +X
+		{ 0, 1, 5, 4 }, { 2, 6, 7, 3 },		// -Y +Y
+		{ 0, 2, 3, 1 }, { 4, 5, 7, 6 }		// -Z +Z
+	};
+	model.iFirstFace = (int32_t)lumps.faces.size();
+	model.nFaces = 6;
+	for (unsigned side = 0; side < 6; side++) {
+		unsigned axis = side / 2;
+		float sign = (side & 1) ? 1.0f : -1.0f;
+		uint16_t plane = (uint16_t)lumps.planes.size();
+		lumps.planes.push_back(MakePlane(axis, sign, (side & 1) ? maxs[axis] : mins[axis]));
+
+		uint32_t firstEdge = (uint32_t)lumps.surfEdges.size();
+		for (unsigned i = 0; i < 4; i++) {
+			lumps.surfEdges.push_back((BSPSURFEDGE)lumps.edges.size());
+			lumps.edges.push_back({ { (uint16_t)(firstVertex + sides[side][i]), (uint16_t)(firstVertex + sides[side][(i + 1) % 4]) } });
+		}
+		unsigned texture = random.Next() % GENERATOR_TEXTURES;
+		lumps.faces.push_back(MakeFace(plane, firstEdge, (uint16_t)(texture * 3 + axis)));
+	}
+
+	for (unsigned axis = 0; axis < 3; axis++) {
+		model.nMins[axis] = mins[axis];
+		model.nMaxs[axis] = maxs[axis];
+	}
+}
+
+//---------------------------------------------------------------------
+// The trees of a box model for every hull : a chain of nodes on the planes of
+// its bounds, grown by the hull, whose outer sides are empty and whose end is solid
+static void AddBoxHulls(GeneratorLumps& lumps, BSPMODEL& model, int16_t emptyLeaf)
+{
+	for (unsigned hull = 0; hull < MAX_MAP_HULLS; hull++) {
+		VECTOR3D extents = BSPCollision::GetHullExtents(hull);
+		float grow[3] = { extents.x, extents.y, extents.z };
+		model.iHeadnodes[hull] = hull == 0 ? (int32_t)lumps.nodes.size() : (int32_t)lumps.clipNodes.size();
+		for (unsigned side = 0; side < 6; side++) {
+			unsigned axis = side / 2;
+			bool maxSide = (side & 1) != 0;
+			int32_t plane = (int32_t)lumps.planes.size();
+			lumps.planes.push_back(MakePlane(axis, 1.0f, maxSide ? model.nMaxs[axis] + grow[axis] : model.nMins[axis] - grow[axis]));
+
+			// Inside is behind the max planes and in front of the min planes
+			bool last = side == 5;
+			if (hull == 0) {
+				int16_t next = last ? (int16_t)~0 : (int16_t)(lumps.nodes.size() + 1);
+				BSPNODE node;
+				memset(&node, 0, sizeof(node));
+				node.iPlane = (uint32_t)plane;
+				node.iChildren[0] = maxSide ? (int16_t)~emptyLeaf : next;
+				node.iChildren[1] = maxSide ? next : (int16_t)~emptyLeaf;
+				for (unsigned i = 0; i < 3; i++) {
+					node.nMins[i] = (int16_t)model.nMins[i];
+					node.nMaxs[i] = (int16_t)model.nMaxs[i];
+				}
+				lumps.nodes.push_back(node);
+			}
+			else {
+				int16_t next = last ? (int16_t)CONTENTS_SOLID : (int16_t)(lumps.clipNodes.size() + 1);
+				BSPCLIPNODE clipNode;
+				clipNode.iPlane = plane;
+				clipNode.iChildren[0] = maxSide ? (int16_t)CONTENTS_EMPTY : next;
+				clipNode.iChildren[1] = maxSide ? next : (int16_t)CONTENTS_EMPTY;
+				lumps.clipNodes.push_back(clipNode);
+			}
+		}
+	}
+}
+
+//---------------------------------------------------------------------
+static BSPMODEL MakeModel()
+{
+	BSPMODEL model = {};
+	return model;
+}
+
+//---------------------------------------------------------------------
+// Entity lump, one pair per line like the compilers write them
+static void AddEntities(GeneratorLumps& lumps, const BSPGeneratorSettings& settings, GeneratorRandom& random)
+{
+	string& entities = lumps.entities;
+	entities = "{\n\"classname\" \"worldspawn\"\n\"message\" \"bsp2fbx benchmark\"\n\"mapversion\" \"220\"\n\"wad\" \"\"\n}\n";
+
+	unsigned modelId = 1;
+	char line[256];
+	for (unsigned i = 0; i < settings.nFuncWalls; i++, modelId++) {
+		snprintf(line, sizeof(line), "{\n\"model\" \"*%u\"\n\"classname\" \"func_wall\"\n\"rendercolor\" \"0 0 0\"\n\"renderamt\" \"255\"\n}\n", modelId);
+		entities += line;
+	}
+	for (unsigned i = 0; i < settings.nFuncBreakables; i++, modelId++) {
+		snprintf(line, sizeof(line), "{\n\"model\" \"*%u\"\n\"classname\" \"func_breakable\"\n\"targetname\" \"breakable%u\"\n\"health\" \"100\"\n\"material\" \"%u\"\n}\n",
+			modelId, i, i % 9);
+		entities += line;
+	}
+
+	// Quoted values can hold spaces and braces
+	static const char characters[] = "abcdefghijklmnopqrstuvwxyz {}0123456789";
+	string message(settings.messageLength, ' ');
+	for (unsigned i = 0; i < settings.nEntities; i++) {
+		for (auto& c : message)
+			c = characters[random.Next() % (sizeof(characters) - 1)];
+		snprintf(line, sizeof(line), "{\n\"classname\" \"%s\"\n\"origin\" \"%d %d %d\"\n\"targetname\" \"target%u\"\n\"message\" \"",
+			(i & 1) ? "info_target" : "light", random.Range(-4096, 4096), random.Range(-4096, 4096), random.Range(0, 1024), i);
+		entities += line;
+		entities += message;
+		entities += "\"\n}\n";
+	}
+}
+
+//---------------------------------------------------------------------
+// Append a lump to the file data, 4 byte aligned
+template<typename T>
+static void WriteLump(vector<uint8_t>& file, BSPHEADER& header, int lumpId, const T* data, size_t size)
+{
+	while (file.size() % 4)
+		file.push_back(0);
+	header.lump[lumpId].nOffset = (int32_t)file.size();
+	header.lump[lumpId].nLength = (int32_t)size;
+	const uint8_t* bytes = (const uint8_t*)data;
+	file.insert(file.end(), bytes, bytes + size);
+}
+
+template<typename T>
+static void WriteLump(vector<uint8_t>& file, BSPHEADER& header, int lumpId, const vector<T>& data)
+{
+	WriteLump(file, header, lumpId, data.data(), data.size() * sizeof(T));
+}
+
+//---------------------------------------------------------------------
+bool GenerateBSP(const char* fileName, const BSPGeneratorSettings& settings, BSPGeneratorInfo& info)
+{
+	GeneratorRandom random(settings.seed);
+	GeneratorLumps lumps;
+
+	AddTextures(lumps);
+	for (uint32_t miptex = 0; miptex < GENERATOR_TEXTURES; miptex++)
+		AddTextureInfos(lumps, miptex);
+
+	// Brush entities' boxes are kept room for in the 16 bit vertex indices
+	unsigned nBoxes = settings.nFuncWalls + settings.nFuncBreakables;
+	unsigned nBoxVertices = min(nBoxes * 8, (unsigned)MAX_MAP_VERTS);
+	unsigned nFaces = min(settings.nFaces, (unsigned)MAX_MAP_FACES);
+	AddPanels(lumps, nFaces, MAX_MAP_VERTS - nBoxVertices);
+	unsigned nWorldFaces = (unsigned)lumps.faces.size();
+	if (nWorldFaces < settings.nFaces)
+		printf("[WARNING] Only %u of the %u faces fit in the map's limits\n", nWorldFaces, settings.nFaces);
+
+	lumps.models.push_back(MakeModel());
+	BSPMODEL& world = lumps.models.back();
+	world.iFirstFace = 0;
+	world.nFaces = (int32_t)nWorldFaces;
+	world.nVisLeafs = 1;
+	world.nMaxs[0] = world.nMaxs[1] = GENERATOR_CELL_SIZE * GENERATOR_PANEL_CELLS;
+	world.nMaxs[2] = (float)(lumps.planes.size() * GENERATOR_PANEL_SPACING);
+
+	// A single node splits the solid leaf 0 from an empty leaf marking every world face,
+	// and a clipnode does the same for hulls 1 to 3 : both are worldspawn's heads, 0
+	BSPNODE node;
+	memset(&node, 0, sizeof(node));
+	node.iChildren[0] = ~1;
+	node.iChildren[1] = ~0;
+	node.nMaxs[0] = node.nMaxs[1] = node.nMaxs[2] = 32767;
+	node.nMins[0] = node.nMins[1] = node.nMins[2] = -32767;
+	node.nFaces = 0;
+	lumps.nodes.push_back(node);
+	BSPCLIPNODE clipNode;
+	clipNode.iPlane = 0;
+	clipNode.iChildren[0] = CONTENTS_EMPTY;
+	clipNode.iChildren[1] = CONTENTS_SOLID;
+	lumps.clipNodes.push_back(clipNode);
+
+	BSPLEAF leaf;
+	memset(&leaf, 0, sizeof(leaf));
+	leaf.nContents = CONTENTS_SOLID;
+	leaf.nVisOffset = -1;
+	lumps.leaves.push_back(leaf);
+	leaf.nContents = CONTENTS_EMPTY;
+	leaf.nVisOffset = 0;
+	leaf.nMarkSurfaces = (uint16_t)nWorldFaces;
+	lumps.leaves.push_back(leaf);
+	for (unsigned faceId = 0; faceId < nWorldFaces; faceId++)
+		lumps.markSurfaces.push_back((uint16_t)faceId);
+
+	// The outside of the brush entities' boxes, seen by no one
+	int16_t boxEmptyLeaf = (int16_t)lumps.leaves.size();
+	leaf.nVisOffset = -1;
+	leaf.nMarkSurfaces = 0;
+	lumps.leaves.push_back(leaf);
+
+	// A box takes 6 planes for its faces and 6 more for the tree of every hull
+	for (unsigned i = 0; i < nBoxes; i++) {
+		if (lumps.vertices.size() + 8 > MAX_MAP_VERTS || lumps.faces.size() + 6 > MAX_MAP_FACES || lumps.planes.size() + 30 > MAX_MAP_PLANES ||
+			lumps.nodes.size() + 6 > MAX_MAP_NODES || lumps.clipNodes.size() + 18 > MAX_MAP_CLIPNODES) {
+			printf("[WARNING] Only %u of the %u brush entities fit in the map's limits\n", i, nBoxes);
+			break;
+		}
+		BSPMODEL model = MakeModel();
+		AddBox(lumps, random, model);
+		AddBoxHulls(lumps, model, boxEmptyLeaf);
+		lumps.models.push_back(model);
+	}
+	AddEntities(lumps, settings, random);
+
+	// The empty leaf sees itself
+	lumps.visibility.push_back(1);
+
+	vector<uint8_t> file(sizeof(BSPHEADER));
+	BSPHEADER header;
+	memset(&header, 0, sizeof(header));
+	header.nVersion = 30;
+	WriteLump(file, header, LUMP_ENTITIES, lumps.entities.c_str(), lumps.entities.size() + 1);
+	WriteLump(file, header, LUMP_PLANES, lumps.planes);
+	WriteLump(file, header, LUMP_TEXTURES, lumps.textures);
+	WriteLump(file, header, LUMP_VERTICES, lumps.vertices);
+	WriteLump(file, header, LUMP_VISIBILITY, lumps.visibility);
+	WriteLump(file, header, LUMP_NODES, lumps.nodes);
+	WriteLump(file, header, LUMP_TEXINFO, lumps.textureInfos);
+	WriteLump(file, header, LUMP_FACES, lumps.faces);
+	WriteLump(file, header, LUMP_LIGHTING, (const uint8_t*)nullptr, 0);
+	WriteLump(file, header, LUMP_CLIPNODES, lumps.clipNodes);
+	WriteLump(file, header, LUMP_LEAVES, lumps.leaves);
+	WriteLump(file, header, LUMP_MARKSURFACES, lumps.markSurfaces);
+	WriteLump(file, header, LUMP_EDGES, lumps.edges);
+	WriteLump(file, header, LUMP_SURFEDGES, lumps.surfEdges);
+	WriteLump(file, header, LUMP_MODELS, lumps.models);
+	memcpy(file.data(), &header, sizeof(header));
+
+	FILE* output = fopen(fileName, "wb");
+	if (!output)
+		return false;
+	bool written = fwrite(file.data(), 1, file.size(), output) == file.size();
+	written = (fclose(output) == 0) && written;
+
+	info.nFaces = (unsigned)lumps.faces.size();
+	info.nWorldFaces = nWorldFaces;
+	info.nVertices = (unsigned)lumps.vertices.size();
+	info.nModels = (unsigned)lumps.models.size();
+	info.nEntities = 1 + (unsigned)(lumps.models.size() - 1) + settings.nEntities;
+	info.entityLumpSize = lumps.entities.size() + 1;
+	info.fileSize = file.size();
+	return written;
+}
@@ -0,0 +1,52 @@
+/*
+	This file generates synthetic GoldSrc v30 BSP files to benchmark the
+	converter without shipping game assets.
+
+	Worldspawn is made of square panels of 64 unit quads sharing their
+	vertices and edges, stacked 256 units apart, with 8 embedded textures in
+	a checkerboard. Every func_wall and func_breakable gets a box of its own,
+	with a chain of nodes and clipnodes on its bounds for every hull. Point
+	entities with long messages, holding spaces and braces, pad the entity
+	lump. There's a single empty leaf referencing all of worldspawn's faces
+	and no lighting.
+
+	The same settings and seed always give the same file.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Size of a generated map
+struct BSPGeneratorSettings {
+	unsigned	nFaces;				// Worldspawn faces, less if vertex indices would overflow 16 bits
+	unsigned	nFuncWalls;
+	unsigned	nFuncBreakables;
+	unsigned	nEntities;			// Point entities padding the entity lump
+	unsigned	messageLength;		// Characters in the message of every point entity
+	uint32_t	seed;				// Places the boxes and fills the messages
+
+	BSPGeneratorSettings() {
+		nFaces = 20000;
+		nFuncWalls = 100;
+		nFuncBreakables = 50;
+		nEntities = 2000;
+		messageLength = 64;
+		seed = 1;
+	}
+};
+
+// What was actually generated
+struct BSPGeneratorInfo {
+	unsigned	nFaces;				// Faces of every model
+	unsigned	nWorldFaces;
+	unsigned	nVertices;
+	unsigned	nModels;
+	unsigned	nEntities;			// Including worldspawn and brush entities
+	size_t		entityLumpSize;
+	size_t		fileSize;
+};
+
+// Write a synthetic BSP file, returns false if it couldn't be written
+bool GenerateBSP(const char* fileName, const BSPGeneratorSettings& settings, BSPGeneratorInfo& info);
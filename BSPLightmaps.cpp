@@ -0,0 +1,200 @@
+#include "BSPLightmaps.h"
+#include "BSPLoader.h"
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+// Smallest atlas page, maps with few lightmaps don't need more
+#define LIGHTMAP_MIN_PAGE_SIZE 64
+
+//---------------------------------------------------------------------
+BSPLightmapAtlas::BSPLightmapAtlas()
+{
+	m_PageSize = 0;
+	m_nPages = 0;
+}
+
+//---------------------------------------------------------------------
+void BSPLightmapAtlas::Clear()
+{
+	m_Faces.clear();
+	m_Styles.clear();
+	m_Unlit = BSPFaceLightmap();
+	m_PageSize = 0;
+	m_nPages = 0;
+}
+
+//---------------------------------------------------------------------
+void BSPLightmapAtlas::Build(const BSPLoader& loader)
+{
+	Clear();
+	m_Faces.resize(loader.m_nFaces);
+
+	bool styleUsed[256] = { false };
+	unsigned nMissing = 0;
+	for (unsigned faceId = 0; faceId < loader.m_nFaces; faceId++) {
+		const BSPFACE& face = loader.m_Faces[faceId];
+		BSPFaceLightmap& lightmap = m_Faces[faceId];
+
+		unsigned nStyles = 0;
+		while (nStyles < 4 && face.nStyles[nStyles] != LIGHTMAP_NO_STYLE)
+			nStyles++;
+		// Sky and liquids have no lightmap and are drawn fullbright
+		if (nStyles == 0 || face.nLightmapOffset == 0xFFFFFFFF || face.nEdges == 0)
+			continue;
+
+		// Extents of the face in texture space, like the engine computes them
+		const BSPTEXTUREINFO& texInfo = loader.m_TextureInfos[face.iTextureInfo];
+		double mins[2] = { DBL_MAX, DBL_MAX };
+		double maxs[2] = { -DBL_MAX, -DBL_MAX };
+		for (unsigned surfedgeId = face.iFirstEdge; surfedgeId < face.iFirstEdge + face.nEdges; surfedgeId++) {
+			int edgeId = loader.m_SurfEdges[surfedgeId];
+			const BSPEDGE& edge = loader.m_Edges[abs(edgeId)];
+			const VECTOR3D& v = loader.m_Vertices[edgeId < 0 ? edge.iVertex[1] : edge.iVertex[0]];
+			double st[2] = {
+				(double)texInfo.vS.x * v.x + (double)texInfo.vS.y * v.y + (double)texInfo.vS.z * v.z + texInfo.fSShift,
+				(double)texInfo.vT.x * v.x + (double)texInfo.vT.y * v.y + (double)texInfo.vT.z * v.z + texInfo.fTShift
+			};
+			for (unsigned axis = 0; axis < 2; axis++) {
+				mins[axis] = min(mins[axis], st[axis]);
+				maxs[axis] = max(maxs[axis], st[axis]);
+			}
+		}
+
+		int sampleMins[2], sampleMaxs[2];
+		for (unsigned axis = 0; axis < 2; axis++) {
+			sampleMins[axis] = (int)floor(mins[axis] / LIGHTMAP_SAMPLE_SIZE);
+			sampleMaxs[axis] = (int)ceil(maxs[axis] / LIGHTMAP_SAMPLE_SIZE);
+		}
+		unsigned width = (unsigned)(sampleMaxs[0] - sampleMins[0] + 1);
+		unsigned height = (unsigned)(sampleMaxs[1] - sampleMins[1] + 1);
+
+		// Samples past the end of the lump or lightmaps bigger than a page are dropped
+		size_t size = (size_t)width * height * 3 * nStyles;
+		if ((size_t)face.nLightmapOffset + size > loader.m_nLighting ||
+			width + 2 * LIGHTMAP_BORDER > LIGHTMAP_MAX_PAGE_SIZE || height + 2 * LIGHTMAP_BORDER > LIGHTMAP_MAX_PAGE_SIZE) {
+			nMissing++;
+			continue;
+		}
+
+		lightmap.lit = true;
+		lightmap.mins[0] = sampleMins[0];
+		lightmap.mins[1] = sampleMins[1];
+		lightmap.width = width;
+		lightmap.height = height;
+		for (unsigned i = 0; i < nStyles; i++)
+			styleUsed[face.nStyles[i]] = true;
+	}
+	if (nMissing)
+		printf("[WARNING] %u faces have no lightmap in the lighting lump\n", nMissing);
+
+	for (unsigned style = 0; style < LIGHTMAP_NO_STYLE; style++) {
+		if (styleUsed[style])
+			m_Styles.push_back((uint8_t)style);
+	}
+
+	// Tallest first so every shelf is as high as its first lightmap
+	vector<BSPFaceLightmap*> lightmaps;
+	lightmaps.reserve(m_Faces.size() + 1);
+	lightmaps.push_back(&m_Unlit);
+	for (auto& lightmap : m_Faces) {
+		if (lightmap.lit)
+			lightmaps.push_back(&lightmap);
+	}
+	stable_sort(lightmaps.begin(), lightmaps.end(), [](const BSPFaceLightmap* a, const BSPFaceLightmap* b) {
+		return a->height != b->height ? a->height > b->height : a->width > b->width;
+	});
+
+	// Smallest page holding everything, several of the largest ones otherwise
+	m_PageSize = LIGHTMAP_MIN_PAGE_SIZE;
+	while ((m_nPages = Pack(lightmaps, m_PageSize)) > 1 && m_PageSize < LIGHTMAP_MAX_PAGE_SIZE)
+		m_PageSize *= 2;
+}
+
+//---------------------------------------------------------------------
+unsigned BSPLightmapAtlas::Pack(const vector<BSPFaceLightmap*>& lightmaps, unsigned pageSize)
+{
+	unsigned page = 0;
+	unsigned shelfX = 0, shelfY = 0, shelfHeight = 0;
+	for (auto lightmap : lightmaps) {
+		unsigned width = lightmap->width + 2 * LIGHTMAP_BORDER;
+		unsigned height = lightmap->height + 2 * LIGHTMAP_BORDER;
+
+		// Next shelf when the row is full, next page when the shelves are
+		if (shelfX + width > pageSize) {
+			shelfY += shelfHeight;
+			shelfX = shelfHeight = 0;
+		}
+		if (shelfY + height > pageSize) {
+			page++;
+			shelfX = shelfY = shelfHeight = 0;
+		}
+
+		lightmap->page = page;
+		lightmap->x = shelfX + LIGHTMAP_BORDER;
+		lightmap->y = shelfY + LIGHTMAP_BORDER;
+		shelfX += width;
+		shelfHeight = max(shelfHeight, height);
+	}
+	return page + 1;
+}
+
+//---------------------------------------------------------------------
+VECTOR2D BSPLightmapAtlas::GetUV(unsigned faceId, float s, float t) const
+{
+	const BSPFaceLightmap& lightmap = m_Faces[faceId].lit ? m_Faces[faceId] : m_Unlit;
+
+	// Sample i of a lightmap sits at S = (mins + i) * 16, in the middle of its texel
+	float x = lightmap.x + 0.5f;
+	float y = lightmap.y + 0.5f;
+	if (lightmap.lit) {
+		x += s / LIGHTMAP_SAMPLE_SIZE - lightmap.mins[0];
+		y += t / LIGHTMAP_SAMPLE_SIZE - lightmap.mins[1];
+	}
+	float tileU = (float)(lightmap.page % LIGHTMAP_TILES_PER_ROW);
+	float tileV = (float)(lightmap.page / LIGHTMAP_TILES_PER_ROW);
+	return VECTOR2D(tileU + x / m_PageSize, tileV + 1.0f - y / m_PageSize);
+}
+
+//---------------------------------------------------------------------
+void BSPLightmapAtlas::RenderPage(const BSPLoader& loader, unsigned page, uint8_t style, vector<uint32_t>& rgba) const
+{
+	rgba.assign((size_t)m_PageSize * m_PageSize, 0xFF000000);
+
+	// Unlit faces are fullbright in the normal style only
+	if (style == 0 && m_Unlit.page == page) {
+		for (unsigned y = 0; y < 1 + 2 * LIGHTMAP_BORDER; y++) {
+			for (unsigned x = 0; x < 1 + 2 * LIGHTMAP_BORDER; x++)
+				rgba[(size_t)(m_Unlit.y - LIGHTMAP_BORDER + y) * m_PageSize + m_Unlit.x - LIGHTMAP_BORDER + x] = 0xFFFFFFFF;
+		}
+	}
+
+	for (unsigned faceId = 0; faceId < m_Faces.size(); faceId++) {
+		const BSPFaceLightmap& lightmap = m_Faces[faceId];
+		if (!lightmap.lit || lightmap.page != page)
+			continue;
+
+		// Lightmaps of the face's styles follow each other
+		const BSPFACE& face = loader.m_Faces[faceId];
+		unsigned slot = 0;
+		while (slot < 4 && face.nStyles[slot] != style && face.nStyles[slot] != LIGHTMAP_NO_STYLE)
+			slot++;
+		if (slot == 4 || face.nStyles[slot] != style)
+			continue;
+		size_t nSamples = (size_t)lightmap.width * lightmap.height;
+		const uint8_t* samples = loader.m_Lighting + face.nLightmapOffset + slot * nSamples * 3;
+
+		// The border repeats the closest edge sample
+		int border = LIGHTMAP_BORDER;
+		for (int y = -border; y < (int)lightmap.height + border; y++) {
+			int sampleY = min(max(y, 0), (int)lightmap.height - 1);
+			uint32_t* row = &rgba[(size_t)(lightmap.y + y) * m_PageSize + lightmap.x];
+			for (int x = -border; x < (int)lightmap.width + border; x++) {
+				int sampleX = min(max(x, 0), (int)lightmap.width - 1);
+				const uint8_t* rgb = samples + ((size_t)sampleY * lightmap.width + sampleX) * 3;
+				row[x] = rgb[0] | (rgb[1] << 8) | (rgb[2] << 16) | 0xFF000000;
+			}
+		}
+	}
+}
@@ -0,0 +1,89 @@
+/*
+	This file packs the lightmaps of a BSP file's faces into atlas pages.
+
+	Every lit face has a lightmap : a grid of RGB samples, one every 16 units
+	along the S and T axes of its texture projection, covering the face's
+	extents in texture space:
+		mins = floor(min(s) / 16), maxs = ceil(max(s) / 16), size = maxs - mins + 1
+	A face has up to 4 light styles, nStyles ends with 255. The lightmaps of
+	its styles follow each other at nLightmapOffset in the lighting lump.
+
+	Lightmaps are packed in square pages by a shelf packer, each with a border
+	repeating its edge samples so bilinear filtering doesn't bleed between
+	faces. Every light style used by the map has its own set of pages with the
+	same layout, so a single UV set addresses all of them. Pages are laid out
+	like UDIM tiles : page n is tile 1001 + n, 10 tiles per row along U.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "BSPDefines.h"
+
+using namespace std;
+
+class BSPLoader;
+
+#define LIGHTMAP_SAMPLE_SIZE	16		// Units between two lightmap samples
+#define LIGHTMAP_BORDER			1		// Samples repeated around every lightmap
+#define LIGHTMAP_MAX_PAGE_SIZE	2048	// Largest atlas page
+#define LIGHTMAP_NO_STYLE		255		// Marks the end of a face's light styles
+#define LIGHTMAP_TILES_PER_ROW	10		// UDIM tiles along U
+
+// Lightmap of a face and its place in the atlas
+struct BSPFaceLightmap {
+	bool		lit;			// Has samples in the lighting lump, unlit faces use a white sample
+	int			mins[2];		// Sample at the smallest S and T of the face
+	unsigned	width, height;	// Samples along S and T
+	unsigned	page;			// Atlas page
+	unsigned	x, y;			// First sample in the page, after the border
+
+	BSPFaceLightmap() {
+		lit = false;
+		mins[0] = mins[1] = 0;
+		width = height = 1;
+		page = x = y = 0;
+	}
+};
+
+// ======================================================================
+// BSPLightmapAtlas places the lightmap of every face of a BSP file
+// ======================================================================
+class BSPLightmapAtlas
+{
+public:
+	BSPLightmapAtlas();
+
+	// Compute every face's lightmap extents and pack them
+	// The lighting lump has to be read, faces whose samples are missing are unlit
+	void Build(const BSPLoader& loader);
+
+	// Forget the packed lightmaps
+	void Clear();
+
+	bool		IsEmpty() const			{ return m_Faces.empty(); }
+	unsigned	GetPageSize() const		{ return m_PageSize; }
+	unsigned	GetPageCount() const	{ return m_nPages; }
+
+	// Light styles used by the map, in increasing order
+	const vector<uint8_t>& GetStyles() const	{ return m_Styles; }
+
+	// Lightmap UV of a point of a face given its texture space S and T
+	// V goes up like the texture coordinates of BSPMeshData
+	VECTOR2D GetUV(unsigned faceId, float s, float t) const;
+
+	// RGBA samples of a page for a light style, faces without that style are black
+	void RenderPage(const BSPLoader& loader, unsigned page, uint8_t style, vector<uint32_t>& rgba) const;
+
+private:
+	// Shelf pack lightmaps with their border in pages of the given size, tallest first
+	// Returns the number of pages
+	static unsigned Pack(const vector<BSPFaceLightmap*>& lightmaps, unsigned pageSize);
+
+	vector<BSPFaceLightmap>	m_Faces;		// Lightmap of every face
+	BSPFaceLightmap			m_Unlit;		// White sample shared by unlit faces
+	vector<uint8_t>			m_Styles;
+	unsigned				m_PageSize;
+	unsigned				m_nPages;
+};
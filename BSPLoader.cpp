@@ -1,33 +1,93 @@
-#pragma once
-
 #include <fstream>
 #include <cassert>
+#include <cstring>
+#include <cstdarg>
 #include "BSPLoader.h"
 
 // -----------------------------------------------------------------
-BSPLoader::BSPLoader(const char* fileName) {
+BSPLoader::BSPLoader(const char* fileName, bool memoryMapped, bool verbose) {
 
-	// Open BSP file
-	m_FileStream.open(fileName, std::ios::binary);
-	if (!m_FileStream.is_open()) {
-		printf("Unable to load file: %s", fileName);
-		exit(-1);
-	}
+	m_MemoryMapped = memoryMapped;
+	m_Verbose = verbose;
+	m_IsValid = false;
 
-	printf("BSP file: %s opened successfully!\n", fileName);
+	for (int i = 0; i < HEADER_LUMPS; i++)
+		m_LumpCopied[i] = false;
 
-	// Get header version
-	m_FileStream.read((char*)&m_Header, sizeof(BSPHEADER));
-	printf("Version: %d\n", m_Header.nVersion);
+	m_nVertices = m_nPlanes = m_nEdges = m_nSurfEdges = 0;
+	m_nTextures = m_nTextureInfos = m_nFaces = m_nModels = 0;
+	m_nNodes = m_nLeaves = m_nEntityData = 0;
+	m_nMarkSurfaces = m_nVisibility = m_nClipNodes = 0;
 
 	m_Vertices = nullptr;
 	m_Planes = nullptr;
 	m_Edges = nullptr;
 	m_SurfEdges = nullptr;
 	m_TextureOffsets = nullptr;
+	m_Textures = nullptr;
+	m_nTextureData = 0;
+	m_TextureData = nullptr;
+	m_nLighting = 0;
+	m_Lighting = nullptr;
 	m_TextureInfos = nullptr;
 	m_Faces = nullptr;
+	m_Models = nullptr;
 	m_Nodes = nullptr;
+	m_Leaves = nullptr;
+	m_ClipNodes = nullptr;
+	m_MarkSurfaces = nullptr;
+	m_Visibility = nullptr;
+	m_EntityData = nullptr;
+
+	size_t fileSize = 0;
+
+	if (m_MemoryMapped) {
+		// Map the whole BSP file once, lumps are then used in place
+		if (!m_MappedFile.Open(fileName) || m_MappedFile.GetSize() < sizeof(BSPHEADER)) {
+			printf("Unable to map file: %s\n", fileName);
+			return;
+		}
+		fileSize = m_MappedFile.GetSize();
+		memcpy(&m_Header, m_MappedFile.GetData(), sizeof(BSPHEADER));
+	}
+	else {
+		// Open BSP file
+		m_FileStream.open(fileName, std::ios::binary);
+		if (!m_FileStream.is_open()) {
+			printf("Unable to load file: %s\n", fileName);
+			return;
+		}
+		m_FileStream.seekg(0, std::ios::end);
+		fileSize = (size_t)m_FileStream.tellg();
+		m_FileStream.seekg(0, std::ios::beg);
+
+		// Get header version
+		if (fileSize < sizeof(BSPHEADER) || !m_FileStream.read((char*)&m_Header, sizeof(BSPHEADER))) {
+			printf("Unable to read header of file: %s\n", fileName);
+			return;
+		}
+	}
+
+	Log("BSP file: %s opened successfully!\n", fileName);
+	Log("Version: %d\n", m_Header.nVersion);
+
+	// Reject truncated or corrupt lump directories before anything is read
+	if (!ValidateLumps(fileSize)) {
+		printf("Invalid lump directory in file: %s\n", fileName);
+		return;
+	}
+
+	m_IsValid = true;
+}
+
+// -----------------------------------------------------------------
+void BSPLoader::Log(const char* format, ...) {
+	if (!m_Verbose)
+		return;
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
 }
 
 // -----------------------------------------------------------------
@@ -35,107 +95,165 @@ BSPLoader::~BSPLoader() {
 
 	m_FileStream.close();
 
-	if (m_Vertices)
-		delete[] m_Vertices;
+	FreeLump(LUMP_VERTICES, m_Vertices);
+	FreeLump(LUMP_PLANES, m_Planes);
+	FreeLump(LUMP_EDGES, m_Edges);
+	FreeLump(LUMP_SURFEDGES, m_SurfEdges);
+	FreeLump(LUMP_TEXINFO, m_TextureInfos);
+	FreeLump(LUMP_FACES, m_Faces);
+	FreeLump(LUMP_MODELS, m_Models);
+	FreeLump(LUMP_NODES, m_Nodes);
+	FreeLump(LUMP_LEAVES, m_Leaves);
+	FreeLump(LUMP_CLIPNODES, m_ClipNodes);
+	FreeLump(LUMP_MARKSURFACES, m_MarkSurfaces);
+	FreeLump(LUMP_VISIBILITY, m_Visibility);
+	FreeLump(LUMP_ENTITIES, m_EntityData);
+	FreeLump(LUMP_TEXTURES, m_TextureData);
+	FreeLump(LUMP_LIGHTING, m_Lighting);
+
+	// Texture offsets and headers are always copied out of the lump
+	if (m_TextureOffsets)
+		delete[] m_TextureOffsets;
 
-	if (m_Planes)
-		delete[] m_Planes;
+	if (m_Textures)
+		delete[] m_Textures;
 
-	if (m_Edges)
-		delete[] m_Edges;
+	m_MappedFile.Close();
+}
 
-	if (m_SurfEdges)
-		delete[] m_SurfEdges;
+// -----------------------------------------------------------------
+bool BSPLoader::ValidateLumps(size_t fileSize) {
+
+	// Size of a single element of each lump, 1 for byte/variable sized lumps
+	static const size_t elementSizes[HEADER_LUMPS] = {
+		1,							// LUMP_ENTITIES
+		sizeof(BSPPLANE),			// LUMP_PLANES
+		1,							// LUMP_TEXTURES
+		sizeof(VECTOR3D),			// LUMP_VERTICES
+		1,							// LUMP_VISIBILITY
+		sizeof(BSPNODE),			// LUMP_NODES
+		sizeof(BSPTEXTUREINFO),		// LUMP_TEXINFO
+		sizeof(BSPFACE),			// LUMP_FACES
+		1,							// LUMP_LIGHTING
+		8,							// LUMP_CLIPNODES
+		sizeof(BSPLEAF),			// LUMP_LEAVES
+		sizeof(uint16_t),			// LUMP_MARKSURFACES
+		sizeof(BSPEDGE),			// LUMP_EDGES
+		sizeof(BSPSURFEDGE),		// LUMP_SURFEDGES
+		sizeof(BSPMODEL)			// LUMP_MODELS
+	};
+
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		const BSPLUMP& lump = m_Header.lump[i];
+
+		if (lump.nOffset < 0 || lump.nLength < 0 ||
+			(size_t)lump.nOffset + (size_t)lump.nLength > fileSize) {
+			printf("[ERROR] Lump %d (offset %d, length %d) lies outside the file\n", i, lump.nOffset, lump.nLength);
+			return false;
+		}
 
-	if (m_TextureOffsets)
-		delete[] m_TextureOffsets;
+		if (lump.nLength % elementSizes[i] != 0) {
+			printf("[ERROR] Lump %d length %d isn't a multiple of %u\n", i, lump.nLength, (unsigned)elementSizes[i]);
+			return false;
+		}
 
-	if (m_TextureInfos)
-		delete[] m_TextureInfos;
+		// Misaligned lumps still work, they are just copied instead of used in place
+		if (m_MemoryMapped && lump.nLength > 0 && lump.nOffset % 4 != 0 && elementSizes[i] > 1) {
+			printf("[WARNING] Lump %d isn't 4 byte aligned and will be copied\n", i);
+		}
+	}
 
-	if (m_Faces)
-		delete[] m_Faces;
+	return true;
+}
 
-	if (m_Nodes)
-		delete[] m_Nodes;
+// -----------------------------------------------------------------
+bool BSPLoader::IsLumpMapped(int lumpId, size_t alignment) const {
+	if (!m_MemoryMapped)
+		return false;
+	uintptr_t address = (uintptr_t)(m_MappedFile.GetData() + m_Header.lump[lumpId].nOffset);
+	return (address % alignment) == 0;
 }
 
 // -----------------------------------------------------------------
-void BSPLoader::ReadNodes() {
+template<typename T>
+const T* BSPLoader::LoadLump(int lumpId, unsigned& count) {
+
+	// Get data offset and size from its LUMP
+	int32_t dataOffset = m_Header.lump[lumpId].nOffset;
+	int32_t dataSize = m_Header.lump[lumpId].nLength;
 
-	// Get Node data offset and size from its LUMP
-	int32_t nodeDataOffset = m_Header.lump[LUMP_NODES].nOffset;
-	int32_t nodeDataSize = m_Header.lump[LUMP_NODES].nLength;
+	count = dataSize / sizeof(T);
 
-	unsigned nNodes = nodeDataSize / sizeof(BSPNODE);
+	// Use the lump in place when possible
+	if (IsLumpMapped(lumpId, alignof(T))) {
+		m_LumpCopied[lumpId] = false;
+		return GetLump<T>(lumpId).Data();
+	}
 
-	// Allocate memory for Node array
-	m_Nodes = new BSPNODE[nNodes];
+	// Otherwise allocate memory and copy it out
+	T* data = new T[count];
+	ReadBytes(dataOffset, data, count * sizeof(T));
+	m_LumpCopied[lumpId] = true;
+	return data;
+}
+
+// -----------------------------------------------------------------
+template<typename T>
+void BSPLoader::FreeLump(int lumpId, const T*& data) {
+	if (data && m_LumpCopied[lumpId])
+		delete[] data;
+	data = nullptr;
+	m_LumpCopied[lumpId] = false;
+}
+
+// -----------------------------------------------------------------
+void BSPLoader::ReadBytes(int32_t offset, void* dst, size_t size) {
+	if (m_MemoryMapped) {
+		assert((size_t)offset + size <= m_MappedFile.GetSize());
+		memcpy(dst, m_MappedFile.GetData() + offset, size);
+	}
+	else {
+		m_FileStream.seekg(offset, std::ios::beg);
+		m_FileStream.read((char*)dst, size);
+	}
+}
+
+// -----------------------------------------------------------------
+void BSPLoader::ReadNodes() {
 
 	// Read Node array from file
-	m_FileStream.seekg(nodeDataOffset, std::ios::beg);
-	m_FileStream.read((char*)m_Nodes, nodeDataSize);
+	m_Nodes = LoadLump<BSPNODE>(LUMP_NODES, m_nNodes);
+	unsigned nNodes = m_nNodes;
+
+	Log("Number of Nodes : %u\n", nNodes);
 
-	// Print out all the nodes for now doing a simple array traversal
-	// Ideally we should be doing the hiearchial traversal 
+	// Children are node indices when positive, bitwise inverse leaf indices otherwise
+	// Only the bounding boxes are checked, printing every node is too much for real maps
 	for (unsigned i = 0; i < nNodes; i++) {
-		BSPNODE& node = m_Nodes[i];
-
-		// Get Child0 data
-		int32_t child0_index = node.iChildren[0];
-		const char* child0_type = "node";
-		if (child0_index < 0) {
-			child0_type = "leaf";
-			child0_index = ~child0_index;
-		}
-			
-		// Get child1 data
-		int32_t child1_index = node.iChildren[1];
-		const char* child1_type = "node";
-		if (child1_index < 0) {
-			child1_type = "leaf";
-			child1_index = ~child1_index;
-		}
+		const BSPNODE& node = m_Nodes[i];
 
-		float bboxLengthX = node.nMaxs[0] - node.nMins[0];
-		if (bboxLengthX < 0) {
+		if (node.nMaxs[0] < node.nMins[0]) {
 			printf("[WARNING] Xmin: %d, Xmax: %d\n", node.nMins[0], node.nMaxs[0]);
 		}
 
-		float bboxLengthY = node.nMaxs[1] - node.nMins[1];
-		if (bboxLengthY < 0) {
+		if (node.nMaxs[1] < node.nMins[1]) {
 			printf("[WARNING] Ymin: %d, Ymax: %d\n", node.nMins[1], node.nMaxs[1]);
 		}
 
-		float bboxLengthZ = node.nMaxs[2] - node.nMins[2];
-		if (bboxLengthZ < 0) {
+		if (node.nMaxs[2] < node.nMins[2]) {
 			printf("[WARNING] Zmin: %d, Zmax: %d\n", node.nMins[2], node.nMaxs[2]);
 		}
-
-		float bboxVolume = bboxLengthX * bboxLengthY * bboxLengthZ;
-		
-		printf("node: %d\tleft: %s(%d)\t\t\tright: %s(%d)\t\t\tvolume: %f\n", i, child0_type, child0_index, child1_type, child1_index, bboxVolume);
 	}
 }
 
 // -----------------------------------------------------------------
 void BSPLoader::ReadVertices()
 {
-	// Get Vertex data offset and size from its LUMP
-	int32_t vertexDataOffset = m_Header.lump[LUMP_VERTICES].nOffset;
-	int32_t vertexDataSize = m_Header.lump[LUMP_VERTICES].nLength;
-
-	m_nVertices = vertexDataSize / sizeof(VECTOR3D);
-
-	// Allocate vertices memory
-	m_Vertices = new VECTOR3D[m_nVertices];
-
-	// Read Node array from file
-	m_FileStream.seekg(vertexDataOffset, std::ios::beg);
-	m_FileStream.read((char*)m_Vertices, vertexDataSize);
+	// Read Vertex array from file
+	m_Vertices = LoadLump<VECTOR3D>(LUMP_VERTICES, m_nVertices);
 
 	// Print all vertices
-	printf("Number of vertices : %u\n", m_nVertices);
+	Log("Number of vertices : %u\n", m_nVertices);
 	/*for (unsigned i = 0; i < nVertices; i++) {
 		printf("Vertex %u: %f,%f,%f\n", i, m_Vertices[i].x, m_Vertices[i].y, m_Vertices[i].z);
 	}*/
@@ -144,21 +262,11 @@ void BSPLoader::ReadVertices()
 // -----------------------------------------------------------------
 void BSPLoader::ReadPlanes()
 {
-	// Get Vertex data offset and size from its LUMP
-	int32_t planeDataOffset = m_Header.lump[LUMP_PLANES].nOffset;
-	int32_t planeDataSize = m_Header.lump[LUMP_PLANES].nLength;
-
-	m_nPlanes = planeDataSize / sizeof(BSPPLANE);
-
-	// Allocate vertices memory
-	m_Planes = new BSPPLANE[m_nPlanes];
-
-	// Read Node array from file
-	m_FileStream.seekg(planeDataOffset, std::ios::beg);
-	m_FileStream.read((char*)m_Planes, planeDataSize);
+	// Read Plane array from file
+	m_Planes = LoadLump<BSPPLANE>(LUMP_PLANES, m_nPlanes);
 
 	// Print all planes
-	printf("Number of planes : %u\n", m_nPlanes);
+	Log("Number of planes : %u\n", m_nPlanes);
 	/*for (unsigned i = 0; i < nPlanes; i++) {
 		printf("Plane %u: Normal=%f,%f,%f\n", i, m_Planes[i].vNormal.x, m_Planes[i].vNormal.y, m_Planes[i].vNormal.z);
 	}*/
@@ -167,21 +275,11 @@ void BSPLoader::ReadPlanes()
 // -----------------------------------------------------------------
 void BSPLoader::ReadEdges()
 {
-	// Get Vertex data offset and size from its LUMP
-	int32_t edgeDataOffset = m_Header.lump[LUMP_EDGES].nOffset;
-	int32_t edgeDataSize = m_Header.lump[LUMP_EDGES].nLength;
-
-	m_nEdges = edgeDataSize / sizeof(BSPEDGE);
-
-	// Allocate vertices memory
-	m_Edges = new BSPEDGE[m_nEdges];
-
-	// Read Node array from file
-	m_FileStream.seekg(edgeDataOffset, std::ios::beg);
-	m_FileStream.read((char*)m_Edges, edgeDataSize);
+	// Read Edge array from file
+	m_Edges = LoadLump<BSPEDGE>(LUMP_EDGES, m_nEdges);
 
 	// Print all edges
-	printf("Number of edges : %u\n", m_nEdges);
+	Log("Number of edges : %u\n", m_nEdges);
 	/*for (unsigned i = 0; i < nEdges; i++) {
 
 		// Get vertex IDs
@@ -202,21 +300,11 @@ void BSPLoader::ReadEdges()
 // -----------------------------------------------------------------
 void BSPLoader::ReadSurfEdges()
 {
-	// Get Vertex data offset and size from its LUMP
-	int32_t surfEdgeDataOffset = m_Header.lump[LUMP_SURFEDGES].nOffset;
-	int32_t surfEdgeDataSize = m_Header.lump[LUMP_SURFEDGES].nLength;
-
-	m_nSurfEdges = surfEdgeDataSize / sizeof(BSPSURFEDGE);
-
-	// Allocate vertices memory
-	m_SurfEdges = new BSPSURFEDGE[m_nSurfEdges];
-
-	// Read Node array from file
-	m_FileStream.seekg(surfEdgeDataOffset, std::ios::beg);
-	m_FileStream.read((char*)m_SurfEdges, surfEdgeDataSize);
+	// Read SurfEdge array from file
+	m_SurfEdges = LoadLump<BSPSURFEDGE>(LUMP_SURFEDGES, m_nSurfEdges);
 
 	// Print all surfedges
-	printf("Number of surface edges : %u\n", m_nSurfEdges);
+	Log("Number of surface edges : %u\n", m_nSurfEdges);
 }
 
 // -----------------------------------------------------------------
@@ -229,30 +317,48 @@ void BSPLoader::ReadTextures()
 	// First, read the texture header
 	BSPTEXTUREHEADER textureHeader;
 
+	// An empty texture lump has no header at all
+	if (textureDataSize < (int32_t)sizeof(BSPTEXTUREHEADER)) {
+		m_nTextures = 0;
+		Log("Number of textures : %u\n", m_nTextures);
+		return;
+	}
+
 	// texture header only
-	m_FileStream.seekg(textureDataOffset, std::ios::beg);
-	m_FileStream.read((char*)&textureHeader, sizeof(BSPTEXTUREHEADER));
+	ReadBytes(textureDataOffset, &textureHeader, sizeof(BSPTEXTUREHEADER));
 
 	//printf("Number of texture offsets : %u\n", textureHeader.nMipTextures);
 
 	m_nTextures = textureHeader.nMipTextures;
 
+	// The offsets table has to fit in the lump
+	size_t maxTextures = (textureDataSize - sizeof(BSPTEXTUREHEADER)) / sizeof(BSPMIPTEXOFFSET);
+	if (m_nTextures > maxTextures) {
+		printf("[WARNING] Texture lump claims %u textures but only has room for %u\n", m_nTextures, (unsigned)maxTextures);
+		m_nTextures = (unsigned)maxTextures;
+	}
+
 	// Read texture offsets
-	m_TextureOffsets = new BSPMIPTEXOFFSET[m_nTextures];
+	BSPMIPTEXOFFSET* textureOffsets = new BSPMIPTEXOFFSET[m_nTextures];
 	m_Textures = new BSPMIPTEX[m_nTextures];
 
 	// texture header only
-	m_FileStream.read((char*)m_TextureOffsets, sizeof(BSPMIPTEXOFFSET) * m_nTextures);
+	ReadBytes(textureDataOffset + sizeof(BSPTEXTUREHEADER), textureOffsets, sizeof(BSPMIPTEXOFFSET) * m_nTextures);
+	m_TextureOffsets = textureOffsets;
 
 	// Read texture MIPOFFSETS
 	for (unsigned i = 0; i < m_nTextures; i++) {
 		//printf("Texture offset : %u :: %u\n", i, m_TextureOffsets[i]);
-		m_FileStream.seekg(textureDataOffset + m_TextureOffsets[i], std::ios::beg);
-		m_FileStream.read((char*)&m_Textures[i], sizeof(BSPMIPTEX));
+		// Missing textures have an offset of -1, give them an empty header
+		if (m_TextureOffsets[i] < 0 || m_TextureOffsets[i] + sizeof(BSPMIPTEX) > (size_t)textureDataSize) {
+			memset(&m_Textures[i], 0, sizeof(BSPMIPTEX));
+			continue;
+		}
+		ReadBytes(textureDataOffset + m_TextureOffsets[i], &m_Textures[i], sizeof(BSPMIPTEX));
 	}
 
 	// Print textures
-	printf("Number of textures : %u\n", m_nTextures);
+	Log("Number of textures : %u\n", m_nTextures);
 	/*for (unsigned i = 0; i < m_nTextures; i++) {
 		BSPMIPTEX tex = m_Textures[i];
 		printf("Texture %u : Name=%s Size=%ux%u Offsets=%u,%u,%u,%u\n",
@@ -262,183 +368,145 @@ void BSPLoader::ReadTextures()
 }
 
 // -----------------------------------------------------------------
-void BSPLoader::ReadTexInfo()
+void BSPLoader::ReadTextureData()
 {
-	// Get TexInfo offset and size from its LUMP
-	int32_t texInfoDataOffset = m_Header.lump[LUMP_TEXINFO].nOffset;
-	int32_t texInfoDataSize = m_Header.lump[LUMP_TEXINFO].nLength;
-
-	m_nTextureInfos = texInfoDataSize / sizeof(BSPTEXTUREINFO);
+	m_TextureData = LoadLump<uint8_t>(LUMP_TEXTURES, m_nTextureData);
+}
 
-	// Allocate texture infos
-	m_TextureInfos = new BSPTEXTUREINFO[m_nTextureInfos];
+// -----------------------------------------------------------------
+const uint8_t* BSPLoader::GetMiptexData(unsigned textureId, size_t& size) const
+{
+	size = 0;
+	if (!m_TextureData || textureId >= m_nTextures)
+		return nullptr;
+
+	// Headers of textures stored in WAD files have no mip offsets
+	int32_t offset = m_TextureOffsets[textureId];
+	if (offset < 0 || (size_t)offset + sizeof(BSPMIPTEX) > m_nTextureData || m_Textures[textureId].nOffsets[0] == 0)
+		return nullptr;
+
+	// Mip offsets are relative to the miptex which can extend up to the end of the lump
+	size = m_nTextureData - offset;
+	return m_TextureData + offset;
+}
 
-	// Read Node array from file
-	m_FileStream.seekg(texInfoDataOffset, std::ios::beg);
-	m_FileStream.read((char*)m_TextureInfos, texInfoDataSize);
+// -----------------------------------------------------------------
+void BSPLoader::ReadTexInfo()
+{
+	// Read TexInfo array from file
+	m_TextureInfos = LoadLump<BSPTEXTUREINFO>(LUMP_TEXINFO, m_nTextureInfos);
 
-	printf("Number of TexInfos : %u\n", m_nTextureInfos);
+	Log("Number of TexInfos : %u\n", m_nTextureInfos);
 }
 
 // -----------------------------------------------------------------
-void BSPLoader::ReadFaces() {
-	// Get Vertex data offset and size from its LUMP
-	int32_t faceDataOffset = m_Header.lump[LUMP_FACES].nOffset;
-	int32_t faceDataSize = m_Header.lump[LUMP_FACES].nLength;
+void BSPLoader::ReadLighting()
+{
+	m_Lighting = LoadLump<uint8_t>(LUMP_LIGHTING, m_nLighting);
 
-	m_nFaces = faceDataSize / sizeof(BSPFACE);
+	Log("Lighting : %u bytes\n", m_nLighting);
+}
 
-	// Allocate vertices memory
-	m_Faces = new BSPFACE[m_nFaces];
+// -----------------------------------------------------------------
+void BSPLoader::ReadFaces() {
+	// Read Face array from file
+	m_Faces = LoadLump<BSPFACE>(LUMP_FACES, m_nFaces);
 
-	// Read Node array from file
-	m_FileStream.seekg(faceDataOffset, std::ios::beg);
-	m_FileStream.read((char*)m_Faces, faceDataSize);
+	Log("Number of Faces : %u\n", m_nFaces);
+}
 
-	printf("Number of Faces : %u\n", m_nFaces);
+// -----------------------------------------------------------------
+// Model index of a "*N" model string, -1 if it isn't one
+static int ParseModelIndex(string_view modelStr) {
+	if (modelStr.size() < 2 || modelStr[0] != '*')
+		return -1;
+	int modelIdx = 0;
+	for (char c : modelStr.substr(1)) {
+		if (c < '0' || c > '9' || modelIdx > 100000)
+			return -1;
+		modelIdx = modelIdx * 10 + (c - '0');
+	}
+	return modelIdx;
 }
 
 // -----------------------------------------------------------------
-void BSPLoader::ProcessEntity(map<string, string>& attributes) {
+void BSPLoader::ProcessEntity(size_t entityId) {
 	// Entities are defined according to their classnames
-	if (attributes.find("classname") != attributes.end()) {
-		std::string classname = attributes["classname"];
-		//printf("Classname : %s\n", classname.c_str());
-
-		// ------------ worldspawn ------------
-		if (classname == "worldspawn") {
-			m_worldspawn.model = &m_Models[0];
-			//printf("Entity : worldspawn Model=0.\n");
-		}
-		// ------------ func_wall ------------
-		else if (classname == "func_wall") {
-			//printf("Entity : func_wall!\n");
-			entity_funcwall afuncwall;
-			// Get the model string
-			string modelStr = attributes["model"];
-			// model strings are of format : *N where N is the model I
-			int modelIdx = stoi(modelStr.substr(1));
-			afuncwall.model = &m_Models[modelIdx];
-			// Add the func_wall into our list of funcwalls
-			m_funcwalls.push_back(afuncwall);
-			//printf("Entity : func_wall Model=%d.\n", modelIdx);
-
-		}
-		// ------------ func_breakable ------------
-		else if (classname == "func_breakable") {
-			entity_funcbreakable afuncbreakable;
-			// Get the model string
-			std::string modelStr = attributes["model"];
-			// model strings are of format : *N where N is the model I
-			int modelIdx = stoi(modelStr.substr(1));
-			afuncbreakable.model = &m_Models[modelIdx];
-			// Add the func_breakable into our list of funcbreakables
-			m_funcbreakables.push_back(afuncbreakable);
-			//printf("Entity : func_breakable Model=%d.\n", modelIdx);
+	string_view classname = m_EntityList.GetValue(entityId, "classname");
+	if (classname.empty())
+		return;
+	//printf("Classname : %.*s\n", (int)classname.size(), classname.data());
+
+	// ------------ worldspawn ------------
+	if (classname == "worldspawn") {
+		m_worldspawn.model = &m_Models[0];
+		//printf("Entity : worldspawn Model=0.\n");
+
+		// WAD files holding the textures which aren't embedded, separated by ';'
+		m_worldspawn.wads.clear();
+		string_view wadStr = m_EntityList.GetValue(entityId, "wad");
+		size_t start = 0;
+		while (start < wadStr.size()) {
+			size_t end = wadStr.find(';', start);
+			if (end == string_view::npos)
+				end = wadStr.size();
+			if (end > start)
+				m_worldspawn.wads.push_back(string(wadStr.substr(start, end - start)));
+			start = end + 1;
 		}
-		else {
-			//printf("[WARNING] Entity isn't supported (yet)!\n");
+		m_worldspawn.skyname = string(m_EntityList.GetValue(entityId, "skyname"));
+	}
+	// ------------ func_wall ------------
+	else if (classname == "func_wall") {
+		//printf("Entity : func_wall!\n");
+		entity_funcwall afuncwall;
+		// Get the model string
+		string_view modelStr = m_EntityList.GetValue(entityId, "model");
+		// model strings are of format : *N where N is the model I
+		int modelIdx = ParseModelIndex(modelStr);
+		if (modelIdx <= 0 || modelIdx >= (int)m_nModels) {
+			printf("[WARNING] func_wall references invalid model %.*s\n", (int)modelStr.size(), modelStr.data());
+			return;
 		}
+		afuncwall.model = &m_Models[modelIdx];
+		// Add the func_wall into our list of funcwalls
+		m_funcwalls.push_back(afuncwall);
+		//printf("Entity : func_wall Model=%d.\n", modelIdx);
 
 	}
-}
-
-// -----------------------------------------------------------------
-void BSPLoader::ProcessEntityStr(string& entityStr) {
-	//printf("Entity : [%s]\n", entityStr.c_str());
-
-	// Process every line
-	// Add key : value pair to a map
-	// Now based on 'classname' key, process that entity
-
-	size_t size = entityStr.size();
-	// Trim the entityStr between the start and end quotes
-	size_t first_newline = entityStr.find_first_of('\"');
-	size_t last_newline = entityStr.find_last_of('\"');
-	string trimmedStr = entityStr.substr(first_newline, last_newline);
-	
-	map<string, string> entityAttributes;
-
-	// Now iterate through each line of string
-	size_t start = 0;
-	size_t end = 0;
-	size_t lineNum = 0;
-	while (true) {
-		// Find the next newline character
-		end = trimmedStr.find('\n', start);
-		if (end == std::string::npos)
-			break;
-
-		// Get line string
-		std::string line = trimmedStr.substr(start, end - start);
-
-		// There might be a \r before \n so need to trim it as well
-		size_t end_trimmed = line.find_last_of('\"');
-		std::string line_trimmed = line.substr(0, end_trimmed + 1);
-
-		//printf("Line : %u :: [%s]\n", lineNum, line_trimmed.c_str());
-	
-		// A line is always of this format:
-		// "key" "value"
-		size_t spacePos = line_trimmed.find(' ');
-		string key = line_trimmed.substr(1, spacePos - 2);
-		string value = line_trimmed.substr(spacePos + 2, line_trimmed.size() - spacePos - 3);
-
-		//printf("Line : %u :: Key=%s Pair=%s\n", lineNum, key.c_str(), value.c_str());
-		entityAttributes[key] = value;
-
-		start = end + 1;
-		lineNum++;
+	// ------------ func_breakable ------------
+	else if (classname == "func_breakable") {
+		entity_funcbreakable afuncbreakable;
+		// Get the model string
+		string_view modelStr = m_EntityList.GetValue(entityId, "model");
+		// model strings are of format : *N where N is the model I
+		int modelIdx = ParseModelIndex(modelStr);
+		if (modelIdx <= 0 || modelIdx >= (int)m_nModels) {
+			printf("[WARNING] func_breakable references invalid model %.*s\n", (int)modelStr.size(), modelStr.data());
+			return;
+		}
+		afuncbreakable.model = &m_Models[modelIdx];
+		// Add the func_breakable into our list of funcbreakables
+		m_funcbreakables.push_back(afuncbreakable);
+		//printf("Entity : func_breakable Model=%d.\n", modelIdx);
+	}
+	else {
+		//printf("[WARNING] Entity isn't supported (yet)!\n");
 	}
-
-	/*for (auto i : entityAttributes) {
-		printf("Entity attribute: %s :: %s\n", i.first.c_str(), i.second.c_str());
-	}*/
-	ProcessEntity(entityAttributes);
 }
 
 // -----------------------------------------------------------------
 void BSPLoader::ReadEntities()
 {
-	// Get Vertex data offset and size from its LUMP
-	int32_t entityDataOffset = m_Header.lump[LUMP_ENTITIES].nOffset;
-	int32_t entityDataSize = m_Header.lump[LUMP_ENTITIES].nLength;
-
-	// Allocate vertices memory
-	char* entities = new char[entityDataSize];
+	// The lump is used in place when mapped, it's only copied once otherwise
+	m_EntityData = LoadLump<char>(LUMP_ENTITIES, m_nEntityData);
 
-	// Read Node array from file
-	m_FileStream.seekg(entityDataOffset, std::ios::beg);
-	m_FileStream.read(entities, entityDataSize);
+	// Keys and values are views into the lump, there's no per entity string
+	m_EntityList.Parse(string_view(m_EntityData, m_nEntityData));
+	Log("Number of Entities : %zu\n", m_EntityList.GetEntityCount());
 
-	// Print all surfedges
-	//printf("Entities : %s\n", entities);
-
-	// C++ strings are simpler to use
-	std::string entitiesStr(entities);
-	delete[] entities;
-
-	// Extract entities from the string
-
-	// An entity's information is enclosed in between { and } brackets
-	size_t start = 0;
-	size_t end = 0;
-	while (true) {
-		// Find the next '{' between [start, ...]
-		start = entitiesStr.find('{', start);
-		// No more '{' present
-		if (start == std::string::npos)
-			break;
-		// Find the next '}' after start
-		end = entitiesStr.find('}', start + 1);
-		// No more '}' present
-		if (end == std::string::npos)
-			break;
-		// Extract entity's string between start and end
-		std::string entityStr = entitiesStr.substr(start, end - start + 1);
-		ProcessEntityStr(entityStr);
-		start = end + 1;
-	}
+	for (size_t entityId = 0; entityId < m_EntityList.GetEntityCount(); entityId++)
+		ProcessEntity(entityId);
 
 	// Print all processed entities
 	/*m_worldspawn.printInfo();			// worldspawn
@@ -451,43 +519,47 @@ void BSPLoader::ReadEntities()
 // -----------------------------------------------------------------
 void BSPLoader::ReadModels()
 {
-	// Get Vertex data offset and size from its LUMP
-	int32_t modelDataOffset = m_Header.lump[LUMP_MODELS].nOffset;
-	int32_t modelDataSize = m_Header.lump[LUMP_MODELS].nLength;
+	// Read Model array from file
+	m_Models = LoadLump<BSPMODEL>(LUMP_MODELS, m_nModels);
 
-	unsigned nModels = modelDataSize / sizeof(BSPMODEL);
+	// Print all surfedges
+	Log("Number of Models : %u\n", m_nModels);
+}
 
-	// Allocate vertices memory
-	m_Models = new BSPMODEL[nModels];
+// -----------------------------------------------------------------
+void BSPLoader::ReadLeaves() {
 
-	// Read Node array from file
-	m_FileStream.seekg(modelDataOffset, std::ios::beg);
-	m_FileStream.read((char*)m_Models, modelDataSize);
+	// Read Leaf array from file
+	m_Leaves = LoadLump<BSPLEAF>(LUMP_LEAVES, m_nLeaves);
+	unsigned nLeaves = m_nLeaves;
 
 	// Print all surfedges
-	printf("Number of Models : %u\n", nModels);
+	Log("Number of Leaves : %u\n", nLeaves);
+	/*for (unsigned i = 0; i < nLeaves; i++) {
+		printf("Leaf : %u Type: %d nFaces: %u\n", i, m_Leaves[i].nContents, m_Leaves[i].nMarkSurfaces);
+	}*/
 }
 
 // -----------------------------------------------------------------
-void BSPLoader::ReadLeaves() {
+void BSPLoader::ReadMarkSurfaces()
+{
+	m_MarkSurfaces = LoadLump<uint16_t>(LUMP_MARKSURFACES, m_nMarkSurfaces);
 
-	// Get Leaves data offset and size from its LUMP
-	int32_t leavesDataOffset = m_Header.lump[LUMP_LEAVES].nOffset;
-	int32_t leavesDataSize = m_Header.lump[LUMP_MODELS].nLength;
-	
-	unsigned nLeaves = leavesDataSize / sizeof(BSPLEAF);
+	Log("Number of MarkSurfaces : %u\n", m_nMarkSurfaces);
+}
 
-	// Allocate leaves memory
-	m_Leaves = new BSPLEAF[nLeaves];
+// -----------------------------------------------------------------
+void BSPLoader::ReadVisibility()
+{
+	m_Visibility = LoadLump<uint8_t>(LUMP_VISIBILITY, m_nVisibility);
 
-	// Read Node array from file
-	m_FileStream.seekg(leavesDataOffset, std::ios::beg);
-	m_FileStream.read((char*)m_Leaves, leavesDataSize);
+	Log("Visibility : %u bytes\n", m_nVisibility);
+}
 
-	// Print all surfedges
-	printf("Number of Leaves : %u\n", nLeaves);
+// -----------------------------------------------------------------
+void BSPLoader::ReadClipNodes()
+{
+	m_ClipNodes = LoadLump<BSPCLIPNODE>(LUMP_CLIPNODES, m_nClipNodes);
 
-	for (unsigned i = 0; i < nLeaves; i++) {
-		printf("Leaf : %u Type: %d nFaces: %u\n", i, m_Leaves[i].nContents, m_Leaves[i].nMarkSurfaces);
-	}
+	Log("Number of ClipNodes : %u\n", m_nClipNodes);
 }
@@ -13,6 +13,8 @@
 #include <map>
 #include "BSPDefines.h"
 #include "BSPEntities.h"
+#include "BSPEntityList.h"
+#include "BSPMappedFile.h"
 
 using namespace std;
 
@@ -23,13 +25,19 @@ class BSPLoader
 {
 public:
 	// Constructor
-	BSPLoader(const char* bspFileName);
+	// When memoryMapped is set the file is mapped once and lumps are used
+	// in place instead of being copied out through a file stream
+	// Informational messages are only printed when verbose is set
+	BSPLoader(const char* bspFileName, bool memoryMapped = false, bool verbose = true);
 	
 	// Destructor
 	~BSPLoader();
 
 	// --------- Class interface ---------;
 
+	// Whether the file could be opened and has a sane lump directory
+	bool IsValid() const { return m_IsValid; }
+
 	// Reads the BSP node hierarchy and returns pointer to array in root
 	void ReadNodes();
 
@@ -50,21 +58,30 @@ public:
 	// Read textures
 	void ReadTextures();
 
+	// Read the whole texture lump so embedded pixels can be decoded
+	void ReadTextureData();
+
+	// Raw miptex of a texture embedded in the BSP, header, mip levels and palette
+	// Returns nullptr if the texture isn't embedded, size is then 0
+	// Only reads data loaded by ReadTextureData so it can be called concurrently
+	const uint8_t* GetMiptexData(unsigned textureId, size_t& size) const;
+
 	// Read TexInfo lump
 	// TexInfo -> texture
 	void ReadTexInfo();
 
+	// Read the lightmap samples of every face
+	void ReadLighting();
+
 	// Read Faces
 	// Face -> Plane, TexInfo, Edges
 	void ReadFaces();
 	
-	// Create entity objects from their attribute mappings
-	void ProcessEntity(map<string, string>& attributes);
-
-	// Extract an entity attributes from its raw string
-	void ProcessEntityStr(string& entityStr);
+	// Create the entity object of a parsed entity from its key/value pairs
+	void ProcessEntity(size_t entityId);
 
 	// Read entities from BSP
+	// The lump is tokenized in place into m_EntityList, which keeps pointing into it
 	void ReadEntities();
 
 	// Read Models from BSP
@@ -73,44 +90,106 @@ public:
 	// Read Leaves from BSP
 	void ReadLeaves();
 
+	// Read MarkSurfaces
+	// Leaf -> MarkSurfaces -> Faces
+	void ReadMarkSurfaces();
+
+	// Read the compressed potentially visible sets of the leaves
+	void ReadVisibility();
+
+	// Read the collision trees of hulls 1 to 3
+	void ReadClipNodes();
+
+	// Returns a typed read-only view over a lump of the mapped file
+	// Only valid in memory mapped mode and for lumps aligned for T
+	template<typename T>
+	LumpView<T> GetLump(int lumpId) const {
+		const BSPLUMP& lump = m_Header.lump[lumpId];
+		assert(IsLumpMapped(lumpId, alignof(T)));
+		return LumpView<T>((const T*)(m_MappedFile.GetData() + lump.nOffset), lump.nLength / sizeof(T));
+	}
+
+	// Whether a lump can be used in place from the mapping
+	bool IsLumpMapped(int lumpId, size_t alignment) const;
+
+private:
+	// printf only in verbose mode
+	void Log(const char* format, ...);
+
+	// Checks every lump of the header against the file size up front
+	bool ValidateLumps(size_t fileSize);
+
+	// Returns an array of T for a lump, either pointing into the mapping
+	// or freshly allocated and read from the file stream
+	template<typename T>
+	const T* LoadLump(int lumpId, unsigned& count);
+
+	// Releases an array returned by LoadLump
+	template<typename T>
+	void FreeLump(int lumpId, const T*& data);
+
+	// Copies raw bytes from the file, works in both modes
+	void ReadBytes(int32_t offset, void* dst, size_t size);
+
+public:
 	// --------- Class data ---------
 
 	std::ifstream		m_FileStream;		// BSP file read handle	
+	BSPMappedFile		m_MappedFile;		// BSP file mapping in memory mapped mode
+	bool				m_MemoryMapped;		// Whether lumps are read from m_MappedFile
+	bool				m_Verbose;			// Whether informational messages are printed
+	bool				m_IsValid;			// Whether the header was read and validated
+	bool				m_LumpCopied[HEADER_LUMPS];	// Whether a lump array was allocated by us
 	BSPHEADER			m_Header;			// Stores version and lump information
 
 	unsigned			m_nVertices;		// Number of Vertices
-	VECTOR3D*			m_Vertices;			// Array of Vertices
+	const VECTOR3D*		m_Vertices;			// Array of Vertices
 
 	unsigned			m_nPlanes;
-	BSPPLANE*			m_Planes;			// Array of Planes
+	const BSPPLANE*		m_Planes;			// Array of Planes
 
 	unsigned			m_nEdges;
-	BSPEDGE*			m_Edges;			// Array of Edges
+	const BSPEDGE*		m_Edges;			// Array of Edges
 
 	unsigned			m_nSurfEdges;		
-	BSPSURFEDGE*		m_SurfEdges;		// Array of SurfEdges
+	const BSPSURFEDGE*	m_SurfEdges;		// Array of SurfEdges
 
-	unsigned			m_nTextures;
-	BSPMIPTEXOFFSET*	m_TextureOffsets;	// Array of Texture Offsets
-	BSPMIPTEX*			m_Textures;			// Array of Textures
+	unsigned				m_nTextures;
+	const BSPMIPTEXOFFSET*	m_TextureOffsets;	// Array of Texture Offsets
+	BSPMIPTEX*				m_Textures;			// Array of Textures
+	unsigned				m_nTextureData;
+	const uint8_t*			m_TextureData;		// Texture lump, read by ReadTextureData
 
-	unsigned			m_nTextureInfos;
-	BSPTEXTUREINFO*		m_TextureInfos;		// Array of TextureInfos
+	unsigned				m_nTextureInfos;
+	const BSPTEXTUREINFO*	m_TextureInfos;		// Array of TextureInfos
 
 	unsigned			m_nFaces;
-	BSPFACE*			m_Faces;			// Array of Faces
+	const BSPFACE*		m_Faces;			// Array of Faces
+
+	unsigned			m_nLighting;
+	const uint8_t*		m_Lighting;			// RGB lightmap samples, read by ReadLighting
 
 	unsigned			m_nModels;
-	BSPMODEL*           m_Models;			// Array of Models
+	const BSPMODEL*		m_Models;			// Array of Models
 
 	unsigned			m_nNodes;
-	BSPNODE*			m_Nodes;			// Array of Nodes
+	const BSPNODE*		m_Nodes;			// Array of Nodes
 
 	unsigned			m_nLeaves;
-	BSPLEAF*			m_Leaves;			// Array of Leaves
+	const BSPLEAF*		m_Leaves;			// Array of Leaves
+
+	unsigned			m_nClipNodes;
+	const BSPCLIPNODE*	m_ClipNodes;		// Array of Clipnodes, read by ReadClipNodes
+
+	unsigned			m_nMarkSurfaces;
+	const uint16_t*		m_MarkSurfaces;		// Face of every leaf's marksurface
+
+	unsigned			m_nVisibility;
+	const uint8_t*		m_Visibility;		// Compressed PVS rows, read by ReadVisibility
 
-	unsigned			m_nEntities;		// Total number of entities in BSP file
-	char*				m_Entities;			// Entity string
+	unsigned			m_nEntityData;
+	const char*			m_EntityData;		// Entity lump, read by ReadEntities
+	BSPEntityList		m_EntityList;		// Key/value pairs of every entity, views into m_EntityData
 
 	entity_worldspawn				m_worldspawn;		// A BSP has a single worldspawn entity
 	vector<entity_funcwall>			m_funcwalls;		// List of func_wall entities
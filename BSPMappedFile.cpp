@@ -0,0 +1,109 @@
+#include "BSPMappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// -----------------------------------------------------------------
+BSPMappedFile::BSPMappedFile() {
+	m_Data = nullptr;
+	m_Size = 0;
+#ifdef _WIN32
+	m_FileHandle = INVALID_HANDLE_VALUE;
+	m_MappingHandle = nullptr;
+#endif
+}
+
+// -----------------------------------------------------------------
+BSPMappedFile::~BSPMappedFile() {
+	Close();
+}
+
+// -----------------------------------------------------------------
+bool BSPMappedFile::Open(const char* fileName, bool readAhead) {
+
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | (readAhead ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS), nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	m_FileHandle = file;
+	m_MappingHandle = mapping;
+	m_Data = (const uint8_t*)data;
+	m_Size = (size_t)fileSize.QuadPart;
+#else
+	int fd = open(fileName, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	// Every lump of a BSP gets touched during a conversion so ask for read-ahead,
+	// files read sparsely like WADs are better left to page in on demand
+	madvise(data, (size_t)st.st_size, readAhead ? MADV_WILLNEED : MADV_RANDOM);
+
+	m_Data = (const uint8_t*)data;
+	m_Size = (size_t)st.st_size;
+#endif
+
+	return true;
+}
+
+// -----------------------------------------------------------------
+void BSPMappedFile::Close() {
+
+#ifdef _WIN32
+	if (m_Data)
+		UnmapViewOfFile(m_Data);
+	if (m_MappingHandle)
+		CloseHandle(m_MappingHandle);
+	if (m_FileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(m_FileHandle);
+	m_MappingHandle = nullptr;
+	m_FileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (m_Data)
+		munmap((void*)m_Data, m_Size);
+#endif
+
+	m_Data = nullptr;
+	m_Size = 0;
+}
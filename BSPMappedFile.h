@@ -0,0 +1,77 @@
+/*
+	This file defines BSPMappedFile which maps a whole BSP file read-only
+	into memory, and LumpView which exposes a lump of that mapping as a
+	typed array without copying it.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cassert>
+
+// ======================================================================
+// BSPMappedFile is a read-only memory mapping of a file on disk
+// ======================================================================
+class BSPMappedFile
+{
+public:
+	// Constructor
+	BSPMappedFile();
+
+	// Destructor
+	~BSPMappedFile();
+
+	// Map a file into memory, returns false if it can't be opened or mapped
+	// readAhead asks the OS to prefetch the whole file, otherwise pages are
+	// only read when they're touched
+	bool Open(const char* fileName, bool readAhead = true);
+
+	// Unmap the file if one is mapped
+	void Close();
+
+	bool			IsOpen() const	{ return m_Data != nullptr; }
+	const uint8_t*	GetData() const	{ return m_Data; }
+	size_t			GetSize() const	{ return m_Size; }
+
+private:
+	// Mappings can't be copied around
+	BSPMappedFile(const BSPMappedFile&);
+	BSPMappedFile& operator=(const BSPMappedFile&);
+
+	const uint8_t*	m_Data;				// Start of the mapping
+	size_t			m_Size;				// Size of the mapped file in bytes
+
+#ifdef _WIN32
+	void*			m_FileHandle;		// HANDLE of the opened file
+	void*			m_MappingHandle;	// HANDLE of the file mapping object
+#endif
+};
+
+// ======================================================================
+// LumpView is a typed read-only span over a lump of a mapped BSP file
+// ======================================================================
+template<typename T>
+class LumpView
+{
+public:
+	LumpView() : m_Data(nullptr), m_Count(0) {}
+	LumpView(const T* data, unsigned count) : m_Data(data), m_Count(count) {}
+
+	const T*	Data() const	{ return m_Data; }
+	unsigned	Count() const	{ return m_Count; }
+	bool		Empty() const	{ return m_Count == 0; }
+
+	const T& operator[](unsigned i) const {
+		assert(i < m_Count);
+		return m_Data[i];
+	}
+
+	// Allows range based for loops over a lump
+	const T*	begin() const	{ return m_Data; }
+	const T*	end() const		{ return m_Data + m_Count; }
+
+private:
+	const T*	m_Data;
+	unsigned	m_Count;
+};
@@ -0,0 +1,129 @@
+/*
+	This file defines BSPMeshData, the geometry of a single BSPMODEL as
+	built once by BSP2FBX and consumed as is by every exporter and mesh
+	post-process.
+
+	Attributes are stored as a structure of arrays : every attribute is a
+	contiguous stream of floats so exporters can hand whole streams to their
+	output format instead of converting one vector at a time.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "BSPDefines.h"
+
+using namespace std;
+
+// FNV-1a over float values, continuing from hash, used by the keys which
+// find identical attributes. +0.0f so that -0 and 0 hash the same
+inline uint64_t HashFloats(const float* values, size_t count, uint64_t hash = 14695981039346656037ull)
+{
+	for (size_t i = 0; i < count; i++) {
+		float value = values[i] + 0.0f;
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		hash = (hash ^ bits) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// A 64 bit hash folded into a size_t
+inline size_t FoldHash(uint64_t hash)
+{
+	return (size_t)(hash ^ (hash >> 32));
+}
+
+// Unwelded meshes have one control point per polygon vertex, in polygon order.
+// Welded meshes share control points between polygons through polygonCPs
+// and keep tangents per polygon vertex since they follow each face's edges.
+// Polygons are grouped by material : the polygons of a material are
+// contiguous so importers make a single draw call out of them.
+// Meshes built with compact normals also give every polygon an index into
+// tables of distinct normals and tangents, since all the vertices of a BSP
+// face share its plane's normal : FBX files store those instead of a normal
+// and a tangent per control point.
+struct BSPMeshData {
+	unsigned			nPolygons;		// Number of polygons
+	vector<unsigned>	nPolygonCPs;	// Every polygon is composed of an array of control points indices
+	vector<unsigned>	materials;		// Scene material of every mesh material, in polygon order
+	vector<unsigned>	polygonMaterials;	// Mesh material of every polygon
+	vector<unsigned>	polygonCPs;		// Control point index of every polygon vertex, empty if unwelded
+	vector<float>		positions;		// Control point positions, x y z
+	vector<float>		normals;		// Control point normals, x y z
+	vector<float>		uvs;			// Control point texture coordinates, u v
+	vector<float>		tangents;		// Control point tangents, x y z, per polygon vertex if welded
+	vector<float>		lightmapUVs;	// Control point lightmap atlas coordinates, u v, empty without lightmaps
+	vector<unsigned>	polygonNormals;		// Normal of every polygon in normalTable, empty without compact normals
+	vector<float>		normalTable;		// Distinct polygon normals, x y z
+	vector<unsigned>	polygonTangents;	// Tangent of every polygon in tangentTable, empty without compact normals
+	vector<float>		tangentTable;		// Distinct polygon tangents, x y z
+
+	BSPMeshData() {
+		nPolygons = 0;
+	}
+
+	// Empty the mesh but keep its buffers around for the next one
+	void Clear() {
+		nPolygons = 0;
+		nPolygonCPs.clear();
+		materials.clear();
+		polygonMaterials.clear();
+		polygonCPs.clear();
+		positions.clear();
+		normals.clear();
+		uvs.clear();
+		tangents.clear();
+		lightmapUVs.clear();
+		polygonNormals.clear();
+		normalTable.clear();
+		polygonTangents.clear();
+		tangentTable.clear();
+	}
+
+	// Allocate every stream once for an unwelded mesh of the given size
+	// Control points are sized right away so they can be written in place
+	void Resize(unsigned nPolygons0, size_t nPolygonVertices, bool withLightmapUVs = false) {
+		nPolygonCPs.reserve(nPolygons0);
+		polygonMaterials.reserve(nPolygons0);
+		positions.resize(nPolygonVertices * 3);
+		normals.resize(nPolygonVertices * 3);
+		uvs.resize(nPolygonVertices * 2);
+		tangents.resize(nPolygonVertices * 3);
+		if (withLightmapUVs)
+			lightmapUVs.resize(nPolygonVertices * 2);
+	}
+
+	// Append a polygon using a scene material, polygons are in control point order
+	// Polygons have to be added grouped by material
+	void AddPolygon(unsigned nCPs, unsigned material) {
+		if (materials.empty() || materials.back() != material)
+			materials.push_back(material);
+		polygonMaterials.push_back((unsigned)materials.size() - 1);
+		nPolygonCPs.push_back(nCPs);
+		nPolygons++;
+	}
+
+	bool IsWelded() const { return !polygonCPs.empty(); }
+	bool HasLightmapUVs() const { return !lightmapUVs.empty(); }
+	bool HasCompactNormals() const { return !polygonNormals.empty(); }
+
+	size_t GetControlPointCount() const { return positions.size() / 3; }
+	size_t GetPolygonVertexCount() const { return tangents.size() / 3; }
+
+	// Control point used by a polygon vertex
+	unsigned GetPolygonCP(unsigned polygonVertex) const {
+		return polygonCPs.empty() ? polygonVertex : polygonCPs[polygonVertex];
+	}
+
+	// Attributes of a control point
+	const float* GetPosition(size_t cp) const	{ return &positions[cp * 3]; }
+	const float* GetNormal(size_t cp) const		{ return &normals[cp * 3]; }
+	const float* GetUV(size_t cp) const			{ return &uvs[cp * 2]; }
+	const float* GetLightmapUV(size_t cp) const	{ return &lightmapUVs[cp * 2]; }
+
+	// Tangent of a polygon vertex, unwelded control points are polygon vertices
+	const float* GetTangent(size_t polygonVertex) const { return &tangents[polygonVertex * 3]; }
+};
@@ -0,0 +1,820 @@
+#include "BSPMeshOptimizer.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+
+// LRU cache modeled by the optimizer, larger than the measuring one like most GPUs
+#define FORSYTH_CACHE_SIZE		32
+
+// Vertices with more remaining triangles than this score like it
+#define FORSYTH_MAX_VALENCE		32
+
+// Scoring constants from Forsyth's article
+#define FORSYTH_CACHE_DECAY_POWER	1.5f
+#define FORSYTH_LAST_TRI_SCORE		0.75f
+#define FORSYTH_VALENCE_BOOST_SCALE	2.0f
+#define FORSYTH_VALENCE_BOOST_POWER	0.5f
+
+// Collapses can't turn a triangle by more than about 75 degrees
+#define SIMPLIFY_MIN_NORMAL_COSINE	0.25
+
+// Triangles whose normal moved less than this keep the normal of their face
+#define SIMPLIFY_KEEP_NORMAL_COSINE	0.9999
+
+// Score tables, indexed by cache position and remaining triangles
+struct ForsythScores {
+	float	cache[FORSYTH_CACHE_SIZE];
+	float	valence[FORSYTH_MAX_VALENCE + 1];
+
+	ForsythScores() {
+		for (unsigned i = 0; i < FORSYTH_CACHE_SIZE; i++) {
+			// The last triangle's vertices are scored the same whatever their order
+			if (i < 3)
+				cache[i] = FORSYTH_LAST_TRI_SCORE;
+			else
+				cache[i] = powf(1.0f - (float)(i - 3) / (FORSYTH_CACHE_SIZE - 3), FORSYTH_CACHE_DECAY_POWER);
+		}
+		valence[0] = 0.0f;
+		for (unsigned i = 1; i <= FORSYTH_MAX_VALENCE; i++)
+			valence[i] = FORSYTH_VALENCE_BOOST_SCALE * powf((float)i, -FORSYTH_VALENCE_BOOST_POWER);
+	}
+
+	// Vertices without remaining triangles don't matter anymore
+	float GetVertexScore(int cachePosition, unsigned remaining) const {
+		if (remaining == 0)
+			return -1.0f;
+		float score = cachePosition >= 0 ? cache[cachePosition] : 0.0f;
+		return score + valence[min(remaining, (unsigned)FORSYTH_MAX_VALENCE)];
+	}
+};
+
+static const ForsythScores s_scores;
+
+// Per vertex state of the optimizer, only valid for the vertices of the current material
+struct ForsythVertex {
+	unsigned	firstTriangle;	// Start of the vertex's triangles in the adjacency array
+	unsigned	nTriangles;		// Triangles of the current material using the vertex
+	unsigned	nRemaining;		// Those not emitted yet, first in its adjacency
+	int			cachePosition;	// -1 when out of the cache
+	float		score;
+};
+
+//---------------------------------------------------------------------
+void TriangulateMeshData(BSPMeshData& meshData)
+{
+	size_t nTriangles = 0;
+	for (unsigned pId = 0; pId < meshData.nPolygons; pId++) {
+		if (meshData.nPolygonCPs[pId] >= 3)
+			nTriangles += meshData.nPolygonCPs[pId] - 2;
+	}
+
+	vector<unsigned> polygonCPs;
+	vector<float> tangents;
+	vector<unsigned> polygonMaterials;
+	vector<unsigned> polygonNormals;
+	vector<unsigned> polygonTangents;
+	bool compact = meshData.HasCompactNormals();
+	polygonCPs.reserve(nTriangles * 3);
+	tangents.reserve(nTriangles * 9);
+	polygonMaterials.reserve(nTriangles);
+	if (compact) {
+		polygonNormals.reserve(nTriangles);
+		polygonTangents.reserve(nTriangles);
+	}
+
+	// Faces are convex so a fan from their first vertex covers them
+	unsigned pvFirst = 0;
+	for (unsigned pId = 0; pId < meshData.nPolygons; pId++) {
+		unsigned nCPs = meshData.nPolygonCPs[pId];
+		for (unsigned i = 1; i + 1 < nCPs; i++) {
+			const unsigned fan[3] = { pvFirst, pvFirst + i, pvFirst + i + 1 };
+			for (unsigned pv : fan) {
+				polygonCPs.push_back(meshData.GetPolygonCP(pv));
+				const float* t = meshData.GetTangent(pv);
+				tangents.insert(tangents.end(), t, t + 3);
+			}
+			polygonMaterials.push_back(meshData.polygonMaterials[pId]);
+			if (compact) {
+				polygonNormals.push_back(meshData.polygonNormals[pId]);
+				polygonTangents.push_back(meshData.polygonTangents[pId]);
+			}
+		}
+		pvFirst += nCPs;
+	}
+
+	meshData.nPolygons = (unsigned)nTriangles;
+	meshData.nPolygonCPs.assign(nTriangles, 3);
+	meshData.polygonCPs.swap(polygonCPs);
+	meshData.tangents.swap(tangents);
+	meshData.polygonMaterials.swap(polygonMaterials);
+	if (compact) {
+		meshData.polygonNormals.swap(polygonNormals);
+		meshData.polygonTangents.swap(polygonTangents);
+	}
+}
+
+//---------------------------------------------------------------------
+// Forsyth's algorithm on the triangles [first, end) of indices, appends the new order to order
+static void OptimizeTriangles(const unsigned* indices, unsigned first, unsigned end,
+	vector<ForsythVertex>& vertices, vector<unsigned>& order)
+{
+	unsigned nTriangles = end - first;
+
+	// Triangles of every vertex, the adjacency of a vertex is compacted as they're emitted
+	vector<unsigned> usedVertices;
+	for (unsigned i = first * 3; i < end * 3; i++) {
+		ForsythVertex& vertex = vertices[indices[i]];
+		if (vertex.nTriangles++ == 0)
+			usedVertices.push_back(indices[i]);
+	}
+	unsigned offset = 0;
+	for (unsigned v : usedVertices) {
+		ForsythVertex& vertex = vertices[v];
+		vertex.firstTriangle = offset;
+		vertex.nRemaining = 0;
+		vertex.cachePosition = -1;
+		vertex.score = s_scores.GetVertexScore(-1, vertex.nTriangles);
+		offset += vertex.nTriangles;
+	}
+	vector<unsigned> adjacency(offset);
+	for (unsigned t = 0; t < nTriangles; t++) {
+		for (unsigned k = 0; k < 3; k++) {
+			ForsythVertex& vertex = vertices[indices[(first + t) * 3 + k]];
+			adjacency[vertex.firstTriangle + vertex.nRemaining++] = t;
+		}
+	}
+
+	// Triangle scores are the sum of their vertices' scores
+	vector<bool> emitted(nTriangles, false);
+	int bestTriangle = -1;
+	float bestScore = -1.0f;
+	for (unsigned t = 0; t < nTriangles; t++) {
+		const unsigned* tri = &indices[(first + t) * 3];
+		float score = vertices[tri[0]].score + vertices[tri[1]].score + vertices[tri[2]].score;
+		if (score > bestScore) {
+			bestScore = score;
+			bestTriangle = (int)t;
+		}
+	}
+
+	unsigned cache[FORSYTH_CACHE_SIZE + 3];
+	unsigned cacheSize = 0;
+	unsigned nextUnemitted = 0;
+	for (unsigned nEmitted = 0; nEmitted < nTriangles; nEmitted++) {
+		// Nothing in the cache scored, carry on with the next triangle in BSP order
+		if (bestTriangle < 0) {
+			while (emitted[nextUnemitted])
+				nextUnemitted++;
+			bestTriangle = (int)nextUnemitted;
+		}
+
+		unsigned t = (unsigned)bestTriangle;
+		const unsigned* tri = &indices[(first + t) * 3];
+		emitted[t] = true;
+		order.push_back(first + t);
+
+		// The triangle's vertices go to the front of the cache
+		unsigned newCache[FORSYTH_CACHE_SIZE + 3];
+		unsigned newCacheSize = 0;
+		for (unsigned k = 0; k < 3; k++) {
+			ForsythVertex& vertex = vertices[tri[k]];
+			unsigned* triangles = &adjacency[vertex.firstTriangle];
+			for (unsigned i = 0; i < vertex.nRemaining; i++) {
+				if (triangles[i] == t) {
+					swap(triangles[i], triangles[vertex.nRemaining - 1]);
+					vertex.nRemaining--;
+					break;
+				}
+			}
+			newCache[newCacheSize++] = tri[k];
+		}
+		for (unsigned i = 0; i < cacheSize; i++) {
+			if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+				newCache[newCacheSize++] = cache[i];
+		}
+
+		// Rescore the vertices of the cache, including the ones it just pushed out
+		for (unsigned i = 0; i < newCacheSize; i++) {
+			ForsythVertex& vertex = vertices[newCache[i]];
+			vertex.cachePosition = i < FORSYTH_CACHE_SIZE ? (int)i : -1;
+			vertex.score = s_scores.GetVertexScore(vertex.cachePosition, vertex.nRemaining);
+		}
+
+		// Next triangle is the best one using a vertex of the cache
+		bestTriangle = -1;
+		bestScore = -1.0f;
+		for (unsigned i = 0; i < newCacheSize; i++) {
+			const ForsythVertex& vertex = vertices[newCache[i]];
+			for (unsigned j = 0; j < vertex.nRemaining; j++) {
+				unsigned candidate = adjacency[vertex.firstTriangle + j];
+				const unsigned* candidateTri = &indices[(first + candidate) * 3];
+				float score = vertices[candidateTri[0]].score + vertices[candidateTri[1]].score + vertices[candidateTri[2]].score;
+				if (score > bestScore) {
+					bestScore = score;
+					bestTriangle = (int)candidate;
+				}
+			}
+		}
+
+		cacheSize = min(newCacheSize, (unsigned)FORSYTH_CACHE_SIZE);
+		memcpy(cache, newCache, cacheSize * sizeof(unsigned));
+	}
+
+	// Leave the vertices ready for the next material
+	for (unsigned v : usedVertices)
+		vertices[v].nTriangles = 0;
+}
+
+//---------------------------------------------------------------------
+void OptimizeVertexCache(BSPMeshData& meshData)
+{
+	if (meshData.nPolygons == 0)
+		return;
+
+	vector<ForsythVertex> vertices(meshData.GetControlPointCount());
+	for (auto& vertex : vertices)
+		vertex.nTriangles = 0;
+
+	// Triangles are only reordered within their material
+	vector<unsigned> order;
+	order.reserve(meshData.nPolygons);
+	unsigned first = 0;
+	for (unsigned t = 1; t <= meshData.nPolygons; t++) {
+		if (t == meshData.nPolygons || meshData.polygonMaterials[t] != meshData.polygonMaterials[first]) {
+			OptimizeTriangles(meshData.polygonCPs.data(), first, t, vertices, order);
+			first = t;
+		}
+	}
+
+	// Tangents are per polygon vertex and move with their triangle
+	vector<unsigned> polygonCPs(meshData.polygonCPs.size());
+	vector<float> tangents(meshData.tangents.size());
+	for (unsigned t = 0; t < order.size(); t++) {
+		memcpy(&polygonCPs[t * 3], &meshData.polygonCPs[order[t] * 3], 3 * sizeof(unsigned));
+		memcpy(&tangents[t * 9], &meshData.tangents[order[t] * 9], 9 * sizeof(float));
+	}
+	meshData.polygonCPs.swap(polygonCPs);
+	meshData.tangents.swap(tangents);
+
+	// So do compact normals, per triangle
+	if (meshData.HasCompactNormals()) {
+		vector<unsigned> polygonNormals(order.size());
+		vector<unsigned> polygonTangents(order.size());
+		for (unsigned t = 0; t < order.size(); t++) {
+			polygonNormals[t] = meshData.polygonNormals[order[t]];
+			polygonTangents[t] = meshData.polygonTangents[order[t]];
+		}
+		meshData.polygonNormals.swap(polygonNormals);
+		meshData.polygonTangents.swap(polygonTangents);
+	}
+}
+
+//---------------------------------------------------------------------
+size_t CountCacheMisses(const BSPMeshData& meshData, unsigned cacheSize)
+{
+	// A vertex is in the FIFO cache if fewer than cacheSize misses happened since it was loaded
+	vector<size_t> loadedAt(meshData.GetControlPointCount(), 0);
+	size_t time = cacheSize + 1;
+	size_t nMisses = 0;
+	size_t nPolygonVertices = meshData.GetPolygonVertexCount();
+	for (size_t pv = 0; pv < nPolygonVertices; pv++) {
+		unsigned cp = meshData.GetPolygonCP((unsigned)pv);
+		if (time - loadedAt[cp] > cacheSize) {
+			loadedAt[cp] = time++;
+			nMisses++;
+		}
+	}
+	return nMisses;
+}
+
+// How a position of a mesh being simplified may move
+enum SimplifyVertexKind {
+	VERTEX_MANIFOLD,	// Inside a single chart, can collapse to any neighbor
+	VERTEX_BORDER,		// On the open border of a chart, only slides along it
+	VERTEX_SEAM,		// On the seam between two charts, slides along it on both sides
+	VERTEX_LOCKED		// Where seams meet, or not manifold : never moves
+};
+
+// Key of a wedge : a position with the attributes of one of its charts
+// position x y z, u v, lightmap u v, mesh material
+struct WedgeKey {
+	float		values[7];
+	unsigned	material;
+
+	bool operator==(const WedgeKey& o) const {
+		for (unsigned i = 0; i < 7; i++) {
+			if (values[i] != o.values[i])
+				return false;
+		}
+		return material == o.material;
+	}
+};
+
+struct WedgeKeyHash {
+	size_t operator()(const WedgeKey& key) const {
+		// The material goes on like one more FNV-1a word
+		uint64_t hash = HashFloats(key.values, sizeof(key.values) / sizeof(key.values[0]));
+		return FoldHash((hash ^ key.material) * 1099511628211ull);
+	}
+};
+
+// Sum of the squared distances to a set of planes, as a symmetric 4x4 matrix
+struct Quadric {
+	double	a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+	void AddPlane(const double n[3], double d) {
+		a2 += n[0] * n[0]; ab += n[0] * n[1]; ac += n[0] * n[2]; ad += n[0] * d;
+		b2 += n[1] * n[1]; bc += n[1] * n[2]; bd += n[1] * d;
+		c2 += n[2] * n[2]; cd += n[2] * d;
+		d2 += d * d;
+	}
+
+	void Add(const Quadric& q) {
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+	}
+
+	double Evaluate(const double p[3]) const {
+		double x = p[0], y = p[1], z = p[2];
+		return a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x
+			+ b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y
+			+ c2 * z * z + 2.0 * cd * z + d2;
+	}
+};
+
+// A candidate collapse of position u into its neighbor v
+struct Collapse {
+	double		cost;
+	unsigned	u, v;
+	unsigned	stampU, stampV;		// Stale once either position changed
+
+	bool operator<(const Collapse& o) const { return cost > o.cost; }
+};
+
+//---------------------------------------------------------------------
+static void Cross(const double a[3], const double b[3], double out[3])
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+//---------------------------------------------------------------------
+// Normal of a triangle scaled by twice its area
+static void TriangleNormal(const double* p0, const double* p1, const double* p2, double out[3])
+{
+	const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	Cross(e1, e2, out);
+}
+
+// State of SimplifyMeshData
+struct Simplifier {
+	vector<double>		positions;			// Of every distinct position, x y z
+	vector<unsigned>	wedgePositions;		// Position of every wedge
+	vector<vector<unsigned>>	positionWedges;		// Wedges of every position
+	vector<vector<unsigned>>	positionTriangles;	// Triangles around every position, some of them removed
+	vector<unsigned>	borderNext, borderPrev;		// Wedges along the border edges of every wedge, ~0u if none
+	vector<uint8_t>		kinds;
+	vector<Quadric>		quadrics;
+	vector<unsigned>	stamps;
+	vector<bool>		removedPositions;
+	vector<unsigned>	corners;			// Wedges of every triangle
+	vector<bool>		removedTriangles;
+	priority_queue<Collapse>	queue;
+
+	unsigned GetPosition(unsigned triangle, unsigned k) const { return wedgePositions[corners[triangle * 3 + k]]; }
+
+	bool HasPosition(unsigned triangle, unsigned p) const {
+		return GetPosition(triangle, 0) == p || GetPosition(triangle, 1) == p || GetPosition(triangle, 2) == p;
+	}
+
+	// Positions sharing a triangle with p
+	void GetNeighbors(unsigned p, vector<unsigned>& neighbors) const {
+		neighbors.clear();
+		for (unsigned t : positionTriangles[p]) {
+			if (removedTriangles[t])
+				continue;
+			for (unsigned k = 0; k < 3; k++) {
+				unsigned q = GetPosition(t, k);
+				if (q != p && find(neighbors.begin(), neighbors.end(), q) == neighbors.end())
+					neighbors.push_back(q);
+			}
+		}
+	}
+
+	// Whether u may collapse into v as far as seams and borders go
+	bool IsAllowed(unsigned u, unsigned v) const {
+		if (removedPositions[v])
+			return false;
+		switch (kinds[u]) {
+		case VERTEX_MANIFOLD:
+			return true;
+		case VERTEX_BORDER:
+		case VERTEX_SEAM: {
+			unsigned w = positionWedges[u][0];
+			return (borderNext[w] != ~0u && wedgePositions[borderNext[w]] == v) ||
+				(borderPrev[w] != ~0u && wedgePositions[borderPrev[w]] == v);
+		}
+		default:
+			return false;
+		}
+	}
+
+	// Queue every allowed collapse of p
+	void QueueCollapses(unsigned p, vector<unsigned>& neighbors) {
+		if (kinds[p] == VERTEX_LOCKED || removedPositions[p])
+			return;
+		GetNeighbors(p, neighbors);
+		for (unsigned v : neighbors) {
+			if (!IsAllowed(p, v))
+				continue;
+			Quadric q = quadrics[p];
+			q.Add(quadrics[v]);
+			Collapse collapse;
+			collapse.cost = max(q.Evaluate(&positions[v * 3]), 0.0);
+			collapse.u = p;
+			collapse.v = v;
+			collapse.stampU = stamps[p];
+			collapse.stampV = stamps[v];
+			queue.push(collapse);
+		}
+	}
+
+	// Whether collapsing u into v keeps the mesh manifold and its triangles facing the same way
+	bool IsValid(unsigned u, unsigned v, vector<unsigned>& neighborsU, vector<unsigned>& neighborsV) const {
+		for (unsigned w : positionWedges[u]) {
+			if (GetTargetWedge(w, v) == ~0u)
+				return false;
+		}
+
+		// Only the triangles on the edge may lose u and v as common neighbors, more would pinch the mesh
+		unsigned nShared = 0;
+		for (unsigned t : positionTriangles[u]) {
+			if (!removedTriangles[t] && HasPosition(t, v))
+				nShared++;
+		}
+		if (nShared == 0)
+			return false;
+		GetNeighbors(u, neighborsU);
+		GetNeighbors(v, neighborsV);
+		unsigned nCommon = 0;
+		for (unsigned q : neighborsU) {
+			if (find(neighborsV.begin(), neighborsV.end(), q) != neighborsV.end())
+				nCommon++;
+		}
+		if (nCommon != nShared)
+			return false;
+
+		// Triangles of u moving to v can't flip or turn much
+		for (unsigned t : positionTriangles[u]) {
+			if (removedTriangles[t] || HasPosition(t, v))
+				continue;
+			const double* p[3];
+			const double* moved[3];
+			for (unsigned k = 0; k < 3; k++) {
+				unsigned q = GetPosition(t, k);
+				p[k] = &positions[q * 3];
+				moved[k] = q == u ? &positions[v * 3] : p[k];
+			}
+			double before[3], after[3];
+			TriangleNormal(p[0], p[1], p[2], before);
+			TriangleNormal(moved[0], moved[1], moved[2], after);
+			double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+			double lengths = sqrt((before[0] * before[0] + before[1] * before[1] + before[2] * before[2]) *
+				(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]));
+			if (lengths <= 0.0 || dot < SIMPLIFY_MIN_NORMAL_COSINE * lengths)
+				return false;
+		}
+		return true;
+	}
+
+	// Wedge of v taking the place of wedge w of u, which share an edge
+	unsigned GetTargetWedge(unsigned w, unsigned v) const {
+		if (borderNext[w] != ~0u && wedgePositions[borderNext[w]] == v)
+			return borderNext[w];
+		if (borderPrev[w] != ~0u && wedgePositions[borderPrev[w]] == v)
+			return borderPrev[w];
+
+		// Inside a chart the triangles around w all use the same wedge of v
+		unsigned u = wedgePositions[w];
+		for (unsigned t : positionTriangles[u]) {
+			if (removedTriangles[t])
+				continue;
+			bool hasWedge = false;
+			unsigned target = ~0u;
+			for (unsigned k = 0; k < 3; k++) {
+				if (corners[t * 3 + k] == w)
+					hasWedge = true;
+				if (GetPosition(t, k) == v)
+					target = corners[t * 3 + k];
+			}
+			if (hasWedge && target != ~0u)
+				return target;
+		}
+		return ~0u;
+	}
+
+	// Move u into v
+	void Apply(unsigned u, unsigned v) {
+		// Wedges of u and where they go, border links skip over u
+		const vector<unsigned>& wedges = positionWedges[u];
+		unsigned targets[2] = { ~0u, ~0u };
+		for (unsigned i = 0; i < wedges.size(); i++) {
+			unsigned w = wedges[i];
+			targets[i] = GetTargetWedge(w, v);
+			if (kinds[u] == VERTEX_MANIFOLD)
+				continue;
+			if (borderNext[w] == targets[i]) {
+				borderNext[borderPrev[w]] = targets[i];
+				borderPrev[targets[i]] = borderPrev[w];
+			}
+			else {
+				borderPrev[borderNext[w]] = targets[i];
+				borderNext[targets[i]] = borderNext[w];
+			}
+		}
+
+		for (unsigned t : positionTriangles[u]) {
+			if (removedTriangles[t])
+				continue;
+			if (HasPosition(t, v)) {
+				removedTriangles[t] = true;
+				continue;
+			}
+			for (unsigned k = 0; k < 3; k++) {
+				for (unsigned i = 0; i < wedges.size(); i++) {
+					if (corners[t * 3 + k] == wedges[i])
+						corners[t * 3 + k] = targets[i];
+				}
+			}
+			positionTriangles[v].push_back(t);
+		}
+		quadrics[v].Add(quadrics[u]);
+		removedPositions[u] = true;
+		positionTriangles[u].clear();
+	}
+};
+
+//---------------------------------------------------------------------
+void SimplifyMeshData(BSPMeshData& meshData, float maxError)
+{
+	unsigned nTriangles = meshData.nPolygons;
+	if (nTriangles == 0)
+		return;
+	bool lightmapped = meshData.HasLightmapUVs();
+	bool compact = meshData.HasCompactNormals();
+
+	// Wedges merge control points whose attributes only differ by their normal,
+	// faces are flat so normals are given back per triangle at the end
+	Simplifier s;
+	s.corners.resize(nTriangles * 3);
+	unordered_map<WedgeKey, unsigned, WedgeKeyHash> wedgeIds;
+	unordered_map<WedgeKey, unsigned, WedgeKeyHash> positionIds;
+	vector<unsigned> wedgeCPs;
+	for (unsigned t = 0; t < nTriangles; t++) {
+		for (unsigned k = 0; k < 3; k++) {
+			unsigned cp = meshData.GetPolygonCP(t * 3 + k);
+			const float* position = meshData.GetPosition(cp);
+			const float* uv = meshData.GetUV(cp);
+			WedgeKey key = { { position[0], position[1], position[2], 0.0f, 0.0f, 0.0f, 0.0f }, 0 };
+			auto positionId = positionIds.emplace(key, (unsigned)positionIds.size());
+			if (positionId.second) {
+				s.positions.insert(s.positions.end(), { (double)position[0], (double)position[1], (double)position[2] });
+				s.positionWedges.emplace_back();
+			}
+
+			key.values[3] = uv[0];
+			key.values[4] = uv[1];
+			if (lightmapped) {
+				key.values[5] = meshData.GetLightmapUV(cp)[0];
+				key.values[6] = meshData.GetLightmapUV(cp)[1];
+			}
+			key.material = meshData.polygonMaterials[t];
+			auto wedge = wedgeIds.emplace(key, (unsigned)wedgeIds.size());
+			if (wedge.second) {
+				s.wedgePositions.push_back(positionId.first->second);
+				s.positionWedges[positionId.first->second].push_back(wedge.first->second);
+				wedgeCPs.push_back(cp);
+			}
+			s.corners[t * 3 + k] = wedge.first->second;
+		}
+	}
+	unsigned nPositions = (unsigned)positionIds.size();
+	unsigned nWedges = (unsigned)wedgeIds.size();
+	s.positionTriangles.resize(nPositions);
+	s.removedTriangles.assign(nTriangles, false);
+	for (unsigned t = 0; t < nTriangles; t++) {
+		for (unsigned k = 0; k < 3; k++)
+			s.positionTriangles[s.GetPosition(t, k)].push_back(t);
+	}
+
+	// A wedge edge used by a single triangle is a border of its chart : seams
+	// between charts are two borders along the same positions
+	unordered_map<uint64_t, unsigned> edgeCounts;
+	for (unsigned t = 0; t < nTriangles; t++) {
+		for (unsigned k = 0; k < 3; k++)
+			edgeCounts[((uint64_t)s.corners[t * 3 + k] << 32) | s.corners[t * 3 + (k + 1) % 3]]++;
+	}
+	s.borderNext.assign(nWedges, ~0u);
+	s.borderPrev.assign(nWedges, ~0u);
+	vector<bool> complex(nWedges, false);
+	for (auto& edge : edgeCounts) {
+		unsigned a = (unsigned)(edge.first >> 32);
+		unsigned b = (unsigned)(edge.first & 0xFFFFFFFF);
+		auto opposite = edgeCounts.find(((uint64_t)b << 32) | a);
+		unsigned nOpposite = opposite == edgeCounts.end() ? 0 : opposite->second;
+		if (edge.second > 1 || nOpposite > 1) {
+			complex[a] = complex[b] = true;
+		}
+		else if (nOpposite == 0) {
+			if (s.borderNext[a] != ~0u || s.borderPrev[b] != ~0u)
+				complex[a] = complex[b] = true;
+			s.borderNext[a] = b;
+			s.borderPrev[b] = a;
+		}
+	}
+
+	s.kinds.assign(nPositions, VERTEX_LOCKED);
+	for (unsigned p = 0; p < nPositions; p++) {
+		const vector<unsigned>& wedges = s.positionWedges[p];
+		bool anyComplex = false;
+		for (unsigned w : wedges)
+			anyComplex = anyComplex || complex[w];
+		if (anyComplex)
+			continue;
+		if (wedges.size() == 1) {
+			unsigned w = wedges[0];
+			bool hasNext = s.borderNext[w] != ~0u;
+			bool hasPrev = s.borderPrev[w] != ~0u;
+			if (!hasNext && !hasPrev)
+				s.kinds[p] = VERTEX_MANIFOLD;
+			else if (hasNext && hasPrev)
+				s.kinds[p] = VERTEX_BORDER;
+		}
+		else if (wedges.size() == 2) {
+			// Both sides of a seam run along the same positions, in opposite directions
+			unsigned w0 = wedges[0], w1 = wedges[1];
+			if (s.borderNext[w0] != ~0u && s.borderPrev[w0] != ~0u && s.borderNext[w1] != ~0u && s.borderPrev[w1] != ~0u &&
+				s.wedgePositions[s.borderNext[w0]] == s.wedgePositions[s.borderPrev[w1]] &&
+				s.wedgePositions[s.borderPrev[w0]] == s.wedgePositions[s.borderNext[w1]])
+				s.kinds[p] = VERTEX_SEAM;
+		}
+	}
+
+	// Quadrics of the planes of the triangles around every position, and of the
+	// planes standing on the borders so that they keep their shape
+	s.quadrics.assign(nPositions, Quadric());
+	for (unsigned t = 0; t < nTriangles; t++) {
+		const double* p[3];
+		for (unsigned k = 0; k < 3; k++)
+			p[k] = &s.positions[s.GetPosition(t, k) * 3];
+		double normal[3];
+		TriangleNormal(p[0], p[1], p[2], normal);
+		double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length <= 0.0)
+			continue;
+		for (unsigned i = 0; i < 3; i++)
+			normal[i] /= length;
+		double d = -(normal[0] * p[0][0] + normal[1] * p[0][1] + normal[2] * p[0][2]);
+		for (unsigned k = 0; k < 3; k++)
+			s.quadrics[s.GetPosition(t, k)].AddPlane(normal, d);
+
+		for (unsigned k = 0; k < 3; k++) {
+			unsigned a = s.corners[t * 3 + k];
+			unsigned b = s.corners[t * 3 + (k + 1) % 3];
+			if (s.borderNext[a] != b)
+				continue;
+			const double edge[3] = { p[(k + 1) % 3][0] - p[k][0], p[(k + 1) % 3][1] - p[k][1], p[(k + 1) % 3][2] - p[k][2] };
+			double side[3];
+			Cross(edge, normal, side);
+			double sideLength = sqrt(side[0] * side[0] + side[1] * side[1] + side[2] * side[2]);
+			if (sideLength <= 0.0)
+				continue;
+			for (unsigned i = 0; i < 3; i++)
+				side[i] /= sideLength;
+			double sideD = -(side[0] * p[k][0] + side[1] * p[k][1] + side[2] * p[k][2]);
+			s.quadrics[s.GetPosition(t, k)].AddPlane(side, sideD);
+			s.quadrics[s.GetPosition(t, (k + 1) % 3)].AddPlane(side, sideD);
+		}
+	}
+
+	// Cheapest collapses first, until the next one would move a position
+	// farther than maxError from the planes it used to be on
+	s.stamps.assign(nPositions, 0);
+	s.removedPositions.assign(nPositions, false);
+	vector<unsigned> neighbors, neighborsV;
+	for (unsigned p = 0; p < nPositions; p++)
+		s.QueueCollapses(p, neighbors);
+	double maxCost = (double)maxError * maxError;
+	while (!s.queue.empty()) {
+		Collapse collapse = s.queue.top();
+		if (collapse.cost > maxCost)
+			break;
+		s.queue.pop();
+		unsigned u = collapse.u, v = collapse.v;
+		if (s.removedPositions[u] || s.removedPositions[v] || collapse.stampU != s.stamps[u] || collapse.stampV != s.stamps[v])
+			continue;
+		if (!s.IsValid(u, v, neighbors, neighborsV))
+			continue;
+		s.Apply(u, v);
+
+		// Costs around v changed
+		s.GetNeighbors(v, neighborsV);
+		s.stamps[v]++;
+		for (unsigned q : neighborsV)
+			s.stamps[q]++;
+		s.QueueCollapses(v, neighbors);
+		for (unsigned q : neighborsV)
+			s.QueueCollapses(q, neighbors);
+	}
+
+	// Control points of the remaining triangles : a wedge gets one per normal it's used with
+	vector<unsigned> polygonCPs, polygonMaterials, polygonNormals, polygonTangents;
+	vector<float> positions, normals, uvs, tangents, lightmapUVs;
+	vector<unsigned> materials;
+	vector<int> materialIds(meshData.materials.size(), -1);
+	unordered_map<WedgeKey, unsigned, WedgeKeyHash> cpIds;
+	unordered_map<WedgeKey, unsigned, WedgeKeyHash> normalIds;
+	unsigned nRemaining = 0;
+	for (unsigned t = 0; t < nTriangles; t++) {
+		if (s.removedTriangles[t])
+			continue;
+		nRemaining++;
+
+		// Triangles still close to their face's plane keep its normal
+		const float* faceNormal = meshData.GetNormal(meshData.GetPolygonCP(t * 3));
+		double geometric[3];
+		TriangleNormal(&s.positions[s.GetPosition(t, 0) * 3], &s.positions[s.GetPosition(t, 1) * 3], &s.positions[s.GetPosition(t, 2) * 3], geometric);
+		double length = sqrt(geometric[0] * geometric[0] + geometric[1] * geometric[1] + geometric[2] * geometric[2]);
+		float normal[3] = { faceNormal[0], faceNormal[1], faceNormal[2] };
+		bool moved = false;
+		double dot = geometric[0] * normal[0] + geometric[1] * normal[1] + geometric[2] * normal[2];
+		if (length > 0.0 && fabs(dot) < SIMPLIFY_KEEP_NORMAL_COSINE * length) {
+			// On the side of the face's normal, whichever way the face winds
+			if (dot < 0.0)
+				length = -length;
+			for (unsigned i = 0; i < 3; i++)
+				normal[i] = (float)(geometric[i] / length);
+			moved = true;
+		}
+
+		for (unsigned k = 0; k < 3; k++) {
+			unsigned w = s.corners[t * 3 + k];
+			WedgeKey key = { { normal[0], normal[1], normal[2], 0.0f, 0.0f, 0.0f, 0.0f }, w };
+			auto cp = cpIds.emplace(key, (unsigned)cpIds.size());
+			if (cp.second) {
+				unsigned source = wedgeCPs[w];
+				const double* position = &s.positions[s.wedgePositions[w] * 3];
+				positions.insert(positions.end(), { (float)position[0], (float)position[1], (float)position[2] });
+				normals.insert(normals.end(), normal, normal + 3);
+				uvs.insert(uvs.end(), meshData.GetUV(source), meshData.GetUV(source) + 2);
+				if (lightmapped)
+					lightmapUVs.insert(lightmapUVs.end(), meshData.GetLightmapUV(source), meshData.GetLightmapUV(source) + 2);
+			}
+			polygonCPs.push_back(cp.first->second);
+			const float* tangent = meshData.GetTangent(t * 3 + k);
+			tangents.insert(tangents.end(), tangent, tangent + 3);
+		}
+
+		// Materials which lost all their triangles are dropped
+		unsigned material = meshData.polygonMaterials[t];
+		if (materialIds[material] < 0) {
+			materialIds[material] = (int)materials.size();
+			materials.push_back(meshData.materials[material]);
+		}
+		polygonMaterials.push_back((unsigned)materialIds[material]);
+
+		if (compact) {
+			unsigned normalId = meshData.polygonNormals[t];
+			if (moved) {
+				WedgeKey key = { { normal[0], normal[1], normal[2], 0.0f, 0.0f, 0.0f, 0.0f }, 0 };
+				auto inserted = normalIds.emplace(key, (unsigned)(meshData.normalTable.size() / 3));
+				if (inserted.second)
+					meshData.normalTable.insert(meshData.normalTable.end(), normal, normal + 3);
+				normalId = inserted.first->second;
+			}
+			polygonNormals.push_back(normalId);
+			polygonTangents.push_back(meshData.polygonTangents[t]);
+		}
+	}
+
+	meshData.nPolygons = nRemaining;
+	meshData.nPolygonCPs.assign(nRemaining, 3);
+	meshData.materials.swap(materials);
+	meshData.polygonMaterials.swap(polygonMaterials);
+	meshData.polygonCPs.swap(polygonCPs);
+	meshData.positions.swap(positions);
+	meshData.normals.swap(normals);
+	meshData.uvs.swap(uvs);
+	meshData.tangents.swap(tangents);
+	meshData.lightmapUVs.swap(lightmapUVs);
+	if (compact) {
+		meshData.polygonNormals.swap(polygonNormals);
+		meshData.polygonTangents.swap(polygonTangents);
+	}
+}
@@ -0,0 +1,47 @@
+/*
+	This file defines post-processes run on a BSPMeshData before it's handed
+	to exporters.
+
+	TriangulateMeshData fans every convex BSP face into triangles, and
+	OptimizeVertexCache reorders the triangles of every material with Tom
+	Forsyth's linear-speed vertex cache optimization so consecutive triangles
+	reuse the vertices the GPU just transformed. Materials stay contiguous.
+
+	Cache efficiency is measured as ACMR, the average number of vertices
+	transformed per triangle through a simulated FIFO post-transform cache :
+	3 is the worst, around 0.6 the best for regular grids. Only shared control
+	points can hit the cache so it mostly pays off on welded meshes.
+
+	SimplifyMeshData builds the lower levels of detail of a triangulated mesh
+	with quadric error edge collapses (Garland and Heckbert) : every position
+	collapses into one of its neighbors, cheapest first, until the next
+	collapse would move the surface farther than a given distance. Corners
+	are welded on position, texture and lightmap coordinates and material,
+	ignoring normals, so creases simplify but seams between texture charts
+	and materials only slide along themselves and open borders keep their
+	shape. Lightmap coordinates are unique to every face, which leaves little
+	to collapse on lightmapped meshes.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include "BSPMesh.h"
+
+// Entries of the FIFO cache used to measure ACMR
+#define VERTEX_CACHE_SIZE 16
+
+// Split every polygon into a fan of triangles
+// Polygon vertices become explicit control point indices, tangents follow them
+void TriangulateMeshData(BSPMeshData& meshData);
+
+// Reorder the triangles of a triangulated mesh for vertex cache locality
+void OptimizeVertexCache(BSPMeshData& meshData);
+
+// Collapse the edges of a triangulated mesh while the error stays under maxError, in map units
+// Control points are rebuilt, triangles keep their normal unless collapses turned them
+void SimplifyMeshData(BSPMeshData& meshData, float maxError);
+
+// Vertices transformed by the triangles of a triangulated mesh through a FIFO cache
+// ACMR is this divided by the number of triangles
+size_t CountCacheMisses(const BSPMeshData& meshData, unsigned cacheSize = VERTEX_CACHE_SIZE);
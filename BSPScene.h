@@ -0,0 +1,106 @@
+/*
+	This file describes the exported scene independently of any output format :
+	the node hierarchy built from the BSP entities, whose geometry is given as
+	BSPMeshData, and a material per BSP texture. Output backends implement
+	BSPSceneExporter.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "BSPDefines.h"
+#include "BSPMesh.h"
+
+using namespace std;
+
+enum BSPScenePropertyType {
+	PROPERTY_INT,
+	PROPERTY_VECTOR,
+	PROPERTY_STRING
+};
+
+// Custom data attached to a node, user properties in FBX and extras in glTF
+struct BSPSceneProperty {
+	string					name;
+	BSPScenePropertyType	type;
+	int						intValue;
+	VECTOR3D				vectorValue;
+	string					stringValue;
+
+	BSPSceneProperty(const string& name0, int value) {
+		name = name0;
+		type = PROPERTY_INT;
+		intValue = value;
+	}
+
+	BSPSceneProperty(const string& name0, const VECTOR3D& value) {
+		name = name0;
+		type = PROPERTY_VECTOR;
+		intValue = 0;
+		vectorValue = value;
+	}
+
+	BSPSceneProperty(const string& name0, const string& value) {
+		name = name0;
+		type = PROPERTY_STRING;
+		intValue = 0;
+		stringValue = value;
+	}
+};
+
+// A node of the exported hierarchy
+struct BSPSceneNode {
+	string			name;
+	int				parent;		// Index of the parent node, -1 for the scene root
+	const BSPMODEL*	model;		// Model whose geometry the node carries, nullptr for grouping nodes
+	vector<unsigned>	faces;	// Faces of the model the node carries, all of them when empty
+	int				hull;		// Hull of the model whose collision brush the node carries, -1 for its faces
+	unsigned		brush;		// Brush of the model's hull, see BSPCollision
+	unsigned		lod;		// Level of detail of the node's mesh, 0 for the full one
+	float			lodError;	// Distance the mesh is simplified by, in map units
+	vector<float>	lodDistances;	// Distances a LOD group switches to its next level at, empty for other nodes
+	VECTOR3D		scaling;	// Local scaling of the node
+	vector<BSPSceneProperty>	properties;
+
+	BSPSceneNode(const string& name0, int parent0, const BSPMODEL* model0 = nullptr) {
+		name = name0;
+		parent = parent0;
+		model = model0;
+		hull = -1;
+		brush = 0;
+		lod = 0;
+		lodError = 0.0f;
+		scaling = VECTOR3D(1.0f, 1.0f, 1.0f);
+	}
+};
+
+// A material of the exported scene, there's one per BSP texture and
+// meshes refer to them by texture index
+struct BSPSceneMaterial {
+	string			name;			// Texture name
+	string			textureFile;	// Image relative to the output file, empty if it wasn't exported
+	bool			transparent;	// Palette index 255 is see-through
+
+	BSPSceneMaterial() {
+		transparent = false;
+	}
+};
+
+// ======================================================================
+// BSPSceneExporter is implemented by output backends which write a scene
+// as its geometry gets built instead of holding it all in memory
+// ======================================================================
+class BSPSceneExporter {
+public:
+	virtual ~BSPSceneExporter() {}
+
+	// Start writing a scene made of the given nodes and materials
+	virtual bool BeginScene(const char* fileName, const vector<BSPSceneNode>& nodes, const vector<BSPSceneMaterial>& materials) = 0;
+
+	// Write the geometry of a node, called once for every node with a model, in node order
+	virtual void WriteMesh(unsigned nodeId, const BSPMeshData& meshData) = 0;
+
+	// Finish writing, returns false if the output couldn't be written
+	virtual bool EndScene() = 0;
+};
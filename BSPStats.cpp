@@ -0,0 +1,143 @@
+#include "BSPStats.h"
+#include "JsonString.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+//---------------------------------------------------------------------
+BSPStats::BSPStats()
+{
+	m_Start = chrono::steady_clock::now();
+}
+
+//---------------------------------------------------------------------
+void BSPStats::Clear()
+{
+	lock_guard<mutex> lock(m_Mutex);
+	m_Start = chrono::steady_clock::now();
+	m_Stages.clear();
+	m_Counters.clear();
+	m_Models.clear();
+}
+
+//---------------------------------------------------------------------
+void BSPStats::AddStage(const char* name, double seconds, uint64_t bytes)
+{
+	lock_guard<mutex> lock(m_Mutex);
+	for (auto& stage : m_Stages) {
+		if (stage.name == name) {
+			stage.seconds += seconds;
+			stage.bytes += bytes;
+			stage.count++;
+			return;
+		}
+	}
+	m_Stages.push_back({ name, seconds, bytes, 1 });
+}
+
+//---------------------------------------------------------------------
+void BSPStats::AddCounter(const char* name, uint64_t value)
+{
+	lock_guard<mutex> lock(m_Mutex);
+	for (auto& counter : m_Counters) {
+		if (counter.first == name) {
+			counter.second += value;
+			return;
+		}
+	}
+	m_Counters.push_back(make_pair(string(name), value));
+}
+
+//---------------------------------------------------------------------
+void BSPStats::AddModel(const BSPStatsModel& model)
+{
+	lock_guard<mutex> lock(m_Mutex);
+	m_Models.push_back(model);
+}
+
+//---------------------------------------------------------------------
+bool BSPStats::WriteJSON(const char* fileName, const char* bspFileName) const
+{
+	lock_guard<mutex> lock(m_Mutex);
+	double total = chrono::duration<double>(chrono::steady_clock::now() - m_Start).count();
+
+	FILE* file = fopen(fileName, "w");
+	if (!file)
+		return false;
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"file\": %s,\n", JsonString(bspFileName).c_str());
+	fprintf(file, "  \"total_ms\": %.3f,\n", total * 1000.0);
+	fprintf(file, "  \"peak_rss_bytes\": %llu,\n", (unsigned long long)GetPeakRSS());
+
+	fprintf(file, "  \"stages\": [\n");
+	for (size_t i = 0; i < m_Stages.size(); i++) {
+		const BSPStatsStage& stage = m_Stages[i];
+		fprintf(file, "    { \"name\": %s, \"ms\": %.3f, \"bytes\": %llu, \"count\": %u }%s\n",
+			JsonString(stage.name).c_str(), stage.seconds * 1000.0, (unsigned long long)stage.bytes, stage.count,
+			i + 1 < m_Stages.size() ? "," : "");
+	}
+	fprintf(file, "  ],\n");
+
+	fprintf(file, "  \"counters\": {\n");
+	for (size_t i = 0; i < m_Counters.size(); i++) {
+		fprintf(file, "    %s: %llu%s\n", JsonString(m_Counters[i].first).c_str(), (unsigned long long)m_Counters[i].second,
+			i + 1 < m_Counters.size() ? "," : "");
+	}
+	fprintf(file, "  },\n");
+
+	fprintf(file, "  \"models\": [\n");
+	for (size_t i = 0; i < m_Models.size(); i++) {
+		const BSPStatsModel& model = m_Models[i];
+		fprintf(file, "    { \"node\": %s, \"faces\": %u, \"polygons\": %u, \"control_points\": %zu, \"polygon_vertices\": %zu, \"ms\": %.3f }%s\n",
+			JsonString(model.node).c_str(), model.faces, model.polygons, model.controlPoints, model.polygonVertices,
+			model.seconds * 1000.0, i + 1 < m_Models.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n");
+	fprintf(file, "}\n");
+	return fclose(file) == 0;
+}
+
+//---------------------------------------------------------------------
+uint64_t BSPStats::GetPeakRSS()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return (uint64_t)counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (uint64_t)usage.ru_maxrss;			// Bytes on macOS
+#else
+	return (uint64_t)usage.ru_maxrss * 1024;	// Kilobytes on Linux
+#endif
+#endif
+}
+
+//---------------------------------------------------------------------
+BSPScopedTimer::BSPScopedTimer(BSPStats* stats, const char* stage, uint64_t bytes)
+{
+	m_Stats = stats;
+	m_Stage = stage;
+	m_Bytes = bytes;
+	if (m_Stats)
+		m_Start = chrono::steady_clock::now();
+}
+
+//---------------------------------------------------------------------
+BSPScopedTimer::~BSPScopedTimer()
+{
+	if (m_Stats)
+		m_Stats->AddStage(m_Stage, chrono::duration<double>(chrono::steady_clock::now() - m_Start).count(), m_Bytes);
+}
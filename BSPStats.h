@@ -0,0 +1,95 @@
+/*
+	This file collects statistics about the conversion of a map : how long
+	every stage took, how many bytes it read from the BSP file, what every
+	model's mesh came out as and the peak memory use of the process.
+
+	Stages are timed by BSPScopedTimer, which does nothing without stats so
+	it can be left around code that runs either way. Stages with the same name
+	add up. Everything can be recorded from worker threads.
+
+	The results are written as JSON, to compare a slow map with the others
+	without a profiler. Peak RSS is the process', so in batch mode it also
+	covers the maps converted before and alongside.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+using namespace std;
+
+// Time spent in a stage and what it read
+struct BSPStatsStage {
+	string		name;
+	double		seconds;
+	uint64_t	bytes;			// Lump bytes read, 0 if the stage doesn't read the BSP file
+	unsigned	count;			// Times the stage ran
+};
+
+// A mesh as it was handed to the exporter
+struct BSPStatsModel {
+	string		node;
+	unsigned	faces;			// BSP faces the mesh was built from
+	unsigned	polygons;		// Polygons or triangles written
+	size_t		controlPoints;
+	size_t		polygonVertices;
+	double		seconds;		// Building, welding and triangulating the mesh
+};
+
+// ======================================================================
+// BSPStats holds the statistics of the conversion of a single map
+// ======================================================================
+class BSPStats
+{
+public:
+	BSPStats();
+
+	// Forget the previous map and restart the total time
+	void Clear();
+
+	// Add to a stage, created the first time its name is seen
+	void AddStage(const char* name, double seconds, uint64_t bytes = 0);
+
+	// Add to a counter, created the first time its name is seen
+	void AddCounter(const char* name, uint64_t value);
+
+	void AddModel(const BSPStatsModel& model);
+
+	// Write everything recorded since Clear as JSON
+	// Returns false if the file couldn't be written
+	bool WriteJSON(const char* fileName, const char* bspFileName) const;
+
+	// Largest resident set of the process so far in bytes, 0 if unknown
+	static uint64_t GetPeakRSS();
+
+private:
+	mutable mutex					m_Mutex;
+	chrono::steady_clock::time_point	m_Start;
+	vector<BSPStatsStage>			m_Stages;		// In the order they first ran
+	vector<pair<string, uint64_t>>	m_Counters;
+	vector<BSPStatsModel>			m_Models;
+};
+
+// ======================================================================
+// BSPScopedTimer adds the time until it's destroyed to a stage of stats,
+// if stats isn't null
+// ======================================================================
+class BSPScopedTimer
+{
+public:
+	BSPScopedTimer(BSPStats* stats, const char* stage, uint64_t bytes = 0);
+	~BSPScopedTimer();
+
+	// Bytes read aren't always known before the stage runs
+	void SetBytes(uint64_t bytes) { m_Bytes = bytes; }
+
+private:
+	BSPStats*						m_Stats;
+	const char*						m_Stage;
+	uint64_t						m_Bytes;
+	chrono::steady_clock::time_point	m_Start;
+};
@@ -0,0 +1,118 @@
+#include "BSPTextures.h"
+#include "CPUFeatures.h"
+#include <string.h>
+
+#ifdef BSP2FBX_X86
+#include <immintrin.h>
+#endif
+
+// Textures are at most 4096 texels wide or high in every GoldSrc tool
+#define MAX_TEXTURE_SIZE 4096
+
+// Colors in a miptex palette
+#define PALETTE_COLORS 256
+
+//---------------------------------------------------------------------
+void ExpandPaletteScalar(const uint8_t* indices, size_t count, const uint32_t* palette, uint32_t* rgba)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		rgba[i + 0] = palette[indices[i + 0]];
+		rgba[i + 1] = palette[indices[i + 1]];
+		rgba[i + 2] = palette[indices[i + 2]];
+		rgba[i + 3] = palette[indices[i + 3]];
+	}
+	for (; i < count; i++)
+		rgba[i] = palette[indices[i]];
+}
+
+#ifdef BSP2FBX_X86
+//---------------------------------------------------------------------
+BSP2FBX_TARGET_AVX2
+static void ExpandPaletteAVX2(const uint8_t* indices, size_t count, const uint32_t* palette, uint32_t* rgba)
+{
+	// 16 pixels per iteration : two gathers of 8 colors from the 1KB palette,
+	// which stays in L1 for the whole texture
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i packed = _mm_loadu_si128((const __m128i*)(indices + i));
+		__m256i lo = _mm256_cvtepu8_epi32(packed);
+		__m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(packed, 8));
+		__m256i colorsLo = _mm256_i32gather_epi32((const int*)palette, lo, 4);
+		__m256i colorsHi = _mm256_i32gather_epi32((const int*)palette, hi, 4);
+		_mm256_storeu_si256((__m256i*)(rgba + i), colorsLo);
+		_mm256_storeu_si256((__m256i*)(rgba + i + 8), colorsHi);
+	}
+	ExpandPaletteScalar(indices + i, count - i, palette, rgba + i);
+}
+#endif
+
+//---------------------------------------------------------------------
+void ExpandPalette(const uint8_t* indices, size_t count, const uint32_t* palette, uint32_t* rgba)
+{
+#ifdef BSP2FBX_X86
+	if (CPUHasAVX2()) {
+		ExpandPaletteAVX2(indices, count, palette, rgba);
+		return;
+	}
+#endif
+	ExpandPaletteScalar(indices, count, palette, rgba);
+}
+
+//---------------------------------------------------------------------
+bool DecodeMiptex(const uint8_t* data, size_t size, BSPTextureImage& image)
+{
+	if (size < sizeof(BSPMIPTEX))
+		return false;
+
+	BSPMIPTEX header;
+	memcpy(&header, data, sizeof(BSPMIPTEX));
+	image.name.assign(header.szName, strnlen(header.szName, MAXTEXTURENAME));
+	image.width = header.nWidth;
+	image.height = header.nHeight;
+	image.transparent = IsTransparentTexture(image.name.c_str());
+
+	// Textures living in a WAD file only have their header in the BSP
+	if (header.nOffsets[0] == 0)
+		return false;
+
+	if (header.nWidth == 0 || header.nHeight == 0 || header.nWidth > MAX_TEXTURE_SIZE || header.nHeight > MAX_TEXTURE_SIZE)
+		return false;
+
+	// Every mip level has to fit before the palette
+	for (unsigned level = 0; level < MIPLEVELS; level++) {
+		size_t mipSize = (size_t)image.GetMipWidth(level) * image.GetMipHeight(level);
+		if (header.nOffsets[level] < sizeof(BSPMIPTEX) || (size_t)header.nOffsets[level] + mipSize > size)
+			return false;
+	}
+
+	size_t paletteOffset = (size_t)header.nOffsets[MIPLEVELS - 1] +
+		(size_t)image.GetMipWidth(MIPLEVELS - 1) * image.GetMipHeight(MIPLEVELS - 1);
+	if (paletteOffset + 2 > size)
+		return false;
+	uint16_t nColors;
+	memcpy(&nColors, data + paletteOffset, 2);
+	const uint8_t* paletteRGB = data + paletteOffset + 2;
+	if (nColors > PALETTE_COLORS || paletteOffset + 2 + (size_t)nColors * 3 > size)
+		return false;
+
+	// Opaque RGBA palette, missing colors are black
+	uint32_t palette[PALETTE_COLORS];
+	for (unsigned i = 0; i < PALETTE_COLORS; i++) {
+		if (i < nColors)
+			palette[i] = paletteRGB[i * 3] | (paletteRGB[i * 3 + 1] << 8) | (paletteRGB[i * 3 + 2] << 16) | 0xFF000000u;
+		else
+			palette[i] = 0xFF000000u;
+	}
+
+	// The blue key becomes fully transparent black so filtering doesn't bleed blue
+	if (image.transparent)
+		palette[PALETTE_COLORS - 1] = 0;
+
+	for (unsigned level = 0; level < MIPLEVELS; level++) {
+		size_t mipSize = (size_t)image.GetMipWidth(level) * image.GetMipHeight(level);
+		image.mips[level].resize(mipSize);
+		ExpandPalette(data + header.nOffsets[level], mipSize, palette, image.mips[level].data());
+	}
+	return true;
+}
@@ -0,0 +1,51 @@
+/*
+	This file decodes GoldSrc miptex textures, embedded in BSP files or
+	stored in WAD files, to RGBA.
+
+	A miptex is a BSPMIPTEX header followed by 4 mip levels of 8 bit
+	palette indices, each half the size of the previous one, then the
+	palette used by all of them:
+		BSPMIPTEX, mip 0, mip 1, mip 2, mip 3, uint16 nColors, nColors * RGB
+	Textures whose name starts with '{' are blue keyed : their last palette
+	entry is transparent.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "BSPDefines.h"
+
+using namespace std;
+
+// A decoded miptex
+struct BSPTextureImage {
+	string				name;
+	unsigned			width, height;		// Size of mip level 0
+	bool				transparent;		// Blue keyed, with an alpha channel
+	vector<uint32_t>	mips[MIPLEVELS];	// RGBA pixels of every mip level, R in the lowest byte
+
+	BSPTextureImage() {
+		width = height = 0;
+		transparent = false;
+	}
+
+	unsigned GetMipWidth(unsigned level) const	{ return width >> level; }
+	unsigned GetMipHeight(unsigned level) const	{ return height >> level; }
+};
+
+// Decode the miptex stored in the size bytes at data
+// Returns false if it's truncated, corrupt or has no pixels (stored in a WAD file)
+bool DecodeMiptex(const uint8_t* data, size_t size, BSPTextureImage& image);
+
+// Expand count palette indices to RGBA colors
+// Uses AVX2 gathers when the CPU supports them and a scalar loop otherwise
+void ExpandPalette(const uint8_t* indices, size_t count, const uint32_t* palette, uint32_t* rgba);
+
+// Scalar version of ExpandPalette, also used for the tail of the vectorized one
+void ExpandPaletteScalar(const uint8_t* indices, size_t count, const uint32_t* palette, uint32_t* rgba);
+
+// Whether a texture is blue keyed
+inline bool IsTransparentTexture(const char* name) { return name[0] == '{'; }
@@ -0,0 +1,228 @@
+#include "BSPVertexKernel.h"
+#include "BSPLoader.h"
+#include "CPUFeatures.h"
+#include <math.h>
+#include <stdlib.h>
+
+#ifdef BSP2FBX_X86
+#include <immintrin.h>
+#endif
+
+// Floats per FaceParams, the stride of the gathers
+#define FACE_PARAMS_FLOATS 16
+
+//---------------------------------------------------------------------
+void BSPVertexKernel::Clear()
+{
+	m_Faces.clear();
+	m_X.clear();
+	m_Y.clear();
+	m_Z.clear();
+	m_NextX.clear();
+	m_NextY.clear();
+	m_NextZ.clear();
+	m_Face.clear();
+}
+
+//---------------------------------------------------------------------
+void BSPVertexKernel::Reserve(size_t nFaces, size_t nVertices)
+{
+	m_Faces.reserve(nFaces);
+	m_X.reserve(nVertices);
+	m_Y.reserve(nVertices);
+	m_Z.reserve(nVertices);
+	m_NextX.reserve(nVertices);
+	m_NextY.reserve(nVertices);
+	m_NextZ.reserve(nVertices);
+	m_Face.reserve(nVertices);
+}
+
+//---------------------------------------------------------------------
+void BSPVertexKernel::AddFace(const BSPLoader& loader, unsigned faceId)
+{
+	static_assert(sizeof(FaceParams) == FACE_PARAMS_FLOATS * sizeof(float), "FaceParams must match the gather stride");
+
+	const BSPFACE* face = &loader.m_Faces[faceId];
+	const BSPTEXTUREINFO& texInfo = loader.m_TextureInfos[face->iTextureInfo];
+	const BSPMIPTEX& tex = loader.m_Textures[texInfo.iMiptex];
+	const BSPPLANE& plane = loader.m_Planes[face->iPlane];
+
+	FaceParams params = {};
+	params.s[0] = texInfo.vS.x;
+	params.s[1] = texInfo.vS.y;
+	params.s[2] = texInfo.vS.z;
+	params.s[3] = texInfo.fSShift;
+	params.t[0] = texInfo.vT.x;
+	params.t[1] = texInfo.vT.y;
+	params.t[2] = texInfo.vT.z;
+	params.t[3] = texInfo.fTShift;
+
+	// Texture coordinates are in texels, FBX wants them relative to the texture size
+	params.width = tex.nWidth ? (float)tex.nWidth : 1.0f;
+	params.height = tex.nHeight ? (float)tex.nHeight : 1.0f;
+
+	// Faces on the back side of their plane face the other way
+	float side = face->nPlaneSide ? -1.0f : 1.0f;
+	params.normal[0] = plane.vNormal.x * side;
+	params.normal[1] = plane.vNormal.y * side;
+	params.normal[2] = plane.vNormal.z * side;
+
+	uint32_t faceIndex = (uint32_t)m_Faces.size();
+	m_Faces.push_back(params);
+
+	// A face is a closed loop of surfedges, v0 -> v1, v1 -> v2, ... vN-1 -> v0,
+	// every surfedge gives a vertex and the tangent along it
+	for (unsigned surfedgeId = face->iFirstEdge; surfedgeId < face->iFirstEdge + face->nEdges; surfedgeId++) {
+		int edgeId = loader.m_SurfEdges[surfedgeId];
+		const BSPEDGE& edge = loader.m_Edges[abs(edgeId)];
+
+		// Negative surfedges use their edge backwards
+		const VECTOR3D& v0 = loader.m_Vertices[edgeId < 0 ? edge.iVertex[1] : edge.iVertex[0]];
+		const VECTOR3D& v1 = loader.m_Vertices[edgeId < 0 ? edge.iVertex[0] : edge.iVertex[1]];
+
+		m_X.push_back(v0.x);
+		m_Y.push_back(v0.y);
+		m_Z.push_back(v0.z);
+		m_NextX.push_back(v1.x);
+		m_NextY.push_back(v1.y);
+		m_NextZ.push_back(v1.z);
+		m_Face.push_back(faceIndex);
+	}
+}
+
+//---------------------------------------------------------------------
+void BSPVertexKernel::ComputeScalar(size_t first, float* positions, float* normals, float* uvs, float* tangents, float* st) const
+{
+	for (size_t i = first; i < m_Face.size(); i++) {
+		const FaceParams& face = m_Faces[m_Face[i]];
+		float x = m_X[i];
+		float y = m_Y[i];
+		float z = m_Z[i];
+
+		// Every edge naturally defines a tangent as well
+		float tx = x - m_NextX[i];
+		float ty = y - m_NextY[i];
+		float tz = z - m_NextZ[i];
+		float length = sqrtf(tx * tx + ty * ty + tz * tz);
+		tx = tx / length;
+		ty = ty / length;
+		tz = tz / length;
+
+		// http://www.flipcode.com/archives/Quake_2_BSP_File_Format.shtml
+		float u = (face.s[0] * x + face.s[1] * y + face.s[2] * z) + face.s[3];
+		float v = (face.t[0] * x + face.t[1] * y + face.t[2] * z) + face.t[3];
+
+		positions[i * 3 + 0] = x;
+		positions[i * 3 + 1] = z;
+		positions[i * 3 + 2] = y;
+		normals[i * 3 + 0] = face.normal[0];
+		normals[i * 3 + 1] = face.normal[2];
+		normals[i * 3 + 2] = face.normal[1];
+		tangents[i * 3 + 0] = tx;
+		tangents[i * 3 + 1] = tz;
+		tangents[i * 3 + 2] = ty;
+
+		// Texture rows go down in GoldSrc but V goes up in FBX
+		uvs[i * 2 + 0] = u / face.width;
+		uvs[i * 2 + 1] = -v / face.height;
+		if (st) {
+			st[i * 2 + 0] = u;
+			st[i * 2 + 1] = v;
+		}
+	}
+}
+
+#ifdef BSP2FBX_X86
+//---------------------------------------------------------------------
+// Store 8 vectors a b c as a0 b0 c0 a1 b1 c1 ... a7 b7 c7
+BSP2FBX_TARGET_AVX2
+static inline void StoreInterleaved3(float* out, __m256 a, __m256 b, __m256 c)
+{
+	// Within each 128 bit half : r0 = a0 b0 c0 a1, r1 = b1 c1 a2 b2, r2 = c2 a3 b3 c3
+	__m256 r0 = _mm256_blend_ps(_mm256_blend_ps(_mm256_permute_ps(a, _MM_SHUFFLE(1, 0, 0, 0)),
+		_mm256_permute_ps(b, _MM_SHUFFLE(0, 0, 0, 0)), 0x22), _mm256_permute_ps(c, _MM_SHUFFLE(0, 0, 0, 0)), 0x44);
+	__m256 r1 = _mm256_blend_ps(_mm256_blend_ps(_mm256_permute_ps(b, _MM_SHUFFLE(2, 2, 2, 1)),
+		_mm256_permute_ps(a, _MM_SHUFFLE(2, 2, 2, 2)), 0x44), _mm256_permute_ps(c, _MM_SHUFFLE(1, 1, 1, 1)), 0x22);
+	__m256 r2 = _mm256_blend_ps(_mm256_blend_ps(_mm256_permute_ps(c, _MM_SHUFFLE(3, 3, 3, 2)),
+		_mm256_permute_ps(a, _MM_SHUFFLE(3, 3, 3, 3)), 0x22), _mm256_permute_ps(b, _MM_SHUFFLE(3, 3, 3, 3)), 0x44);
+	_mm256_storeu_ps(out, _mm256_permute2f128_ps(r0, r1, 0x20));
+	_mm256_storeu_ps(out + 8, _mm256_permute2f128_ps(r2, r0, 0x30));
+	_mm256_storeu_ps(out + 16, _mm256_permute2f128_ps(r1, r2, 0x31));
+}
+
+//---------------------------------------------------------------------
+// Store 8 vectors a b as a0 b0 a1 b1 ... a7 b7
+BSP2FBX_TARGET_AVX2
+static inline void StoreInterleaved2(float* out, __m256 a, __m256 b)
+{
+	__m256 lo = _mm256_unpacklo_ps(a, b);
+	__m256 hi = _mm256_unpackhi_ps(a, b);
+	_mm256_storeu_ps(out, _mm256_permute2f128_ps(lo, hi, 0x20));
+	_mm256_storeu_ps(out + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+}
+
+//---------------------------------------------------------------------
+BSP2FBX_TARGET_AVX2
+void BSPVertexKernel::ComputeAVX2(float* positions, float* normals, float* uvs, float* tangents, float* st) const
+{
+	const float* faces = (const float*)m_Faces.data();
+	const __m256 signMask = _mm256_set1_ps(-0.0f);
+	size_t count = m_Face.size();
+
+	// 8 vertices per iteration, computed in lanes then interleaved into the streams
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		// Offsets of the lanes' FaceParams, FACE_PARAMS_FLOATS floats each
+		__m256i offsets = _mm256_slli_epi32(_mm256_loadu_si256((const __m256i*)&m_Face[i]), 4);
+		__m256 x = _mm256_loadu_ps(&m_X[i]);
+		__m256 y = _mm256_loadu_ps(&m_Y[i]);
+		__m256 z = _mm256_loadu_ps(&m_Z[i]);
+
+		__m256 tx = _mm256_sub_ps(x, _mm256_loadu_ps(&m_NextX[i]));
+		__m256 ty = _mm256_sub_ps(y, _mm256_loadu_ps(&m_NextY[i]));
+		__m256 tz = _mm256_sub_ps(z, _mm256_loadu_ps(&m_NextZ[i]));
+		__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, tx), _mm256_mul_ps(ty, ty)), _mm256_mul_ps(tz, tz)));
+		tx = _mm256_div_ps(tx, length);
+		ty = _mm256_div_ps(ty, length);
+		tz = _mm256_div_ps(tz, length);
+
+		// The texture projection of every lane's face
+		__m256 sx = _mm256_i32gather_ps(faces + 0, offsets, 4);
+		__m256 sy = _mm256_i32gather_ps(faces + 1, offsets, 4);
+		__m256 sz = _mm256_i32gather_ps(faces + 2, offsets, 4);
+		__m256 ss = _mm256_i32gather_ps(faces + 3, offsets, 4);
+		__m256 u = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, x), _mm256_mul_ps(sy, y)), _mm256_mul_ps(sz, z)), ss);
+		__m256 tsx = _mm256_i32gather_ps(faces + 4, offsets, 4);
+		__m256 tsy = _mm256_i32gather_ps(faces + 5, offsets, 4);
+		__m256 tsz = _mm256_i32gather_ps(faces + 6, offsets, 4);
+		__m256 ts = _mm256_i32gather_ps(faces + 7, offsets, 4);
+		__m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tsx, x), _mm256_mul_ps(tsy, y)), _mm256_mul_ps(tsz, z)), ts);
+		__m256 uvU = _mm256_div_ps(u, _mm256_i32gather_ps(faces + 8, offsets, 4));
+		__m256 uvV = _mm256_div_ps(_mm256_xor_ps(v, signMask), _mm256_i32gather_ps(faces + 9, offsets, 4));
+		__m256 nx = _mm256_i32gather_ps(faces + 10, offsets, 4);
+		__m256 ny = _mm256_i32gather_ps(faces + 11, offsets, 4);
+		__m256 nz = _mm256_i32gather_ps(faces + 12, offsets, 4);
+
+		// Interleaved with Y and Z swapped
+		StoreInterleaved3(positions + i * 3, x, z, y);
+		StoreInterleaved3(normals + i * 3, nx, nz, ny);
+		StoreInterleaved3(tangents + i * 3, tx, tz, ty);
+		StoreInterleaved2(uvs + i * 2, uvU, uvV);
+		if (st)
+			StoreInterleaved2(st + i * 2, u, v);
+	}
+	ComputeScalar(i, positions, normals, uvs, tangents, st);
+}
+#endif
+
+//---------------------------------------------------------------------
+void BSPVertexKernel::Compute(float* positions, float* normals, float* uvs, float* tangents, float* st) const
+{
+#ifdef BSP2FBX_X86
+	if (CPUHasAVX2()) {
+		ComputeAVX2(positions, normals, uvs, tangents, st);
+		return;
+	}
+#endif
+	ComputeScalar(0, positions, normals, uvs, tangents, st);
+}
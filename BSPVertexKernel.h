@@ -0,0 +1,65 @@
+/*
+	This file computes the attributes of the polygon vertices of a mesh in
+	batches : faces are first gathered into a structure of arrays, then a
+	single kernel computes the position, normal, texture coordinates and
+	tangent of every vertex, 8 at a time with AVX2.
+
+	Every vertex keeps the index of its face, whose texture projection,
+	texture size and normal are read with gathers from a table of 16 floats
+	per face, so batches run across face boundaries. The AVX2 and scalar
+	kernels do the same operations in the same order without FMA, so they
+	compute the same bits and the outputs don't depend on the CPU.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "BSPDefines.h"
+
+using namespace std;
+
+class BSPLoader;
+
+class BSPVertexKernel {
+public:
+	// Empty the batch but keep its buffers around for the next one
+	void Clear();
+
+	// Allocate the batch once for the given number of faces and vertices
+	void Reserve(size_t nFaces, size_t nVertices);
+
+	// Gather the vertices of a face, in surfedge order
+	void AddFace(const BSPLoader& loader, unsigned faceId);
+
+	size_t GetVertexCount() const { return m_Face.size(); }
+
+	// Write the attributes of every gathered vertex to streams sized for them,
+	// swapped to Y up like SwitchHandedness : positions, normals and tangents
+	// x y z, uvs u v relative to the texture size with V going up.
+	// st receives the texture coordinates in texels, s t, unless it's null
+	// Uses AVX2 when the CPU supports it and the scalar kernel otherwise
+	void Compute(float* positions, float* normals, float* uvs, float* tangents, float* st) const;
+
+	// Scalar version of Compute, also used for the tail of the vectorized one
+	void ComputeScalar(size_t first, float* positions, float* normals, float* uvs, float* tangents, float* st) const;
+
+private:
+	// Texture projection (BSPTEXTUREINFO's vS, fSShift, vT, fTShift), texture
+	// size and normal of a face, padded to a cache line
+	struct FaceParams {
+		float	s[4];
+		float	t[4];
+		float	width, height;
+		float	normal[3];
+		float	pad[3];
+	};
+
+	void ComputeAVX2(float* positions, float* normals, float* uvs, float* tangents, float* st) const;
+
+	vector<FaceParams>	m_Faces;
+	vector<float>		m_X, m_Y, m_Z;					// Start vertex of every surfedge
+	vector<float>		m_NextX, m_NextY, m_NextZ;		// End vertex of every surfedge, which defines the tangent
+	vector<uint32_t>	m_Face;							// Face of every vertex, in m_Faces
+};
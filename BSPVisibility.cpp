@@ -0,0 +1,108 @@
+#include "BSPVisibility.h"
+#include "BSPLoader.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+//---------------------------------------------------------------------
+BSPVisibility::BSPVisibility()
+{
+	m_RowSize = 0;
+	m_nLeaves = 0;
+}
+
+//---------------------------------------------------------------------
+void BSPVisibility::Clear()
+{
+	m_Rows.clear();
+	m_RowSize = 0;
+	m_nLeaves = 0;
+}
+
+//---------------------------------------------------------------------
+void BSPVisibility::Build(const BSPLoader& loader)
+{
+	Clear();
+	if (loader.m_nModels == 0 || loader.m_nLeaves < 2)
+		return;
+
+	// Leaf 0 is never visible, worldspawn's leaves are the first ones after it
+	int nVisLeafs = loader.m_Models[0].nVisLeafs;
+	if (nVisLeafs <= 0 || (unsigned)nVisLeafs >= loader.m_nLeaves) {
+		printf("[WARNING] Worldspawn claims %d leaves out of %u, using all of them\n", nVisLeafs, loader.m_nLeaves - 1);
+		nVisLeafs = (int)loader.m_nLeaves - 1;
+	}
+	m_nLeaves = (unsigned)nVisLeafs;
+	m_RowSize = (m_nLeaves + 7) / 8;
+	m_Rows.assign(m_RowSize * m_nLeaves, 0);
+
+	unsigned nCorrupt = 0;
+	for (unsigned leafId = 1; leafId <= m_nLeaves; leafId++) {
+		uint8_t* row = &m_Rows[(leafId - 1) * m_RowSize];
+		int32_t offset = loader.m_Leaves[leafId].nVisOffset;
+
+		// Without vis data the engine draws everything
+		bool decoded = false;
+		if (offset >= 0 && (size_t)offset < loader.m_nVisibility) {
+			decoded = DecompressRow(loader.m_Visibility + offset, loader.m_nVisibility - offset, row, m_RowSize);
+			if (!decoded)
+				nCorrupt++;
+		}
+		if (!decoded)
+			memset(row, 0xFF, m_RowSize);
+
+		// Bits past the last leaf are padding
+		if (m_nLeaves & 7)
+			row[m_RowSize - 1] &= (uint8_t)((1 << (m_nLeaves & 7)) - 1);
+	}
+	if (nCorrupt)
+		printf("[WARNING] %u leaves have a truncated PVS and see everything\n", nCorrupt);
+}
+
+//---------------------------------------------------------------------
+bool BSPVisibility::DecompressRow(const uint8_t* in, size_t inSize, uint8_t* out, size_t rowSize)
+{
+	const uint8_t* inEnd = in + inSize;
+	uint8_t* outEnd = out + rowSize;
+	while (out < outEnd) {
+		if (in >= inEnd)
+			return false;
+
+		// Copy the literal bytes up to the next zero run at once
+		size_t nLiterals = min((size_t)(inEnd - in), (size_t)(outEnd - out));
+		const uint8_t* zero = (const uint8_t*)memchr(in, 0, nLiterals);
+		if (zero)
+			nLiterals = zero - in;
+		memcpy(out, in, nLiterals);
+		in += nLiterals;
+		out += nLiterals;
+		if (!zero || out >= outEnd)
+			continue;
+
+		// Zero runs are already zero in out
+		if (in + 1 >= inEnd)
+			return false;
+		out += min((size_t)in[1], (size_t)(outEnd - out));
+		in += 2;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------
+void BSPVisibility::CompressRow(const uint8_t* row, size_t rowSize, vector<uint8_t>& out)
+{
+	for (size_t i = 0; i < rowSize; i++) {
+		if (row[i]) {
+			out.push_back(row[i]);
+			continue;
+		}
+
+		// A run counts up to 255 zero bytes
+		size_t nZeros = 1;
+		while (i + nZeros < rowSize && row[i + nZeros] == 0 && nZeros < 255)
+			nZeros++;
+		out.push_back(0);
+		out.push_back((uint8_t)nZeros);
+		i += nZeros - 1;
+	}
+}
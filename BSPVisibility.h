@@ -0,0 +1,59 @@
+/*
+	This file decodes the potentially visible sets of a BSP file.
+
+	The PVS of a leaf is a bitset of the leaves which can be seen from
+	anywhere inside it, bit i standing for leaf i + 1 since leaf 0 is the
+	solid leaf shared by the whole map. Only the worldspawn's nVisLeafs
+	leaves have one. Rows are run-length compressed in the visibility lump :
+	a non-zero byte is copied as is, a zero byte is followed by the number of
+	zero bytes it stands for. Leaves whose nVisOffset is -1, like every leaf of
+	maps compiled without vis, see the whole map.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+using namespace std;
+
+class BSPLoader;
+
+// ======================================================================
+// BSPVisibility holds the decompressed PVS of every leaf of a BSP file
+// ======================================================================
+class BSPVisibility
+{
+public:
+	BSPVisibility();
+
+	// Decompress the PVS of every leaf of the worldspawn
+	// Leaves, the visibility lump and models have to be read
+	void Build(const BSPLoader& loader);
+
+	// Forget the decompressed sets
+	void Clear();
+
+	bool		IsEmpty() const			{ return m_nLeaves == 0; }
+	unsigned	GetLeafCount() const	{ return m_nLeaves; }		// Leaves with a PVS, leaf 0 excluded
+	size_t		GetRowSize() const		{ return m_RowSize; }
+
+	// Whether leaf to is in the PVS of leaf from, both in [1, GetLeafCount()]
+	bool IsVisible(unsigned from, unsigned to) const {
+		unsigned bit = to - 1;
+		return (m_Rows[(from - 1) * m_RowSize + (bit >> 3)] & (1 << (bit & 7))) != 0;
+	}
+
+	// Decompress a row of rowSize bytes, returns false if the data ends before the row
+	// out has to be zeroed, the rest of a truncated row is left as it is
+	static bool DecompressRow(const uint8_t* in, size_t inSize, uint8_t* out, size_t rowSize);
+
+	// Run-length compress a row like the visibility lump, appending it to out
+	static void CompressRow(const uint8_t* row, size_t rowSize, vector<uint8_t>& out);
+
+private:
+	vector<uint8_t>	m_Rows;		// PVS of every leaf, leaf 1 first
+	size_t			m_RowSize;	// Bytes per row
+	unsigned		m_nLeaves;
+};
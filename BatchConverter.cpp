@@ -0,0 +1,187 @@
+#include "BatchConverter.h"
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+namespace fs = std::filesystem;
+
+// Serializes per map report lines coming from several workers
+static mutex s_reportLock;
+
+//---------------------------------------------------------------------
+BatchConverter::BatchConverter(const BSP2FBXOptions& options)
+{
+	m_options = options;
+	m_cache = nullptr;
+	if (!m_options.cacheDirectory.empty())
+		m_cache = new ConversionCache(m_options.cacheDirectory, m_options.cacheMaxBytes, m_options);
+}
+
+//---------------------------------------------------------------------
+BatchConverter::~BatchConverter()
+{
+	if (m_cache)
+		delete m_cache;
+}
+
+//---------------------------------------------------------------------
+bool BatchConverter::AddInput(const char* input)
+{
+	// Response file : one input per line
+	if (input[0] == '@') {
+		ifstream responseFile(input + 1);
+		if (!responseFile.is_open()) {
+			printf("ERROR: Unable to open response file %s\n", input + 1);
+			return false;
+		}
+		string line;
+		while (getline(responseFile, line)) {
+			// Ignore line endings, surrounding blanks, empty lines and comments
+			size_t first = line.find_first_not_of(" \t\r");
+			size_t last = line.find_last_not_of(" \t\r");
+			if (first == string::npos || line[first] == '#')
+				continue;
+			if (!AddInput(line.substr(first, last - first + 1).c_str()))
+				return false;
+		}
+		return true;
+	}
+
+	std::error_code ec;
+	fs::path path(input);
+
+	// Directory : every .bsp file below it
+	if (fs::is_directory(path, ec)) {
+		for (fs::recursive_directory_iterator it(path, ec), end; it != end; it.increment(ec)) {
+			if (ec)
+				break;
+			if (!it->is_regular_file(ec))
+				continue;
+			string extension = it->path().extension().string();
+			transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+			if (extension == ".bsp")
+				m_maps.push_back(MapResult{ it->path().string(), it->file_size(ec), false, false, 0.0 });
+		}
+		return true;
+	}
+
+	if (!fs::is_regular_file(path, ec)) {
+		printf("ERROR: %s is neither a BSP file, a directory nor a response file\n", input);
+		return false;
+	}
+
+	m_maps.push_back(MapResult{ path.string(), fs::file_size(path, ec), false, false, 0.0 });
+	return true;
+}
+
+//---------------------------------------------------------------------
+void BatchConverter::ConvertMap(MapResult& result)
+{
+	auto start = chrono::steady_clock::now();
+
+	// Contexts are created lazily so each FbxManager lives on its worker thread
+	int workerId = ThreadPool::GetCurrentWorkerIndex();
+	if (!m_contexts[workerId])
+		m_contexts[workerId] = new BSP2FBX(m_options, &m_wadCache);
+	BSP2FBX* context = m_contexts[workerId];
+
+	try {
+		if (m_cache)
+			result.success = m_cache->Convert(*context, result.bspFile.c_str(), result.cached);
+		else
+			result.success = context->LoadBSPFile(result.bspFile.c_str()) && context->GenerateOutput();
+	}
+	catch (const exception& e) {
+		printf("[ERROR] %s : %s\n", result.bspFile.c_str(), e.what());
+		result.success = false;
+	}
+
+	// Don't keep the map around until this worker picks up the next one
+	context->UnloadBSPFile();
+
+	result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	lock_guard<mutex> lock(s_reportLock);
+	printf("[%s] %s (%.1f ms)\n", result.success ? (result.cached ? "CACHED" : "OK") : "FAILED",
+		result.bspFile.c_str(), result.seconds * 1000.0);
+}
+
+//---------------------------------------------------------------------
+unsigned BatchConverter::Run()
+{
+	// Biggest maps first so a large map doesn't end up alone at the end of the run
+	stable_sort(m_maps.begin(), m_maps.end(), [](const MapResult& a, const MapResult& b) {
+		return a.fileSize > b.fileSize;
+	});
+
+	auto start = chrono::steady_clock::now();
+
+	unsigned nThreads = m_options.nThreads;
+	{
+		ThreadPool pool(nThreads);
+		nThreads = pool.GetThreadCount();
+		printf("Converting %u maps with %u threads\n", (unsigned)m_maps.size(), nThreads);
+
+		m_contexts.assign(nThreads, nullptr);
+
+		TaskGroup group;
+		for (auto& map : m_maps)
+			pool.Submit([this, &map] { ConvertMap(map); }, &group);
+		pool.Wait(group);
+
+		// Contexts are destroyed on the workers which created them too : each
+		// task waits for all the others to start so every worker runs one
+		atomic<unsigned> nStarted(0);
+		TaskGroup teardown;
+		for (unsigned i = 0; i < nThreads; i++) {
+			pool.Submit([this, &nStarted, nThreads] {
+				nStarted++;
+				while (nStarted < nThreads)
+					this_thread::yield();
+				int workerId = ThreadPool::GetCurrentWorkerIndex();
+				delete m_contexts[workerId];
+				m_contexts[workerId] = nullptr;
+			}, &teardown);
+		}
+		pool.Wait(teardown);
+		m_contexts.clear();
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	// ----- Summary -----
+	unsigned nFailed = 0;
+	uintmax_t totalBytes = 0;
+	for (auto& map : m_maps) {
+		if (!map.success)
+			nFailed++;
+		totalBytes += map.fileSize;
+	}
+
+	if (nFailed) {
+		printf("Failed maps:\n");
+		for (auto& map : m_maps) {
+			if (!map.success)
+				printf("  %s\n", map.bspFile.c_str());
+		}
+	}
+
+	if (m_cache)
+		printf("%u maps were reused from the cache, %u converted\n", m_cache->GetHitCount(), m_cache->GetMissCount());
+
+	if (m_options.exportTextures)
+		printf("%u WAD textures were decoded for all maps\n", (unsigned)m_wadCache.GetDecodedCount());
+
+	double megabytes = totalBytes / (1024.0 * 1024.0);
+	printf("*** Batch done : %u succeeded, %u failed in %.2f s (%.2f maps/s, %.2f MB/s) ***\n",
+		(unsigned)m_maps.size() - nFailed, nFailed, seconds,
+		seconds > 0.0 ? m_maps.size() / seconds : 0.0,
+		seconds > 0.0 ? megabytes / seconds : 0.0);
+
+	return nFailed;
+}
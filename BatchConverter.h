@@ -0,0 +1,55 @@
+/*
+	The BatchConverter class converts many BSP files in one process.
+	Maps are spread over a work-stealing ThreadPool and every worker thread
+	keeps its own BSP2FBX context (and so its own FbxManager) across maps.
+	Textures read from WAD files are decoded once and shared by all maps.
+	Maps whose outputs are in the ConversionCache aren't converted again.
+*/
+
+#pragma once
+
+#include "BSP2FBX.h"
+#include "WADLoader.h"
+#include "ConversionCache.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class BatchConverter {
+public:
+	// Constructor
+	BatchConverter(const BSP2FBXOptions& options);
+
+	// Destructor
+	~BatchConverter();
+
+	// Add maps to convert from an input which is either
+	// - a BSP file
+	// - a directory, searched recursively for .bsp files
+	// - a response file prefixed with '@' listing one input per line
+	// Returns false if the input can't be read
+	bool AddInput(const char* input);
+
+	// Convert every map and print a summary, returns the number of failed maps
+	unsigned Run();
+
+private:
+	// Result of converting a single map
+	struct MapResult {
+		string		bspFile;
+		uintmax_t	fileSize;
+		bool		success;
+		bool		cached;		// Outputs were reused from the cache
+		double		seconds;
+	};
+
+	// Convert a single map using the context of the calling worker
+	void ConvertMap(MapResult& result);
+
+	BSP2FBXOptions			m_options;
+	vector<MapResult>		m_maps;			// Every map to convert and its result
+	vector<BSP2FBX*>		m_contexts;		// One conversion context per worker
+	WADTextureCache			m_wadCache;		// WAD textures decoded once for all the maps
+	ConversionCache*		m_cache;		// Outputs of maps converted before, null without a cache directory
+};
@@ -0,0 +1,409 @@
+#include "Benchmark.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <filesystem>
+#include "BSPLoader.h"
+#include "BSPEntityList.h"
+#include "BSPVertexKernel.h"
+#include "BSP2FBX.h"
+#include "FBXNativeExporter.h"
+#include "GLTFExporter.h"
+
+using namespace std;
+
+// Best, median and mean durations of a set of runs, in seconds
+struct BenchmarkTimes {
+	double	best;
+	double	median;
+	double	mean;
+};
+
+//---------------------------------------------------------------------
+static BenchmarkTimes SummarizeRuns(vector<double> durations)
+{
+	if (durations.empty())
+		return { 0.0, 0.0, 0.0 };
+	sort(durations.begin(), durations.end());
+	double total = 0.0;
+	for (double duration : durations)
+		total += duration;
+	return { durations[0], durations[durations.size() / 2], total / durations.size() };
+}
+
+//---------------------------------------------------------------------
+// Duration of a single call of function, in seconds
+template<typename F>
+static double TimeRun(F function)
+{
+	auto start = chrono::steady_clock::now();
+	function();
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//---------------------------------------------------------------------
+// Run function iterations times and time every run
+template<typename F>
+static BenchmarkTimes TimeRuns(unsigned iterations, F function)
+{
+	vector<double> durations(iterations);
+	for (unsigned i = 0; i < iterations; i++)
+		durations[i] = TimeRun(function);
+	return SummarizeRuns(durations);
+}
+
+//---------------------------------------------------------------------
+// The parser BSPLoader used before BSPEntityList : the lump is copied to a
+// string, every {...} block and every line of it is copied again, and a line
+// has to be a single "key" "value" pair without spaces around the quotes
+static void ParseEntitiesWithStrings(const char* lump, size_t lumpSize, vector<map<string, string>>& entities)
+{
+	entities.clear();
+	string entitiesStr(lump, strnlen(lump, lumpSize));
+
+	size_t start = 0;
+	size_t end = 0;
+	while (true) {
+		start = entitiesStr.find('{', start);
+		if (start == string::npos)
+			break;
+		end = entitiesStr.find('}', start + 1);
+		if (end == string::npos)
+			break;
+		string entityStr = entitiesStr.substr(start, end - start + 1);
+
+		size_t firstQuote = entityStr.find_first_of('\"');
+		size_t lastQuote = entityStr.find_last_of('\"');
+		string trimmedStr = entityStr.substr(firstQuote, lastQuote);
+
+		map<string, string> attributes;
+		size_t lineStart = 0;
+		while (true) {
+			size_t lineEnd = trimmedStr.find('\n', lineStart);
+			if (lineEnd == string::npos)
+				break;
+			string line = trimmedStr.substr(lineStart, lineEnd - lineStart);
+			string lineTrimmed = line.substr(0, line.find_last_of('\"') + 1);
+			size_t spacePos = lineTrimmed.find(' ');
+			string key = lineTrimmed.substr(1, spacePos - 2);
+			string value = lineTrimmed.substr(spacePos + 2, lineTrimmed.size() - spacePos - 3);
+			attributes[key] = value;
+			lineStart = lineEnd + 1;
+		}
+		entities.push_back(move(attributes));
+		start = end + 1;
+	}
+}
+
+//---------------------------------------------------------------------
+bool RunEntityParserBenchmark(const char* bspFileName, unsigned iterations)
+{
+	if (iterations == 0)
+		iterations = 1;
+
+	BSPLoader loader(bspFileName, true, false);
+	if (!loader.IsValid())
+		return false;
+	const BSPLUMP& lump = loader.m_Header.lump[LUMP_ENTITIES];
+	const char* entityData = (const char*)loader.m_MappedFile.GetData() + lump.nOffset;
+	size_t entityDataSize = (size_t)lump.nLength;
+
+	vector<map<string, string>> stringEntities;
+	BenchmarkTimes stringTimes = TimeRuns(iterations, [&]() {
+		ParseEntitiesWithStrings(entityData, entityDataSize, stringEntities);
+	});
+
+	BSPEntityList entityList;
+	BenchmarkTimes listTimes = TimeRuns(iterations, [&]() {
+		entityList.Parse(string_view(entityData, entityDataSize));
+	});
+
+	// The old parser drops values with spaces and pairs sharing a line, count where they differ
+	unsigned nMismatches = 0;
+	size_t nEntities = entityList.GetEntityCount();
+	if (stringEntities.size() != nEntities)
+		nMismatches++;
+	for (size_t entityId = 0; entityId < min(nEntities, stringEntities.size()); entityId++) {
+		map<string, string> attributes;
+		const BSPEntityPair* pairs = entityList.GetPairs(entityId);
+		for (size_t i = 0; i < entityList.GetPairCount(entityId); i++)
+			attributes[string(pairs[i].key)] = string(pairs[i].value);
+		if (attributes != stringEntities[entityId])
+			nMismatches++;
+	}
+
+	double megabytes = entityDataSize / (1024.0 * 1024.0);
+	printf("%s : %zu entities, %zu bytes, %u runs\n", bspFileName, nEntities, entityDataSize, iterations);
+	printf("  string parser  : best %9.3f ms  median %9.3f ms  %8.1f MB/s\n",
+		stringTimes.best * 1000.0, stringTimes.median * 1000.0, megabytes / stringTimes.best);
+	printf("  BSPEntityList  : best %9.3f ms  median %9.3f ms  %8.1f MB/s\n",
+		listTimes.best * 1000.0, listTimes.median * 1000.0, megabytes / listTimes.best);
+	printf("  speedup        : %.2fx\n", stringTimes.best / listTimes.best);
+	if (nMismatches)
+		printf("  [WARNING] %u entities differ between the parsers\n", nMismatches);
+	return true;
+}
+
+// Conversion stages timed by the synthetic benchmark, in the order they run
+enum BenchmarkStage {
+	STAGE_OPEN,			// BSPLoader's constructor : header and lump validation
+	STAGE_GEOMETRY,		// Lumps needed to build meshes
+	STAGE_ENTITIES,		// ReadEntities, tokenizing and processing the entities
+	STAGE_TOKENIZE,		// BSPEntityList alone on the entity lump
+	STAGE_TREE,			// Nodes, leaves, marksurfaces and visibility
+	STAGE_ATTRIBUTES,	// BSPVertexKernel on every face of worldspawn, AVX2 when supported
+	STAGE_ATTRIBUTES_SCALAR,	// The same with the scalar kernel
+	STAGE_LOAD,			// BSP2FBX::LoadBSPFile as the converter calls it
+	STAGE_MESH,			// Building the meshes of every node, welded or triangulated per options
+	STAGE_NATIVE_FBX,	// Scene written by FBXNativeExporter
+	STAGE_GLB,			// Scene written by GLTFExporter as a .glb
+#ifndef BSP2FBX_NO_FBXSDK
+	STAGE_FBX_SDK,		// Scene built and exported with the FBX SDK
+#endif
+	STAGE_COUNT
+};
+
+static const char* s_stageNames[STAGE_COUNT] = {
+	"open",
+	"geometry",
+	"entities",
+	"tokenize",
+	"tree",
+	"attributes",
+	"attributes_scalar",
+	"load",
+	"mesh",
+	"native_fbx",
+	"glb",
+#ifndef BSP2FBX_NO_FBXSDK
+	"fbx_sdk",
+#endif
+};
+
+// Generated map and the durations of its stages
+struct BenchmarkMap {
+	BSPGeneratorSettings	settings;
+	BSPGeneratorInfo		info;
+	string					fileName;
+	vector<double>			durations[STAGE_COUNT];
+	size_t					nAttributeMismatches = 0;	// Vertices where the AVX2 and scalar kernels differ
+};
+
+//---------------------------------------------------------------------
+// One iteration of every stage on a map, returns false if a stage failed
+static bool RunBenchmarkIteration(BenchmarkMap& map, const BSP2FBXOptions& options, const string& directory)
+{
+	const char* fileName = map.fileName.c_str();
+	{
+		BSPLoader* loader = nullptr;
+		map.durations[STAGE_OPEN].push_back(TimeRun([&]() {
+			loader = new BSPLoader(fileName, options.memoryMapped, false);
+		}));
+		if (!loader->IsValid()) {
+			delete loader;
+			return false;
+		}
+		map.durations[STAGE_GEOMETRY].push_back(TimeRun([&]() {
+			loader->ReadVertices();
+			loader->ReadPlanes();
+			loader->ReadEdges();
+			loader->ReadSurfEdges();
+			loader->ReadTexInfo();
+			loader->ReadTextures();
+			loader->ReadFaces();
+			loader->ReadModels();
+		}));
+
+		map.durations[STAGE_ENTITIES].push_back(TimeRun([&]() {
+			loader->ReadEntities();
+		}));
+		BSPEntityList entityList;
+		map.durations[STAGE_TOKENIZE].push_back(TimeRun([&]() {
+			entityList.Parse(string_view(loader->m_EntityData, loader->m_nEntityData));
+		}));
+		map.durations[STAGE_TREE].push_back(TimeRun([&]() {
+			loader->ReadNodes();
+			loader->ReadLeaves();
+			loader->ReadMarkSurfaces();
+			loader->ReadVisibility();
+		}));
+
+		// Vertex attributes alone, gathered once for both kernels
+		BSPVertexKernel kernel;
+		unsigned nWorldFaces = loader->m_nModels ? loader->m_Models[0].nFaces : 0;
+		for (unsigned faceId = 0; faceId < nWorldFaces; faceId++)
+			kernel.AddFace(*loader, loader->m_Models[0].iFirstFace + faceId);
+		size_t nVertices = kernel.GetVertexCount();
+		vector<float> positions(nVertices * 3), normals(nVertices * 3), uvs(nVertices * 2), tangents(nVertices * 3), st(nVertices * 2);
+		vector<float> scalarPositions(nVertices * 3), scalarNormals(nVertices * 3), scalarUVs(nVertices * 2), scalarTangents(nVertices * 3), scalarST(nVertices * 2);
+		map.durations[STAGE_ATTRIBUTES].push_back(TimeRun([&]() {
+			kernel.Compute(positions.data(), normals.data(), uvs.data(), tangents.data(), st.data());
+		}));
+		map.durations[STAGE_ATTRIBUTES_SCALAR].push_back(TimeRun([&]() {
+			kernel.ComputeScalar(0, scalarPositions.data(), scalarNormals.data(), scalarUVs.data(), scalarTangents.data(), scalarST.data());
+		}));
+
+		// Both kernels have to give the same bits, count the vertices where they don't
+		map.nAttributeMismatches = 0;
+		for (size_t i = 0; i < nVertices; i++) {
+			if (memcmp(&positions[i * 3], &scalarPositions[i * 3], 3 * sizeof(float)) ||
+				memcmp(&normals[i * 3], &scalarNormals[i * 3], 3 * sizeof(float)) ||
+				memcmp(&uvs[i * 2], &scalarUVs[i * 2], 2 * sizeof(float)) ||
+				memcmp(&tangents[i * 3], &scalarTangents[i * 3], 3 * sizeof(float)) ||
+				memcmp(&st[i * 2], &scalarST[i * 2], 2 * sizeof(float)))
+				map.nAttributeMismatches++;
+		}
+		delete loader;
+	}
+
+	// Outputs go to the benchmark directory whatever the options say
+	BSP2FBXOptions benchmarkOptions = options;
+	benchmarkOptions.verbose = false;
+	benchmarkOptions.nativeFbx = false;
+	benchmarkOptions.format = OUTPUT_FBX;
+	benchmarkOptions.exportTextures = false;
+	benchmarkOptions.lightmaps = false;
+	benchmarkOptions.stats = false;
+	BSP2FBX bsp2fbx(benchmarkOptions);
+
+	bool loaded = false;
+	map.durations[STAGE_LOAD].push_back(TimeRun([&]() {
+		loaded = bsp2fbx.LoadBSPFile(fileName);
+	}));
+	if (!loaded)
+		return false;
+
+	size_t nPolygons = 0;
+	map.durations[STAGE_MESH].push_back(TimeRun([&]() {
+		vector<BSPSceneNode> nodes;
+		bsp2fbx.BuildSceneNodes(nodes);
+		bsp2fbx.ForEachMesh(nodes, [&](unsigned, const BSPMeshData& meshData) {
+			nPolygons += meshData.nPolygons;
+		});
+	}));
+
+	bool result = true;
+	string fbxFileName = (std::filesystem::path(directory) / "native.fbx").string();
+	map.durations[STAGE_NATIVE_FBX].push_back(TimeRun([&]() {
+		FBXNativeExporter exporter(options.compressArrays);
+		result = bsp2fbx.ExportScene(exporter, fbxFileName.c_str()) && result;
+	}));
+
+	string glbFileName = (std::filesystem::path(directory) / "scene.glb").string();
+	map.durations[STAGE_GLB].push_back(TimeRun([&]() {
+		GLTFExporter exporter(true);
+		result = bsp2fbx.ExportScene(exporter, glbFileName.c_str()) && result;
+	}));
+
+#ifndef BSP2FBX_NO_FBXSDK
+	// Written next to the generated map
+	map.durations[STAGE_FBX_SDK].push_back(TimeRun([&]() {
+		result = bsp2fbx.GenerateFBX() && result;
+	}));
+#endif
+	return result && nPolygons > 0;
+}
+
+//---------------------------------------------------------------------
+static void WriteBenchmarkJSON(FILE* file, const vector<BenchmarkMap>& maps, unsigned iterations, const BSP2FBXOptions& options)
+{
+	fprintf(file, "{\n");
+	fprintf(file, "  \"version\": 1,\n");
+	fprintf(file, "  \"iterations\": %u,\n", iterations);
+	fprintf(file, "  \"threads\": %u,\n", options.nThreads);
+	fprintf(file, "  \"mmap\": %s,\n", options.memoryMapped ? "true" : "false");
+	fprintf(file, "  \"weld\": %s,\n", options.weld ? "true" : "false");
+	fprintf(file, "  \"triangulate\": %s,\n", options.triangulate ? "true" : "false");
+	fprintf(file, "  \"maps\": [\n");
+	for (size_t mapId = 0; mapId < maps.size(); mapId++) {
+		const BenchmarkMap& map = maps[mapId];
+		fprintf(file, "    {\n");
+		fprintf(file, "      \"faces\": %u,\n", map.info.nFaces);
+		fprintf(file, "      \"world_faces\": %u,\n", map.info.nWorldFaces);
+		fprintf(file, "      \"vertices\": %u,\n", map.info.nVertices);
+		fprintf(file, "      \"models\": %u,\n", map.info.nModels);
+		fprintf(file, "      \"entities\": %u,\n", map.info.nEntities);
+		fprintf(file, "      \"entity_bytes\": %zu,\n", map.info.entityLumpSize);
+		fprintf(file, "      \"file_bytes\": %zu,\n", map.info.fileSize);
+		fprintf(file, "      \"seed\": %u,\n", map.settings.seed);
+		fprintf(file, "      \"attribute_mismatches\": %zu,\n", map.nAttributeMismatches);
+		fprintf(file, "      \"stages\": {\n");
+		for (unsigned stage = 0; stage < STAGE_COUNT; stage++) {
+			BenchmarkTimes times = SummarizeRuns(map.durations[stage]);
+			fprintf(file, "        \"%s\": { \"best_ms\": %.4f, \"median_ms\": %.4f, \"mean_ms\": %.4f }%s\n",
+				s_stageNames[stage], times.best * 1000.0, times.median * 1000.0, times.mean * 1000.0,
+				stage + 1 < STAGE_COUNT ? "," : "");
+		}
+		fprintf(file, "      }\n");
+		fprintf(file, "    }%s\n", mapId + 1 < maps.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n");
+	fprintf(file, "}\n");
+}
+
+//---------------------------------------------------------------------
+bool RunSyntheticBenchmark(const vector<BSPGeneratorSettings>& settings, unsigned iterations,
+	const BSP2FBXOptions& options, const char* jsonFileName)
+{
+	if (iterations == 0)
+		iterations = 1;
+
+	std::error_code ec;
+	std::filesystem::path directory = std::filesystem::temp_directory_path(ec) / "bsp2fbx_benchmark";
+	std::filesystem::create_directories(directory, ec);
+	if (ec) {
+		printf("[ERROR] Couldn't create %s\n", directory.string().c_str());
+		return false;
+	}
+
+	bool result = true;
+	vector<BenchmarkMap> maps(settings.size());
+	for (size_t mapId = 0; mapId < maps.size() && result; mapId++) {
+		BenchmarkMap& map = maps[mapId];
+		map.settings = settings[mapId];
+		map.fileName = (directory / ("map" + to_string(mapId) + ".bsp")).string();
+		if (!GenerateBSP(map.fileName.c_str(), map.settings, map.info)) {
+			printf("[ERROR] Couldn't write %s\n", map.fileName.c_str());
+			result = false;
+			break;
+		}
+		for (unsigned i = 0; i < iterations; i++) {
+			if (!RunBenchmarkIteration(map, options, directory.string())) {
+				printf("[ERROR] Converting %s failed\n", map.fileName.c_str());
+				result = false;
+				break;
+			}
+		}
+
+		// Results also go to stdout when the JSON doesn't
+		if (jsonFileName && result) {
+			printf("%u faces, %u models, %u entities (%zu bytes), %u runs\n",
+				map.info.nFaces, map.info.nModels, map.info.nEntities, map.info.entityLumpSize, iterations);
+			for (unsigned stage = 0; stage < STAGE_COUNT; stage++) {
+				BenchmarkTimes times = SummarizeRuns(map.durations[stage]);
+				printf("  %-17s : best %9.3f ms  median %9.3f ms  mean %9.3f ms\n",
+					s_stageNames[stage], times.best * 1000.0, times.median * 1000.0, times.mean * 1000.0);
+			}
+		}
+		// On stderr when stdout is kept for the JSON
+		if (map.nAttributeMismatches && result)
+			fprintf(jsonFileName ? stdout : stderr, "  [WARNING] %zu vertices differ between the AVX2 and scalar kernels\n", map.nAttributeMismatches);
+	}
+	std::filesystem::remove_all(directory, ec);
+	if (!result)
+		return false;
+
+	FILE* file = jsonFileName ? fopen(jsonFileName, "w") : stdout;
+	if (!file) {
+		printf("[ERROR] Couldn't create %s\n", jsonFileName);
+		return false;
+	}
+	WriteBenchmarkJSON(file, maps, iterations, options);
+	if (file != stdout)
+		return fclose(file) == 0;
+	return true;
+}
@@ -0,0 +1,31 @@
+/*
+	This file defines benchmarks of the conversion's hot spots, run from the
+	command line on real maps. Timings are the best and median of several
+	runs so they can be compared between builds on the same machine.
+
+	The synthetic benchmark needs no map at all : it generates maps of given
+	sizes with BSPGenerator and times every stage of their conversion, from
+	opening the file to writing each output format, as JSON so results can
+	be tracked by scripts.
+*/
+
+#pragma once
+
+#include <vector>
+#include "BSPGenerator.h"
+
+using namespace std;
+
+struct BSP2FBXOptions;
+
+// Time tokenizing the entity lump of a BSP file with BSPEntityList against
+// the string based parser it replaced, and check both find the same pairs
+// Returns false if the file can't be read
+bool RunEntityParserBenchmark(const char* bspFileName, unsigned iterations);
+
+// Generate a map for every settings in a temporary directory and time the
+// conversion stages of each over several iterations, converting with options
+// Results are written as JSON to jsonFileName, or stdout if null
+// Returns false if a map couldn't be generated, converted or the JSON written
+bool RunSyntheticBenchmark(const vector<BSPGeneratorSettings>& maps, unsigned iterations,
+	const BSP2FBXOptions& options, const char* jsonFileName);
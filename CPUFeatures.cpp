@@ -0,0 +1,48 @@
+#include "CPUFeatures.h"
+
+#ifdef BSP2FBX_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+//---------------------------------------------------------------------
+static bool DetectAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// OSXSAVE and AVX, then the OS has to save the YMM registers
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+		return false;
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+//---------------------------------------------------------------------
+bool CPUHasAVX2()
+{
+	static const bool hasAVX2 = DetectAVX2();
+	return hasAVX2;
+}
+
+#else
+
+//---------------------------------------------------------------------
+bool CPUHasAVX2()
+{
+	return false;
+}
+
+#endif
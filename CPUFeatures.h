@@ -0,0 +1,22 @@
+/*
+	This file defines runtime detection of the SIMD instruction sets used
+	by the vectorized kernels, and the attribute needed to compile a
+	function for an instruction set the rest of the build doesn't target.
+*/
+
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BSP2FBX_X86 1
+#endif
+
+// MSVC compiles intrinsics for any instruction set, GCC and Clang need the
+// target enabled per function
+#if defined(BSP2FBX_X86) && !defined(_MSC_VER)
+#define BSP2FBX_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define BSP2FBX_TARGET_AVX2
+#endif
+
+// Whether the CPU and the OS support AVX2
+bool CPUHasAVX2();
@@ -0,0 +1,360 @@
+#include "ConversionCache.h"
+#include "BSPMappedFile.h"
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <functional>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+// XXH64 primes
+#define XXH_PRIME64_1	0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3	0x165667B19E3779F9ULL
+#define XXH_PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5	0x27D4EB2F165667C5ULL
+
+static inline uint64_t RotateLeft(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t Read64(const uint8_t* p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t Read32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t HashRound(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = RotateLeft(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t HashMerge(uint64_t acc, uint64_t value)
+{
+	acc ^= HashRound(0, value);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+//---------------------------------------------------------------------
+uint64_t ConversionCache::Hash(const void* data, size_t size, uint64_t seed)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	const uint8_t* end = p + size;
+	uint64_t h;
+
+	// Four independent lanes over 32 byte stripes
+	if (size >= 32) {
+		uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		uint64_t v2 = seed + XXH_PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - XXH_PRIME64_1;
+		const uint8_t* limit = end - 32;
+		do {
+			v1 = HashRound(v1, Read64(p));
+			v2 = HashRound(v2, Read64(p + 8));
+			v3 = HashRound(v3, Read64(p + 16));
+			v4 = HashRound(v4, Read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+		h = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+		h = HashMerge(h, v1);
+		h = HashMerge(h, v2);
+		h = HashMerge(h, v3);
+		h = HashMerge(h, v4);
+	}
+	else {
+		h = seed + XXH_PRIME64_5;
+	}
+	h += (uint64_t)size;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= HashRound(0, Read64(p));
+		h = RotateLeft(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)Read32(p) * XXH_PRIME64_1;
+		h = RotateLeft(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= (*p) * XXH_PRIME64_5;
+		h = RotateLeft(h, 11) * XXH_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+//---------------------------------------------------------------------
+// Every option which changes the outputs, with the build flags which do
+static string GetOptionsString(const BSP2FBXOptions& options)
+{
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "bsp2fbx %s weld=%d native=%d compress=%d format=%d textures=%d:%d lightmaps=%d triangulate=%d compact=%d pvs=%d cull=%d collision=%u",
+		BSP2FBX_VERSION, options.weld, options.nativeFbx, options.compressArrays, (int)options.format,
+		options.exportTextures, (int)options.textureFormat, options.lightmaps, options.triangulate,
+		options.compactNormals, options.pvs, options.cullHidden, options.collisionHulls);
+	string optionsString = buffer;
+#ifdef BSP2FBX_NO_FBXSDK
+	optionsString += " nofbxsdk";
+#endif
+#ifdef BSP2FBX_WITH_ZLIB
+	optionsString += " zlib";
+#endif
+	if (options.chunkFaces)
+		optionsString += " chunks=" + to_string(options.chunkFaces);
+	for (float error : options.lodErrors) {
+		snprintf(buffer, sizeof(buffer), " lod=%g", error);
+		optionsString += buffer;
+	}
+	if (options.exportTextures) {
+		for (auto& directory : options.wadDirectories)
+			optionsString += " wad-dir=" + directory;
+	}
+	return optionsString;
+}
+
+// Ticks of the file clock, to order entries by last use
+static int64_t GetFileTime(const fs::path& path)
+{
+	std::error_code ec;
+	return (int64_t)fs::last_write_time(path, ec).time_since_epoch().count();
+}
+
+// Total size of the files below a directory
+static uint64_t GetDirectorySize(const fs::path& directory)
+{
+	std::error_code ec;
+	uint64_t size = 0;
+	for (fs::recursive_directory_iterator it(directory, ec), end; it != end; it.increment(ec)) {
+		if (ec)
+			break;
+		if (it->is_regular_file(ec))
+			size += it->file_size(ec);
+	}
+	return size;
+}
+
+// Hard-link src to dst, or copy it if it can't be linked
+static bool LinkOrCopyFile(const fs::path& src, const fs::path& dst)
+{
+	std::error_code ec;
+	fs::create_directories(dst.parent_path(), ec);
+	fs::create_hard_link(src, dst, ec);
+	if (!ec)
+		return true;
+	ec.clear();
+	fs::copy_file(src, dst, fs::copy_options::overwrite_existing, ec);
+	return !ec;
+}
+
+//---------------------------------------------------------------------
+ConversionCache::ConversionCache(const string& directory, uint64_t maxBytes, const BSP2FBXOptions& options)
+{
+	m_directory = directory;
+	m_maxBytes = maxBytes;
+	string optionsString = GetOptionsString(options);
+	m_optionsHash = Hash(optionsString.data(), optionsString.size());
+	m_totalBytes = 0;
+	m_nHits = 0;
+	m_nMisses = 0;
+
+	std::error_code ec;
+	fs::create_directories(m_directory, ec);
+	if (ec)
+		printf("[WARNING] Couldn't create the cache directory %s\n", m_directory.c_str());
+
+	// Entries are directories named after their key, the others were left by interrupted runs
+	vector<fs::path> leftovers;
+	for (fs::directory_iterator it(m_directory, ec), end; it != end; it.increment(ec)) {
+		if (ec)
+			break;
+		if (!it->is_directory(ec))
+			continue;
+		string name = it->path().filename().string();
+		if (name.find('.') != string::npos) {
+			leftovers.push_back(it->path());
+			continue;
+		}
+		Entry entry = { GetDirectorySize(it->path()), GetFileTime(it->path()) };
+		m_entries[name] = entry;
+		m_totalBytes += entry.size;
+	}
+	for (auto& leftover : leftovers)
+		fs::remove_all(leftover, ec);
+
+	// The cache may have been filled with a larger size
+	lock_guard<mutex> lock(m_mutex);
+	Evict(string());
+}
+
+//---------------------------------------------------------------------
+string ConversionCache::GetKey(const char* bspFile) const
+{
+	BSPMappedFile file;
+	if (!file.Open(bspFile))
+		return string();
+	uint64_t contentHash = Hash(file.GetData(), file.GetSize());
+
+	// Outputs are named after the map and reference each other by name
+	string name = fs::path(bspFile).stem().string();
+	uint64_t settingsHash = Hash(name.data(), name.size(), m_optionsHash);
+
+	char key[33];
+	snprintf(key, sizeof(key), "%016llx%016llx", (unsigned long long)contentHash, (unsigned long long)settingsHash);
+	return key;
+}
+
+//---------------------------------------------------------------------
+bool ConversionCache::Restore(const string& key, const char* bspFile)
+{
+	// The entry is pinned rather than locked while it's restored, so copies
+	// from a cache on another volume don't hold up the other workers
+	{
+		lock_guard<mutex> lock(m_mutex);
+		auto entry = m_entries.find(key);
+		if (entry == m_entries.end())
+			return false;
+		entry->second.pins++;
+	}
+
+	bool restored = true;
+	std::error_code ec;
+	fs::path entryDirectory = fs::path(m_directory) / key;
+	fs::path mapDirectory = fs::path(bspFile).parent_path();
+	if (mapDirectory.empty())
+		mapDirectory = ".";
+
+	for (fs::recursive_directory_iterator it(entryDirectory, ec), end; it != end; it.increment(ec)) {
+		if (ec)
+			break;
+		if (!it->is_regular_file(ec))
+			continue;
+		fs::path output = mapDirectory / it->path().lexically_relative(entryDirectory);
+		std::error_code outputEc;
+		if (fs::exists(output, outputEc) && fs::equivalent(it->path(), output, outputEc))
+			continue;
+		fs::remove(output, outputEc);
+		if (!LinkOrCopyFile(it->path(), output)) {
+			restored = false;
+			break;
+		}
+	}
+	if (ec)
+		restored = false;
+
+	lock_guard<mutex> lock(m_mutex);
+	Entry& entry = m_entries[key];
+	entry.pins--;
+	if (restored) {
+		// Entries are evicted by the time they were last used
+		fs::last_write_time(entryDirectory, fs::file_time_type::clock::now(), ec);
+		entry.lastUse = GetFileTime(entryDirectory);
+	}
+	// Evictions skipped while the entry was pinned
+	Evict(key);
+	return restored;
+}
+
+//---------------------------------------------------------------------
+void ConversionCache::Store(const string& key, const char* bspFile, const vector<string>& outputFiles)
+{
+	std::error_code ec;
+	fs::path mapDirectory = fs::path(bspFile).parent_path();
+	if (mapDirectory.empty())
+		mapDirectory = ".";
+
+	// Built aside and renamed so an entry is never seen half written
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%zx.tmp", hash<thread::id>()(this_thread::get_id()));
+	fs::path tempDirectory = fs::path(m_directory) / (key + suffix);
+	fs::remove_all(tempDirectory, ec);
+
+	uint64_t size = 0;
+	for (auto& outputFile : outputFiles) {
+		fs::path relative = fs::path(outputFile).lexically_relative(mapDirectory);
+		if (relative.empty() || *relative.begin() == "..") {
+			printf("[WARNING] %s isn't next to %s and can't be cached\n", outputFile.c_str(), bspFile);
+			fs::remove_all(tempDirectory, ec);
+			return;
+		}
+		if (!LinkOrCopyFile(outputFile, tempDirectory / relative)) {
+			printf("[WARNING] Couldn't cache %s\n", outputFile.c_str());
+			fs::remove_all(tempDirectory, ec);
+			return;
+		}
+		size += fs::file_size(outputFile, ec);
+	}
+
+	lock_guard<mutex> lock(m_mutex);
+	fs::path entryDirectory = fs::path(m_directory) / key;
+	bool stored = m_entries.count(key) == 0;
+	if (stored) {
+		fs::rename(tempDirectory, entryDirectory, ec);
+		stored = !ec;
+	}
+	if (!stored) {
+		// Another worker stored the same map first
+		fs::remove_all(tempDirectory, ec);
+		return;
+	}
+	m_entries[key] = { size, GetFileTime(entryDirectory) };
+	m_totalBytes += size;
+	Evict(key);
+}
+
+//---------------------------------------------------------------------
+void ConversionCache::Evict(const string& key)
+{
+	std::error_code ec;
+	while (m_totalBytes > m_maxBytes) {
+		auto oldest = m_entries.end();
+		for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+			if (it->first != key && it->second.pins == 0 && (oldest == m_entries.end() || it->second.lastUse < oldest->second.lastUse))
+				oldest = it;
+		}
+		if (oldest == m_entries.end())
+			break;
+		fs::remove_all(fs::path(m_directory) / oldest->first, ec);
+		m_totalBytes -= oldest->second.size;
+		m_entries.erase(oldest);
+	}
+}
+
+//---------------------------------------------------------------------
+bool ConversionCache::Convert(BSP2FBX& context, const char* bspFile, bool& cached)
+{
+	cached = false;
+	string key = GetKey(bspFile);
+	if (!key.empty() && Restore(key, bspFile)) {
+		cached = true;
+		m_nHits++;
+		return true;
+	}
+	m_nMisses++;
+
+	if (!context.LoadBSPFile(bspFile) || !context.GenerateOutput())
+		return false;
+	if (!key.empty()) {
+		vector<string> outputFiles;
+		context.GetOutputFiles(outputFiles);
+		Store(key, bspFile, outputFiles);
+	}
+	return true;
+}
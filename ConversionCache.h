@@ -0,0 +1,77 @@
+/*
+	The ConversionCache class skips converting maps which were already
+	converted with the same options.
+
+	A map's key hashes the bytes of the BSP file, its output name (outputs
+	reference each other by name, like a glTF file its .bin), the converter
+	version, the build and every option which changes the outputs. The outputs
+	of a conversion are stored in a directory of the cache named after the key
+	and hard-linked back next to the map when the key is seen again, copied if
+	the cache is on another volume. The WAD files textures are read from aren't
+	part of the key, converting after changing them requires another cache or
+	an empty one. Statistics aren't cached either.
+
+	The least recently used entries are evicted when the cache grows beyond
+	its size. BSP2FBX unlinks outputs still hard-linked to an entry before
+	writing them again, so converting can't change the cached files.
+*/
+
+#pragma once
+
+#include "BSP2FBX.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+using namespace std;
+
+class ConversionCache {
+public:
+	// Constructor
+	// Entries are kept in directory, created if needed, up to maxBytes of outputs
+	ConversionCache(const string& directory, uint64_t maxBytes, const BSP2FBXOptions& options);
+
+	// Convert a map with context unless its outputs are cached
+	// cached tells whether they were restored from the cache
+	// Returns false if neither worked, can be called from several threads
+	bool Convert(BSP2FBX& context, const char* bspFile, bool& cached);
+
+	unsigned GetHitCount() const { return m_nHits; }
+	unsigned GetMissCount() const { return m_nMisses; }
+
+	// Fast 64 bit hash of a block of memory (XXH64)
+	static uint64_t Hash(const void* data, size_t size, uint64_t seed = 0);
+
+private:
+	// Size and last use of an entry
+	struct Entry {
+		uint64_t	size;
+		int64_t		lastUse;	// Ticks of the file clock, larger is more recent
+		unsigned	pins = 0;	// Restores in progress, the entry can't be evicted until they're done
+	};
+
+	// Key of a map, empty if the file can't be read
+	string GetKey(const char* bspFile) const;
+
+	// Hard-link or copy the outputs of an entry next to bspFile, returns false on a miss
+	bool Restore(const string& key, const char* bspFile);
+
+	// Hard-link or copy the outputs of a converted map into a new entry
+	void Store(const string& key, const char* bspFile, const vector<string>& outputFiles);
+
+	// Remove least recently used entries until the cache fits in its size, keeping key and pinned entries
+	// m_mutex must be held
+	void Evict(const string& key);
+
+	string				m_directory;
+	uint64_t			m_maxBytes;
+	uint64_t			m_optionsHash;	// Hash of the version, build and options
+	mutex				m_mutex;		// Guards m_entries and m_totalBytes
+	map<string, Entry>	m_entries;		// Every entry of the cache directory
+	uint64_t			m_totalBytes;
+	atomic<unsigned>	m_nHits;
+	atomic<unsigned>	m_nMisses;
+};
@@ -0,0 +1,199 @@
+#include "ConversionServer.h"
+#include "JsonString.h"
+#include <stdarg.h>
+#include <string.h>
+#include <exception>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Milliseconds elapsed since start
+static double GetElapsedMs(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+//---------------------------------------------------------------------
+ConversionServer::ConversionServer(const BSP2FBXOptions& options)
+{
+	m_options = options;
+	m_options.verbose = false;
+	m_cache = nullptr;
+	if (!m_options.cacheDirectory.empty())
+		m_cache = new ConversionCache(m_options.cacheDirectory, m_options.cacheMaxBytes, m_options);
+	m_output = nullptr;
+	m_nQueued = 0;
+	m_nRunning = 0;
+	m_nSucceeded = 0;
+	m_nFailed = 0;
+}
+
+//---------------------------------------------------------------------
+ConversionServer::~ConversionServer()
+{
+	if (m_cache)
+		delete m_cache;
+}
+
+//---------------------------------------------------------------------
+FILE* ConversionServer::DetachStdout()
+{
+	fflush(stdout);
+#ifdef _WIN32
+	int responses = _dup(_fileno(stdout));
+	if (responses < 0 || _dup2(_fileno(stderr), _fileno(stdout)) < 0)
+		return nullptr;
+	return _fdopen(responses, "w");
+#else
+	int responses = dup(STDOUT_FILENO);
+	if (responses < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+		return nullptr;
+	return fdopen(responses, "w");
+#endif
+}
+
+//---------------------------------------------------------------------
+void ConversionServer::Respond(const char* format, ...)
+{
+	lock_guard<mutex> lock(m_outputLock);
+	va_list args;
+	va_start(args, format);
+	vfprintf(m_output, format, args);
+	va_end(args);
+	fputc('\n', m_output);
+	fflush(m_output);
+}
+
+//---------------------------------------------------------------------
+void ConversionServer::ConvertJob(const Job& job)
+{
+	m_nQueued--;
+	m_nRunning++;
+	int workerId = ThreadPool::GetCurrentWorkerIndex();
+	string id = JsonString(job.id);
+	Respond("{\"id\":%s,\"status\":\"started\",\"worker\":%d,\"wait_ms\":%.3f}", id.c_str(), workerId, GetElapsedMs(job.queued));
+
+	auto start = chrono::steady_clock::now();
+	BSP2FBX* context = m_contexts[workerId];
+	bool success = false;
+	bool cached = false;
+	string error;
+	try {
+		if (m_cache)
+			success = m_cache->Convert(*context, job.bspFile.c_str(), cached);
+		else
+			success = context->LoadBSPFile(job.bspFile.c_str()) && context->GenerateOutput();
+	}
+	catch (const exception& e) {
+		error = e.what();
+	}
+
+	// Keep the context warm but not the map
+	context->UnloadBSPFile();
+
+	if (success)
+		m_nSucceeded++;
+	else
+		m_nFailed++;
+	m_nRunning--;
+	if (error.empty()) {
+		Respond("{\"id\":%s,\"status\":\"%s\",\"cached\":%s,\"ms\":%.3f}", id.c_str(), success ? "done" : "failed",
+			cached ? "true" : "false", GetElapsedMs(start));
+	}
+	else {
+		Respond("{\"id\":%s,\"status\":\"failed\",\"error\":%s,\"ms\":%.3f}", id.c_str(), JsonString(error).c_str(), GetElapsedMs(start));
+	}
+}
+
+//---------------------------------------------------------------------
+bool ConversionServer::HandleRequest(const string& request, ThreadPool& pool)
+{
+	// Command, then its arguments separated by blanks
+	size_t commandEnd = request.find_first_of(" \t");
+	string command = request.substr(0, commandEnd);
+	string arguments = commandEnd == string::npos ? string() : request.substr(request.find_first_not_of(" \t", commandEnd));
+
+	if (command == "quit")
+		return false;
+
+	if (command == "status") {
+		Respond("{\"status\":\"status\",\"queued\":%u,\"running\":%u,\"succeeded\":%u,\"failed\":%u}",
+			m_nQueued.load(), m_nRunning.load(), m_nSucceeded.load(), m_nFailed.load());
+		return true;
+	}
+
+	if (command == "convert") {
+		size_t idEnd = arguments.find_first_of(" \t");
+		size_t fileStart = idEnd == string::npos ? string::npos : arguments.find_first_not_of(" \t", idEnd);
+		if (fileStart == string::npos) {
+			Respond("{\"status\":\"error\",\"error\":\"convert needs an id and a BSP file\"}");
+			return true;
+		}
+		Job job;
+		job.id = arguments.substr(0, idEnd);
+		job.bspFile = arguments.substr(fileStart);
+		job.queued = chrono::steady_clock::now();
+		m_nQueued++;
+		Respond("{\"id\":%s,\"status\":\"queued\",\"file\":%s}", JsonString(job.id).c_str(), JsonString(job.bspFile).c_str());
+		pool.Submit([this, job] { ConvertJob(job); }, &m_jobs);
+		return true;
+	}
+
+	Respond("{\"status\":\"error\",\"error\":%s}", JsonString("Unknown request " + command).c_str());
+	return true;
+}
+
+//---------------------------------------------------------------------
+unsigned ConversionServer::Run(FILE* input, FILE* output)
+{
+	m_output = output;
+	ThreadPool pool(m_options.nThreads);
+	unsigned nThreads = pool.GetThreadCount();
+
+	// Every worker creates its context up front, so its FbxManager lives on
+	// its thread and the first jobs don't pay for it : a warm up task waits
+	// for all the others to start so each runs on a worker of its own
+	m_contexts.assign(nThreads, nullptr);
+	{
+		atomic<unsigned> nStarted(0);
+		TaskGroup warmUp;
+		for (unsigned i = 0; i < nThreads; i++) {
+			pool.Submit([this, &nStarted, nThreads] {
+				int workerId = ThreadPool::GetCurrentWorkerIndex();
+				if (!m_contexts[workerId])
+					m_contexts[workerId] = new BSP2FBX(m_options, &m_wadCache);
+				nStarted++;
+				while (nStarted < nThreads)
+					this_thread::yield();
+			}, &warmUp);
+		}
+		pool.Wait(warmUp);
+	}
+	Respond("{\"status\":\"ready\",\"version\":\"%s\",\"workers\":%u}", BSP2FBX_VERSION, nThreads);
+
+	// Lines of any length, without their line ending
+	string request;
+	char buffer[4096];
+	bool running = true;
+	while (running && fgets(buffer, sizeof(buffer), input)) {
+		request += buffer;
+		if (request.back() != '\n' && !feof(input))
+			continue;
+		size_t last = request.find_last_not_of(" \t\r\n");
+		size_t first = request.find_first_not_of(" \t\r\n");
+		if (first != string::npos)
+			running = HandleRequest(request.substr(first, last - first + 1), pool);
+		request.clear();
+	}
+
+	pool.Wait(m_jobs);
+	for (auto context : m_contexts)
+		delete context;
+	m_contexts.clear();
+
+	Respond("{\"status\":\"stopped\",\"succeeded\":%u,\"failed\":%u}", m_nSucceeded.load(), m_nFailed.load());
+	return m_nFailed;
+}
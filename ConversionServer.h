@@ -0,0 +1,78 @@
+/*
+	The ConversionServer class keeps warm conversion contexts around and
+	converts maps on request, so tools converting maps interactively don't
+	pay for starting a process and creating an FbxManager every time.
+
+	Requests are read one per line from a stream, usually stdin :
+		convert <id> <file.bsp>		Queue a conversion, the file name is the rest of the line
+		status						Report the number of queued, running and finished jobs
+		quit						Finish the queued jobs and stop, like the end of the stream
+
+	Every answer is a line of JSON on the response stream with the id of its
+	job, streamed as the job goes from "queued" to "started" to "done" or
+	"failed". Jobs run concurrently on a ThreadPool whose workers each keep
+	their own BSP2FBX context, with the options of the command line, and
+	share decoded WAD textures and the conversion cache if any.
+*/
+
+#pragma once
+
+#include "BSP2FBX.h"
+#include "WADLoader.h"
+#include "ConversionCache.h"
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+class ConversionServer {
+public:
+	// Constructor
+	ConversionServer(const BSP2FBXOptions& options);
+
+	// Destructor
+	~ConversionServer();
+
+	// Answer the requests of input on output until quit or the end of input
+	// Returns the number of failed jobs
+	unsigned Run(FILE* input, FILE* output);
+
+	// Give the responses a stream of their own : returns a new stream writing
+	// to stdout and makes stdout write to stderr, so messages printed while
+	// converting can't get mixed with the responses
+	static FILE* DetachStdout();
+
+private:
+	// A conversion request
+	struct Job {
+		string		id;
+		string		bspFile;
+		chrono::steady_clock::time_point	queued;
+	};
+
+	// Parse a request line, returns false for quit
+	bool HandleRequest(const string& request, ThreadPool& pool);
+
+	// Convert a map using the context of the calling worker
+	void ConvertJob(const Job& job);
+
+	// Write a line to the response stream, flushed right away
+	void Respond(const char* format, ...);
+
+	BSP2FBXOptions			m_options;
+	vector<BSP2FBX*>		m_contexts;		// One conversion context per worker, kept across jobs
+	WADTextureCache			m_wadCache;		// WAD textures decoded once for all the jobs
+	ConversionCache*		m_cache;		// Outputs of maps converted before, null without a cache directory
+	FILE*					m_output;
+	mutex					m_outputLock;	// Keeps the responses of concurrent jobs on lines of their own
+	atomic<unsigned>		m_nQueued;
+	atomic<unsigned>		m_nRunning;
+	atomic<unsigned>		m_nSucceeded;
+	atomic<unsigned>		m_nFailed;
+	TaskGroup				m_jobs;			// Jobs not finished yet
+};
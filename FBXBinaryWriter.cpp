@@ -0,0 +1,366 @@
+#include "FBXBinaryWriter.h"
+#include <string.h>
+#include <cassert>
+
+// Version written in the header and footer, 7.4 is the last one with 32 bit offsets
+#define FBX_VERSION 7400
+
+// Size of the null record closing a list of nested nodes
+#define FBX_NULL_RECORD_SIZE 13
+
+// File header magic
+static const char s_headerMagic[23] = "Kaydara FBX Binary  \x00\x1a";
+
+// The FBX SDK checks FileId and the footer id against CreationTime so all
+// three are written with the well known values used by other exporters
+const uint8_t FBXBinaryWriter::FileId[16] = {
+	0x28, 0xb3, 0x2a, 0xeb, 0xb6, 0x24, 0xcc, 0xc2, 0xbf, 0xc8, 0xb0, 0x2a, 0xa9, 0x2b, 0xfc, 0xf1
+};
+const char* FBXBinaryWriter::CreationTime = "1970-01-01 10:00:00:000";
+static const uint8_t s_footerId[16] = {
+	0xfa, 0xbc, 0xab, 0x09, 0xd0, 0xc8, 0xd4, 0x66, 0xb1, 0x76, 0xfb, 0x83, 0x1c, 0xf7, 0x26, 0x7e
+};
+static const uint8_t s_footerMagic[16] = {
+	0xf8, 0x5a, 0x8c, 0x6a, 0xde, 0xf5, 0xd9, 0x7e, 0xec, 0xe9, 0x0c, 0xe3, 0x75, 0x8f, 0x29, 0x0b
+};
+
+// Size of the file buffer, nodes are mostly written sequentially
+#define FBX_FILE_BUFFER_SIZE (1 << 20)
+
+//---------------------------------------------------------------------
+FBXBinaryWriter::FBXBinaryWriter()
+{
+	m_file = nullptr;
+	m_failed = false;
+	m_compressArrays = false;
+	m_arrayOffset = -1;
+	m_arrayBytes = 0;
+	m_arrayExpectedBytes = 0;
+}
+
+//---------------------------------------------------------------------
+FBXBinaryWriter::~FBXBinaryWriter()
+{
+	if (m_file)
+		Close();
+}
+
+//---------------------------------------------------------------------
+bool FBXBinaryWriter::Open(const char* fileName, bool compressArrays)
+{
+	m_file = fopen(fileName, "wb");
+	if (!m_file)
+		return false;
+	setvbuf(m_file, nullptr, _IOFBF, FBX_FILE_BUFFER_SIZE);
+
+	m_failed = false;
+	m_nodes.clear();
+#ifdef BSP2FBX_WITH_ZLIB
+	m_compressArrays = compressArrays;
+#else
+	m_compressArrays = false;
+	(void)compressArrays;
+#endif
+
+	// Magic followed by the version
+	Write(s_headerMagic, sizeof(s_headerMagic));
+	WriteU32(FBX_VERSION);
+	return !m_failed;
+}
+
+//---------------------------------------------------------------------
+bool FBXBinaryWriter::Close()
+{
+	if (!m_file)
+		return false;
+
+	while (!m_nodes.empty())
+		EndNode();
+
+	// Null record closing the top level node list
+	uint8_t zeros[FBX_NULL_RECORD_SIZE] = { 0 };
+	Write(zeros, FBX_NULL_RECORD_SIZE);
+
+	// Footer : id, padding to a 16 byte boundary, version, reserved bytes and magic
+	Write(s_footerId, sizeof(s_footerId));
+	WriteU32(0);
+	int64_t offset = Tell();
+	size_t padding = (size_t)(((offset + 15) & ~15) - offset);
+	if (padding == 0)
+		padding = 16;
+	uint8_t zeroBlock[120] = { 0 };
+	Write(zeroBlock, padding);
+	WriteU32(FBX_VERSION);
+	Write(zeroBlock, 120);
+	Write(s_footerMagic, sizeof(s_footerMagic));
+
+	if (fclose(m_file) != 0)
+		m_failed = true;
+	m_file = nullptr;
+	return !m_failed;
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::Write(const void* data, size_t size)
+{
+	if (size && fwrite(data, 1, size, m_file) != size)
+		m_failed = true;
+}
+
+//---------------------------------------------------------------------
+int64_t FBXBinaryWriter::Tell()
+{
+#ifdef _WIN32
+	return _ftelli64(m_file);
+#else
+	return (int64_t)ftello(m_file);
+#endif
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::PatchU32(int64_t offset, uint32_t value)
+{
+	int64_t current = Tell();
+#ifdef _WIN32
+	_fseeki64(m_file, offset, SEEK_SET);
+	Write(&value, 4);
+	_fseeki64(m_file, current, SEEK_SET);
+#else
+	fseeko(m_file, (off_t)offset, SEEK_SET);
+	Write(&value, 4);
+	fseeko(m_file, (off_t)current, SEEK_SET);
+#endif
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::CloseProperties(OpenNode& node)
+{
+	if (node.propertiesClosed)
+		return;
+	// NumProperties and PropertyListLen follow EndOffset
+	PatchU32(node.headerOffset + 4, node.nProperties);
+	PatchU32(node.headerOffset + 8, (uint32_t)(Tell() - node.propertiesOffset));
+	node.propertiesClosed = true;
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::BeginNode(const char* name)
+{
+	// The parent's property list ends here
+	if (!m_nodes.empty()) {
+		CloseProperties(m_nodes.back());
+		m_nodes.back().hasChildren = true;
+	}
+
+	OpenNode node;
+	node.headerOffset = Tell();
+	node.nProperties = 0;
+	node.propertiesClosed = false;
+	node.hasChildren = false;
+
+	// EndOffset, NumProperties and PropertyListLen are patched later
+	WriteU32(0);
+	WriteU32(0);
+	WriteU32(0);
+	size_t nameLength = strlen(name);
+	assert(nameLength < 256);
+	WriteU8((uint8_t)nameLength);
+	Write(name, nameLength);
+
+	node.propertiesOffset = Tell();
+	m_nodes.push_back(node);
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::EndNode()
+{
+	assert(!m_nodes.empty());
+	OpenNode& node = m_nodes.back();
+	CloseProperties(node);
+
+	// Nested lists end with a null record, so do nodes without any property
+	if (node.hasChildren || node.nProperties == 0) {
+		uint8_t zeros[FBX_NULL_RECORD_SIZE] = { 0 };
+		Write(zeros, FBX_NULL_RECORD_SIZE);
+	}
+
+	PatchU32(node.headerOffset, (uint32_t)Tell());
+	m_nodes.pop_back();
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::BeginProperty(char type)
+{
+	assert(!m_nodes.empty() && !m_nodes.back().propertiesClosed);
+	m_nodes.back().nProperties++;
+	WriteU8((uint8_t)type);
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddBool(bool value)
+{
+	BeginProperty('C');
+	WriteU8(value ? 1 : 0);
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddInt16(int16_t value)
+{
+	BeginProperty('Y');
+	Write(&value, sizeof(value));
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddInt32(int32_t value)
+{
+	BeginProperty('I');
+	Write(&value, sizeof(value));
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddInt64(int64_t value)
+{
+	BeginProperty('L');
+	Write(&value, sizeof(value));
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddFloat(float value)
+{
+	BeginProperty('F');
+	Write(&value, sizeof(value));
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddDouble(double value)
+{
+	BeginProperty('D');
+	Write(&value, sizeof(value));
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddString(const char* value)
+{
+	AddString(value, (uint32_t)strlen(value));
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddString(const char* value, uint32_t length)
+{
+	BeginProperty('S');
+	WriteU32(length);
+	Write(value, length);
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddRaw(const void* data, uint32_t length)
+{
+	BeginProperty('R');
+	WriteU32(length);
+	Write(data, length);
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddInt32Array(const int32_t* values, uint32_t count)
+{
+	BeginArray('i', count);
+	WriteArrayData(values, count * sizeof(int32_t));
+	EndArray();
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddFloatArray(const float* values, uint32_t count)
+{
+	BeginArray('f', count);
+	WriteArrayData(values, count * sizeof(float));
+	EndArray();
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::AddDoubleArray(const double* values, uint32_t count)
+{
+	BeginArray('d', count);
+	WriteArrayData(values, count * sizeof(double));
+	EndArray();
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::BeginArray(char type, uint32_t count)
+{
+	size_t elementSize = 0;
+	switch (type) {
+	case 'b': elementSize = 1; break;
+	case 'i': elementSize = 4; break;
+	case 'f': elementSize = 4; break;
+	case 'l': elementSize = 8; break;
+	case 'd': elementSize = 8; break;
+	default: assert(!"Unknown FBX array type");
+	}
+
+	BeginProperty(type);
+	m_arrayOffset = Tell();
+	m_arrayBytes = 0;
+	m_arrayExpectedBytes = count * elementSize;
+
+	// ArrayLength, Encoding, CompressedLength
+	WriteU32(count);
+	WriteU32(m_compressArrays ? 1 : 0);
+	WriteU32(m_compressArrays ? 0 : (uint32_t)m_arrayExpectedBytes);
+
+#ifdef BSP2FBX_WITH_ZLIB
+	if (m_compressArrays) {
+		memset(&m_zstream, 0, sizeof(m_zstream));
+		deflateInit(&m_zstream, Z_DEFAULT_COMPRESSION);
+		m_zbuffer.resize(1 << 16);
+	}
+#endif
+}
+
+#ifdef BSP2FBX_WITH_ZLIB
+//---------------------------------------------------------------------
+void FBXBinaryWriter::DeflateArrayData(const void* data, size_t size, int flush)
+{
+	m_zstream.next_in = (Bytef*)data;
+	m_zstream.avail_in = (uInt)size;
+	do {
+		m_zstream.next_out = m_zbuffer.data();
+		m_zstream.avail_out = (uInt)m_zbuffer.size();
+		deflate(&m_zstream, flush);
+		Write(m_zbuffer.data(), m_zbuffer.size() - m_zstream.avail_out);
+	} while (m_zstream.avail_out == 0);
+}
+#endif
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::WriteArrayData(const void* data, size_t size)
+{
+	assert(m_arrayOffset >= 0);
+	m_arrayBytes += size;
+#ifdef BSP2FBX_WITH_ZLIB
+	if (m_compressArrays) {
+		DeflateArrayData(data, size, Z_NO_FLUSH);
+		return;
+	}
+#endif
+	Write(data, size);
+}
+
+//---------------------------------------------------------------------
+void FBXBinaryWriter::EndArray()
+{
+	assert(m_arrayOffset >= 0);
+	assert(m_arrayBytes == m_arrayExpectedBytes);
+
+#ifdef BSP2FBX_WITH_ZLIB
+	if (m_compressArrays) {
+		DeflateArrayData(nullptr, 0, Z_FINISH);
+		deflateEnd(&m_zstream);
+		// Compressed data starts right after the 12 bytes of array header
+		PatchU32(m_arrayOffset + 8, (uint32_t)(Tell() - m_arrayOffset - 12));
+	}
+#endif
+
+	if (m_arrayBytes != m_arrayExpectedBytes)
+		m_failed = true;
+	m_arrayOffset = -1;
+}
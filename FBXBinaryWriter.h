@@ -0,0 +1,117 @@
+/*
+	This file defines FBXBinaryWriter which streams a FBX 7.4 binary file
+	straight to disk without building a scene in memory.
+
+	A binary FBX file is a tree of node records:
+		EndOffset, NumProperties, PropertyListLen, NameLen, Name,
+		Properties..., nested node records, null record
+	Node sizes aren't known until a node is closed so every node header
+	is written with placeholders and patched once the node ends.
+	Array properties can be compressed with zlib when the writer is built
+	with BSP2FBX_WITH_ZLIB.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#ifdef BSP2FBX_WITH_ZLIB
+#include "zlib.h"
+#endif
+
+using namespace std;
+
+class FBXBinaryWriter {
+public:
+	// Constructor
+	FBXBinaryWriter();
+
+	// Destructor, closes the file if still open
+	~FBXBinaryWriter();
+
+	// Create the file and write the FBX header
+	// compressArrays is ignored when zlib isn't available
+	bool Open(const char* fileName, bool compressArrays);
+
+	// Close every open node, write the footer and close the file
+	// Returns false if anything failed to be written
+	bool Close();
+
+	// ----- Nodes -----
+	// Properties of a node have to be added before any of its children
+
+	void BeginNode(const char* name);
+	void EndNode();
+
+	// ----- Scalar properties -----
+
+	void AddBool(bool value);
+	void AddInt16(int16_t value);
+	void AddInt32(int32_t value);
+	void AddInt64(int64_t value);
+	void AddFloat(float value);
+	void AddDouble(double value);
+	void AddString(const char* value);
+	void AddString(const char* value, uint32_t length);
+	void AddRaw(const void* data, uint32_t length);
+
+	// ----- Array properties -----
+
+	void AddInt32Array(const int32_t* values, uint32_t count);
+	void AddFloatArray(const float* values, uint32_t count);
+	void AddDoubleArray(const double* values, uint32_t count);
+
+	// Arrays can also be streamed in pieces : type is one of 'i', 'l', 'f', 'd', 'b'
+	// and exactly count elements have to be written before EndArray
+	void BeginArray(char type, uint32_t count);
+	void WriteArrayData(const void* data, size_t size);
+	void EndArray();
+
+	bool IsCompressingArrays() const { return m_compressArrays; }
+
+	// Value of the top level FileId node matching the footer and CreationTime
+	static const uint8_t FileId[16];
+	static const char* CreationTime;
+
+private:
+	// An open node whose header still has to be patched
+	struct OpenNode {
+		int64_t		headerOffset;		// Offset of the node record
+		int64_t		propertiesOffset;	// Offset of its first property
+		uint32_t	nProperties;		// Properties written so far
+		bool		propertiesClosed;	// Whether a child was written after the properties
+		bool		hasChildren;
+	};
+
+	// Writes the property list length of the current node before its first child
+	void CloseProperties(OpenNode& node);
+
+	// Start a property of the current node
+	void BeginProperty(char type);
+
+	// Raw file output
+	void Write(const void* data, size_t size);
+	void WriteU8(uint8_t value)		{ Write(&value, 1); }
+	void WriteU32(uint32_t value)	{ Write(&value, 4); }
+	void PatchU32(int64_t offset, uint32_t value);
+	int64_t Tell();
+
+	FILE*				m_file;
+	bool				m_failed;			// Set on the first write error
+	bool				m_compressArrays;
+	vector<OpenNode>	m_nodes;			// Stack of open nodes
+
+	// Array being streamed
+	int64_t				m_arrayOffset;		// Offset of the array header
+	size_t				m_arrayBytes;		// Uncompressed bytes written so far
+	size_t				m_arrayExpectedBytes;
+
+#ifdef BSP2FBX_WITH_ZLIB
+	z_stream			m_zstream;
+	vector<uint8_t>		m_zbuffer;
+	void DeflateArrayData(const void* data, size_t size, int flush);
+#endif
+};
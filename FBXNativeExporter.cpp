@@ -0,0 +1,677 @@
+#include "FBXNativeExporter.h"
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+
+// Doubles converted per chunk while streaming float geometry
+#define FBX_CONVERT_CHUNK 4096
+
+static const char* s_creator = "bsp2fbx";
+
+//---------------------------------------------------------------------
+FBXNativeExporter::FBXNativeExporter(bool compressArrays)
+{
+	m_compressArrays = compressArrays;
+	m_nodes = nullptr;
+	m_materials = nullptr;
+}
+
+//---------------------------------------------------------------------
+bool FBXNativeExporter::BeginScene(const char* fileName, const vector<BSPSceneNode>& nodes, const vector<BSPSceneMaterial>& materials)
+{
+	m_nodes = &nodes;
+	m_materials = &materials;
+	std::error_code ec;
+	m_outputDirectory = std::filesystem::absolute(fileName, ec).parent_path().string();
+	m_connections.clear();
+
+	if (!m_writer.Open(fileName, m_compressArrays))
+		return false;
+
+	WriteHeaderExtension();
+	WriteGlobalSettings();
+	WriteDefinitions();
+
+	// Meshes are streamed into Objects, so it stays open until EndScene
+	m_writer.BeginNode("Objects");
+
+	// Grouping nodes have no geometry and can be written right away
+	for (unsigned i = 0; i < nodes.size(); i++) {
+		if (nodes[i].model)
+			continue;
+		if (nodes[i].lodDistances.empty()) {
+			WriteModel(i, "Null");
+		}
+		else {
+			WriteLODGroup(i);
+			WriteModel(i, "LodGroup");
+		}
+	}
+
+	for (unsigned i = 0; i < materials.size(); i++) {
+		WriteMaterial(i);
+		if (!materials[i].textureFile.empty())
+			WriteTexture(i);
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteMesh(unsigned nodeId, const BSPMeshData& meshData)
+{
+	WriteGeometry(nodeId, meshData);
+	WriteModel(nodeId, "Mesh");
+	m_connections.push_back(make_pair(GetGeometryId(nodeId), GetModelId(nodeId)));
+
+	// The order of a model's material connections is the one its material layer indexes
+	for (unsigned materialId : meshData.materials)
+		m_connections.push_back(make_pair(GetMaterialId(materialId), GetModelId(nodeId)));
+}
+
+//---------------------------------------------------------------------
+bool FBXNativeExporter::EndScene()
+{
+	m_writer.EndNode();	// Objects
+
+	WriteConnections();
+
+	m_writer.BeginNode("Takes");
+	m_writer.BeginNode("Current");
+	m_writer.AddString("");
+	m_writer.EndNode();
+	m_writer.EndNode();
+
+	return m_writer.Close();
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::AddObjectName(const string& name, const char* className)
+{
+	string objectName = name;
+	objectName.push_back('\x00');
+	objectName.push_back('\x01');
+	objectName += className;
+	m_writer.AddString(objectName.c_str(), (uint32_t)objectName.size());
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::BeginP(const char* name, const char* type, const char* label, const char* flags)
+{
+	m_writer.BeginNode("P");
+	m_writer.AddString(name);
+	m_writer.AddString(type);
+	m_writer.AddString(label);
+	m_writer.AddString(flags);
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteHeaderExtension()
+{
+	m_writer.BeginNode("FBXHeaderExtension");
+	{
+		m_writer.BeginNode("FBXHeaderVersion");
+		m_writer.AddInt32(1003);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("FBXVersion");
+		m_writer.AddInt32(7400);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("EncryptionType");
+		m_writer.AddInt32(0);
+		m_writer.EndNode();
+
+		// Has to match FBXBinaryWriter::CreationTime
+		const int32_t timeStamp[][2] = { { 1000, 0 }, { 1970, 0 }, { 1, 0 }, { 1, 0 }, { 10, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } };
+		const char* timeStampNames[] = { "Version", "Year", "Month", "Day", "Hour", "Minute", "Second", "Millisecond" };
+		m_writer.BeginNode("CreationTimeStamp");
+		for (unsigned i = 0; i < 8; i++) {
+			m_writer.BeginNode(timeStampNames[i]);
+			m_writer.AddInt32(timeStamp[i][0]);
+			m_writer.EndNode();
+		}
+		m_writer.EndNode();
+
+		m_writer.BeginNode("Creator");
+		m_writer.AddString(s_creator);
+		m_writer.EndNode();
+	}
+	m_writer.EndNode();
+
+	// FileId and CreationTime have to match the footer written by FBXBinaryWriter
+	m_writer.BeginNode("FileId");
+	m_writer.AddRaw(FBXBinaryWriter::FileId, sizeof(FBXBinaryWriter::FileId));
+	m_writer.EndNode();
+
+	m_writer.BeginNode("CreationTime");
+	m_writer.AddString(FBXBinaryWriter::CreationTime);
+	m_writer.EndNode();
+
+	m_writer.BeginNode("Creator");
+	m_writer.AddString(s_creator);
+	m_writer.EndNode();
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteGlobalSettings()
+{
+	// Positions are already swapped to Y up by BuildMeshData
+	const char* axisNames[] = { "UpAxis", "UpAxisSign", "FrontAxis", "FrontAxisSign", "CoordAxis", "CoordAxisSign",
+		"OriginalUpAxis", "OriginalUpAxisSign" };
+	const int32_t axisValues[] = { 1, 1, 2, 1, 0, 1, 1, 1 };
+
+	m_writer.BeginNode("GlobalSettings");
+	{
+		m_writer.BeginNode("Version");
+		m_writer.AddInt32(1000);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("Properties70");
+		for (unsigned i = 0; i < 8; i++) {
+			BeginP(axisNames[i], "int", "Integer", "");
+			m_writer.AddInt32(axisValues[i]);
+			m_writer.EndNode();
+		}
+		BeginP("UnitScaleFactor", "double", "Number", "");
+		m_writer.AddDouble(1.0);
+		m_writer.EndNode();
+		BeginP("OriginalUnitScaleFactor", "double", "Number", "");
+		m_writer.AddDouble(1.0);
+		m_writer.EndNode();
+		m_writer.EndNode();
+	}
+	m_writer.EndNode();
+
+	m_writer.BeginNode("Documents");
+	{
+		m_writer.BeginNode("Count");
+		m_writer.AddInt32(1);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("Document");
+		m_writer.AddInt64(1);
+		m_writer.AddString("Scene");
+		m_writer.AddString("Scene");
+		{
+			m_writer.BeginNode("Properties70");
+			m_writer.EndNode();
+			m_writer.BeginNode("RootNode");
+			m_writer.AddInt64(0);
+			m_writer.EndNode();
+		}
+		m_writer.EndNode();
+	}
+	m_writer.EndNode();
+
+	m_writer.BeginNode("References");
+	m_writer.EndNode();
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteDefinitions()
+{
+	int32_t nModels = (int32_t)m_nodes->size();
+	int32_t nGeometries = 0;
+	int32_t nNodeAttributes = 0;
+	for (auto& node : *m_nodes) {
+		if (node.model)
+			nGeometries++;
+		if (!node.lodDistances.empty())
+			nNodeAttributes++;
+	}
+	int32_t nMaterials = (int32_t)m_materials->size();
+	int32_t nTextures = 0;
+	for (auto& material : *m_materials) {
+		if (!material.textureFile.empty())
+			nTextures++;
+	}
+
+	// Node attributes are only written for LOD groups
+	const char* types[] = { "GlobalSettings", "Model", "Geometry", "Material", "Texture", "NodeAttribute" };
+	const int32_t counts[] = { 1, nModels, nGeometries, nMaterials, nTextures, nNodeAttributes };
+	const unsigned nTypes = sizeof(counts) / sizeof(counts[0]) - (nNodeAttributes ? 0 : 1);
+
+	m_writer.BeginNode("Definitions");
+	{
+		m_writer.BeginNode("Version");
+		m_writer.AddInt32(100);
+		m_writer.EndNode();
+
+		int32_t nObjects = 0;
+		for (unsigned i = 0; i < nTypes; i++)
+			nObjects += counts[i];
+		m_writer.BeginNode("Count");
+		m_writer.AddInt32(nObjects);
+		m_writer.EndNode();
+
+		for (unsigned i = 0; i < nTypes; i++) {
+			m_writer.BeginNode("ObjectType");
+			m_writer.AddString(types[i]);
+			m_writer.BeginNode("Count");
+			m_writer.AddInt32(counts[i]);
+			m_writer.EndNode();
+			m_writer.EndNode();
+		}
+	}
+	m_writer.EndNode();
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteModel(unsigned nodeId, const char* type)
+{
+	const BSPSceneNode& node = (*m_nodes)[nodeId];
+
+	m_writer.BeginNode("Model");
+	m_writer.AddInt64(GetModelId(nodeId));
+	AddObjectName(node.name, "Model");
+	m_writer.AddString(type);
+	{
+		m_writer.BeginNode("Version");
+		m_writer.AddInt32(232);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("Properties70");
+		if (node.scaling.x != 1.0f || node.scaling.y != 1.0f || node.scaling.z != 1.0f) {
+			BeginP("Lcl Scaling", "Lcl Scaling", "", "A");
+			m_writer.AddDouble(node.scaling.x);
+			m_writer.AddDouble(node.scaling.y);
+			m_writer.AddDouble(node.scaling.z);
+			m_writer.EndNode();
+		}
+
+		// Custom data as user properties, like the FBX SDK writes them
+		for (auto& property : node.properties) {
+			switch (property.type) {
+			case PROPERTY_INT:
+				BeginP(property.name.c_str(), "int", "Integer", "U");
+				m_writer.AddInt32(property.intValue);
+				break;
+			case PROPERTY_VECTOR:
+				BeginP(property.name.c_str(), "Vector3D", "Vector", "U");
+				m_writer.AddDouble(property.vectorValue.x);
+				m_writer.AddDouble(property.vectorValue.y);
+				m_writer.AddDouble(property.vectorValue.z);
+				break;
+			case PROPERTY_STRING:
+				BeginP(property.name.c_str(), "KString", "", "U");
+				m_writer.AddString(property.stringValue.c_str());
+				break;
+			}
+			m_writer.EndNode();
+		}
+		m_writer.EndNode();
+
+		m_writer.BeginNode("Shading");
+		m_writer.AddBool(true);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("Culling");
+		m_writer.AddString("CullingOff");
+		m_writer.EndNode();
+	}
+	m_writer.EndNode();
+
+	int64_t parentId = node.parent < 0 ? 0 : GetModelId((unsigned)node.parent);
+	m_connections.push_back(make_pair(GetModelId(nodeId), parentId));
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteLODGroup(unsigned nodeId)
+{
+	const BSPSceneNode& node = (*m_nodes)[nodeId];
+
+	m_writer.BeginNode("NodeAttribute");
+	m_writer.AddInt64(GetNodeAttributeId(nodeId));
+	AddObjectName(node.name, "NodeAttribute");
+	m_writer.AddString("LodGroup");
+	{
+		m_writer.BeginNode("Properties70");
+		BeginP("MinMaxDistance", "bool", "", "");
+		m_writer.AddInt32(0);
+		m_writer.EndNode();
+		BeginP("WorldSpace", "bool", "", "");
+		m_writer.AddInt32(0);
+		m_writer.EndNode();
+
+		// Level N is shown up to threshold N, the last one beyond
+		for (unsigned level = 0; level < node.lodDistances.size(); level++) {
+			string name = "Thresholds|Level" + to_string(level);
+			BeginP(name.c_str(), "Distance", "", "");
+			m_writer.AddFloat(node.lodDistances[level]);
+			m_writer.AddString("cm");
+			m_writer.EndNode();
+		}
+		for (unsigned level = 0; level <= node.lodDistances.size(); level++) {
+			string name = "DisplayLevels|Level" + to_string(level);
+			BeginP(name.c_str(), "enum", "", "");
+			m_writer.AddInt32(0);	// UseLOD
+			m_writer.EndNode();
+		}
+		m_writer.EndNode();
+
+		m_writer.BeginNode("TypeFlags");
+		m_writer.AddString("LodGroup");
+		m_writer.EndNode();
+	}
+	m_writer.EndNode();
+
+	m_connections.push_back(make_pair(GetNodeAttributeId(nodeId), GetModelId(nodeId)));
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteMaterial(unsigned materialId)
+{
+	m_writer.BeginNode("Material");
+	m_writer.AddInt64(GetMaterialId(materialId));
+	AddObjectName((*m_materials)[materialId].name, "Material");
+	m_writer.AddString("");
+	{
+		m_writer.BeginNode("Version");
+		m_writer.AddInt32(102);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("ShadingModel");
+		m_writer.AddString("phong");
+		m_writer.EndNode();
+
+		m_writer.BeginNode("MultiLayer");
+		m_writer.AddInt32(0);
+		m_writer.EndNode();
+
+		// White so the texture shows as is
+		m_writer.BeginNode("Properties70");
+		BeginP("DiffuseColor", "Color", "", "A");
+		m_writer.AddDouble(1.0);
+		m_writer.AddDouble(1.0);
+		m_writer.AddDouble(1.0);
+		m_writer.EndNode();
+		BeginP("DiffuseFactor", "Number", "", "A");
+		m_writer.AddDouble(1.0);
+		m_writer.EndNode();
+		m_writer.EndNode();
+	}
+	m_writer.EndNode();
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteTexture(unsigned materialId)
+{
+	const BSPSceneMaterial& material = (*m_materials)[materialId];
+	string fileName = (std::filesystem::path(m_outputDirectory) / material.textureFile).string();
+
+	m_writer.BeginNode("Texture");
+	m_writer.AddInt64(GetTextureId(materialId));
+	AddObjectName(material.name, "Texture");
+	m_writer.AddString("");
+	{
+		m_writer.BeginNode("Type");
+		m_writer.AddString("TextureVideoClip");
+		m_writer.EndNode();
+
+		m_writer.BeginNode("Version");
+		m_writer.AddInt32(202);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("TextureName");
+		AddObjectName(material.name, "Texture");
+		m_writer.EndNode();
+
+		m_writer.BeginNode("FileName");
+		m_writer.AddString(fileName.c_str());
+		m_writer.EndNode();
+
+		m_writer.BeginNode("RelativeFilename");
+		m_writer.AddString(material.textureFile.c_str());
+		m_writer.EndNode();
+	}
+	m_writer.EndNode();
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteFloatArray(const float* values, size_t count)
+{
+	double chunk[FBX_CONVERT_CHUNK];
+	m_writer.BeginArray('d', (uint32_t)count);
+	for (size_t first = 0; first < count; first += FBX_CONVERT_CHUNK) {
+		size_t n = min((size_t)FBX_CONVERT_CHUNK, count - first);
+		for (size_t i = 0; i < n; i++)
+			chunk[i] = values[first + i];
+		m_writer.WriteArrayData(chunk, n * sizeof(double));
+	}
+	m_writer.EndArray();
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteLayerElement(const char* type, const char* mapping, const char* arrayName, const vector<float>& values,
+	const vector<unsigned>* indices)
+{
+	m_writer.BeginNode(type);
+	m_writer.AddInt32(0);
+	{
+		m_writer.BeginNode("Version");
+		m_writer.AddInt32(102);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("Name");
+		m_writer.AddString("");
+		m_writer.EndNode();
+
+		m_writer.BeginNode("MappingInformationType");
+		m_writer.AddString(mapping);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("ReferenceInformationType");
+		m_writer.AddString(indices ? "IndexToDirect" : "Direct");
+		m_writer.EndNode();
+
+		m_writer.BeginNode(arrayName);
+		WriteFloatArray(values.data(), values.size());
+		m_writer.EndNode();
+
+		// The index array is named after the values, like NormalsIndex
+		if (indices) {
+			m_writer.BeginNode((string(arrayName) + "Index").c_str());
+			m_writer.BeginArray('i', (uint32_t)indices->size());
+			m_writer.WriteArrayData(indices->data(), indices->size() * sizeof(int32_t));
+			m_writer.EndArray();
+			m_writer.EndNode();
+		}
+	}
+	m_writer.EndNode();
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteUVLayerElement(int32_t index, const char* name, const vector<float>& uvs)
+{
+	m_writer.BeginNode("LayerElementUV");
+	m_writer.AddInt32(index);
+	{
+		m_writer.BeginNode("Version");
+		m_writer.AddInt32(101);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("Name");
+		m_writer.AddString(name);
+		m_writer.EndNode();
+
+		m_writer.BeginNode("MappingInformationType");
+		m_writer.AddString("ByVertice");
+		m_writer.EndNode();
+
+		m_writer.BeginNode("ReferenceInformationType");
+		m_writer.AddString("Direct");
+		m_writer.EndNode();
+
+		m_writer.BeginNode("UV");
+		WriteFloatArray(uvs.data(), uvs.size());
+		m_writer.EndNode();
+	}
+	m_writer.EndNode();
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteGeometry(unsigned nodeId, const BSPMeshData& meshData)
+{
+	const BSPSceneNode& node = (*m_nodes)[nodeId];
+
+	m_writer.BeginNode("Geometry");
+	m_writer.AddInt64(GetGeometryId(nodeId));
+	AddObjectName(node.name, "Geometry");
+	m_writer.AddString("Mesh");
+	{
+		m_writer.BeginNode("Properties70");
+		m_writer.EndNode();
+
+		m_writer.BeginNode("GeometryVersion");
+		m_writer.AddInt32(124);
+		m_writer.EndNode();
+
+		// Control points
+		m_writer.BeginNode("Vertices");
+		WriteFloatArray(meshData.positions.data(), meshData.positions.size());
+		m_writer.EndNode();
+
+		// Polygons as control point indices, the last one of each polygon is stored as ~index
+		size_t nPolygonVertices = meshData.GetPolygonVertexCount();
+
+		m_writer.BeginNode("PolygonVertexIndex");
+		m_writer.BeginArray('i', (uint32_t)nPolygonVertices);
+		{
+			int32_t chunk[FBX_CONVERT_CHUNK];
+			unsigned nChunk = 0;
+			unsigned pvId = 0;
+			for (unsigned pId = 0; pId < meshData.nPolygons; pId++) {
+				unsigned nCPs = meshData.nPolygonCPs[pId];
+				for (unsigned i = 0; i < nCPs; i++, pvId++) {
+					int32_t cpId = (int32_t)meshData.GetPolygonCP(pvId);
+					chunk[nChunk++] = (i == nCPs - 1) ? ~cpId : cpId;
+					if (nChunk == FBX_CONVERT_CHUNK) {
+						m_writer.WriteArrayData(chunk, nChunk * sizeof(int32_t));
+						nChunk = 0;
+					}
+				}
+			}
+			m_writer.WriteArrayData(chunk, nChunk * sizeof(int32_t));
+		}
+		m_writer.EndArray();
+		m_writer.EndNode();
+
+		// Layer elements, same mapping as CreateFbxMesh
+		if (meshData.HasCompactNormals()) {
+			WriteLayerElement("LayerElementNormal", "ByPolygon", "Normals", meshData.normalTable, &meshData.polygonNormals);
+			WriteLayerElement("LayerElementTangent", "ByPolygon", "Tangents", meshData.tangentTable, &meshData.polygonTangents);
+		}
+		else {
+			WriteLayerElement("LayerElementNormal", "ByVertice", "Normals", meshData.normals);
+			WriteLayerElement("LayerElementTangent", meshData.IsWelded() ? "ByPolygonVertex" : "ByVertice", "Tangents",
+				meshData.tangents);
+		}
+
+		WriteUVLayerElement(0, "uvLayer", meshData.uvs);
+		if (meshData.HasLightmapUVs())
+			WriteUVLayerElement(1, "lightmapUV", meshData.lightmapUVs);
+
+		// Polygons index the materials connected to the model
+		m_writer.BeginNode("LayerElementMaterial");
+		m_writer.AddInt32(0);
+		{
+			m_writer.BeginNode("Version");
+			m_writer.AddInt32(101);
+			m_writer.EndNode();
+
+			m_writer.BeginNode("Name");
+			m_writer.AddString("");
+			m_writer.EndNode();
+
+			m_writer.BeginNode("MappingInformationType");
+			m_writer.AddString("ByPolygon");
+			m_writer.EndNode();
+
+			m_writer.BeginNode("ReferenceInformationType");
+			m_writer.AddString("IndexToDirect");
+			m_writer.EndNode();
+
+			m_writer.BeginNode("Materials");
+			m_writer.BeginArray('i', (uint32_t)meshData.polygonMaterials.size());
+			m_writer.WriteArrayData(meshData.polygonMaterials.data(), meshData.polygonMaterials.size() * sizeof(int32_t));
+			m_writer.EndArray();
+			m_writer.EndNode();
+		}
+		m_writer.EndNode();
+
+		const char* layerElements[] = { "LayerElementNormal", "LayerElementTangent", "LayerElementUV", "LayerElementMaterial" };
+		m_writer.BeginNode("Layer");
+		m_writer.AddInt32(0);
+		{
+			m_writer.BeginNode("Version");
+			m_writer.AddInt32(100);
+			m_writer.EndNode();
+
+			for (auto layerElement : layerElements) {
+				m_writer.BeginNode("LayerElement");
+				m_writer.BeginNode("Type");
+				m_writer.AddString(layerElement);
+				m_writer.EndNode();
+				m_writer.BeginNode("TypedIndex");
+				m_writer.AddInt32(0);
+				m_writer.EndNode();
+				m_writer.EndNode();
+			}
+		}
+		m_writer.EndNode();
+
+		// Lightmap coordinates are the UV set of the second layer
+		if (meshData.HasLightmapUVs()) {
+			m_writer.BeginNode("Layer");
+			m_writer.AddInt32(1);
+			{
+				m_writer.BeginNode("Version");
+				m_writer.AddInt32(100);
+				m_writer.EndNode();
+
+				m_writer.BeginNode("LayerElement");
+				m_writer.BeginNode("Type");
+				m_writer.AddString("LayerElementUV");
+				m_writer.EndNode();
+				m_writer.BeginNode("TypedIndex");
+				m_writer.AddInt32(1);
+				m_writer.EndNode();
+				m_writer.EndNode();
+			}
+			m_writer.EndNode();
+		}
+	}
+	m_writer.EndNode();
+}
+
+//---------------------------------------------------------------------
+void FBXNativeExporter::WriteConnections()
+{
+	m_writer.BeginNode("Connections");
+	for (auto& connection : m_connections) {
+		m_writer.BeginNode("C");
+		m_writer.AddString("OO");
+		m_writer.AddInt64(connection.first);
+		m_writer.AddInt64(connection.second);
+		m_writer.EndNode();
+	}
+
+	// Textures feed the diffuse color of their material, and its transparency
+	// when see-through texels have a zero alpha
+	for (unsigned i = 0; i < m_materials->size(); i++) {
+		const BSPSceneMaterial& material = (*m_materials)[i];
+		if (material.textureFile.empty())
+			continue;
+		const char* properties[] = { "DiffuseColor", "TransparentColor" };
+		for (unsigned j = 0; j < (material.transparent ? 2u : 1u); j++) {
+			m_writer.BeginNode("C");
+			m_writer.AddString("OP");
+			m_writer.AddInt64(GetTextureId(i));
+			m_writer.AddInt64(GetMaterialId(i));
+			m_writer.AddString(properties[j]);
+			m_writer.EndNode();
+		}
+	}
+	m_writer.EndNode();
+}
@@ -0,0 +1,68 @@
+/*
+	FBXNativeExporter writes a BSP scene as a FBX 7.4 binary file using
+	FBXBinaryWriter, without the Autodesk FBX SDK.
+	Geometry is streamed to disk one mesh at a time so memory use doesn't
+	depend on the size of the map. Only the small list of connections is
+	kept around until the end of the file.
+	Materials are written up front, each mesh connects to the ones it uses
+	in the order its material layer indexes them.
+	LOD groups are models with a LodGroup node attribute holding the
+	distances at which they switch to their next child.
+*/
+
+#pragma once
+
+#include "BSPScene.h"
+#include "FBXBinaryWriter.h"
+
+class FBXNativeExporter : public BSPSceneExporter {
+public:
+	// compressArrays deflates geometry arrays when zlib is available
+	FBXNativeExporter(bool compressArrays);
+
+	bool BeginScene(const char* fileName, const vector<BSPSceneNode>& nodes, const vector<BSPSceneMaterial>& materials);
+	void WriteMesh(unsigned nodeId, const BSPMeshData& meshData);
+	bool EndScene();
+
+private:
+	// Object ids, 0 is the scene root
+	int64_t GetModelId(unsigned nodeId) const		{ return 1000000 + 2 * (int64_t)nodeId; }
+	int64_t GetGeometryId(unsigned nodeId) const	{ return 1000000 + 2 * (int64_t)nodeId + 1; }
+	int64_t GetNodeAttributeId(unsigned nodeId) const	{ return GetGeometryId(nodeId); }	// LOD groups have no geometry
+	int64_t GetMaterialId(unsigned materialId) const	{ return 2000000000 + 2 * (int64_t)materialId; }
+	int64_t GetTextureId(unsigned materialId) const		{ return 2000000000 + 2 * (int64_t)materialId + 1; }
+
+	void WriteHeaderExtension();
+	void WriteGlobalSettings();
+	void WriteDefinitions();
+	void WriteModel(unsigned nodeId, const char* type);
+	void WriteLODGroup(unsigned nodeId);
+	void WriteMaterial(unsigned materialId);
+	void WriteTexture(unsigned materialId);
+	void WriteGeometry(unsigned nodeId, const BSPMeshData& meshData);
+	void WriteConnections();
+
+	// Object names are "name\x00\x01Class" in binary files
+	void AddObjectName(const string& name, const char* className);
+
+	// Start a "P" property record of a Properties70 node
+	void BeginP(const char* name, const char* type, const char* label, const char* flags);
+
+	// Stream a float attribute stream as an array of doubles
+	void WriteFloatArray(const float* values, size_t count);
+
+	// A layer element referenced by the "Layer" node of a geometry
+	// With indices its values are a table indexed per mapped element (IndexToDirect)
+	void WriteLayerElement(const char* type, const char* mapping, const char* arrayName, const vector<float>& values,
+		const vector<unsigned>* indices = nullptr);
+
+	// A UV set, per control point
+	void WriteUVLayerElement(int32_t index, const char* name, const vector<float>& uvs);
+
+	FBXBinaryWriter				m_writer;
+	bool						m_compressArrays;
+	string						m_outputDirectory;
+	const vector<BSPSceneNode>*	m_nodes;
+	const vector<BSPSceneMaterial>*	m_materials;
+	vector<pair<int64_t, int64_t>>	m_connections;	// child id -> parent id
+};
@@ -0,0 +1,481 @@
+#include "GLTFExporter.h"
+#include "JsonString.h"
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+
+// Interleaved vertex : position, normal, tangent, uv, followed by the lightmap uv if any
+#define GLTF_VERTEX_FLOATS (3 + 3 + 4 + 2)
+#define GLTF_LIGHTMAP_UV_FLOATS 2
+
+// Buffer view targets and accessor component types
+#define GLTF_ARRAY_BUFFER			34962
+#define GLTF_ELEMENT_ARRAY_BUFFER	34963
+#define GLTF_UNSIGNED_SHORT			5123
+#define GLTF_UNSIGNED_INT			5125
+#define GLTF_FLOAT					5126
+
+// GLB container
+#define GLB_MAGIC		0x46546C67	// "glTF"
+#define GLB_VERSION		2
+#define GLB_CHUNK_JSON	0x4E4F534A	// "JSON"
+#define GLB_CHUNK_BIN	0x004E4942	// "BIN\0"
+
+// Largest vertex count addressed with 16 bit indices, 0xFFFF is kept for primitive restart
+#define GLTF_MAX_INDEX16 0xFFFE
+
+//---------------------------------------------------------------------
+static string JsonFloats(const float* values, unsigned count)
+{
+	string json = "[";
+	char number[32];
+	for (unsigned i = 0; i < count; i++) {
+		snprintf(number, sizeof(number), i ? ",%.9g" : "%.9g", values[i]);
+		json += number;
+	}
+	json.push_back(']');
+	return json;
+}
+
+//---------------------------------------------------------------------
+static string JsonUri(const string& path)
+{
+	// Exported texture paths are relative, only characters a URI can't hold are escaped
+	string uri;
+	for (char c : path) {
+		if (isalnum((unsigned char)c) || strchr("-._~!$&'()*+,;=:@/", c)) {
+			uri.push_back(c);
+		}
+		else {
+			char escaped[4];
+			snprintf(escaped, sizeof(escaped), "%%%02X", (unsigned char)c);
+			uri += escaped;
+		}
+	}
+	return JsonString(uri);
+}
+
+//---------------------------------------------------------------------
+static void AppendJson(string& array, const string& element)
+{
+	if (!array.empty())
+		array.push_back(',');
+	array += element;
+}
+
+//---------------------------------------------------------------------
+GLTFExporter::GLTFExporter(bool binary)
+{
+	m_binary = binary;
+	m_binFile = nullptr;
+	m_binSize = 0;
+	m_failed = false;
+	m_nodes = nullptr;
+	m_materials = nullptr;
+	m_nBufferViews = 0;
+	m_nAccessors = 0;
+	m_nMeshes = 0;
+	m_nMaterials = 0;
+	m_nTextures = 0;
+}
+
+//---------------------------------------------------------------------
+GLTFExporter::~GLTFExporter()
+{
+	if (m_binFile) {
+		fclose(m_binFile);
+		if (m_binary)
+			remove(m_binFileName.c_str());
+	}
+}
+
+//---------------------------------------------------------------------
+bool GLTFExporter::BeginScene(const char* fileName, const vector<BSPSceneNode>& nodes, const vector<BSPSceneMaterial>& materials)
+{
+	m_fileName = fileName;
+	m_nodes = &nodes;
+	m_nodeMeshes.assign(nodes.size(), -1);
+	m_materials = &materials;
+	m_gltfMaterials.assign(materials.size(), -1);
+	m_bufferViewsJson.clear();
+	m_accessorsJson.clear();
+	m_meshesJson.clear();
+	m_materialsJson.clear();
+	m_texturesJson.clear();
+	m_imagesJson.clear();
+	m_nBufferViews = m_nAccessors = m_nMeshes = 0;
+	m_nMaterials = m_nTextures = 0;
+	m_binSize = 0;
+	m_failed = false;
+
+	// A .glb needs the JSON before the binary chunk, so geometry goes to a
+	// temporary file first and is copied behind the JSON by EndScene
+	if (m_binary) {
+		m_binFileName = m_fileName + ".bin.tmp";
+	}
+	else {
+		size_t dot = m_fileName.find_last_of('.');
+		m_binFileName = (dot == string::npos ? m_fileName : m_fileName.substr(0, dot)) + ".bin";
+	}
+
+	m_binFile = fopen(m_binFileName.c_str(), "wb");
+	return m_binFile != nullptr;
+}
+
+//---------------------------------------------------------------------
+void GLTFExporter::WriteBin(const void* data, size_t size)
+{
+	if (size && fwrite(data, 1, size, m_binFile) != size)
+		m_failed = true;
+	m_binSize += size;
+}
+
+//---------------------------------------------------------------------
+void GLTFExporter::AlignBin()
+{
+	static const uint8_t zeros[4] = { 0 };
+	WriteBin(zeros, (4 - m_binSize % 4) % 4);
+}
+
+//---------------------------------------------------------------------
+unsigned GLTFExporter::AddBufferView(size_t offset, size_t length, unsigned stride, unsigned target)
+{
+	char json[160];
+	if (stride)
+		snprintf(json, sizeof(json), "{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"byteStride\":%u,\"target\":%u}",
+			offset, length, stride, target);
+	else
+		snprintf(json, sizeof(json), "{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"target\":%u}",
+			offset, length, target);
+	AppendJson(m_bufferViewsJson, json);
+	return m_nBufferViews++;
+}
+
+//---------------------------------------------------------------------
+unsigned GLTFExporter::AddAccessor(unsigned bufferView, size_t byteOffset, unsigned componentType, size_t count, const char* type,
+	const float* min, const float* max)
+{
+	char header[160];
+	snprintf(header, sizeof(header), "{\"bufferView\":%u,\"byteOffset\":%zu,\"componentType\":%u,\"count\":%zu,\"type\":\"%s\"",
+		bufferView, byteOffset, componentType, count, type);
+	string json = header;
+	if (min && max)
+		json += ",\"min\":" + JsonFloats(min, 3) + ",\"max\":" + JsonFloats(max, 3);
+	json.push_back('}');
+	AppendJson(m_accessorsJson, json);
+	return m_nAccessors++;
+}
+
+//---------------------------------------------------------------------
+unsigned GLTFExporter::GetMaterial(unsigned materialId)
+{
+	if (m_gltfMaterials[materialId] >= 0)
+		return (unsigned)m_gltfMaterials[materialId];
+
+	// BSP textures aren't lit by their material : no metal, fully rough
+	const BSPSceneMaterial& material = (*m_materials)[materialId];
+	string json = "{\"name\":" + JsonString(material.name) + ",\"pbrMetallicRoughness\":{";
+	if (!material.textureFile.empty()) {
+		// Samplers default to repeat which is how BSP textures are mapped
+		AppendJson(m_imagesJson, "{\"uri\":" + JsonUri(material.textureFile) + "}");
+		AppendJson(m_texturesJson, "{\"source\":" + to_string(m_nTextures) + "}");
+		json += "\"baseColorTexture\":{\"index\":" + to_string(m_nTextures) + "},";
+		m_nTextures++;
+	}
+	json += "\"metallicFactor\":0}";
+
+	// See-through texels have a zero alpha in the exported image
+	if (material.transparent)
+		json += ",\"alphaMode\":\"MASK\"";
+	json.push_back('}');
+	AppendJson(m_materialsJson, json);
+
+	m_gltfMaterials[materialId] = (int)m_nMaterials;
+	return m_nMaterials++;
+}
+
+//---------------------------------------------------------------------
+void GLTFExporter::WriteMesh(unsigned nodeId, const BSPMeshData& meshData)
+{
+	// glTF only knows triangles : polygons are convex so they're split as fans
+	size_t nTriangles = 0;
+	for (unsigned pId = 0; pId < meshData.nPolygons; pId++) {
+		if (meshData.nPolygonCPs[pId] >= 3)
+			nTriangles += meshData.nPolygonCPs[pId] - 2;
+	}
+	// Accessors can't be empty, a model made of sky only has no mesh
+	if (nTriangles == 0)
+		return;
+
+	// Welded tangents are per polygon vertex, a shared vertex keeps the first one
+	size_t nVertices = meshData.GetControlPointCount();
+	bool lightmapped = meshData.HasLightmapUVs();
+	unsigned vertexFloats = GLTF_VERTEX_FLOATS + (lightmapped ? GLTF_LIGHTMAP_UV_FLOATS : 0);
+	m_vertices.resize(nVertices * vertexFloats);
+	vector<bool> tangentSet(nVertices, !meshData.IsWelded());
+	float min[3] = { 0.0f, 0.0f, 0.0f };
+	float max[3] = { 0.0f, 0.0f, 0.0f };
+	for (size_t i = 0; i < nVertices; i++) {
+		float* vertex = &m_vertices[i * vertexFloats];
+		const float* p = meshData.GetPosition(i);
+		memcpy(vertex + 0, p, 3 * sizeof(float));
+		memcpy(vertex + 3, meshData.GetNormal(i), 3 * sizeof(float));
+		if (!meshData.IsWelded())
+			memcpy(vertex + 6, meshData.GetTangent(i), 3 * sizeof(float));
+		vertex[9] = 1.0f;
+
+		// V goes up in BSPMeshData but glTF's UV origin is the top left corner
+		const float* uv = meshData.GetUV(i);
+		vertex[10] = uv[0];
+		vertex[11] = 1.0f - uv[1];
+		if (lightmapped) {
+			const float* lightmapUV = meshData.GetLightmapUV(i);
+			vertex[12] = lightmapUV[0];
+			vertex[13] = 1.0f - lightmapUV[1];
+		}
+
+		for (unsigned axis = 0; axis < 3; axis++) {
+			min[axis] = (i == 0) ? p[axis] : std::min(min[axis], p[axis]);
+			max[axis] = (i == 0) ? p[axis] : std::max(max[axis], p[axis]);
+		}
+	}
+
+	// Polygons of a material are contiguous, each run becomes a primitive
+	m_indices.clear();
+	m_indices.reserve(nTriangles * 3);
+	m_primitives.clear();
+	unsigned pvFirst = 0;
+	for (unsigned pId = 0; pId < meshData.nPolygons; pId++) {
+		unsigned nCPs = meshData.nPolygonCPs[pId];
+		unsigned material = meshData.polygonMaterials[pId];
+		if (m_primitives.empty() || m_primitives.back().first != material)
+			m_primitives.push_back(make_pair(material, m_indices.size()));
+		for (unsigned i = 0; i < nCPs; i++) {
+			unsigned cp = meshData.GetPolygonCP(pvFirst + i);
+			if (!tangentSet[cp]) {
+				memcpy(&m_vertices[cp * vertexFloats + 6], meshData.GetTangent(pvFirst + i), 3 * sizeof(float));
+				tangentSet[cp] = true;
+			}
+		}
+		for (unsigned i = 1; i + 1 < nCPs; i++) {
+			m_indices.push_back(meshData.GetPolygonCP(pvFirst));
+			m_indices.push_back(meshData.GetPolygonCP(pvFirst + i));
+			m_indices.push_back(meshData.GetPolygonCP(pvFirst + i + 1));
+		}
+		pvFirst += nCPs;
+	}
+
+	// ----- Vertices -----
+	AlignBin();
+	size_t vertexOffset = m_binSize;
+	WriteBin(m_vertices.data(), m_vertices.size() * sizeof(float));
+	unsigned vertexView = AddBufferView(vertexOffset, m_binSize - vertexOffset, vertexFloats * sizeof(float), GLTF_ARRAY_BUFFER);
+	unsigned positionAccessor = AddAccessor(vertexView, 0, GLTF_FLOAT, nVertices, "VEC3", min, max);
+	unsigned normalAccessor = AddAccessor(vertexView, 3 * sizeof(float), GLTF_FLOAT, nVertices, "VEC3");
+	unsigned tangentAccessor = AddAccessor(vertexView, 6 * sizeof(float), GLTF_FLOAT, nVertices, "VEC4");
+	unsigned uvAccessor = AddAccessor(vertexView, 10 * sizeof(float), GLTF_FLOAT, nVertices, "VEC2");
+	string attributes = "\"POSITION\":" + to_string(positionAccessor) + ",\"NORMAL\":" + to_string(normalAccessor) +
+		",\"TANGENT\":" + to_string(tangentAccessor) + ",\"TEXCOORD_0\":" + to_string(uvAccessor);
+	if (lightmapped)
+		attributes += ",\"TEXCOORD_1\":" + to_string(AddAccessor(vertexView, 12 * sizeof(float), GLTF_FLOAT, nVertices, "VEC2"));
+
+	// ----- Indices -----
+	AlignBin();
+	size_t indexOffset = m_binSize;
+	bool shortIndices = nVertices <= GLTF_MAX_INDEX16;
+	if (shortIndices) {
+		m_indices16.assign(m_indices.begin(), m_indices.end());
+		WriteBin(m_indices16.data(), m_indices16.size() * sizeof(uint16_t));
+	}
+	else {
+		WriteBin(m_indices.data(), m_indices.size() * sizeof(uint32_t));
+	}
+	unsigned indexView = AddBufferView(indexOffset, m_binSize - indexOffset, 0, GLTF_ELEMENT_ARRAY_BUFFER);
+
+	// ----- Primitives -----
+	string primitivesJson;
+	for (unsigned i = 0; i < m_primitives.size(); i++) {
+		size_t firstIndex = m_primitives[i].second;
+		size_t nIndices = (i + 1 < m_primitives.size() ? m_primitives[i + 1].second : m_indices.size()) - firstIndex;
+		// Polygons with less than 3 vertices have no triangle
+		if (nIndices == 0)
+			continue;
+		unsigned indexAccessor = AddAccessor(indexView, firstIndex * (shortIndices ? sizeof(uint16_t) : sizeof(uint32_t)),
+			shortIndices ? GLTF_UNSIGNED_SHORT : GLTF_UNSIGNED_INT, nIndices, "SCALAR");
+		unsigned material = GetMaterial(meshData.materials[m_primitives[i].first]);
+
+		AppendJson(primitivesJson, "{\"attributes\":{" + attributes + "},\"indices\":" + to_string(indexAccessor) +
+			",\"material\":" + to_string(material) + ",\"mode\":4}");
+	}
+
+	AppendJson(m_meshesJson, "{\"primitives\":[" + primitivesJson + "],\"name\":" + JsonString((*m_nodes)[nodeId].name) + "}");
+	m_nodeMeshes[nodeId] = (int)m_nMeshes++;
+}
+
+//---------------------------------------------------------------------
+string GLTFExporter::BuildJson() const
+{
+	const vector<BSPSceneNode>& nodes = *m_nodes;
+
+	// MSFT_lod : the full level of a LOD group lists the others, which stay out
+	// of the hierarchy. Levels of a group follow each other
+	vector<string> lodIds(nodes.size());
+	for (unsigned i = 0; i < nodes.size(); i++) {
+		if (nodes[i].lod > 0)
+			AppendJson(lodIds[i - nodes[i].lod], to_string(i));
+	}
+
+	string nodesJson, rootsJson;
+	for (unsigned i = 0; i < nodes.size(); i++) {
+		const BSPSceneNode& node = nodes[i];
+		string json = "{\"name\":" + JsonString(node.name);
+
+		string children;
+		for (unsigned j = i + 1; j < nodes.size(); j++) {
+			if (nodes[j].parent == (int)i && nodes[j].lod == 0)
+				AppendJson(children, to_string(j));
+		}
+		if (!children.empty())
+			json += ",\"children\":[" + children + "]";
+
+		if (m_nodeMeshes[i] >= 0)
+			json += ",\"mesh\":" + to_string(m_nodeMeshes[i]);
+
+		if (!lodIds[i].empty())
+			json += ",\"extensions\":{\"MSFT_lod\":{\"ids\":[" + lodIds[i] + "]}}";
+
+		if (node.scaling.x != 1.0f || node.scaling.y != 1.0f || node.scaling.z != 1.0f) {
+			const float scale[3] = { node.scaling.x, node.scaling.y, node.scaling.z };
+			json += ",\"scale\":" + JsonFloats(scale, 3);
+		}
+
+		// Custom data goes to the node's extras
+		string extras;
+		for (auto& property : node.properties) {
+			string value;
+			if (property.type == PROPERTY_INT) {
+				value = to_string(property.intValue);
+			}
+			else if (property.type == PROPERTY_VECTOR) {
+				const float vector[3] = { property.vectorValue.x, property.vectorValue.y, property.vectorValue.z };
+				value = JsonFloats(vector, 3);
+			}
+			else {
+				value = JsonString(property.stringValue);
+			}
+			AppendJson(extras, JsonString(property.name) + ":" + value);
+		}
+		if (!extras.empty())
+			json += ",\"extras\":{" + extras + "}";
+		json.push_back('}');
+		AppendJson(nodesJson, json);
+
+		if (node.parent < 0)
+			AppendJson(rootsJson, to_string(i));
+	}
+
+	// The .glb binary chunk is the buffer without any uri
+	string buffer = "{\"byteLength\":" + to_string(m_binSize);
+	if (!m_binary) {
+		size_t slash = m_binFileName.find_last_of("/\\");
+		buffer += ",\"uri\":" + JsonString(slash == string::npos ? m_binFileName : m_binFileName.substr(slash + 1));
+	}
+	buffer.push_back('}');
+
+	string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"bsp2fbx\"},\"scene\":0,";
+	json += "\"scenes\":[{\"nodes\":[" + rootsJson + "]}],";
+	if (find_if(nodes.begin(), nodes.end(), [](const BSPSceneNode& node) { return node.lod > 0; }) != nodes.end())
+		json += "\"extensionsUsed\":[\"MSFT_lod\"],";
+	json += "\"nodes\":[" + nodesJson + "]";
+	if (m_nMeshes) {
+		json += ",\"meshes\":[" + m_meshesJson + "]";
+		json += ",\"accessors\":[" + m_accessorsJson + "]";
+		json += ",\"bufferViews\":[" + m_bufferViewsJson + "]";
+	}
+	if (m_nMaterials)
+		json += ",\"materials\":[" + m_materialsJson + "]";
+	if (m_nTextures) {
+		json += ",\"textures\":[" + m_texturesJson + "]";
+		json += ",\"images\":[" + m_imagesJson + "]";
+	}
+	if (m_binSize)
+		json += ",\"buffers\":[" + buffer + "]";
+	json.push_back('}');
+	return json;
+}
+
+//---------------------------------------------------------------------
+bool GLTFExporter::WriteGlb(const string& json)
+{
+	FILE* glb = fopen(m_fileName.c_str(), "wb");
+	if (!glb)
+		return false;
+
+	// Chunks are 4 byte aligned, JSON with spaces and BIN with zeros
+	string paddedJson = json;
+	paddedJson.append((4 - paddedJson.size() % 4) % 4, ' ');
+	size_t binLength = (m_binSize + 3) & ~(size_t)3;
+
+	uint32_t header[3] = { GLB_MAGIC, GLB_VERSION, 0 };
+	header[2] = (uint32_t)(12 + 8 + paddedJson.size() + (binLength ? 8 + binLength : 0));
+	uint32_t jsonChunk[2] = { (uint32_t)paddedJson.size(), GLB_CHUNK_JSON };
+	bool ok = fwrite(header, sizeof(header), 1, glb) == 1;
+	ok = ok && fwrite(jsonChunk, sizeof(jsonChunk), 1, glb) == 1;
+	ok = ok && fwrite(paddedJson.data(), 1, paddedJson.size(), glb) == paddedJson.size();
+
+	if (binLength) {
+		uint32_t binChunk[2] = { (uint32_t)binLength, GLB_CHUNK_BIN };
+		ok = ok && fwrite(binChunk, sizeof(binChunk), 1, glb) == 1;
+
+		// Copy the geometry written so far behind the JSON
+		FILE* bin = fopen(m_binFileName.c_str(), "rb");
+		ok = ok && bin != nullptr;
+		vector<uint8_t> chunk(1 << 16);
+		size_t copied = 0;
+		while (ok && copied < m_binSize) {
+			size_t size = fread(chunk.data(), 1, min(chunk.size(), m_binSize - copied), bin);
+			ok = size > 0 && fwrite(chunk.data(), 1, size, glb) == size;
+			copied += size;
+		}
+		if (bin)
+			fclose(bin);
+
+		static const uint8_t zeros[4] = { 0 };
+		ok = ok && fwrite(zeros, 1, binLength - m_binSize, glb) == binLength - m_binSize;
+	}
+
+	if (fclose(glb) != 0)
+		ok = false;
+	return ok;
+}
+
+//---------------------------------------------------------------------
+bool GLTFExporter::EndScene()
+{
+	// Buffer length has to be a multiple of 4 in .gltf files as well
+	AlignBin();
+	if (fclose(m_binFile) != 0)
+		m_failed = true;
+	m_binFile = nullptr;
+
+	string json = BuildJson();
+
+	bool ok = !m_failed;
+	if (m_binary) {
+		ok = ok && WriteGlb(json);
+		remove(m_binFileName.c_str());
+	}
+	else {
+		FILE* file = fopen(m_fileName.c_str(), "wb");
+		ok = ok && file != nullptr;
+		if (file) {
+			ok = ok && fwrite(json.data(), 1, json.size(), file) == json.size();
+			if (fclose(file) != 0)
+				ok = false;
+		}
+		// An empty buffer isn't referenced
+		if (m_binSize == 0)
+			remove(m_binFileName.c_str());
+	}
+	return ok;
+}
@@ -0,0 +1,82 @@
+/*
+	GLTFExporter writes a BSP scene as glTF 2.0, either a .gltf file with
+	its geometry in a .bin file next to it or a single binary .glb file.
+
+	Mesh vertices are interleaved in a single buffer view so they can be
+	uploaded to the GPU as is:
+		POSITION (vec3), NORMAL (vec3), TANGENT (vec4), TEXCOORD_0 (vec2)
+	followed by the lightmap atlas coordinates TEXCOORD_1 (vec2) when the
+	mesh has them.
+	Every material of a mesh is a triangle primitive sharing these vertices,
+	with its own range of the mesh's index buffer view. Indices are 16 bit
+	whenever the mesh has few enough vertices, 32 bit otherwise. Geometry
+	is streamed to the .bin file as meshes are written and only the JSON
+	description is kept in memory.
+*/
+
+#pragma once
+
+#include "BSPScene.h"
+#include <stdint.h>
+#include <stdio.h>
+
+class GLTFExporter : public BSPSceneExporter {
+public:
+	// binary writes a single .glb file instead of .gltf and .bin
+	GLTFExporter(bool binary);
+	~GLTFExporter();
+
+	bool BeginScene(const char* fileName, const vector<BSPSceneNode>& nodes, const vector<BSPSceneMaterial>& materials);
+	void WriteMesh(unsigned nodeId, const BSPMeshData& meshData);
+	bool EndScene();
+
+private:
+	// Raw output to the .bin file, padded so every buffer view starts 4 byte aligned
+	void WriteBin(const void* data, size_t size);
+	void AlignBin();
+
+	// Append a buffer view / accessor to the JSON arrays and return its index
+	unsigned AddBufferView(size_t offset, size_t length, unsigned stride, unsigned target);
+	unsigned AddAccessor(unsigned bufferView, size_t byteOffset, unsigned componentType, size_t count, const char* type,
+		const float* min = nullptr, const float* max = nullptr);
+
+	// glTF material of a scene material, added on first use with its texture
+	unsigned GetMaterial(unsigned materialId);
+
+	// The glTF JSON document
+	string BuildJson() const;
+
+	// Write the .glb container from the JSON and the temporary .bin file
+	bool WriteGlb(const string& json);
+
+	bool				m_binary;
+	string				m_fileName;
+	string				m_binFileName;
+	FILE*				m_binFile;
+	size_t				m_binSize;
+	bool				m_failed;
+
+	const vector<BSPSceneNode>*	m_nodes;
+	vector<int>			m_nodeMeshes;		// glTF mesh of every node, -1 if none
+	const vector<BSPSceneMaterial>*	m_materials;
+	vector<int>			m_gltfMaterials;	// glTF material of every scene material, -1 if unused
+
+	// JSON array contents, without brackets
+	string				m_bufferViewsJson;
+	string				m_accessorsJson;
+	string				m_meshesJson;
+	string				m_materialsJson;
+	string				m_texturesJson;
+	string				m_imagesJson;
+	unsigned			m_nBufferViews;
+	unsigned			m_nAccessors;
+	unsigned			m_nMeshes;
+	unsigned			m_nMaterials;
+	unsigned			m_nTextures;
+
+	// Reused between meshes
+	vector<float>		m_vertices;
+	vector<uint32_t>	m_indices;
+	vector<uint16_t>	m_indices16;
+	vector<pair<unsigned, size_t>>	m_primitives;	// Mesh material and first index of every primitive
+};
@@ -0,0 +1,194 @@
+#include "ImageWriter.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#ifdef BSP2FBX_WITH_ZLIB
+#include "zlib.h"
+#endif
+
+using namespace std;
+
+// Largest block of a stored (uncompressed) deflate stream
+#define DEFLATE_STORED_BLOCK 65535
+
+//---------------------------------------------------------------------
+const char* GetImageExtension(BSPImageFormat format)
+{
+	return format == IMAGE_TGA ? ".tga" : ".png";
+}
+
+//---------------------------------------------------------------------
+bool WriteImage(const char* fileName, BSPImageFormat format, unsigned width, unsigned height, const uint32_t* rgba)
+{
+	if (format == IMAGE_TGA)
+		return WriteTGA(fileName, width, height, rgba);
+	return WritePNG(fileName, width, height, rgba);
+}
+
+// ----- PNG -----
+
+//---------------------------------------------------------------------
+static uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+	static uint32_t table[256];
+	static bool tableReady = [] {
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		return true;
+	}();
+	(void)tableReady;
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+//---------------------------------------------------------------------
+static void PutU32BE(uint8_t* dst, uint32_t value)
+{
+	dst[0] = (uint8_t)(value >> 24);
+	dst[1] = (uint8_t)(value >> 16);
+	dst[2] = (uint8_t)(value >> 8);
+	dst[3] = (uint8_t)value;
+}
+
+//---------------------------------------------------------------------
+static bool WritePNGChunk(FILE* file, const char* type, const uint8_t* data, size_t size)
+{
+	uint8_t header[8];
+	PutU32BE(header, (uint32_t)size);
+	memcpy(header + 4, type, 4);
+	uint8_t crc[4];
+	PutU32BE(crc, Crc32(Crc32(0, header + 4, 4), data, size));
+
+	return fwrite(header, 1, 8, file) == 8 &&
+		(size == 0 || fwrite(data, 1, size, file) == size) &&
+		fwrite(crc, 1, 4, file) == 4;
+}
+
+//---------------------------------------------------------------------
+static void DeflateImage(const vector<uint8_t>& raw, vector<uint8_t>& zdata)
+{
+#ifdef BSP2FBX_WITH_ZLIB
+	// Favor speed, textures are small and written in bulk
+	uLongf zsize = compressBound((uLong)raw.size());
+	zdata.resize(zsize);
+	compress2(zdata.data(), &zsize, raw.data(), (uLong)raw.size(), Z_BEST_SPEED);
+	zdata.resize(zsize);
+#else
+	// zlib header, stored blocks and the adler32 of the raw data
+	zdata.clear();
+	zdata.reserve(raw.size() + (raw.size() / DEFLATE_STORED_BLOCK + 1) * 5 + 6);
+	zdata.push_back(0x78);
+	zdata.push_back(0x01);
+	size_t offset = 0;
+	do {
+		size_t blockSize = raw.size() - offset;
+		if (blockSize > DEFLATE_STORED_BLOCK)
+			blockSize = DEFLATE_STORED_BLOCK;
+		bool last = offset + blockSize == raw.size();
+		zdata.push_back(last ? 1 : 0);
+		zdata.push_back((uint8_t)blockSize);
+		zdata.push_back((uint8_t)(blockSize >> 8));
+		zdata.push_back((uint8_t)~blockSize);
+		zdata.push_back((uint8_t)(~blockSize >> 8));
+		zdata.insert(zdata.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+		offset += blockSize;
+	} while (offset < raw.size());
+
+	uint32_t a = 1, b = 0;
+	for (size_t i = 0; i < raw.size(); i++) {
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	uint8_t adler[4];
+	PutU32BE(adler, (b << 16) | a);
+	zdata.insert(zdata.end(), adler, adler + 4);
+#endif
+}
+
+//---------------------------------------------------------------------
+bool WritePNG(const char* fileName, unsigned width, unsigned height, const uint32_t* rgba)
+{
+	// Every row starts with its filter type, 0 is none
+	size_t rowSize = (size_t)width * 4;
+	vector<uint8_t> raw((rowSize + 1) * height);
+	for (unsigned y = 0; y < height; y++) {
+		uint8_t* row = &raw[(rowSize + 1) * y];
+		row[0] = 0;
+		memcpy(row + 1, rgba + (size_t)y * width, rowSize);
+	}
+
+	vector<uint8_t> zdata;
+	DeflateImage(raw, zdata);
+
+	FILE* file = fopen(fileName, "wb");
+	if (!file)
+		return false;
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+	// Width, height, 8 bits per channel, RGBA, default compression, filter and no interlacing
+	uint8_t ihdr[13];
+	PutU32BE(ihdr, width);
+	PutU32BE(ihdr + 4, height);
+	ihdr[8] = 8;
+	ihdr[9] = 6;
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+	bool ok = fwrite(signature, 1, 8, file) == 8 &&
+		WritePNGChunk(file, "IHDR", ihdr, sizeof(ihdr)) &&
+		WritePNGChunk(file, "IDAT", zdata.data(), zdata.size()) &&
+		WritePNGChunk(file, "IEND", nullptr, 0);
+
+	if (fclose(file) != 0)
+		ok = false;
+	return ok;
+}
+
+// ----- TGA -----
+
+//---------------------------------------------------------------------
+bool WriteTGA(const char* fileName, unsigned width, unsigned height, const uint32_t* rgba)
+{
+	if (width > 0xFFFF || height > 0xFFFF)
+		return false;
+
+	FILE* file = fopen(fileName, "wb");
+	if (!file)
+		return false;
+
+	// Uncompressed true color, 32 bits per pixel with 8 alpha bits, top left origin
+	uint8_t header[18] = { 0 };
+	header[2] = 2;
+	header[12] = (uint8_t)width;
+	header[13] = (uint8_t)(width >> 8);
+	header[14] = (uint8_t)height;
+	header[15] = (uint8_t)(height >> 8);
+	header[16] = 32;
+	header[17] = 0x28;
+	bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+	// TGA pixels are BGRA
+	vector<uint8_t> row((size_t)width * 4);
+	for (unsigned y = 0; y < height && ok; y++) {
+		const uint8_t* src = (const uint8_t*)(rgba + (size_t)y * width);
+		for (unsigned x = 0; x < width; x++) {
+			row[x * 4 + 0] = src[x * 4 + 2];
+			row[x * 4 + 1] = src[x * 4 + 1];
+			row[x * 4 + 2] = src[x * 4 + 0];
+			row[x * 4 + 3] = src[x * 4 + 3];
+		}
+		ok = fwrite(row.data(), 1, row.size(), file) == row.size();
+	}
+
+	if (fclose(file) != 0)
+		ok = false;
+	return ok;
+}
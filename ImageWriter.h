@@ -0,0 +1,27 @@
+/*
+	This file defines writers for 32 bit RGBA images, used to save the
+	textures decoded from BSP and WAD files.
+	PNG files are deflated with zlib when the build has BSP2FBX_WITH_ZLIB,
+	otherwise their pixel data is stored uncompressed which every PNG
+	reader still accepts.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Image file formats
+enum BSPImageFormat {
+	IMAGE_PNG,
+	IMAGE_TGA
+};
+
+// File extension including the dot
+const char* GetImageExtension(BSPImageFormat format);
+
+// Write width x height RGBA pixels, R in the lowest byte, top row first
+// Returns false if the file couldn't be written
+bool WriteImage(const char* fileName, BSPImageFormat format, unsigned width, unsigned height, const uint32_t* rgba);
+
+bool WritePNG(const char* fileName, unsigned width, unsigned height, const uint32_t* rgba);
+bool WriteTGA(const char* fileName, unsigned width, unsigned height, const uint32_t* rgba);
@@ -0,0 +1,24 @@
+#include "JsonString.h"
+#include <stdio.h>
+
+//---------------------------------------------------------------------
+string JsonString(const string& value)
+{
+	string json = "\"";
+	for (char c : value) {
+		if (c == '"' || c == '\\') {
+			json.push_back('\\');
+			json.push_back(c);
+		}
+		else if ((unsigned char)c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+			json += escaped;
+		}
+		else {
+			json.push_back(c);
+		}
+	}
+	json.push_back('"');
+	return json;
+}
@@ -0,0 +1,14 @@
+/*
+	This file defines the string escaping shared by the outputs written as
+	JSON : glTF files, conversion statistics and the answers of the
+	conversion server.
+*/
+
+#pragma once
+
+#include <string>
+
+using namespace std;
+
+// A string as a quoted JSON string, quotes, backslashes and control characters escaped
+string JsonString(const string& value);
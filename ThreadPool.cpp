@@ -0,0 +1,224 @@
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <exception>
+
+// The pool and index of the worker running on this thread if any
+static thread_local ThreadPool*	t_WorkerPool = nullptr;
+static thread_local int			t_WorkerIndex = -1;
+
+// -----------------------------------------------------------------
+ThreadPool::ThreadPool(unsigned nThreads) {
+
+	if (nThreads == 0)
+		nThreads = thread::hardware_concurrency();
+	if (nThreads == 0)
+		nThreads = 1;
+
+	m_NextQueue = 0;
+	m_QueuedTasks = 0;
+	m_Stopping = false;
+
+	for (unsigned i = 0; i < nThreads; i++)
+		m_Queues.push_back(new WorkerQueue());
+
+	for (unsigned i = 0; i < nThreads; i++)
+		m_Workers.push_back(thread(&ThreadPool::WorkerLoop, this, i));
+}
+
+// -----------------------------------------------------------------
+ThreadPool::~ThreadPool() {
+
+	{
+		lock_guard<mutex> lock(m_SleepLock);
+		m_Stopping = true;
+	}
+	m_WorkAvailable.notify_all();
+
+	for (auto& worker : m_Workers)
+		worker.join();
+
+	for (auto queue : m_Queues)
+		delete queue;
+}
+
+// -----------------------------------------------------------------
+int ThreadPool::GetCurrentWorkerIndex() {
+	return t_WorkerIndex;
+}
+
+// -----------------------------------------------------------------
+ThreadPool* ThreadPool::GetCurrentPool() {
+	return t_WorkerPool;
+}
+
+// -----------------------------------------------------------------
+void ThreadPool::Submit(function<void()> task, TaskGroup* group) {
+
+	if (group)
+		group->m_Pending++;
+
+	// Workers keep their own tasks local, others are spread round robin
+	unsigned queueId;
+	if (t_WorkerPool == this)
+		queueId = (unsigned)t_WorkerIndex;
+	else
+		queueId = m_NextQueue++ % m_Queues.size();
+
+	{
+		WorkerQueue* queue = m_Queues[queueId];
+		lock_guard<mutex> lock(queue->lock);
+		queue->tasks.push_back(Task{ move(task), group });
+	}
+	m_QueuedTasks++;
+
+	// Taking the lock makes sure a worker about to sleep sees the new task
+	{
+		lock_guard<mutex> lock(m_SleepLock);
+	}
+	m_WorkAvailable.notify_one();
+}
+
+// -----------------------------------------------------------------
+bool ThreadPool::FindTask(int index, Task& task, const TaskGroup* group) {
+
+	unsigned nQueues = (unsigned)m_Queues.size();
+
+	// Newest task of our own deque first, it's the most likely to be cache hot
+	if (index >= 0) {
+		WorkerQueue* queue = m_Queues[index];
+		lock_guard<mutex> lock(queue->lock);
+		for (auto it = queue->tasks.rbegin(); it != queue->tasks.rend(); ++it) {
+			if (group && it->group != group)
+				continue;
+			task = move(*it);
+			queue->tasks.erase(next(it).base());
+			m_QueuedTasks--;
+			return true;
+		}
+	}
+
+	// Then steal the oldest task of any other worker
+	unsigned start = (index >= 0) ? (unsigned)index + 1 : 0;
+	for (unsigned i = 0; i < nQueues; i++) {
+		unsigned victim = (start + i) % nQueues;
+		if ((int)victim == index)
+			continue;
+		WorkerQueue* queue = m_Queues[victim];
+		lock_guard<mutex> lock(queue->lock);
+		for (auto it = queue->tasks.begin(); it != queue->tasks.end(); ++it) {
+			if (group && it->group != group)
+				continue;
+			task = move(*it);
+			queue->tasks.erase(it);
+			m_QueuedTasks--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// -----------------------------------------------------------------
+bool ThreadPool::KeepError(TaskGroup* group) {
+
+	if (!group)
+		return false;
+	lock_guard<mutex> lock(group->m_ErrorLock);
+	if (!group->m_Error)
+		group->m_Error = current_exception();
+	return true;
+}
+
+// -----------------------------------------------------------------
+void ThreadPool::RunTask(Task& task) {
+
+	try {
+		task.func();
+	}
+	catch (const exception& e) {
+		if (!KeepError(task.group))
+			printf("[ERROR] Uncaught exception in pool task: %s\n", e.what());
+	}
+	catch (...) {
+		if (!KeepError(task.group))
+			printf("[ERROR] Uncaught exception in pool task\n");
+	}
+
+	if (task.group && --task.group->m_Pending == 0) {
+		lock_guard<mutex> lock(m_SleepLock);
+		m_TaskFinished.notify_all();
+	}
+}
+
+// -----------------------------------------------------------------
+void ThreadPool::WorkerLoop(unsigned index) {
+
+	t_WorkerPool = this;
+	t_WorkerIndex = (int)index;
+
+	while (true) {
+		Task task;
+		if (FindTask((int)index, task, nullptr)) {
+			RunTask(task);
+			continue;
+		}
+
+		unique_lock<mutex> lock(m_SleepLock);
+		m_WorkAvailable.wait(lock, [this] { return m_Stopping || m_QueuedTasks.load() > 0; });
+		if (m_Stopping && m_QueuedTasks.load() == 0)
+			break;
+	}
+
+	t_WorkerPool = nullptr;
+	t_WorkerIndex = -1;
+}
+
+// -----------------------------------------------------------------
+void ThreadPool::Wait(TaskGroup& group) {
+
+	bool isWorker = (t_WorkerPool == this);
+
+	while (!group.IsDone()) {
+
+		// A worker waiting on nested tasks helps instead of blocking its thread
+		// It only picks tasks of that group, an unrelated task could reenter
+		// whatever state the waiting task is in the middle of using
+		if (isWorker) {
+			Task task;
+			if (FindTask(t_WorkerIndex, task, &group)) {
+				RunTask(task);
+				continue;
+			}
+		}
+
+		// Nothing to run, the remaining tasks are in flight on other workers
+		unique_lock<mutex> lock(m_SleepLock);
+		m_TaskFinished.wait_for(lock, chrono::milliseconds(1), [&group] { return group.IsDone(); });
+	}
+
+	// The group can be reused once its error is handed to the waiting thread
+	exception_ptr error;
+	{
+		lock_guard<mutex> lock(group.m_ErrorLock);
+		swap(error, group.m_Error);
+	}
+	if (error)
+		rethrow_exception(error);
+}
+
+// -----------------------------------------------------------------
+void ThreadPool::ParallelFor(unsigned begin, unsigned end, unsigned grainSize, const function<void(unsigned)>& body) {
+
+	if (grainSize == 0)
+		grainSize = 1;
+
+	TaskGroup group;
+	for (unsigned first = begin; first < end; first += grainSize) {
+		unsigned last = (end - first > grainSize) ? first + grainSize : end;
+		Submit([first, last, &body] {
+			for (unsigned i = first; i < last; i++)
+				body(i);
+		}, &group);
+	}
+	Wait(group);
+}
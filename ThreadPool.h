@@ -0,0 +1,109 @@
+/*
+	This file defines a small work-stealing thread pool.
+	Every worker owns a deque of tasks : it pushes and pops its own tasks at
+	the back and steals from the front of other workers' deques when it runs dry.
+	Tasks can be tracked with a TaskGroup and waited upon, the first exception
+	thrown by a task of a group is rethrown by the thread waiting on it.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// ======================================================================
+// TaskGroup counts the tasks submitted with it which haven't finished yet
+// and keeps the first exception one of them threw
+// ======================================================================
+class TaskGroup
+{
+public:
+	TaskGroup() : m_Pending(0) {}
+
+	bool IsDone() const { return m_Pending.load() == 0; }
+
+private:
+	friend class ThreadPool;
+	atomic<int>		m_Pending;
+	mutex			m_ErrorLock;
+	exception_ptr	m_Error;
+};
+
+// ======================================================================
+// ThreadPool runs tasks on a fixed set of worker threads
+// ======================================================================
+class ThreadPool
+{
+public:
+	// Constructor
+	// A thread count of 0 uses one worker per hardware thread
+	ThreadPool(unsigned nThreads = 0);
+
+	// Destructor, waits for all the queued tasks to finish
+	~ThreadPool();
+
+	// Queue a task, optionally tracked by a group
+	// Tasks submitted from a worker go to that worker's own deque
+	void Submit(function<void()> task, TaskGroup* group = nullptr);
+
+	// Block until every task of the group has finished
+	// Workers calling this keep running queued tasks of the group instead of sleeping
+	// Rethrows the first exception thrown by a task of the group
+	void Wait(TaskGroup& group);
+
+	// Run body(i) for every i in [begin, end) split into tasks of grainSize
+	// Rethrows the first exception thrown by body once every task has finished
+	void ParallelFor(unsigned begin, unsigned end, unsigned grainSize, const function<void(unsigned)>& body);
+
+	unsigned GetThreadCount() const { return (unsigned)m_Workers.size(); }
+
+	// Index of the calling worker in its pool, -1 when not called from a worker
+	static int GetCurrentWorkerIndex();
+
+	// Pool of the calling worker, nullptr when not called from a worker
+	static ThreadPool* GetCurrentPool();
+
+private:
+	struct Task {
+		function<void()>	func;
+		TaskGroup*			group;
+	};
+
+	struct WorkerQueue {
+		mutex				lock;
+		deque<Task>			tasks;
+	};
+
+	// Main loop of every worker thread
+	void WorkerLoop(unsigned index);
+
+	// Pop a task from our own deque or steal one from another worker
+	// When group is set only tasks of that group are considered
+	bool FindTask(int index, Task& task, const TaskGroup* group);
+
+	// Run a task and notify waiters of its group
+	// Exceptions are kept by the group for Wait, printed for tasks without one
+	void RunTask(Task& task);
+
+	// Keep the exception being handled for the thread waiting on the group,
+	// returns false for tasks without a group
+	static bool KeepError(TaskGroup* group);
+
+	vector<thread>			m_Workers;
+	vector<WorkerQueue*>	m_Queues;			// One deque per worker
+	atomic<unsigned>		m_NextQueue;		// Round robin for tasks submitted from outside
+	atomic<int>				m_QueuedTasks;		// Number of tasks sitting in deques
+	bool					m_Stopping;
+
+	mutex					m_SleepLock;		// Guards sleeping and waking workers/waiters
+	condition_variable		m_WorkAvailable;
+	condition_variable		m_TaskFinished;
+};
@@ -0,0 +1,153 @@
+#include "WADLoader.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// -----------------------------------------------------------------
+string ToLowerTextureName(const char* name)
+{
+	string lower(name, strnlen(name, MAXTEXTURENAME));
+	for (auto& c : lower)
+		c = (char)tolower((unsigned char)c);
+	return lower;
+}
+
+// -----------------------------------------------------------------
+bool WADLoader::Open(const char* fileName)
+{
+	m_FileName = fileName;
+	m_Index.clear();
+	m_Directory.clear();
+
+	// Only the lumps of used textures are read, don't prefetch the whole file
+	if (!m_MappedFile.Open(fileName, false))
+		return false;
+
+	const uint8_t* data = m_MappedFile.GetData();
+	size_t size = m_MappedFile.GetSize();
+
+	WADHEADER header;
+	if (size < sizeof(WADHEADER))
+		return false;
+	memcpy(&header, data, sizeof(WADHEADER));
+	if (memcmp(header.szMagic, WAD3_MAGIC, 4) != 0) {
+		printf("[WARNING] %s isn't a WAD3 file\n", fileName);
+		return false;
+	}
+	if (header.nDir < 0 || header.nDirOffset < 0 ||
+		(size_t)header.nDirOffset + (size_t)header.nDir * sizeof(WADDIRENTRY) > size) {
+		printf("[WARNING] %s has a corrupt directory\n", fileName);
+		return false;
+	}
+
+	m_Directory.resize(header.nDir);
+	memcpy(m_Directory.data(), data + header.nDirOffset, header.nDir * sizeof(WADDIRENTRY));
+
+	m_Index.reserve(header.nDir);
+	for (unsigned i = 0; i < m_Directory.size(); i++) {
+		const WADDIRENTRY& entry = m_Directory[i];
+		if (entry.nType != WAD_TYPE_MIPTEX || entry.bCompression)
+			continue;
+		if (entry.nFilePos < 0 || entry.nDiskSize < 0 || (size_t)entry.nFilePos + (size_t)entry.nDiskSize > size)
+			continue;
+		// The first lump of a given name wins like in the engine
+		m_Index.emplace(ToLowerTextureName(entry.szName), i);
+	}
+	return true;
+}
+
+// -----------------------------------------------------------------
+const uint8_t* WADLoader::FindMiptex(const char* textureName, size_t& size) const
+{
+	size = 0;
+	auto it = m_Index.find(ToLowerTextureName(textureName));
+	if (it == m_Index.end())
+		return nullptr;
+
+	const WADDIRENTRY& entry = m_Directory[it->second];
+	size = entry.nDiskSize;
+	return m_MappedFile.GetData() + entry.nFilePos;
+}
+
+// -----------------------------------------------------------------
+const WADLoader* WADTextureCache::OpenWAD(const string& path)
+{
+	// Called with m_Lock held
+	auto it = m_WADs.find(path);
+	if (it != m_WADs.end())
+		return it->second.get();
+
+	unique_ptr<WADLoader> wad(new WADLoader());
+	if (!wad->Open(path.c_str()))
+		wad.reset();
+	return (m_WADs[path] = move(wad)).get();
+}
+
+// -----------------------------------------------------------------
+void WADTextureCache::FindWADs(const vector<string>& wadNames, const vector<string>& searchDirectories, vector<const WADLoader*>& wads)
+{
+	wads.clear();
+	for (auto& wadName : wadNames) {
+		// Paths are the ones of the mapper's machine like \half-life\valve\halflife.wad
+		size_t slash = wadName.find_last_of("/\\");
+		string fileName = (slash == string::npos) ? wadName : wadName.substr(slash + 1);
+
+		const WADLoader* wad = nullptr;
+		std::error_code ec;
+		for (auto& directory : searchDirectories) {
+			fs::path path = fs::path(directory) / fileName;
+			if (!fs::is_regular_file(path, ec))
+				continue;
+			string canonicalPath = fs::weakly_canonical(path, ec).string();
+			lock_guard<mutex> lock(m_Lock);
+			wad = OpenWAD(ec ? path.string() : canonicalPath);
+			if (wad)
+				break;
+		}
+
+		if (wad)
+			wads.push_back(wad);
+		else
+			printf("[WARNING] WAD file %s wasn't found\n", fileName.c_str());
+	}
+}
+
+// -----------------------------------------------------------------
+shared_ptr<const BSPTextureImage> WADTextureCache::GetTexture(const char* textureName, const vector<const WADLoader*>& wads)
+{
+	for (auto wad : wads) {
+		size_t size;
+		const uint8_t* miptex = wad->FindMiptex(textureName, size);
+		if (!miptex)
+			continue;
+
+		string key = wad->GetFileName() + '\n' + ToLowerTextureName(textureName);
+		{
+			lock_guard<mutex> lock(m_Lock);
+			auto it = m_Textures.find(key);
+			if (it != m_Textures.end())
+				return it->second;
+		}
+
+		// Decode without holding the lock, if another map decoded it meanwhile its copy is kept
+		shared_ptr<BSPTextureImage> image = make_shared<BSPTextureImage>();
+		if (!DecodeMiptex(miptex, size, *image)) {
+			printf("[WARNING] Texture %.16s of %s is corrupt\n", textureName, wad->GetFileName().c_str());
+			return nullptr;
+		}
+
+		lock_guard<mutex> lock(m_Lock);
+		return m_Textures.emplace(key, image).first->second;
+	}
+	return nullptr;
+}
+
+// -----------------------------------------------------------------
+size_t WADTextureCache::GetDecodedCount()
+{
+	lock_guard<mutex> lock(m_Lock);
+	return m_Textures.size();
+}
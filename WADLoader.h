@@ -0,0 +1,101 @@
+/*
+	This file defines WADLoader which reads textures from a GoldSrc WAD3
+	file, and WADTextureCache which shares opened WAD files and decoded
+	textures between every map converted by the process.
+
+	A WAD3 file is a header, lumps and a directory describing every lump.
+	Texture lumps hold a miptex exactly like the ones embedded in BSP files.
+	Files are memory mapped once and only the lumps of textures a map uses
+	are ever touched.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "BSPMappedFile.h"
+#include "BSPTextures.h"
+
+using namespace std;
+
+#define WAD3_MAGIC		"WAD3"
+#define WAD_TYPE_MIPTEX	0x43
+
+// WAD header
+struct WADHEADER
+{
+	char		szMagic[4];		// "WAD3"
+	int32_t		nDir;			// Number of directory entries
+	int32_t		nDirOffset;		// Offset of the directory in the file
+};
+
+// WAD directory entry
+struct WADDIRENTRY
+{
+	int32_t		nFilePos;		// Offset of the lump in the file
+	int32_t		nDiskSize;		// Size of the lump in the file
+	int32_t		nSize;			// Uncompressed size of the lump
+	int8_t		nType;			// Lump type, WAD_TYPE_MIPTEX for textures
+	int8_t		bCompression;	// Never used by GoldSrc tools
+	int16_t		nDummy;			// Padding
+	char		szName[MAXTEXTURENAME];	// Lump name, nul terminated unless 16 characters long
+};
+
+// Texture names are case insensitive in GoldSrc
+string ToLowerTextureName(const char* name);
+
+// ======================================================================
+// WADLoader maps a WAD3 file and indexes its textures by name
+// ======================================================================
+class WADLoader
+{
+public:
+	// Map and index a WAD file, returns false if it isn't a valid WAD3 file
+	bool Open(const char* fileName);
+
+	// Raw miptex of a texture, nullptr if the WAD doesn't have it
+	const uint8_t* FindMiptex(const char* textureName, size_t& size) const;
+
+	const string&	GetFileName() const		{ return m_FileName; }
+	unsigned		GetTextureCount() const	{ return (unsigned)m_Index.size(); }
+
+private:
+	string							m_FileName;
+	BSPMappedFile					m_MappedFile;
+	unordered_map<string, unsigned>	m_Index;		// Lower case texture name -> directory entry
+	vector<WADDIRENTRY>				m_Directory;
+};
+
+// ======================================================================
+// WADTextureCache opens every WAD file once and decodes every texture
+// once, no matter how many maps use them. It's shared by all the threads
+// of a batch.
+// ======================================================================
+class WADTextureCache
+{
+public:
+	// Find and open the WAD files listed by a map's worldspawn
+	// Only their file name is used, it's looked for in every search directory in order
+	// Missing WAD files are skipped with a warning
+	void FindWADs(const vector<string>& wadNames, const vector<string>& searchDirectories, vector<const WADLoader*>& wads);
+
+	// Texture from the first WAD that has it, decoded on first use
+	// Returns nullptr if none has it or it's corrupt
+	shared_ptr<const BSPTextureImage> GetTexture(const char* textureName, const vector<const WADLoader*>& wads);
+
+	// Number of textures decoded so far
+	size_t GetDecodedCount();
+
+private:
+	// Opened WAD files by path, nullptr for files which aren't valid WADs
+	const WADLoader* OpenWAD(const string& path);
+
+	mutex											m_Lock;
+	map<string, unique_ptr<WADLoader>>				m_WADs;
+	unordered_map<string, shared_ptr<const BSPTextureImage>>	m_Textures;	// WAD file name + texture name -> image
+};